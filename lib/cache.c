@@ -0,0 +1,526 @@
+/*
+	cache.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elfix.h"
+
+/*
+ * A persistent cache of the PT_PAX and XATTR_PAX flags of files, so that
+ * reading the flags of a file which has not changed costs a stat() and
+ * a lookup rather than an open(), the ELF headers and an fgetxattr().
+ *
+ * The cache is one file, mapped shared by every process using it: a
+ * header and a power of two table of slots, open addressing on
+ * (st_dev, st_ino) with linear probing.  A slot also holds the size and
+ * ctime the flags were read at, and is only a hit if they still match.
+ * Any write to a file, and any change to its xattrs, moves its ctime on,
+ * so a stale slot is never believed; it is simply overwritten.
+ *
+ * That only holds if the ctime the flags are stored under is the ctime
+ * they were read at.  So the caller gives us the fstat() it took before
+ * reading them and we take another after: if they differ, or if the
+ * ctime is so recent that a change in the same clock tick would not
+ * show, nothing is stored.  This is the same trick git uses for its
+ * index.
+ *
+ * Lookups take no locks.  Each slot carries a sequence number which is
+ * odd while it is being written, so a reader which races a writer sees
+ * the number change and counts a miss.  Writers hold flock(LOCK_EX) on
+ * the cache file, and give up the write rather than wait for it.  When
+ * the table is half full it is copied into a new file twice the size
+ * which is renamed over the old one; anybody still mapping the old one
+ * goes on getting correct answers from it until they reopen.
+ */
+#define CACHE_MAGIC		"ELFIXC\0\1"
+#define CACHE_VERSION		1
+#define CACHE_MIN_SLOTS		(1 << 14)
+#define CACHE_RACY_SECS		2
+
+struct cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;
+	uint64_t nslots;
+	uint64_t used;
+};
+
+struct cache_slot
+{
+	uint32_t seq;			/* 0 never used, odd while being written */
+	uint32_t what;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t ctime_sec;
+	uint32_t ctime_nsec;
+	uint16_t pt_flags;
+	uint16_t xt_flags;
+};
+
+struct elfix_cache
+{
+	char *path;
+	int fd;
+	int writable;
+	dev_t dev;			/* of the cache file we have mapped */
+	ino_t ino;
+	struct cache_header *hdr;
+	struct cache_slot *slot;
+	size_t map_size;
+	pthread_rwlock_t map_lock;	/* read for lookups, write to remap */
+	pthread_mutex_t store_lock;
+};
+
+
+static size_t
+cache_hash(uint64_t dev, uint64_t ino)
+{
+	uint64_t h = (dev << 32) ^ ino;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+
+static size_t
+map_size(uint64_t nslots)
+{
+	return sizeof(struct cache_header) + nslots * sizeof(struct cache_slot);
+}
+
+
+// Lay out an empty table in fd
+static int
+cache_init(int fd, uint64_t nslots)
+{
+	struct cache_header hdr;
+
+	if(ftruncate(fd, map_size(nslots)) < 0)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CACHE_VERSION;
+	hdr.slot_size = sizeof(struct cache_slot);
+	hdr.nslots = nslots;
+
+	if(pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -1;
+
+	return 0;
+}
+
+
+static int
+cache_valid(const struct cache_header *hdr, off_t size)
+{
+	return !memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic))
+		&& hdr->version == CACHE_VERSION
+		&& hdr->slot_size == sizeof(struct cache_slot)
+		&& hdr->nslots >= CACHE_MIN_SLOTS
+		&& (hdr->nslots & (hdr->nslots - 1)) == 0
+		&& size >= 0 && (uint64_t)size == map_size(hdr->nslots);
+}
+
+
+static void
+cache_unmap(elfix_cache_t *c)
+{
+	if(c->hdr)
+		munmap(c->hdr, c->map_size);
+	if(c->fd >= 0)
+		close(c->fd);
+	c->hdr = NULL;
+	c->slot = NULL;
+	c->fd = -1;
+}
+
+
+/*
+ * Open and map c->path, creating or replacing it if we may and it is
+ * missing or not a cache we understand.
+ */
+static int
+cache_map(elfix_cache_t *c)
+{
+	struct cache_header hdr;
+	struct stat st;
+	int e;
+
+	c->writable = 1;
+	if((c->fd = open(c->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+	{
+		if(errno != EACCES && errno != EROFS && errno != EPERM)
+			return -1;
+		c->writable = 0;
+		if((c->fd = open(c->path, O_RDONLY | O_CLOEXEC)) < 0)
+			return -1;
+	}
+
+	if(fstat(c->fd, &st) < 0)
+		goto fail;
+
+	if(pread(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || !cache_valid(&hdr, st.st_size))
+	{
+		if(!c->writable)
+		{
+			errno = EINVAL;
+			goto fail;
+		}
+
+		// Empty, or from some other version: start again
+		if(flock(c->fd, LOCK_EX) < 0)
+			goto fail;
+		if(fstat(c->fd, &st) < 0)
+			goto fail_unlock;
+		if(pread(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || !cache_valid(&hdr, st.st_size))
+		{
+			if(ftruncate(c->fd, 0) < 0 || cache_init(c->fd, CACHE_MIN_SLOTS) < 0)
+				goto fail_unlock;
+			if(pread(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+				goto fail_unlock;
+		}
+		flock(c->fd, LOCK_UN);
+	}
+
+	c->dev = st.st_dev;
+	c->ino = st.st_ino;
+	c->map_size = map_size(hdr.nslots);
+	c->hdr = mmap(NULL, c->map_size, c->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, c->fd, 0);
+	if(c->hdr == MAP_FAILED)
+	{
+		c->hdr = NULL;
+		goto fail;
+	}
+	c->slot = (struct cache_slot *)(c->hdr + 1);
+
+	return 0;
+
+fail_unlock:
+	e = errno;
+	flock(c->fd, LOCK_UN);
+	errno = e;
+fail:
+	e = errno;
+	cache_unmap(c);
+	errno = e;
+	return -1;
+}
+
+
+/*
+ * Open the cache at path, creating it if need be.  If it cannot be
+ * written, lookups still work and stores quietly do nothing.  Returns
+ * NULL with errno set on failure.
+ */
+elfix_cache_t *
+elfix_cache_open(const char *path)
+{
+	elfix_cache_t *c;
+
+	if((c = calloc(1, sizeof(elfix_cache_t))) == NULL)
+		return NULL;
+
+	c->fd = -1;
+	if((c->path = strdup(path)) == NULL || cache_map(c) < 0)
+	{
+		int e = errno;
+
+		free(c->path);
+		free(c);
+		errno = e;
+		return NULL;
+	}
+
+	pthread_rwlock_init(&c->map_lock, NULL);
+	pthread_mutex_init(&c->store_lock, NULL);
+
+	return c;
+}
+
+
+void
+elfix_cache_close(elfix_cache_t *c)
+{
+	if(c == NULL)
+		return;
+
+	cache_unmap(c);
+	pthread_rwlock_destroy(&c->map_lock);
+	pthread_mutex_destroy(&c->store_lock);
+	free(c->path);
+	free(c);
+}
+
+
+// The slot for (dev, ino), or the empty one where it would go, or NULL if full
+static struct cache_slot *
+find_slot(const elfix_cache_t *c, uint64_t dev, uint64_t ino)
+{
+	size_t i, j, mask = c->hdr->nslots - 1;
+	struct cache_slot *s;
+
+	for(i = 0, j = cache_hash(dev, ino) & mask; i <= mask; i++, j = (j + 1) & mask)
+	{
+		s = &c->slot[j];
+		if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == 0)
+			return s;
+		if(s->dev == dev && s->ino == ino)
+			return s;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Returns 1 and fills in *e if the cache has the flags of the file st
+ * describes, as it is now, else 0.
+ */
+int
+elfix_cache_lookup(elfix_cache_t *c, const struct stat *st, struct elfix_cache_entry *e)
+{
+	struct cache_slot *s, copy;
+	uint32_t seq;
+	int hit = 0;
+
+	pthread_rwlock_rdlock(&c->map_lock);
+
+	if(c->hdr && (s = find_slot(c, st->st_dev, st->st_ino)) != NULL)
+	{
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		memcpy(&copy, s, sizeof(copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		hit = seq != 0 && !(seq & 1) && seq == __atomic_load_n(&s->seq, __ATOMIC_RELAXED)
+			&& copy.dev == (uint64_t)st->st_dev && copy.ino == (uint64_t)st->st_ino
+			&& copy.size == (uint64_t)st->st_size
+			&& copy.ctime_sec == st->st_ctim.tv_sec
+			&& copy.ctime_nsec == (uint32_t)st->st_ctim.tv_nsec;
+
+		if(hit)
+		{
+			e->what = copy.what;
+			e->pt_flags = copy.pt_flags;
+			e->xt_flags = copy.xt_flags;
+		}
+	}
+
+	pthread_rwlock_unlock(&c->map_lock);
+
+	return hit;
+}
+
+
+// Move everything into a new cache file twice the size, we hold the lock
+static int
+cache_grow(elfix_cache_t *c)
+{
+	char *tmp;
+	int fd, e;
+	uint64_t i, nslots = 2 * c->hdr->nslots;
+	struct cache_header *hdr;
+	struct cache_slot *slot, *s;
+	size_t j, mask = nslots - 1, size = map_size(nslots);
+
+	if(asprintf(&tmp, "%s.XXXXXX", c->path) < 0)
+		return -1;
+
+	if((fd = mkstemp(tmp)) < 0)
+	{
+		free(tmp);
+		return -1;
+	}
+
+	if(fchmod(fd, 0644) < 0 || cache_init(fd, nslots) < 0)
+		goto fail;
+
+	if((hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto fail;
+	slot = (struct cache_slot *)(hdr + 1);
+
+	for(i = 0; i < c->hdr->nslots; i++)
+	{
+		s = &c->slot[i];
+		if(s->seq == 0 || (s->seq & 1))
+			continue;
+		for(j = cache_hash(s->dev, s->ino) & mask; slot[j].seq; j = (j + 1) & mask)
+			;
+		slot[j] = *s;
+		slot[j].seq = 2;
+		hdr->used++;
+	}
+
+	munmap(hdr, size);
+
+	if(rename(tmp, c->path) < 0)
+		goto fail;
+
+	free(tmp);
+	close(fd);
+	return 0;
+
+fail:
+	e = errno;
+	unlink(tmp);
+	free(tmp);
+	close(fd);
+	errno = e;
+	return -1;
+}
+
+
+/*
+ * If somebody else has replaced the cache file since we mapped it, map
+ * the new one.  We hold store_lock.  Returns 1 if we did, and so closed
+ * the old one and dropped any flock() we had on it.
+ */
+static int
+cache_follow(elfix_cache_t *c)
+{
+	struct stat st;
+
+	if(stat(c->path, &st) == 0 && st.st_dev == c->dev && st.st_ino == c->ino)
+		return 0;
+
+	pthread_rwlock_wrlock(&c->map_lock);
+	cache_unmap(c);
+	cache_map(c);
+	pthread_rwlock_unlock(&c->map_lock);
+	return 1;
+}
+
+
+/*
+ * flock() the cache file for writing, and if it was replaced while we
+ * were getting the lock, lock the new one instead.  Returns 0, or -1
+ * with errno set and nothing locked.
+ */
+static int
+cache_lock(elfix_cache_t *c)
+{
+	do
+	{
+		if(c->hdr == NULL || !c->writable)
+		{
+			errno = EROFS;
+			return -1;
+		}
+		if(flock(c->fd, LOCK_EX | LOCK_NB) < 0)
+			return -1;
+	}
+	while(cache_follow(c));
+
+	return 0;
+}
+
+
+/*
+ * Remember e as the flags of the open file fd, which were read after
+ * before was taken by fstat(fd).  Returns 0, or -1 with errno set if
+ * nothing was stored: EAGAIN if the file changed or changed too
+ * recently, EROFS if we cannot write the cache, or EWOULDBLOCK if
+ * somebody else is writing it just now.
+ */
+int
+elfix_cache_store(elfix_cache_t *c, int fd, const struct stat *before, const struct elfix_cache_entry *e)
+{
+	struct cache_slot *s;
+	struct stat after, *st = &after;
+	struct timespec now;
+	uint32_t seq;
+	int ret = -1;
+
+	if(fstat(fd, &after) < 0)
+		return -1;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if(after.st_dev != before->st_dev || after.st_ino != before->st_ino
+			|| after.st_size != before->st_size
+			|| after.st_ctim.tv_sec != before->st_ctim.tv_sec
+			|| after.st_ctim.tv_nsec != before->st_ctim.tv_nsec
+			|| after.st_ctim.tv_sec > now.tv_sec - CACHE_RACY_SECS)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+
+	pthread_mutex_lock(&c->store_lock);
+
+	cache_follow(c);
+	if(cache_lock(c) < 0)
+		goto out;
+
+	if(2 * (c->hdr->used + 1) > c->hdr->nslots)
+	{
+		if(cache_grow(c) < 0)
+			goto out_unlock;
+		flock(c->fd, LOCK_UN);
+		cache_follow(c);
+		if(cache_lock(c) < 0)
+			goto out;
+	}
+
+	if((s = find_slot(c, st->st_dev, st->st_ino)) == NULL)
+	{
+		errno = ENOSPC;
+		goto out_unlock;
+	}
+
+	seq = s->seq;
+	if(seq == 0)
+		c->hdr->used++;
+
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->what = e->what;
+	s->dev = st->st_dev;
+	s->ino = st->st_ino;
+	s->size = st->st_size;
+	s->ctime_sec = st->st_ctim.tv_sec;
+	s->ctime_nsec = st->st_ctim.tv_nsec;
+	s->pt_flags = e->pt_flags;
+	s->xt_flags = e->xt_flags;
+	__atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+
+	ret = 0;
+
+out_unlock:
+	flock(c->fd, LOCK_UN);
+out:
+	pthread_mutex_unlock(&c->store_lock);
+	return ret;
+}
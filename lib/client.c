@@ -0,0 +1,343 @@
+/*
+	client.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "elfix.h"
+
+/*
+ * paxctl-ng --server speaks a line protocol over a UNIX stream socket.
+ * Each request is
+ *
+ *	OP<TAB>ARG<TAB>PATH<LF>
+ *
+ * where OP is get, set, set-pt, set-xt, create, delete or copy, ARG is
+ * the flags for the set ops, "secure" or "default" for create, "pt2xt"
+ * or "xt2pt" for copy and empty otherwise.  An empty PATH means the file
+ * is the next descriptor passed with SCM_RIGHTS.  Requests are numbered
+ * from 1 on each connection and may be answered out of order, each with
+ *
+ *	ID<TAB>ERRNO<TAB>WRITTEN<TAB>PT<TAB>XT<LF>
+ *
+ * PT and XT are the flags afterwards as -v prints them, or "none".
+ *
+ * Requests are buffered and written in large chunks.  While the socket
+ * is full we read whatever replies are waiting, so a client may send a
+ * whole batch before it asks for the first reply without deadlocking.
+ */
+
+#define OUT_FLUSH	65536
+
+struct elfix_client
+{
+	int fd;
+	unsigned long nsent;
+	char *out, *in;
+	size_t outlen, outsize;
+	size_t inlen, insize;
+};
+
+
+elfix_client_t *
+elfix_client_open(const char *sock)
+{
+	elfix_client_t *c;
+	struct sockaddr_un addr;
+
+	if(strlen(sock) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	if((c = calloc(1, sizeof(elfix_client_t))) == NULL)
+		return NULL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock);
+
+	if((c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+	{
+		free(c);
+		return NULL;
+	}
+
+	if(connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		elfix_client_close(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+
+static int
+grow(char **buf, size_t *size, size_t need)
+{
+	char *p;
+	size_t n = *size ? *size : 4096;
+
+	while(n < need)
+		n *= 2;
+	if(n == *size)
+		return 0;
+	if((p = realloc(*buf, n)) == NULL)
+		return -1;
+	*buf = p;
+	*size = n;
+	return 0;
+}
+
+
+// Read whatever replies are there into c->in.  Returns 0 at end of file.
+static ssize_t
+fill(elfix_client_t *c, int flags)
+{
+	ssize_t n;
+
+	if(grow(&c->in, &c->insize, c->inlen + 4096) < 0)
+		return -1;
+
+	do
+		n = recv(c->fd, c->in + c->inlen, c->insize - c->inlen, flags);
+	while(n < 0 && errno == EINTR);
+
+	if(n > 0)
+		c->inlen += n;
+	return n;
+}
+
+
+/*
+ * Write out everything buffered.  If passfd is not -1, it rides along
+ * with the first chunk.  The server queues passed descriptors in the
+ * order they arrive, so it only matters that each one gets there no
+ * later than its request.
+ */
+static int
+flush(elfix_client_t *c, int passfd)
+{
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	ssize_t n;
+
+	while(c->outlen > 0)
+	{
+		pfd.fd = c->fd;
+		pfd.events = POLLOUT | POLLIN;
+		if(poll(&pfd, 1, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if(pfd.revents & POLLIN)
+		{
+			if((n = fill(c, MSG_DONTWAIT)) == 0)
+			{
+				errno = EPIPE;
+				return -1;
+			}
+			if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+		}
+
+		if(!(pfd.revents & (POLLOUT | POLLERR | POLLHUP)))
+			continue;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = c->out;
+		iov.iov_len = c->outlen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if(passfd >= 0)
+		{
+			memset(cbuf, 0, sizeof(cbuf));
+			msg.msg_control = cbuf;
+			msg.msg_controllen = sizeof(cbuf);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &passfd, sizeof(int));
+		}
+
+		if((n = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0)
+		{
+			if(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+				continue;
+			return -1;
+		}
+
+		passfd = -1;
+		c->outlen -= n;
+		memmove(c->out, c->out + n, c->outlen);
+	}
+
+	return 0;
+}
+
+
+static int
+clean(const char *s)
+{
+	return strpbrk(s, "\t\n") == NULL;
+}
+
+
+/*
+ * Queue one request for the file at path, or, if path is NULL, for the
+ * open file fd, which the server gets a copy of.  Returns the request's
+ * id, which its reply will carry.
+ */
+unsigned long
+elfix_client_send(elfix_client_t *c, const char *op, const char *arg, const char *path, int fd)
+{
+	size_t len;
+
+	if(arg == NULL)
+		arg = "";
+	if(path == NULL)
+		path = "";
+
+	if(!clean(op) || !clean(arg) || !clean(path) || (*path == '\0') == (fd < 0))
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	len = strlen(op) + strlen(arg) + strlen(path) + 3;
+	if(grow(&c->out, &c->outsize, c->outlen + len + 1) < 0)
+		return 0;
+	snprintf(c->out + c->outlen, len + 1, "%s\t%s\t%s\n", op, arg, path);
+	c->outlen += len;
+
+	if((fd >= 0 || c->outlen >= OUT_FLUSH) && flush(c, fd) < 0)
+		return 0;
+
+	return ++c->nsent;
+}
+
+
+// Send what is left and tell the server there are no more requests
+int
+elfix_client_done(elfix_client_t *c)
+{
+	if(flush(c, -1) < 0)
+		return -1;
+	return shutdown(c->fd, SHUT_WR);
+}
+
+
+static void
+copy_flags(char *dst, const char *src)
+{
+	if(!strcmp(src, "none"))
+		dst[0] = '\0';
+	else
+	{
+		strncpy(dst, src, ELFIX_FLAGS_SIZE - 1);
+		dst[ELFIX_FLAGS_SIZE - 1] = '\0';
+	}
+}
+
+
+/*
+ * Wait for the next reply.  Returns 1 with the reply filled in, 0 once
+ * the server has answered everything and closed, or -1.
+ */
+int
+elfix_client_recv(elfix_client_t *c, struct elfix_reply *r)
+{
+	char *nl, *f[5], *p;
+	ssize_t n;
+	size_t len;
+	int i;
+
+	if(flush(c, -1) < 0)
+		return -1;
+
+	while((nl = memchr(c->in, '\n', c->inlen)) == NULL)
+	{
+		if((n = fill(c, 0)) < 0)
+			return -1;
+		if(n == 0)
+		{
+			if(c->inlen == 0)
+				return 0;
+			errno = EPROTO;
+			return -1;
+		}
+	}
+
+	*nl = '\0';
+	len = nl - c->in + 1;
+
+	p = c->in;
+	for(i = 0; i < 5; i++)
+	{
+		f[i] = strsep(&p, "\t");
+		if(f[i] == NULL)
+		{
+			errno = EPROTO;
+			return -1;
+		}
+	}
+
+	memset(r, 0, sizeof(struct elfix_reply));
+	r->id = strtoul(f[0], NULL, 10);
+	r->error = atoi(f[1]);
+	r->written = atoi(f[2]);
+	copy_flags(r->pt_flags, f[3]);
+	copy_flags(r->xt_flags, f[4]);
+
+	c->inlen -= len;
+	memmove(c->in, c->in + len, c->inlen);
+
+	return 1;
+}
+
+
+void
+elfix_client_close(elfix_client_t *c)
+{
+	if(c == NULL)
+		return;
+
+	close(c->fd);
+	free(c->out);
+	free(c->in);
+	free(c);
+}
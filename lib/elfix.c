@@ -0,0 +1,1368 @@
+/*
+	elfix.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <endian.h>
+#include <byteswap.h>
+
+#ifdef PTPAX
+ #include <gelf.h>
+#endif
+
+#ifdef XTPAX
+ #include <sys/xattr.h>
+ #ifndef ENOATTR
+  #define ENOATTR ENODATA
+ #endif
+#endif
+
+#include "elfix.h"
+
+#define ERRMSG_SIZE	256
+
+struct elfix
+{
+	int error;
+	int sys_errno;
+	char msg[ERRMSG_SIZE];
+	struct elfix_stats stats;
+};
+
+
+#ifdef PTPAX
+static pthread_once_t elf_once = PTHREAD_ONCE_INIT;
+static int elf_ok;
+
+static void
+elf_init(void)
+{
+	elf_ok = elf_version(EV_CURRENT) != EV_NONE;
+}
+#endif
+
+
+elfix_t *
+elfix_new(void)
+{
+	elfix_t *h;
+
+#ifdef PTPAX
+	pthread_once(&elf_once, elf_init);
+#endif
+
+	if((h = calloc(1, sizeof(elfix_t))) == NULL)
+		return NULL;
+
+	strcpy(h->msg, "no error");
+	return h;
+}
+
+
+void
+elfix_free(elfix_t *h)
+{
+	free(h);
+}
+
+
+int
+elfix_features(void)
+{
+	int features = 0;
+
+#ifdef PTPAX
+	features |= ELFIX_HAVE_PT;
+#endif
+#ifdef XTPAX
+	features |= ELFIX_HAVE_XT;
+#endif
+
+	return features;
+}
+
+
+int
+elfix_error(const elfix_t *h)
+{
+	return h->error;
+}
+
+
+int
+elfix_errno(const elfix_t *h)
+{
+	return h->sys_errno;
+}
+
+
+const char *
+elfix_strerror(const elfix_t *h)
+{
+	return h->msg;
+}
+
+
+void
+elfix_get_stats(const elfix_t *h, struct elfix_stats *stats)
+{
+	*stats = h->stats;
+}
+
+
+void
+elfix_reset_stats(elfix_t *h)
+{
+	memset(&h->stats, 0, sizeof(struct elfix_stats));
+}
+
+
+// Record an error in the handle and hand back its code
+static int
+fail(elfix_t *h, int error, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+static int
+fail(elfix_t *h, int error, const char *fmt, ...)
+{
+	va_list ap;
+
+	h->error = error;
+	h->sys_errno = error == ELFIX_ESYS ? errno : 0;
+
+	va_start(ap, fmt);
+	vsnprintf(h->msg, ERRMSG_SIZE, fmt, ap);
+	va_end(ap);
+
+	return error;
+}
+
+
+static int
+ok(elfix_t *h, int ret)
+{
+	h->error = ret;
+	h->sys_errno = 0;
+	strcpy(h->msg, ret == ELFIX_ENOFLAGS ? "no PaX flags found" : "no error");
+	return ret;
+}
+
+
+// For reading ELF structures in the file's byte order
+static uint16_t
+raw16(uint16_t v, int swap)
+{
+	return swap ? bswap_16(v) : v;
+}
+
+static uint32_t
+raw32(uint32_t v, int swap)
+{
+	return swap ? bswap_32(v) : v;
+}
+
+static uint64_t
+raw64(uint64_t v, int swap)
+{
+	return swap ? bswap_64(v) : v;
+}
+
+
+/*
+ * Header-only access to PT_PAX_FLAGS.  Rather than have libelf map the
+ * whole object just to reach one p_flags word, we pread() the Ehdr and
+ * the phdr table and, when setting, pwrite() only the p_flags words which
+ * change.  Anything unusual (PN_XNUM, odd e_phentsize, short reads, more
+ * PT_PAX_FLAGS phdrs than we care to track) returns PT_RAW_FALLBACK and
+ * the caller goes through libelf.
+ */
+#define PT_RAW_OK                       0
+#define PT_RAW_FALLBACK                 1
+
+#define PT_RAW_MAX                      4
+
+struct pt_raw
+{
+	int swap;			// file byte order is not ours
+	int n;				// number of PT_PAX_FLAGS phdrs
+	off_t off[PT_RAW_MAX];		// file offset of each one's p_flags
+	uint32_t flags[PT_RAW_MAX];	// and its value in host order
+};
+
+// Where the phdr table is, from the first n bytes of the object
+struct pt_layout
+{
+	uint64_t phoff;
+	size_t phnum, phentsize, p_flags_at;
+};
+
+static int
+parse_ehdr_raw(const unsigned char *ehdr, size_t n, struct pt_raw *raw, struct pt_layout *l)
+{
+	memset(raw, 0, sizeof(struct pt_raw));
+
+	if(n < EI_NIDENT)
+		return PT_RAW_FALLBACK;
+
+	if(memcmp(ehdr, ELFMAG, SELFMAG) || ehdr[EI_VERSION] != EV_CURRENT)
+		return PT_RAW_FALLBACK;
+
+	if(ehdr[EI_DATA] == ELFDATA2LSB)
+		raw->swap = __BYTE_ORDER != __LITTLE_ENDIAN;
+	else if(ehdr[EI_DATA] == ELFDATA2MSB)
+		raw->swap = __BYTE_ORDER != __BIG_ENDIAN;
+	else
+		return PT_RAW_FALLBACK;
+
+	if(ehdr[EI_CLASS] == ELFCLASS64 && n >= sizeof(Elf64_Ehdr))
+	{
+		Elf64_Ehdr e;
+
+		memcpy(&e, ehdr, sizeof(Elf64_Ehdr));
+		l->phoff = raw64(e.e_phoff, raw->swap);
+		l->phentsize = raw16(e.e_phentsize, raw->swap);
+		l->phnum = raw16(e.e_phnum, raw->swap);
+		if(l->phentsize != sizeof(Elf64_Phdr))
+			return PT_RAW_FALLBACK;
+		l->p_flags_at = offsetof(Elf64_Phdr, p_flags);
+	}
+	else if(ehdr[EI_CLASS] == ELFCLASS32 && n >= sizeof(Elf32_Ehdr))
+	{
+		Elf32_Ehdr e;
+
+		memcpy(&e, ehdr, sizeof(Elf32_Ehdr));
+		l->phoff = raw32(e.e_phoff, raw->swap);
+		l->phentsize = raw16(e.e_phentsize, raw->swap);
+		l->phnum = raw16(e.e_phnum, raw->swap);
+		if(l->phentsize != sizeof(Elf32_Phdr))
+			return PT_RAW_FALLBACK;
+		l->p_flags_at = offsetof(Elf32_Phdr, p_flags);
+	}
+	else
+		return PT_RAW_FALLBACK;
+
+	// The real count is in section 0's sh_info, leave that to libelf
+	if(l->phnum == PN_XNUM)
+		return PT_RAW_FALLBACK;
+
+	if(l->phnum && (l->phoff == 0 || l->phoff > INT64_MAX - l->phnum * l->phentsize))
+		return PT_RAW_FALLBACK;
+
+	return PT_RAW_OK;
+}
+
+
+static int
+scan_phdrs_raw(const unsigned char *phdrs, const struct pt_layout *l, struct pt_raw *raw)
+{
+	uint32_t p_type, p_flags;
+	size_t i;
+
+	for(i = 0; i < l->phnum; i++)
+	{
+		// p_type is the first word of both Elf32_Phdr and Elf64_Phdr
+		memcpy(&p_type, phdrs + i * l->phentsize, sizeof(uint32_t));
+		if(raw32(p_type, raw->swap) != PT_PAX_FLAGS)
+			continue;
+
+		if(raw->n == PT_RAW_MAX)
+			return PT_RAW_FALLBACK;
+
+		memcpy(&p_flags, phdrs + i * l->phentsize + l->p_flags_at, sizeof(uint32_t));
+		raw->off[raw->n] = l->phoff + i * l->phentsize + l->p_flags_at;
+		raw->flags[raw->n] = raw32(p_flags, raw->swap);
+		raw->n++;
+	}
+
+	return PT_RAW_OK;
+}
+
+
+#ifdef PTPAX
+static int
+find_pt_pax_raw(elfix_t *h, int fd, struct pt_raw *raw)
+{
+	unsigned char ehdr[sizeof(Elf64_Ehdr)];
+	unsigned char *phdrs;
+	struct pt_layout l;
+	size_t len;
+	ssize_t n;
+	int ret;
+
+	if((n = pread(fd, ehdr, sizeof(ehdr), 0)) > 0)
+		h->stats.bytes_read += n;
+
+	if(parse_ehdr_raw(ehdr, n < 0 ? 0 : n, raw, &l) != PT_RAW_OK)
+		return PT_RAW_FALLBACK;
+
+	if(l.phnum == 0)
+		return PT_RAW_OK;
+
+	len = l.phnum * l.phentsize;
+	if((phdrs = malloc(len)) == NULL)
+		return PT_RAW_FALLBACK;
+
+	if(pread(fd, phdrs, len, l.phoff) != (ssize_t)len)
+	{
+		free(phdrs);
+		return PT_RAW_FALLBACK;
+	}
+	h->stats.bytes_read += len;
+
+	ret = scan_phdrs_raw(phdrs, &l, raw);
+	free(phdrs);
+	return ret;
+}
+#endif
+
+
+/*
+ * The same for an object, or just the start of one, already in memory.
+ * The offsets in raw are then offsets into buf.
+ */
+static int
+find_pt_pax_mem(const unsigned char *buf, size_t size, struct pt_raw *raw)
+{
+	struct pt_layout l;
+
+	if(parse_ehdr_raw(buf, size, raw, &l) != PT_RAW_OK)
+		return PT_RAW_FALLBACK;
+
+	if(l.phnum && (l.phoff > size || l.phnum * l.phentsize > size - l.phoff))
+		return PT_RAW_FALLBACK;
+
+	return scan_phdrs_raw(buf + l.phoff, &l, raw);
+}
+
+
+#ifdef PTPAX
+static int
+get_pt_flags_elf(elfix_t *h, int fd, uint16_t *pt_flags)
+{
+	Elf *elf;
+	GElf_Phdr phdr;
+	size_t i, phnum;
+	int found = 0;
+
+	if(!elf_ok)
+		return fail(h, ELFIX_ELIBELF, "libelf is out of date");
+
+	if((elf = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
+		return fail(h, ELFIX_ELIBELF, "elf_begin() fail: %s", elf_errmsg(elf_errno()));
+	h->stats.elf_sessions++;
+
+	if(elf_kind(elf) != ELF_K_ELF)
+	{
+		elf_end(elf);
+		return fail(h, ELFIX_ENOTELF, "elf_kind() fail: this is not an elf file.");
+	}
+
+	elf_getphdrnum(elf, &phnum);
+
+	for(i=0; i<phnum; i++)
+	{
+		if(gelf_getphdr(elf, i, &phdr) != &phdr)
+		{
+			elf_end(elf);
+			return fail(h, ELFIX_ELIBELF, "gelf_getphdr(): %s", elf_errmsg(elf_errno()));
+		}
+
+		// The last PT_PAX_FLAGS phdr wins
+		if(phdr.p_type == PT_PAX_FLAGS)
+		{
+			*pt_flags = phdr.p_flags;
+			found = 1;
+		}
+	}
+
+	elf_end(elf);
+	return ok(h, found ? ELFIX_OK : ELFIX_ENOFLAGS);
+}
+
+
+static int
+set_pt_flags_elf(elfix_t *h, int fd, uint16_t pt_flags)
+{
+	Elf *elf;
+	GElf_Phdr phdr;
+	size_t i, phnum;
+	int found = 0;
+
+	if(!elf_ok)
+		return fail(h, ELFIX_ELIBELF, "libelf is out of date");
+
+	if((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL)
+		return fail(h, ELFIX_ELIBELF, "elf_begin() fail: %s", elf_errmsg(elf_errno()));
+	h->stats.elf_sessions++;
+
+	if(elf_kind(elf) != ELF_K_ELF)
+	{
+		elf_end(elf);
+		return fail(h, ELFIX_ENOTELF, "elf_kind() fail: this is not an elf file.");
+	}
+
+	elf_getphdrnum(elf, &phnum);
+
+	for(i=0; i<phnum; i++)
+	{
+		if(gelf_getphdr(elf, i, &phdr) != &phdr)
+		{
+			elf_end(elf);
+			return fail(h, ELFIX_ELIBELF, "gelf_getphdr(): %s", elf_errmsg(elf_errno()));
+		}
+
+		if(phdr.p_type == PT_PAX_FLAGS)
+		{
+			//RANDEXEC is deprecated, we'll force it off like paxctl
+			phdr.p_flags = pt_flags | PF_NORANDEXEC;
+			h->stats.pt_writes++;
+			found = 1;
+
+			if(!gelf_update_phdr(elf, i, &phdr))
+			{
+				elf_end(elf);
+				return fail(h, ELFIX_ELIBELF, "gelf_update_phdr(): %s", elf_errmsg(elf_errno()));
+			}
+		}
+	}
+
+	elf_end(elf);
+	return ok(h, found ? ELFIX_OK : ELFIX_ENOFLAGS);
+}
+
+
+// pwrite() the p_flags words found by find_pt_pax_raw() which differ
+static int
+set_pt_flags_raw(elfix_t *h, int fd, const struct pt_raw *raw, uint16_t pt_flags)
+{
+	uint32_t p_flags;
+	int i;
+
+	if(raw->n == 0)
+		return ok(h, ELFIX_ENOFLAGS);
+
+	//RANDEXEC is deprecated, we'll force it off like paxctl
+	p_flags = raw32(pt_flags | PF_NORANDEXEC, raw->swap);
+
+	for(i = 0; i < raw->n; i++)
+	{
+		if(raw->flags[i] == (uint32_t)(pt_flags | PF_NORANDEXEC))
+			continue;
+		h->stats.pt_writes++;
+		if(pwrite(fd, &p_flags, sizeof(uint32_t), raw->off[i]) != sizeof(uint32_t))
+			return fail(h, ELFIX_ESYS, "pwrite() of p_flags failed: %s", strerror(errno));
+	}
+
+	return ok(h, ELFIX_OK);
+}
+#endif
+
+
+/*
+ * Leaves *pt_flags alone unless there is a PT_PAX_FLAGS phdr, in which
+ * case it is the p_flags of the last one.
+ */
+int
+elfix_get_pt_flags(elfix_t *h, int fd, uint16_t *pt_flags)
+{
+#ifdef PTPAX
+	struct pt_raw raw;
+
+	if(find_pt_pax_raw(h, fd, &raw) != PT_RAW_OK)
+		return get_pt_flags_elf(h, fd, pt_flags);
+
+	if(raw.n == 0)
+		return ok(h, ELFIX_ENOFLAGS);
+
+	*pt_flags = raw.flags[raw.n - 1];
+	return ok(h, ELFIX_OK);
+#else
+	(void)fd;
+	(void)pt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without PT_PAX support");
+#endif
+}
+
+
+/*
+ * Set p_flags of every PT_PAX_FLAGS phdr to pt_flags | PF_NORANDEXEC,
+ * writing only the words which differ.
+ */
+int
+elfix_set_pt_flags(elfix_t *h, int fd, uint16_t pt_flags)
+{
+#ifdef PTPAX
+	struct pt_raw raw;
+
+	if(find_pt_pax_raw(h, fd, &raw) != PT_RAW_OK)
+		return set_pt_flags_elf(h, fd, pt_flags);
+
+	return set_pt_flags_raw(h, fd, &raw, pt_flags);
+#else
+	(void)fd;
+	(void)pt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without PT_PAX support");
+#endif
+}
+
+
+/*
+ * elfix_set_pt_flags() without the libelf fallback, for callers which
+ * must not have the whole object rewritten: ELFIX_EINVAL for a layout
+ * only libelf can handle, and nothing is written.
+ */
+int
+elfix_set_pt_flags_hdr(elfix_t *h, int fd, uint16_t pt_flags)
+{
+#ifdef PTPAX
+	struct pt_raw raw;
+
+	if(find_pt_pax_raw(h, fd, &raw) != PT_RAW_OK)
+		return fail(h, ELFIX_EINVAL, "the phdrs cannot be patched without libelf");
+
+	return set_pt_flags_raw(h, fd, &raw, pt_flags);
+#else
+	(void)fd;
+	(void)pt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without PT_PAX support");
+#endif
+}
+
+
+/*
+ * The same two for the first size bytes of an object already in memory,
+ * eg. the head of a member of an archive.  The Ehdr and the whole phdr
+ * table must be in buf, else ELFIX_EINVAL and the caller has to get
+ * more of the object.  There is no libelf fallback here.
+ */
+int
+elfix_get_pt_flags_mem(elfix_t *h, const void *buf, size_t size, uint16_t *pt_flags)
+{
+#ifdef PTPAX
+	struct pt_raw raw;
+
+	if(size < SELFMAG || memcmp(buf, ELFMAG, SELFMAG))
+		return fail(h, ELFIX_ENOTELF, "this is not an elf file.");
+
+	if(find_pt_pax_mem(buf, size, &raw) != PT_RAW_OK)
+		return fail(h, ELFIX_EINVAL, "the phdr table is not in the %zu bytes given", size);
+
+	if(raw.n == 0)
+		return ok(h, ELFIX_ENOFLAGS);
+
+	*pt_flags = raw.flags[raw.n - 1];
+	return ok(h, ELFIX_OK);
+#else
+	(void)buf;
+	(void)size;
+	(void)pt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without PT_PAX support");
+#endif
+}
+
+
+int
+elfix_set_pt_flags_mem(elfix_t *h, void *buf, size_t size, uint16_t pt_flags)
+{
+#ifdef PTPAX
+	struct pt_raw raw;
+	uint32_t p_flags;
+	int i;
+
+	if(size < SELFMAG || memcmp(buf, ELFMAG, SELFMAG))
+		return fail(h, ELFIX_ENOTELF, "this is not an elf file.");
+
+	if(find_pt_pax_mem(buf, size, &raw) != PT_RAW_OK)
+		return fail(h, ELFIX_EINVAL, "the phdr table is not in the %zu bytes given", size);
+
+	if(raw.n == 0)
+		return ok(h, ELFIX_ENOFLAGS);
+
+	//RANDEXEC is deprecated, we'll force it off like paxctl
+	p_flags = raw32(pt_flags | PF_NORANDEXEC, raw.swap);
+
+	for(i = 0; i < raw.n; i++)
+	{
+		if(raw.flags[i] == (uint32_t)(pt_flags | PF_NORANDEXEC))
+			continue;
+		h->stats.pt_writes++;
+		memcpy((unsigned char *)buf + raw.off[i], &p_flags, sizeof(uint32_t));
+	}
+
+	return ok(h, ELFIX_OK);
+#else
+	(void)buf;
+	(void)size;
+	(void)pt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without PT_PAX support");
+#endif
+}
+
+
+int
+elfix_get_xt_flags(elfix_t *h, int fd, uint16_t *xt_flags)
+{
+#ifdef XTPAX
+	char buf[ELFIX_FLAGS_SIZE];
+	ssize_t n;
+
+	memset(buf, 0, ELFIX_FLAGS_SIZE);
+
+	h->stats.xattr_get++;
+	if((n = fgetxattr(fd, ELFIX_PAX_NAMESPACE, buf, ELFIX_FLAGS_SIZE)) == -1)
+	{
+		if(errno == ENOATTR)
+		{
+			h->stats.enoattr++;
+			return ok(h, ELFIX_ENOFLAGS);
+		}
+		return fail(h, ELFIX_ESYS, "fgetxattr(): %s", strerror(errno));
+	}
+
+	h->stats.bytes_read += n;
+	*xt_flags = elfix_string2bin(buf);
+	return ok(h, ELFIX_OK);
+#else
+	(void)fd;
+	(void)xt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without XATTR_PAX support");
+#endif
+}
+
+
+#ifdef XTPAX
+static int
+put_xt_flags(elfix_t *h, int fd, uint16_t xt_flags, int how)
+{
+	char buf[ELFIX_FLAGS_SIZE];
+
+	memset(buf, 0, ELFIX_FLAGS_SIZE);
+	elfix_bin2string(xt_flags, buf);
+
+	h->stats.xattr_set++;
+	if(fsetxattr(fd, ELFIX_PAX_NAMESPACE, buf, strlen(buf), how))
+		return fail(h, ELFIX_ESYS, "fsetxattr(): %s", strerror(errno));
+
+	return ok(h, ELFIX_OK);
+}
+#endif
+
+
+int
+elfix_set_xt_flags(elfix_t *h, int fd, uint16_t xt_flags)
+{
+#ifdef XTPAX
+	return put_xt_flags(h, fd, xt_flags, 0);
+#else
+	(void)fd;
+	(void)xt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without XATTR_PAX support");
+#endif
+}
+
+
+// Fails with ELFIX_ESYS and EEXIST if there already are flags
+int
+elfix_create_xt_flags(elfix_t *h, int fd, uint16_t xt_flags)
+{
+#ifdef XTPAX
+	return put_xt_flags(h, fd, xt_flags, XATTR_CREATE);
+#else
+	(void)fd;
+	(void)xt_flags;
+	return fail(h, ELFIX_ENOTSUP, "built without XATTR_PAX support");
+#endif
+}
+
+
+int
+elfix_delete_xt_flags(elfix_t *h, int fd)
+{
+#ifdef XTPAX
+	h->stats.xattr_remove++;
+	if( !fremovexattr(fd, ELFIX_PAX_NAMESPACE) )
+		return ok(h, ELFIX_OK);
+
+	// If this fails because there was no such named xattr
+	// in the first place, then in a sense, we succeeded.
+	// See: https://bugs.gentoo.org/show_bug.cgi?id=485908
+	if( errno == ENOATTR )
+	{
+		h->stats.enoattr++;
+		return ok(h, ELFIX_OK);
+	}
+
+	return fail(h, ELFIX_ESYS, "fremovexattr(): %s", strerror(errno));
+#else
+	(void)fd;
+	return fail(h, ELFIX_ENOTSUP, "built without XATTR_PAX support");
+#endif
+}
+
+
+// Read len bytes at off, all or nothing
+static int
+read_at(elfix_t *h, int fd, void *buf, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	if(off > INT64_MAX || (n = pread(fd, buf, len, off)) < 0)
+		return -1;
+	h->stats.bytes_read += n;
+	return (size_t)n == len ? 0 : -1;
+}
+
+
+/*
+ * What kind of ELF object fd is: its class, byte order, e_type and
+ * e_machine, whether it asks for an interpreter, and its DT_SONAME.
+ * Only the headers, the dynamic section and the one string are read.
+ * A missing or damaged dynamic section just leaves soname empty.
+ */
+#define DYN_MAX		4096
+
+int
+elfix_get_elf_info(elfix_t *h, int fd, struct elfix_elf_info *info)
+{
+	unsigned char ehdr[sizeof(Elf64_Ehdr)], *phdrs, *dyn;
+	uint64_t phoff, dyn_off = 0, dyn_size = 0, strtab = 0, soname = 0;
+	uint64_t p_type, p_off, p_vaddr, p_filesz, str_off = 0;
+	size_t i, phnum, phentsize, dynentsize;
+	int swap, is64, have_soname = 0;
+	ssize_t n;
+
+	memset(info, 0, sizeof(struct elfix_elf_info));
+
+	if((n = pread(fd, ehdr, sizeof(ehdr), 0)) < 0)
+		return fail(h, ELFIX_ESYS, "pread() of the ELF header failed: %s", strerror(errno));
+	h->stats.bytes_read += n;
+
+	if(n < EI_NIDENT || memcmp(ehdr, ELFMAG, SELFMAG))
+		return fail(h, ELFIX_ENOTELF, "this is not an elf file.");
+
+	info->elf_class = ehdr[EI_CLASS];
+	info->data = ehdr[EI_DATA];
+	info->osabi = ehdr[EI_OSABI];
+
+	if(ehdr[EI_DATA] == ELFDATA2LSB)
+		swap = __BYTE_ORDER != __LITTLE_ENDIAN;
+	else if(ehdr[EI_DATA] == ELFDATA2MSB)
+		swap = __BYTE_ORDER != __BIG_ENDIAN;
+	else
+		return fail(h, ELFIX_ENOTELF, "unknown ELF byte order %d", ehdr[EI_DATA]);
+
+	if(ehdr[EI_CLASS] == ELFCLASS64 && (size_t)n >= sizeof(Elf64_Ehdr))
+	{
+		Elf64_Ehdr *e = (Elf64_Ehdr *)ehdr;
+
+		is64 = 1;
+		info->type = raw16(e->e_type, swap);
+		info->machine = raw16(e->e_machine, swap);
+		phoff = raw64(e->e_phoff, swap);
+		phentsize = raw16(e->e_phentsize, swap);
+		phnum = raw16(e->e_phnum, swap);
+		if(phentsize != sizeof(Elf64_Phdr))
+			phnum = 0;
+	}
+	else if(ehdr[EI_CLASS] == ELFCLASS32 && (size_t)n >= sizeof(Elf32_Ehdr))
+	{
+		Elf32_Ehdr *e = (Elf32_Ehdr *)ehdr;
+
+		is64 = 0;
+		info->type = raw16(e->e_type, swap);
+		info->machine = raw16(e->e_machine, swap);
+		phoff = raw32(e->e_phoff, swap);
+		phentsize = raw16(e->e_phentsize, swap);
+		phnum = raw16(e->e_phnum, swap);
+		if(phentsize != sizeof(Elf32_Phdr))
+			phnum = 0;
+	}
+	else
+		return fail(h, ELFIX_ENOTELF, "unknown ELF class %d", ehdr[EI_CLASS]);
+
+	// Good enough for classifying, the rest is optional
+	if(phnum == 0 || phnum == PN_XNUM || phoff == 0)
+		return ok(h, ELFIX_OK);
+
+	if((phdrs = malloc(phnum * phentsize)) == NULL)
+		return fail(h, ELFIX_ESYS, "malloc(): %s", strerror(errno));
+
+	if(read_at(h, fd, phdrs, phnum * phentsize, phoff) < 0)
+	{
+		free(phdrs);
+		return ok(h, ELFIX_OK);
+	}
+
+	for(i = 0; i < phnum; i++)
+	{
+		if(is64)
+		{
+			Elf64_Phdr *p = (Elf64_Phdr *)(phdrs + i * phentsize);
+
+			p_type = raw32(p->p_type, swap);
+			p_off = raw64(p->p_offset, swap);
+			p_filesz = raw64(p->p_filesz, swap);
+		}
+		else
+		{
+			Elf32_Phdr *p = (Elf32_Phdr *)(phdrs + i * phentsize);
+
+			p_type = raw32(p->p_type, swap);
+			p_off = raw32(p->p_offset, swap);
+			p_filesz = raw32(p->p_filesz, swap);
+		}
+
+		if(p_type == PT_INTERP)
+			info->has_interp = 1;
+		else if(p_type == PT_DYNAMIC)
+		{
+			dyn_off = p_off;
+			dyn_size = p_filesz;
+		}
+	}
+
+	dynentsize = is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+	if(dyn_size > DYN_MAX * dynentsize)
+		dyn_size = DYN_MAX * dynentsize;
+	dyn_size -= dyn_size % dynentsize;
+
+	if(dyn_size > 0 && (dyn = malloc(dyn_size)) != NULL)
+	{
+		if(read_at(h, fd, dyn, dyn_size, dyn_off) == 0)
+			for(i = 0; i < dyn_size / dynentsize; i++)
+			{
+				int64_t tag;
+				uint64_t val;
+
+				if(is64)
+				{
+					Elf64_Dyn *d = (Elf64_Dyn *)(dyn + i * dynentsize);
+					tag = (int64_t)raw64(d->d_tag, swap);
+					val = raw64(d->d_un.d_val, swap);
+				}
+				else
+				{
+					Elf32_Dyn *d = (Elf32_Dyn *)(dyn + i * dynentsize);
+					tag = (int32_t)raw32(d->d_tag, swap);
+					val = raw32(d->d_un.d_val, swap);
+				}
+
+				if(tag == DT_NULL)
+					break;
+				if(tag == DT_STRTAB)
+					strtab = val;
+				else if(tag == DT_SONAME)
+				{
+					soname = val;
+					have_soname = 1;
+				}
+			}
+		free(dyn);
+	}
+
+	// DT_STRTAB is an address, find the PT_LOAD which holds it
+	for(i = 0; have_soname && strtab && i < phnum; i++)
+	{
+		if(is64)
+		{
+			Elf64_Phdr *p = (Elf64_Phdr *)(phdrs + i * phentsize);
+
+			p_type = raw32(p->p_type, swap);
+			p_off = raw64(p->p_offset, swap);
+			p_vaddr = raw64(p->p_vaddr, swap);
+			p_filesz = raw64(p->p_filesz, swap);
+		}
+		else
+		{
+			Elf32_Phdr *p = (Elf32_Phdr *)(phdrs + i * phentsize);
+
+			p_type = raw32(p->p_type, swap);
+			p_off = raw32(p->p_offset, swap);
+			p_vaddr = raw32(p->p_vaddr, swap);
+			p_filesz = raw32(p->p_filesz, swap);
+		}
+
+		if(p_type == PT_LOAD && strtab >= p_vaddr && strtab - p_vaddr < p_filesz)
+		{
+			str_off = p_off + (strtab - p_vaddr) + soname;
+			break;
+		}
+	}
+
+	free(phdrs);
+
+	if(str_off && (n = pread(fd, info->soname, sizeof(info->soname) - 1, str_off)) > 0)
+	{
+		h->stats.bytes_read += n;
+		info->soname[n] = '\0';
+		// A name which does not end in time is no name at all
+		if(strlen(info->soname) == (size_t)n)
+			info->soname[0] = '\0';
+	}
+	else
+		info->soname[0] = '\0';
+
+	return ok(h, ELFIX_OK);
+}
+
+
+/*
+ * The NT_GNU_BUILD_ID of fd, from its PT_NOTE segments, which the linker
+ * puts near the start of the file.  Like the above only the headers and
+ * the notes are read, at most NOTE_MAX bytes of each segment.  id must
+ * hold ELFIX_BUILD_ID_MAX bytes, *len gets how many there are.
+ */
+#define NOTE_MAX	4096
+
+int
+elfix_get_build_id(elfix_t *h, int fd, unsigned char *id, size_t *len)
+{
+	unsigned char ehdr[sizeof(Elf64_Ehdr)], *phdrs, *note;
+	uint64_t phoff, p_type, p_off, p_filesz, p_align;
+	uint32_t n_namesz, n_descsz, n_type;
+	size_t i, j, phnum, phentsize, align, desc_at;
+	int swap, is64;
+	ssize_t n;
+
+	*len = 0;
+
+	if((n = pread(fd, ehdr, sizeof(ehdr), 0)) < 0)
+		return fail(h, ELFIX_ESYS, "pread() of the ELF header failed: %s", strerror(errno));
+	h->stats.bytes_read += n;
+
+	if(n < EI_NIDENT || memcmp(ehdr, ELFMAG, SELFMAG))
+		return fail(h, ELFIX_ENOTELF, "this is not an elf file.");
+
+	if(ehdr[EI_DATA] == ELFDATA2LSB)
+		swap = __BYTE_ORDER != __LITTLE_ENDIAN;
+	else if(ehdr[EI_DATA] == ELFDATA2MSB)
+		swap = __BYTE_ORDER != __BIG_ENDIAN;
+	else
+		return fail(h, ELFIX_ENOTELF, "unknown ELF byte order %d", ehdr[EI_DATA]);
+
+	if(ehdr[EI_CLASS] == ELFCLASS64 && (size_t)n >= sizeof(Elf64_Ehdr))
+	{
+		Elf64_Ehdr *e = (Elf64_Ehdr *)ehdr;
+
+		is64 = 1;
+		phoff = raw64(e->e_phoff, swap);
+		phentsize = raw16(e->e_phentsize, swap);
+		phnum = raw16(e->e_phnum, swap);
+		if(phentsize != sizeof(Elf64_Phdr))
+			phnum = 0;
+	}
+	else if(ehdr[EI_CLASS] == ELFCLASS32 && (size_t)n >= sizeof(Elf32_Ehdr))
+	{
+		Elf32_Ehdr *e = (Elf32_Ehdr *)ehdr;
+
+		is64 = 0;
+		phoff = raw32(e->e_phoff, swap);
+		phentsize = raw16(e->e_phentsize, swap);
+		phnum = raw16(e->e_phnum, swap);
+		if(phentsize != sizeof(Elf32_Phdr))
+			phnum = 0;
+	}
+	else
+		return fail(h, ELFIX_ENOTELF, "unknown ELF class %d", ehdr[EI_CLASS]);
+
+	if(phnum == 0 || phnum == PN_XNUM || phoff == 0)
+		return fail(h, ELFIX_ENOFLAGS, "no NT_GNU_BUILD_ID note found");
+
+	if((phdrs = malloc(phnum * phentsize)) == NULL)
+		return fail(h, ELFIX_ESYS, "malloc(): %s", strerror(errno));
+
+	if(read_at(h, fd, phdrs, phnum * phentsize, phoff) < 0)
+	{
+		free(phdrs);
+		return fail(h, ELFIX_ENOFLAGS, "no NT_GNU_BUILD_ID note found");
+	}
+
+	if((note = malloc(NOTE_MAX)) == NULL)
+	{
+		free(phdrs);
+		return fail(h, ELFIX_ESYS, "malloc(): %s", strerror(errno));
+	}
+
+	for(i = 0; i < phnum && *len == 0; i++)
+	{
+		if(is64)
+		{
+			Elf64_Phdr *p = (Elf64_Phdr *)(phdrs + i * phentsize);
+
+			p_type = raw32(p->p_type, swap);
+			p_off = raw64(p->p_offset, swap);
+			p_filesz = raw64(p->p_filesz, swap);
+			p_align = raw64(p->p_align, swap);
+		}
+		else
+		{
+			Elf32_Phdr *p = (Elf32_Phdr *)(phdrs + i * phentsize);
+
+			p_type = raw32(p->p_type, swap);
+			p_off = raw32(p->p_offset, swap);
+			p_filesz = raw32(p->p_filesz, swap);
+			p_align = raw32(p->p_align, swap);
+		}
+
+		if(p_type != PT_NOTE)
+			continue;
+		if(p_filesz > NOTE_MAX)
+			p_filesz = NOTE_MAX;
+		if(read_at(h, fd, note, p_filesz, p_off) < 0)
+			continue;
+
+		// Notes are padded to 4 bytes, except in segments aligned to 8
+		align = p_align == 8 ? 8 : 4;
+		for(j = 0; j + 3 * sizeof(uint32_t) <= p_filesz; )
+		{
+			memcpy(&n_namesz, note + j, sizeof(uint32_t));
+			memcpy(&n_descsz, note + j + 4, sizeof(uint32_t));
+			memcpy(&n_type, note + j + 8, sizeof(uint32_t));
+			n_namesz = raw32(n_namesz, swap);
+			n_descsz = raw32(n_descsz, swap);
+			n_type = raw32(n_type, swap);
+
+			if(n_namesz > NOTE_MAX || n_descsz > NOTE_MAX)
+				break;
+			desc_at = j + 12 + ((n_namesz + align - 1) & ~(align - 1));
+			if(desc_at + n_descsz > p_filesz)
+				break;
+
+			if(n_type == NT_GNU_BUILD_ID && n_namesz == sizeof(ELF_NOTE_GNU)
+					&& !memcmp(note + j + 12, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU))
+					&& n_descsz > 0 && n_descsz <= ELFIX_BUILD_ID_MAX)
+			{
+				memcpy(id, note + desc_at, n_descsz);
+				*len = n_descsz;
+				break;
+			}
+
+			j = desc_at + ((n_descsz + align - 1) & ~(align - 1));
+		}
+	}
+
+	free(note);
+	free(phdrs);
+
+	if(*len == 0)
+		return fail(h, ELFIX_ENOFLAGS, "no NT_GNU_BUILD_ID note found");
+
+	return ok(h, ELFIX_OK);
+}
+
+
+/*
+ * A hash of the first ELFIX_HASH_BYTES bytes of fd, which hold the ELF
+ * header and usually the phdrs, to tell cheaply whether two files are
+ * the same build.  The p_flags of any PT_PAX_FLAGS phdr there are taken
+ * as 0, so that marking a file does not change its hash.  Works on any
+ * file, ELF or not; *size gets its st_size.
+ */
+int
+elfix_get_header_hash(elfix_t *h, int fd, uint64_t *hash, uint64_t *size)
+{
+	unsigned char buf[ELFIX_HASH_BYTES];
+	struct pt_raw raw;
+	struct stat st;
+	ssize_t n;
+	int i;
+
+	if(fstat(fd, &st) < 0)
+		return fail(h, ELFIX_ESYS, "fstat(): %s", strerror(errno));
+	*size = st.st_size;
+
+	if((n = pread(fd, buf, sizeof(buf), 0)) < 0)
+		return fail(h, ELFIX_ESYS, "pread(): %s", strerror(errno));
+	h->stats.bytes_read += n;
+
+	if(find_pt_pax_mem(buf, n, &raw) == PT_RAW_OK)
+		for(i = 0; i < raw.n; i++)
+			memset(buf + raw.off[i], 0, sizeof(uint32_t));
+
+	// FNV-1a
+	*hash = 14695981039346656037ULL;
+	for(i = 0; i < n; i++)
+		*hash = (*hash ^ buf[i]) * 1099511628211ULL;
+
+	return ok(h, ELFIX_OK);
+}
+
+
+uint16_t
+elfix_update_flags(uint16_t flags, uint16_t pax_flags)
+{
+	//PAGEEXEC
+	if(pax_flags & PF_PAGEEXEC)
+	{
+		flags |= PF_PAGEEXEC;
+		flags &= ~PF_NOPAGEEXEC;
+	}
+	if(pax_flags & PF_NOPAGEEXEC)
+	{
+		flags &= ~PF_PAGEEXEC;
+		flags |= PF_NOPAGEEXEC;
+	}
+	if((pax_flags & PF_PAGEEXEC) && (pax_flags & PF_NOPAGEEXEC))
+	{
+		flags &= ~PF_PAGEEXEC;
+		flags &= ~PF_NOPAGEEXEC;
+	}
+
+	//EMUTRAMP
+	if(pax_flags & PF_EMUTRAMP)
+	{
+		flags |= PF_EMUTRAMP;
+		flags &= ~PF_NOEMUTRAMP;
+	}
+	if(pax_flags & PF_NOEMUTRAMP)
+	{
+		flags &= ~PF_EMUTRAMP;
+		flags |= PF_NOEMUTRAMP;
+	}
+	if((pax_flags & PF_EMUTRAMP) && (pax_flags & PF_NOEMUTRAMP))
+	{
+		flags &= ~PF_EMUTRAMP;
+		flags &= ~PF_NOEMUTRAMP;
+	}
+
+	//MPROTECT
+	if(pax_flags & PF_MPROTECT)
+	{
+		flags |= PF_MPROTECT;
+		flags &= ~PF_NOMPROTECT;
+	}
+	if(pax_flags & PF_NOMPROTECT)
+	{
+		flags &= ~PF_MPROTECT;
+		flags |= PF_NOMPROTECT;
+	}
+	if((pax_flags & PF_MPROTECT) && (pax_flags & PF_NOMPROTECT))
+	{
+		flags &= ~PF_MPROTECT;
+		flags &= ~PF_NOMPROTECT;
+	}
+
+	//RANDMMAP
+	if(pax_flags & PF_RANDMMAP)
+	{
+		flags |= PF_RANDMMAP;
+		flags &= ~PF_NORANDMMAP;
+	}
+	if(pax_flags & PF_NORANDMMAP)
+	{
+		flags &= ~PF_RANDMMAP;
+		flags |= PF_NORANDMMAP;
+	}
+	if((pax_flags & PF_RANDMMAP) && (pax_flags & PF_NORANDMMAP))
+	{
+		flags &= ~PF_RANDMMAP;
+		flags &= ~PF_NORANDMMAP;
+	}
+
+	//SEGMEXEC
+	if(pax_flags & PF_SEGMEXEC)
+	{
+		flags |= PF_SEGMEXEC;
+		flags &= ~PF_NOSEGMEXEC;
+	}
+	if(pax_flags & PF_NOSEGMEXEC)
+	{
+		flags &= ~PF_SEGMEXEC;
+		flags |= PF_NOSEGMEXEC;
+	}
+	if((pax_flags & PF_SEGMEXEC) && (pax_flags & PF_NOSEGMEXEC))
+	{
+		flags &= ~PF_SEGMEXEC;
+		flags &= ~PF_NOSEGMEXEC;
+	}
+
+	return flags;
+}
+
+
+/*
+ * Turn a string of flag letters, as used on the command line and in -B
+ * manifests, into pax_flags.  '-' is a placeholder and is ignored so that
+ * printed flags can be fed back in.  Returns -1 on any other letter.
+ */
+int
+elfix_parse_flags(const char *sflags, uint16_t *pax_flags)
+{
+	*pax_flags = 0;
+
+	for(; *sflags; sflags++)
+	{
+		switch(*sflags)
+		{
+			case 'P':
+				*pax_flags |= PF_PAGEEXEC;
+				break;
+			case 'p':
+				*pax_flags |= PF_NOPAGEEXEC;
+				break;
+			case 'E':
+				*pax_flags |= PF_EMUTRAMP;
+				break;
+			case 'e':
+				*pax_flags |= PF_NOEMUTRAMP;
+				break;
+			case 'M':
+				*pax_flags |= PF_MPROTECT;
+				break;
+			case 'm':
+				*pax_flags |= PF_NOMPROTECT;
+				break;
+			case 'R':
+				*pax_flags |= PF_RANDMMAP;
+				break;
+			case 'r':
+				*pax_flags |= PF_NORANDMMAP;
+				break;
+			case 'S':
+				*pax_flags |= PF_SEGMEXEC;
+				break;
+			case 's':
+				*pax_flags |= PF_NOSEGMEXEC;
+				break;
+			case 'Z':
+				*pax_flags = PF_PAGEEXEC | PF_SEGMEXEC | PF_MPROTECT |
+					PF_NOEMUTRAMP | PF_RANDMMAP ;
+				break;
+			case 'z':
+				*pax_flags = PF_PAGEEXEC | PF_NOPAGEEXEC | PF_SEGMEXEC | PF_NOSEGMEXEC |
+					PF_MPROTECT | PF_NOMPROTECT | PF_EMUTRAMP | PF_NOEMUTRAMP |
+					PF_RANDMMAP | PF_NORANDMMAP ;
+				break;
+			case '-':
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+uint16_t
+elfix_string2bin(const char *buf)
+{
+	int i;
+	uint16_t flags = 0;
+
+	for(i = 0; i < 5 && buf[i]; i++)
+	{
+		if(buf[i] == 'P')
+			flags |= PF_PAGEEXEC;
+		else if(buf[i] == 'p')
+			flags |= PF_NOPAGEEXEC;
+
+		if(buf[i] == 'E')
+			flags |= PF_EMUTRAMP;
+		else if(buf[i] == 'e')
+			flags |= PF_NOEMUTRAMP;
+
+		if(buf[i] == 'M')
+			flags |= PF_MPROTECT;
+		else if(buf[i] == 'm')
+			flags |= PF_NOMPROTECT;
+
+		if(buf[i] == 'R')
+			flags |= PF_RANDMMAP;
+		else if(buf[i] == 'r')
+			flags |= PF_NORANDMMAP;
+
+		if(buf[i] == 'S')
+			flags |= PF_SEGMEXEC;
+		else if(buf[i] == 's')
+			flags |= PF_NOSEGMEXEC;
+	}
+
+	return flags;
+}
+
+
+// buf must hold ELFIX_FLAGS_SIZE, it gets only the letters which are set
+void
+elfix_bin2string(uint16_t flags, char *buf)
+{
+	int i;
+
+	for(i = 0; i < ELFIX_FLAGS_SIZE; i++)
+		buf[i] = 0;
+
+	i = 0;
+
+	if(flags & PF_PAGEEXEC)
+		buf[i++] = 'P';
+	else if(flags & PF_NOPAGEEXEC)
+		buf[i++] = 'p';
+
+	if(flags & PF_EMUTRAMP)
+		buf[i++] = 'E';
+	else if(flags & PF_NOEMUTRAMP)
+		buf[i++] = 'e';
+
+	if(flags & PF_MPROTECT)
+		buf[i++] = 'M';
+	else if(flags & PF_NOMPROTECT)
+		buf[i++] = 'm';
+
+	if(flags & PF_RANDMMAP)
+		buf[i++] = 'R';
+	else if(flags & PF_NORANDMMAP)
+		buf[i++] = 'r';
+
+	if(flags & PF_SEGMEXEC)
+		buf[i++] = 'S';
+	else if(flags & PF_NOSEGMEXEC)
+		buf[i++] = 's';
+}
+
+
+// buf must hold ELFIX_FLAGS_SIZE, it gets all five places with '-' for unset
+void
+elfix_bin2string4print(uint16_t flags, char *buf)
+{
+	buf[0] = flags & PF_PAGEEXEC ? 'P' :
+		flags & PF_NOPAGEEXEC ? 'p' : '-' ;
+
+	buf[1] = flags & PF_EMUTRAMP   ? 'E' :
+		flags & PF_NOEMUTRAMP ? 'e' : '-';
+
+	buf[2] = flags & PF_MPROTECT   ? 'M' :
+		flags & PF_NOMPROTECT ? 'm' : '-';
+
+	buf[3] = flags & PF_RANDMMAP   ? 'R' :
+		flags & PF_NORANDMMAP ? 'r' : '-';
+
+	buf[4] = flags & PF_SEGMEXEC   ? 'S' :
+		flags & PF_NOSEGMEXEC ? 's' : '-';
+
+	buf[5] = '\0';
+}
@@ -0,0 +1,185 @@
+/*
+	elfix.h: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ELFIX_H
+#define ELFIX_H
+
+/*
+ * libelfix: reading and writing PT_PAX and XATTR_PAX flags.
+ *
+ * Every call which touches a file takes an elfix_t handle.  The handle
+ * holds the details of the last error and some counters, and nothing
+ * else, so one handle per thread is all it takes for several threads
+ * to mark files at once.  Nothing is printed and there is no global
+ * state apart from libelf's elf_version(), which elfix_new() sets up
+ * exactly once.
+ *
+ * Calls return ELFIX_OK, ELFIX_ENOFLAGS if the file simply has no
+ * flags of that kind, or one of the errors below, in which case
+ * elfix_strerror() has the details.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <elf.h>
+#include <sys/stat.h>
+
+#ifndef PT_PAX_FLAGS
+ #define PT_PAX_FLAGS    0x65041580      /* Indicates PaX flag markings */
+#endif
+#ifndef PF_PAGEEXEC
+ #define PF_PAGEEXEC     (1 << 4)        /* Enable  PAGEEXEC */
+ #define PF_NOPAGEEXEC   (1 << 5)        /* Disable PAGEEXEC */
+ #define PF_SEGMEXEC     (1 << 6)        /* Enable  SEGMEXEC */
+ #define PF_NOSEGMEXEC   (1 << 7)        /* Disable SEGMEXEC */
+ #define PF_MPROTECT     (1 << 8)        /* Enable  MPROTECT */
+ #define PF_NOMPROTECT   (1 << 9)        /* Disable MPROTECT */
+ #define PF_RANDEXEC     (1 << 10)       /* DEPRECATED: Enable  RANDEXEC */
+ #define PF_NORANDEXEC   (1 << 11)       /* DEPRECATED: Disable RANDEXEC */
+ #define PF_EMUTRAMP     (1 << 12)       /* Enable  EMUTRAMP */
+ #define PF_NOEMUTRAMP   (1 << 13)       /* Disable EMUTRAMP */
+ #define PF_RANDMMAP     (1 << 14)       /* Enable  RANDMMAP */
+ #define PF_NORANDMMAP   (1 << 15)       /* Disable RANDMMAP */
+#endif
+
+#define ELFIX_PAX_NAMESPACE     "user.pax.flags"
+#define ELFIX_FLAGS_SIZE        6       /* five letters and a NUL */
+
+/* Return codes */
+#define ELFIX_OK                0
+#define ELFIX_ENOFLAGS          1       /* no PT_PAX_FLAGS phdr or no user.pax.flags */
+#define ELFIX_ENOTSUP           2       /* built without PT_PAX or XATTR_PAX support */
+#define ELFIX_ENOTELF           3       /* not an ELF object */
+#define ELFIX_ELIBELF           4       /* libelf failed */
+#define ELFIX_ESYS              5       /* a system call failed, see elfix_errno() */
+#define ELFIX_EINVAL            6       /* bad argument */
+
+/* What elfix_features() can return */
+#define ELFIX_HAVE_PT           1
+#define ELFIX_HAVE_XT           2
+
+typedef struct elfix elfix_t;
+
+struct elfix_stats
+{
+	unsigned long elf_sessions;     /* elf_begin() fallbacks */
+	unsigned long bytes_read;       /* by pread() of headers and by fgetxattr() */
+	unsigned long xattr_get;
+	unsigned long xattr_set;
+	unsigned long xattr_remove;
+	unsigned long enoattr;          /* of the above, how many found nothing */
+	unsigned long pt_writes;        /* p_flags words written */
+};
+
+/* Handles */
+elfix_t *elfix_new(void);
+void elfix_free(elfix_t *);
+int elfix_features(void);
+int elfix_error(const elfix_t *);
+int elfix_errno(const elfix_t *);
+const char *elfix_strerror(const elfix_t *);
+void elfix_get_stats(const elfix_t *, struct elfix_stats *);
+void elfix_reset_stats(elfix_t *);
+
+/* PT_PAX */
+int elfix_get_pt_flags(elfix_t *, int, uint16_t *);
+int elfix_set_pt_flags(elfix_t *, int, uint16_t);
+int elfix_set_pt_flags_hdr(elfix_t *, int, uint16_t);
+int elfix_get_pt_flags_mem(elfix_t *, const void *, size_t, uint16_t *);
+int elfix_set_pt_flags_mem(elfix_t *, void *, size_t, uint16_t);
+
+/* XATTR_PAX */
+int elfix_get_xt_flags(elfix_t *, int, uint16_t *);
+int elfix_set_xt_flags(elfix_t *, int, uint16_t);
+int elfix_create_xt_flags(elfix_t *, int, uint16_t);
+int elfix_delete_xt_flags(elfix_t *, int);
+
+/* What kind of object a file is */
+struct elfix_elf_info
+{
+	int elf_class;                  /* ELFCLASS32 or ELFCLASS64 */
+	int data;                       /* ELFDATA2LSB or ELFDATA2MSB */
+	int osabi;
+	uint16_t type;                  /* e_type */
+	uint16_t machine;               /* e_machine */
+	int has_interp;                 /* a PT_INTERP phdr, so ET_DYN is a PIE */
+	char soname[256];               /* DT_SONAME, or "" */
+};
+
+int elfix_get_elf_info(elfix_t *, int, struct elfix_elf_info *);
+
+/* NT_GNU_BUILD_ID, ELFIX_ENOFLAGS if there is none */
+#define ELFIX_BUILD_ID_MAX      64
+
+int elfix_get_build_id(elfix_t *, int, unsigned char *, size_t *);
+
+/* Cheaply, whether a file is still the same build */
+#define ELFIX_HASH_BYTES        4096
+
+int elfix_get_header_hash(elfix_t *, int, uint64_t *, uint64_t *);
+
+/* Flag arithmetic, these need no handle */
+uint16_t elfix_update_flags(uint16_t, uint16_t);
+int elfix_parse_flags(const char *, uint16_t *);
+uint16_t elfix_string2bin(const char *);
+void elfix_bin2string(uint16_t, char *);
+void elfix_bin2string4print(uint16_t, char *);
+
+/*
+ * Persistent flag cache shared by processes, see cache.c.  Entries are
+ * keyed by st_dev, st_ino, st_size and st_ctim.  To store, pass the
+ * open file and an fstat() of it from before its flags were read.
+ */
+typedef struct elfix_cache elfix_cache_t;
+
+#define ELFIX_CACHE_NOTELF      4       /* with ELFIX_HAVE_PT and ELFIX_HAVE_XT */
+
+struct elfix_cache_entry
+{
+	unsigned what;                  /* which of the flags below were read */
+	uint16_t pt_flags;              /* UINT16_MAX if there are none */
+	uint16_t xt_flags;
+};
+
+elfix_cache_t *elfix_cache_open(const char *);
+int elfix_cache_lookup(elfix_cache_t *, const struct stat *, struct elfix_cache_entry *);
+int elfix_cache_store(elfix_cache_t *, int, const struct stat *, const struct elfix_cache_entry *);
+void elfix_cache_close(elfix_cache_t *);
+
+/*
+ * Client side of paxctl-ng --server, see client.c for the protocol.
+ * These return NULL, 0 or -1 on failure with errno set.
+ */
+typedef struct elfix_client elfix_client_t;
+
+struct elfix_reply
+{
+	unsigned long id;               /* as returned by elfix_client_send() */
+	int error;                      /* 0, or an errno value */
+	int written;                    /* the request changed what is on disk */
+	char pt_flags[ELFIX_FLAGS_SIZE];        /* afterwards, as printed by -v, */
+	char xt_flags[ELFIX_FLAGS_SIZE];        /* or "" if there are none */
+};
+
+elfix_client_t *elfix_client_open(const char *);
+unsigned long elfix_client_send(elfix_client_t *, const char *, const char *, const char *, int);
+int elfix_client_done(elfix_client_t *);
+int elfix_client_recv(elfix_client_t *, struct elfix_reply *);
+void elfix_client_close(elfix_client_t *);
+
+#endif
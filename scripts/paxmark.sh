@@ -60,6 +60,13 @@ paxmarksh() {
 
 	if has XT ${PAX_MARKINGS}; then
 		flags="${flags//z}"
+
+		#Mark all the files with a single paxctl-ng, falling back one by one below
+		if [[ ${dodefault} != "yes" && "${flags}" ]] && \
+				type -p paxctl-ng > /dev/null && paxctl-ng -l ; then
+			printf "${flags}\t%s\0" "$@" | paxctl-ng -l -0 -B - >/dev/null 2>&1 && set --
+		fi
+
 		for f in "$@"; do
 
 			#First try paxctl-ng
@@ -24,32 +24,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#ifdef PTPAX
- #include <gelf.h>
-#endif
-
-#ifdef NEED_PAX_DECLS
- #define PT_PAX_FLAGS    0x65041580      /* Indicates PaX flag markings */
- #define PF_PAGEEXEC     (1 << 4)        /* Enable  PAGEEXEC */
- #define PF_NOPAGEEXEC   (1 << 5)        /* Disable PAGEEXEC */
- #define PF_SEGMEXEC     (1 << 6)        /* Enable  SEGMEXEC */
- #define PF_NOSEGMEXEC   (1 << 7)        /* Disable SEGMEXEC */
- #define PF_MPROTECT     (1 << 8)        /* Enable  MPROTECT */
- #define PF_NOMPROTECT   (1 << 9)        /* Disable MPROTECT */
- #define PF_RANDEXEC     (1 << 10)       /* DEPRECATED: Enable  RANDEXEC */
- #define PF_NORANDEXEC   (1 << 11)       /* DEPRECATED: Disable RANDEXEC */
- #define PF_EMUTRAMP     (1 << 12)       /* Enable  EMUTRAMP */
- #define PF_NOEMUTRAMP   (1 << 13)       /* Disable EMUTRAMP */
- #define PF_RANDMMAP     (1 << 14)       /* Enable  RANDMMAP */
- #define PF_NORANDMMAP   (1 << 15)       /* Disable RANDMMAP */
-#endif
-
 #ifdef XTPAX
  #include <sys/xattr.h>
- #define PAX_NAMESPACE	"user.pax.flags"
 #endif
 
-#define FLAGS_SIZE	6
+#include <elfix.h>
+
+/* The same "elfix" USDT probes as paxctl-ng */
+#include <probes.h>
 
 
 static PyObject * pax_getflags(PyObject *, PyObject *);
@@ -83,6 +65,19 @@ static PyMethodDef PaxMethods[] = {
     };
 #endif
 
+/*
+ * The flag cache of paxctl-ng --cache, if $PAXCTL_NG_CACHE names one, so
+ * that getflags() on a file which has not changed costs only a stat().
+ */
+#if defined(PTPAX) && defined(XTPAX)
+ #define CACHE_WANT	(ELFIX_HAVE_PT | ELFIX_HAVE_XT)
+#elif defined(PTPAX)
+ #define CACHE_WANT	ELFIX_HAVE_PT
+#else
+ #define CACHE_WANT	ELFIX_HAVE_XT
+#endif
+
+static elfix_cache_t *pax_cache;
 static PyObject *PaxError;
 
 PyMODINIT_FUNC
@@ -111,6 +106,10 @@ initpax(void)
 	Py_INCREF(PaxError);
 	PyModule_AddObject(m, "PaxError", PaxError);
 
+	// Without it we just read every file
+	if(getenv("PAXCTL_NG_CACHE") && *getenv("PAXCTL_NG_CACHE"))
+		pax_cache = elfix_cache_open(getenv("PAXCTL_NG_CACHE"));
+
 #if PY_MAJOR_VERSION >= 3
 	return m;
 #else
@@ -119,177 +118,59 @@ initpax(void)
 }
 
 
+/*
+ * Thin wrappers over libelfix which turn its errors into PaxError
+ * and carry the same USDT probes as paxctl-ng.
+ */
 #ifdef PTPAX
 uint16_t
-get_pt_flags(int fd)
+get_pt_flags(elfix_t *h, int fd)
 {
-	Elf *elf;
-	GElf_Phdr phdr;
-	size_t i, phnum;
-
 	uint16_t pt_flags = UINT16_MAX;
+	int e;
 
-	if(elf_version(EV_CURRENT) == EV_NONE)
-	{
-		PyErr_SetString(PaxError, "get_pt_flags: library out of date");
-		return pt_flags;
-	}
-
-	if((elf = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
-	{
-		PyErr_SetString(PaxError, "get_pt_flags: elf_begin() failed");
-		return pt_flags;
-	}
-
-	if(elf_kind(elf) != ELF_K_ELF)
-	{
-		elf_end(elf);
-		PyErr_SetString(PaxError, "get_pt_flags: elf_kind() failed: this is not an elf file.");
-		return pt_flags;
-	}
-
-	elf_getphdrnum(elf, &phnum);
-
-	for(i=0; i<phnum; i++)
-	{
-		if(gelf_getphdr(elf, i, &phdr) != &phdr)
-		{
-			PyErr_SetString(PaxError, "get_pt_flags: gelf_getphdr() failed: could not get phdr.");
-			return pt_flags;
-		}
-
-		if(phdr.p_type == PT_PAX_FLAGS)
-			pt_flags = phdr.p_flags;
-	}
+	PAX_PROBE1(get_pt_flags__entry, fd);
 
-	elf_end(elf);
+	e = elfix_get_pt_flags(h, fd, &pt_flags);
+	if(e != ELFIX_OK && e != ELFIX_ENOFLAGS)
+		PyErr_Format(PaxError, "get_pt_flags: %s", elfix_strerror(h));
 
+	PAX_PROBE3(get_pt_flags__return, fd, pt_flags, e);
 	return pt_flags;
 }
 #endif
 
 
-uint16_t
-string2bin(char *buf)
-{
-	int i;
-	uint16_t flags = 0;
-
-	for(i = 0; i < 5; i++)
-	{
-		if(buf[i] == 'P')
-			flags |= PF_PAGEEXEC;
-		else if(buf[i] == 'p')
-			flags |= PF_NOPAGEEXEC;
-
-		if(buf[i] == 'E')
-			flags |= PF_EMUTRAMP;
-		else if(buf[i] == 'e')
-			flags |= PF_NOEMUTRAMP;
-
-		if(buf[i] == 'M')
-			flags |= PF_MPROTECT;
-		else if(buf[i] == 'm')
-			flags |= PF_NOMPROTECT;
-
-		if(buf[i] == 'R')
-			flags |= PF_RANDMMAP;
-		else if(buf[i] == 'r')
-			flags |= PF_NORANDMMAP;
-
-		if(buf[i] == 'S')
-			flags |= PF_SEGMEXEC;
-		else if(buf[i] == 's')
-			flags |= PF_NOSEGMEXEC;
-	}
-
-	return flags;
-}
-
-
 #ifdef XTPAX
 uint16_t
-get_xt_flags(int fd)
+get_xt_flags(elfix_t *h, int fd)
 {
-	char buf[FLAGS_SIZE];
 	uint16_t xt_flags = UINT16_MAX;
+	int e;
 
-	memset(buf, 0, FLAGS_SIZE);
+	PAX_PROBE1(get_xt_flags__entry, fd);
 
-	if(fgetxattr(fd, PAX_NAMESPACE, buf, FLAGS_SIZE) != -1)
-		xt_flags = string2bin(buf);
+	e = elfix_get_xt_flags(h, fd, &xt_flags);
 
+	PAX_PROBE3(get_xt_flags__return, fd, xt_flags, e);
 	return xt_flags;
 }
 #endif
 
 
-void
-bin2string4print(uint16_t flags, char *buf)
-{
-	buf[0] = flags & PF_PAGEEXEC ? 'P' :
-		flags & PF_NOPAGEEXEC ? 'p' : '-' ;
-
-	buf[1] = flags & PF_EMUTRAMP   ? 'E' :
-		flags & PF_NOEMUTRAMP ? 'e' : '-';
-
-	buf[2] = flags & PF_MPROTECT   ? 'M' :
-		flags & PF_NOMPROTECT ? 'm' : '-';
-
-	buf[3] = flags & PF_RANDMMAP   ? 'R' :
-		flags & PF_NORANDMMAP ? 'r' : '-';
-
-	buf[4] = flags & PF_SEGMEXEC   ? 'S' :
-		flags & PF_NOSEGMEXEC ? 's' : '-';
-}
-
-
-void
-bin2string(uint16_t flags, char *buf)
-{
-	int i;
-
-	for(i = 0; i < 5; i++)
-		buf[i] = 0;
-
-	i = 0;
-
-	if(flags & PF_PAGEEXEC)
-		buf[i++] = 'P';
-	else if(flags & PF_NOPAGEEXEC)
-		buf[i++] = 'p';
-
-	if(flags & PF_EMUTRAMP)
-		buf[i++] = 'E';
-	else if(flags & PF_NOEMUTRAMP)
-		buf[i++] = 'e';
-
-	if(flags & PF_MPROTECT)
-		buf[i++] = 'M';
-	else if(flags & PF_NOMPROTECT)
-		buf[i++] = 'm';
-
-	if(flags & PF_RANDMMAP)
-		buf[i++] = 'R';
-	if(flags & PF_NORANDMMAP)
-		buf[i++] = 'r';
-
-	if(flags & PF_SEGMEXEC)
-		 buf[i++] = 'S';
-	else if(flags & PF_NOSEGMEXEC)
-		buf[i++] = 's';
-}
-
-
 static PyObject *
 pax_getflags(PyObject *self, PyObject *args)
 {
 	const char *f_name;
-	int fd, flags_found;
-	uint16_t flags;
-	char buf[FLAGS_SIZE];
+	elfix_t *h;
+	int fd, flags_found, cacheable;
+	uint16_t flags, pt_flags, xt_flags;
+	char buf[ELFIX_FLAGS_SIZE];
+	struct stat st;
+	struct elfix_cache_entry e;
+	struct elfix_elf_info info;
 
-	memset(buf, 0, FLAGS_SIZE);
+	memset(buf, 0, ELFIX_FLAGS_SIZE);
 
 	if (!PyArg_ParseTuple(args, "s", &f_name))
 	{
@@ -297,10 +178,48 @@ pax_getflags(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
-	if((fd = open(f_name, O_RDONLY)) < 0)
+	pt_flags = xt_flags = UINT16_MAX;
+
+	if(pax_cache && stat(f_name, &st) == 0 && elfix_cache_lookup(pax_cache, &st, &e)
+			&& (e.what & CACHE_WANT) == CACHE_WANT)
 	{
-		PyErr_SetString(PaxError, "pax_getflags: open() failed");
-		return NULL;
+		pt_flags = e.pt_flags;
+		xt_flags = e.xt_flags;
+	}
+	else
+	{
+		if((fd = open(f_name, O_RDONLY)) < 0)
+		{
+			PyErr_SetString(PaxError, "pax_getflags: open() failed");
+			return NULL;
+		}
+
+		if((h = elfix_new()) == NULL)
+		{
+			close(fd);
+			return PyErr_NoMemory();
+		}
+
+		cacheable = pax_cache && fstat(fd, &st) == 0;
+
+#ifdef PTPAX
+		pt_flags = get_pt_flags(h, fd);
+#endif
+#ifdef XTPAX
+		xt_flags = get_xt_flags(h, fd);
+#endif
+
+		// Only what is surely an ELF object is worth remembering
+		if(cacheable && !PyErr_Occurred() && elfix_get_elf_info(h, fd, &info) == ELFIX_OK)
+		{
+			e.what = CACHE_WANT;
+			e.pt_flags = pt_flags;
+			e.xt_flags = xt_flags;
+			elfix_cache_store(pax_cache, fd, &st, &e);
+		}
+
+		close(fd);
+		elfix_free(h);
 	}
 
 	/* Since the xattr pax flags are obtained second, they
@@ -315,27 +234,25 @@ pax_getflags(PyObject *self, PyObject *args)
 	flags_found = 0;
 
 #ifdef PTPAX
-	flags = get_pt_flags(fd);
+	flags = pt_flags;
 	if( flags != UINT16_MAX )
 	{
 		flags_found = 1;
-		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
+		memset(buf, 0, ELFIX_FLAGS_SIZE);
+		elfix_bin2string4print(flags, buf);
 	}
 #endif
 
 #ifdef XTPAX
-	flags = get_xt_flags(fd);
+	flags = xt_flags;
 	if( flags != UINT16_MAX )
 	{
 		flags_found = 1;
-		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
+		memset(buf, 0, ELFIX_FLAGS_SIZE);
+		elfix_bin2string4print(flags, buf);
 	}
 #endif
 
-	close(fd);
-
 	if( !flags_found )
 	{
 		PyErr_SetString(PaxError, "pax_getflags: no PAX flags found");
@@ -349,167 +266,44 @@ pax_getflags(PyObject *self, PyObject *args)
 uint16_t
 update_flags(uint16_t oflags, uint16_t flags)
 {
-	//PAGEEXEC
-	if(flags & PF_PAGEEXEC)
-	{
-		oflags |= PF_PAGEEXEC;
-		oflags &= ~PF_NOPAGEEXEC;
-	}
-	if(flags & PF_NOPAGEEXEC)
-	{
-		oflags &= ~PF_PAGEEXEC;
-		oflags |= PF_NOPAGEEXEC;
-	}
-	if((flags & PF_PAGEEXEC) && (flags & PF_NOPAGEEXEC))
-	{
-		oflags &= ~PF_PAGEEXEC;
-		oflags &= ~PF_NOPAGEEXEC;
-	}
-
-	//EMUTRAMP
-	if(flags & PF_EMUTRAMP)
-	{
-		oflags |= PF_EMUTRAMP;
-		oflags &= ~PF_NOEMUTRAMP;
-	}
-	if(flags & PF_NOEMUTRAMP)
-	{
-		oflags &= ~PF_EMUTRAMP;
-		oflags |= PF_NOEMUTRAMP;
-	}
-	if((flags & PF_EMUTRAMP) && (flags & PF_NOEMUTRAMP))
-	{
-		oflags &= ~PF_EMUTRAMP;
-		oflags &= ~PF_NOEMUTRAMP;
-	}
-
-	//MPROTECT
-	if(flags & PF_MPROTECT)
-	{
-		oflags |= PF_MPROTECT;
-		oflags &= ~PF_NOMPROTECT;
-	}
-	if(flags & PF_NOMPROTECT)
-	{
-		oflags &= ~PF_MPROTECT;
-		oflags |= PF_NOMPROTECT;
-	}
-	if((flags & PF_MPROTECT) && (flags & PF_NOMPROTECT))
-	{
-		oflags &= ~PF_MPROTECT;
-		oflags &= ~PF_NOMPROTECT;
-	}
+	PAX_PROBE2(update_flags__entry, oflags, flags);
 
-	//RANDMMAP
-	if(flags & PF_RANDMMAP)
-	{
-		oflags |= PF_RANDMMAP;
-		oflags &= ~PF_NORANDMMAP;
-	}
-	if(flags & PF_NORANDMMAP)
-	{
-		oflags &= ~PF_RANDMMAP;
-		oflags |= PF_NORANDMMAP;
-	}
-	if((flags & PF_RANDMMAP) && (flags & PF_NORANDMMAP))
-	{
-		oflags &= ~PF_RANDMMAP;
-		oflags &= ~PF_NORANDMMAP;
-	}
-
-	//SEGMEXEC
-	if(flags & PF_SEGMEXEC)
-	{
-		oflags |= PF_SEGMEXEC;
-		oflags &= ~PF_NOSEGMEXEC;
-	}
-	if(flags & PF_NOSEGMEXEC)
-	{
-		oflags &= ~PF_SEGMEXEC;
-		oflags |= PF_NOSEGMEXEC;
-	}
-	if((flags & PF_SEGMEXEC) && (flags & PF_NOSEGMEXEC))
-	{
-		oflags &= ~PF_SEGMEXEC;
-		oflags &= ~PF_NOSEGMEXEC;
-	}
+	oflags = elfix_update_flags(oflags, flags);
 
+	PAX_PROBE1(update_flags__return, oflags);
 	return oflags;
 }
 
 
 #ifdef PTPAX
 void
-set_pt_flags(int fd, uint16_t pt_flags)
+set_pt_flags(elfix_t *h, int fd, uint16_t pt_flags)
 {
-	Elf *elf;
-	GElf_Phdr phdr;
-	size_t i, phnum;
-
-	if(elf_version(EV_CURRENT) == EV_NONE)
-	{
-		PyErr_SetString(PaxError, "set_pt_flags: library out of date");
-		return;
-	}
-
-	if((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL)
-	{
-		PyErr_SetString(PaxError, "set_pt_flags: elf_begin() failed");
-		return;
-	}
-
-	if(elf_kind(elf) != ELF_K_ELF)
-	{
-		elf_end(elf);
-		PyErr_SetString(PaxError, "set_pt_flags: elf_kind() failed: this is not an elf file.");
-		return;
-	}
+	int e;
 
-	elf_getphdrnum(elf, &phnum);
-
-	for(i=0; i<phnum; i++)
-	{
-		if(gelf_getphdr(elf, i, &phdr) != &phdr)
-		{
-			elf_end(elf);
-			PyErr_SetString(PaxError, "set_pt_flags: gelf_getphdr() failed");
-			return;
-		}
+	PAX_PROBE2(set_pt_flags__entry, fd, pt_flags);
 
-		if(phdr.p_type == PT_PAX_FLAGS)
-		{
-			phdr.p_flags = pt_flags;
-
-			if(!gelf_update_phdr(elf, i, &phdr))
-			{
-				elf_end(elf);
-				PyErr_SetString(PaxError, "set_pt_flags: gelf_update_phdr() failed");
-				return;
-			}
-		}
-	}
+	e = elfix_set_pt_flags(h, fd, pt_flags);
+	if(e != ELFIX_OK && e != ELFIX_ENOFLAGS)
+		PyErr_Format(PaxError, "set_pt_flags: %s", elfix_strerror(h));
 
-	elf_end(elf);
+	PAX_PROBE3(set_pt_flags__return, fd, pt_flags, e);
 }
 #endif
 
 
 #ifdef XTPAX
 void
-set_xt_flags(int fd, uint16_t xt_flags)
+set_xt_flags(elfix_t *h, int fd, uint16_t xt_flags)
 {
-	char buf[FLAGS_SIZE];
+	int e;
 
-	memset(buf, 0, FLAGS_SIZE);
-	bin2string(xt_flags, buf);
+	PAX_PROBE2(set_xt_flags__entry, fd, xt_flags);
 
-	if( fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), 0))
-	{
-		PyErr_SetString(PaxError, "pax_deletextpax: fremovexattr() failed");
-		return;
-	}
-	else
-		return;
+	if((e = elfix_set_xt_flags(h, fd, xt_flags)) != ELFIX_OK)
+		PyErr_Format(PaxError, "set_xt_flags: %s", elfix_strerror(h));
+
+	PAX_PROBE3(set_xt_flags__return, fd, xt_flags, e);
 }
 #endif
 
@@ -518,6 +312,7 @@ static PyObject *
 pax_setbinflags(PyObject *self, PyObject *args)
 {
 	const char *f_name;
+	elfix_t *h;
 	int fd, iflags, rdwr_pt_pax = 1;
 	uint16_t oflags, nflags, flags;
 
@@ -527,6 +322,9 @@ pax_setbinflags(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
+	flags = (uint16_t) iflags;
+	PAX_PROBE2(file__entry, f_name, flags);
+
 	if((fd = open(f_name, O_RDWR)) < 0)
 	{
 #ifdef PTPAX
@@ -534,34 +332,41 @@ pax_setbinflags(PyObject *self, PyObject *args)
 #endif
 		if((fd = open(f_name, O_RDONLY)) < 0)
 		{
+			PAX_PROBE3(file__return, f_name, flags, EXIT_FAILURE);
 			PyErr_SetString(PaxError, "pax_setbinflags: open() failed");
 			return NULL;
 		}
 	}
 
-	flags = (uint16_t) iflags;
+	if((h = elfix_new()) == NULL)
+	{
+		close(fd);
+		return PyErr_NoMemory();
+	}
 
 #ifdef PTPAX
 	if(rdwr_pt_pax)
 	{
-		oflags = get_pt_flags(fd);
+		oflags = get_pt_flags(h, fd);
 		if( oflags == UINT16_MAX )
 			oflags = PF_NOEMUTRAMP ;
 		nflags = update_flags( oflags, flags);
-		set_pt_flags(fd, nflags);
+		set_pt_flags(h, fd, nflags);
         }
 #endif
 
 #ifdef XTPAX
-	oflags = get_xt_flags(fd);
+	oflags = get_xt_flags(h, fd);
 	if( oflags == UINT16_MAX )
 		oflags = PF_NOEMUTRAMP ;
 	nflags = update_flags( oflags, flags);
-	set_xt_flags(fd, nflags);
+	set_xt_flags(h, fd, nflags);
 #endif
 
 	close(fd);
+	elfix_free(h);
 
+	PAX_PROBE3(file__return, f_name, flags, PyErr_Occurred() ? EXIT_FAILURE : EXIT_SUCCESS);
 	return Py_BuildValue("");
 }
 
@@ -618,6 +423,7 @@ static PyObject *
 pax_setstrflags(PyObject *self, PyObject *args)
 {
 	char *f_name, *sflags;
+	elfix_t *h;
 	int fd, rdwr_pt_pax = 1;
 	uint16_t oflags, nflags, flags;
 
@@ -627,6 +433,9 @@ pax_setstrflags(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
+	flags = parse_sflags(sflags);
+	PAX_PROBE2(file__entry, f_name, flags);
+
 	if((fd = open(f_name, O_RDWR)) < 0)
 	{
 #ifdef PTPAX
@@ -634,34 +443,41 @@ pax_setstrflags(PyObject *self, PyObject *args)
 #endif
 		if((fd = open(f_name, O_RDONLY)) < 0)
 		{
+			PAX_PROBE3(file__return, f_name, flags, EXIT_FAILURE);
 			PyErr_SetString(PaxError, "pax_setstrflags: open() failed");
 			return NULL;
 		}
 	}
 
-	flags = parse_sflags(sflags);
+	if((h = elfix_new()) == NULL)
+	{
+		close(fd);
+		return PyErr_NoMemory();
+	}
 
 #ifdef PTPAX
 	if(rdwr_pt_pax)
 	{
-		oflags = get_pt_flags(fd);
+		oflags = get_pt_flags(h, fd);
 		if( oflags == UINT16_MAX )
 			oflags = PF_NOEMUTRAMP ;
 		nflags = update_flags( oflags, flags);
-		set_pt_flags(fd, nflags);
+		set_pt_flags(h, fd, nflags);
 	}
 #endif
 
 #ifdef XTPAX
-	oflags = get_xt_flags(fd);
+	oflags = get_xt_flags(h, fd);
 	if( oflags == UINT16_MAX )
 		oflags = PF_NOEMUTRAMP ;
 	nflags = update_flags( oflags, flags);
-	set_xt_flags(fd, nflags);
+	set_xt_flags(h, fd, nflags);
 #endif
 
 	close(fd);
+	elfix_free(h);
 
+	PAX_PROBE3(file__return, f_name, flags, PyErr_Occurred() ? EXIT_FAILURE : EXIT_SUCCESS);
 	return Py_BuildValue("");
 }
 
@@ -685,7 +501,7 @@ pax_deletextpax(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
-	if( !fremovexattr(fd, PAX_NAMESPACE) )
+	if( !fremovexattr(fd, ELFIX_PAX_NAMESPACE) )
 	{
 		close(fd);
 		return Py_BuildValue("");
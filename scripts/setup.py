@@ -100,6 +100,18 @@ else:
 				define_macros = [('PTPAX', 1), ('XTPAX', 1)]
 			)
 
+# The flag I/O itself lives in libelfix, which brings in libelf and libattr
+module1.libraries = ['elfix']
+module1.include_dirs.append('../lib')
+
+# The USDT probes are shared with paxctl-ng in src/probes.h
+module1.include_dirs.append('../src')
+module1.library_dirs.append('../lib/.libs')
+
+# USDT probes, as with ./configure --enable-usdt
+if os.getenv('USDT') != None:
+	module1.define_macros.append(('USDT', 1))
+
 
 setup(
 	name = 'PaxPython',
@@ -0,0 +1,328 @@
+/*
+	agent.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef FANOTIFY
+ #include <sys/fanotify.h>
+#endif
+
+#include "paxctl-ng.h"
+
+#ifdef FANOTIFY
+
+/*
+ * --exec-agent: rather than marking every file when it is installed,
+ * mark each one the first time somebody executes it.  We hold every
+ * exec on the watched mounts with FAN_OPEN_EXEC_PERM, look the file up
+ * in the -B manifest or the --policy, mark it if need be and then let
+ * the exec go on.  Execs are never denied; if marking fails the binary
+ * runs as it is.
+ *
+ * Once a file has been seen its (st_dev, st_ino) goes in the verdict
+ * cache with its ctime.  Any change to the file or its xattrs moves the
+ * ctime on, so as long as it stays put, a later exec costs an fstat()
+ * and one lookup here.
+ */
+struct verdict
+{
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+};
+
+struct verdict_cache
+{
+	struct verdict *slot;
+	size_t size, used;
+};
+
+static volatile sig_atomic_t agent_stop;
+
+static void
+agent_stop_handler(int sig)
+{
+	agent_stop = 1;
+}
+
+
+static size_t
+verdict_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t)dev << 32) ^ (uint64_t)ino;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+
+static struct verdict *
+verdict_slot(struct verdict_cache *vc, dev_t dev, ino_t ino)
+{
+	size_t j, mask = vc->size - 1;
+
+	for(j = verdict_hash(dev, ino) & mask; vc->slot[j].ino; j = (j + 1) & mask)
+		if(vc->slot[j].dev == dev && vc->slot[j].ino == ino)
+			break;
+
+	return &vc->slot[j];
+}
+
+
+// Returns 1 if the file has been seen as it is now
+static int
+verdict_lookup(struct verdict_cache *vc, const struct stat *st)
+{
+	struct verdict *v;
+
+	if(vc->used == 0)
+		return 0;
+
+	v = verdict_slot(vc, st->st_dev, st->st_ino);
+	return v->ino && v->ctime.tv_sec == st->st_ctim.tv_sec &&
+		v->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+
+static void
+verdict_store(struct verdict_cache *vc, const struct stat *st)
+{
+	struct verdict *v;
+	size_t i;
+
+	if(2 * (vc->used + 1) > vc->size)
+	{
+		struct verdict_cache bigger;
+
+		bigger.size = vc->size ? 2 * vc->size : 4096;
+		bigger.used = 0;
+		if((bigger.slot = calloc(bigger.size, sizeof(*bigger.slot))) == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		for(i = 0; i < vc->size; i++)
+			if(vc->slot[i].ino)
+			{
+				v = verdict_slot(&bigger, vc->slot[i].dev, vc->slot[i].ino);
+				*v = vc->slot[i];
+				bigger.used++;
+			}
+
+		free(vc->slot);
+		*vc = bigger;
+	}
+
+	v = verdict_slot(vc, st->st_dev, st->st_ino);
+	if(!v->ino)
+		vc->used++;
+	v->dev = st->st_dev;
+	v->ino = st->st_ino;
+	v->ctime = st->st_ctim;
+}
+
+
+struct agent
+{
+	int fan;
+	struct pax_policy *policy;
+	struct verdict_cache cache;
+	const struct paxctl_opts *opts;
+	int verbose;
+	unsigned long nexec, nhits, nmarked, nfailed;
+};
+
+
+/*
+ * First sight of this file, or it has changed since.  fd is the one
+ * fanotify opened for us, read-only; process_file() reopens it through
+ * /proc so that PT_PAX can be written too.
+ */
+static void
+agent_check(struct agent *a, int fd, struct stat *st)
+{
+	struct pax_work w;
+	char proc[64], path[PATH_MAX];
+	ssize_t n;
+	uint16_t pax_flags;
+
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	if((n = readlink(proc, path, sizeof(path) - 1)) < 0)
+		return;
+	path[n] = '\0';
+
+	if(policy_match(a->policy, path, fd, &pax_flags) == POLICY_MATCH && pax_flags != 0)
+	{
+		memset(&w, 0, sizeof(struct pax_work));
+		w.path = proc;
+		w.fd = -1;
+		w.pax_flags = pax_flags;
+		w.ret = process_file(&w, a->opts);
+
+		if(w.ret != EXIT_SUCCESS || w.errnum)
+			a->nfailed++;
+		else if(w.written)
+			a->nmarked++;
+
+		if(a->verbose)
+			printf("%s: %s\n", path, w.ret != EXIT_SUCCESS || w.errnum ? "failed" :
+				w.written ? "marked" : "up to date");
+
+		// Remember it as it is after our own write
+		if(fstat(fd, st) < 0)
+			return;
+	}
+
+	verdict_store(&a->cache, st);
+}
+
+
+static void
+agent_event(struct agent *a, const struct fanotify_event_metadata *m)
+{
+	struct fanotify_response resp;
+	struct stat st;
+
+	if(m->fd < 0)
+		return;
+
+	if(m->mask & FAN_OPEN_EXEC_PERM)
+	{
+		a->nexec++;
+		if(fstat(m->fd, &st) == 0 && S_ISREG(st.st_mode))
+		{
+			if(verdict_lookup(&a->cache, &st))
+				a->nhits++;
+			else
+				agent_check(a, m->fd, &st);
+		}
+
+		resp.fd = m->fd;
+		resp.response = FAN_ALLOW;
+		if(write(a->fan, &resp, sizeof(resp)) != sizeof(resp))
+			warn("fanotify response");
+	}
+
+	close(m->fd);
+}
+
+
+int
+run_agent(char **mounts, int nmounts, const struct paxctl_opts *opts)
+{
+	struct agent a;
+	struct paxctl_opts aopts;
+	struct sigaction sa;
+	char buf[8192] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+	const struct fanotify_event_metadata *m;
+	char *root = "/";
+	ssize_t n;
+	int i;
+
+	memset(&a, 0, sizeof(a));
+
+	// Marking is done quietly, the agent says what it did itself
+	aopts = *opts;
+	aopts.verbose = 0;
+	aopts.tree = 0;
+	a.opts = &aopts;
+	a.verbose = opts->verbose;
+	if(opts->agent_file)
+		a.policy = policy_load_manifest(opts->agent_file, opts->batch_delim);
+	else
+		a.policy = opts->policy;
+
+	if((a.fan = fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE | O_CLOEXEC)) < 0)
+		err(EXIT_FAILURE, "fanotify_init()");
+
+	if(nmounts == 0)
+	{
+		mounts = &root;
+		nmounts = 1;
+	}
+
+	for(i = 0; i < nmounts; i++)
+		if(fanotify_mark(a.fan, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN_EXEC_PERM, AT_FDCWD, mounts[i]) < 0)
+			err(EXIT_FAILURE, "%s", mounts[i]);
+
+	// No SA_RESTART, so a signal gets us out of read()
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = agent_stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if(opts->verbose)
+		printf("exec agent: watching %d mount(s)\n", nmounts);
+	fflush(stdout);
+
+	while(!agent_stop)
+	{
+		if((n = read(a.fan, buf, sizeof(buf))) < 0)
+		{
+			if(errno != EINTR && errno != EAGAIN)
+				err(EXIT_FAILURE, "fanotify read");
+			continue;
+		}
+
+		for(m = (struct fanotify_event_metadata *)buf; FAN_EVENT_OK(m, n); m = FAN_EVENT_NEXT(m, n))
+		{
+			if(m->vers != FANOTIFY_METADATA_VERSION)
+				errx(EXIT_FAILURE, "fanotify: unexpected metadata version %d", m->vers);
+			agent_event(&a, m);
+		}
+
+		if(opts->verbose)
+			fflush(stdout);
+	}
+
+	// Anything still held is let through once the group goes away
+	close(a.fan);
+
+	if(opts->verbose)
+		printf("exec agent: %lu execs, %lu cached, %lu marked, %lu failed\n",
+			a.nexec, a.nhits, a.nmarked, a.nfailed);
+
+	if(opts->agent_file)
+		policy_free(a.policy);
+	free(a.cache.slot);
+
+	return EXIT_SUCCESS;
+}
+
+#else
+
+int
+run_agent(char **mounts, int nmounts, const struct paxctl_opts *opts)
+{
+	errx(EXIT_FAILURE, "option --exec-agent is not supported by this build");
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*
+	batch.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * Read a manifest of FLAGS<TAB>PATH records, one per line or NUL
+ * terminated if delim is '\0', from file or from stdin for "-".  FLAGS
+ * uses the same letters as the command line, eg. "PeMRs" or "-e-R-".
+ * If bare is set the records are just PATH, for --policy to decide on,
+ * and fn is given no flags.  Each good record is handed to fn, each bad
+ * one is warned about and counted in *nbad.  Returns EXIT_FAILURE on a
+ * read error part way.
+ */
+int
+read_manifest(const char *file, int delim, int bare, void (*fn)(char *, uint16_t, void *), void *arg, unsigned long *nbad)
+{
+	FILE *f;
+	char *line = NULL, *tab;
+	size_t len = 0;
+	ssize_t n;
+	unsigned long lineno = 0;
+	uint16_t pax_flags;
+	int ret = EXIT_SUCCESS;
+
+	if(!strcmp(file, "-"))
+		f = stdin;
+	else if((f = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	while((n = getdelim(&line, &len, delim, f)) != -1)
+	{
+		lineno++;
+
+		if(n > 0 && line[n-1] == delim)
+			line[--n] = '\0';
+
+		// Allow blank lines and comments in newline separated manifests
+		if(n == 0 || (delim == '\n' && line[0] == '#'))
+			continue;
+
+		if(bare)
+		{
+			fn(line, 0, arg);
+			continue;
+		}
+
+		if((tab = strchr(line, '\t')) == NULL || tab[1] == '\0')
+		{
+			warnx("%s:%lu: expected FLAGS<TAB>PATH", file, lineno);
+			(*nbad)++;
+			continue;
+		}
+
+		*tab = '\0';
+		if(elfix_parse_flags(line, &pax_flags) < 0)
+		{
+			warnx("%s:%lu: invalid flags '%s'", file, lineno, line);
+			(*nbad)++;
+			continue;
+		}
+
+		fn(tab + 1, pax_flags, arg);
+	}
+
+	if(ferror(f))
+	{
+		warn("%s", file);
+		ret = EXIT_FAILURE;
+	}
+
+	free(line);
+	if(f != stdin)
+		fclose(f);
+
+	return ret;
+}
+
+
+struct batch_sink
+{
+	struct pax_pool *pool;
+	struct pax_client *client;
+	const struct pax_policy *policy;
+	int registry;
+	unsigned long nunmatched;
+};
+
+static void
+batch_one(char *path, uint16_t pax_flags, void *arg)
+{
+	struct batch_sink *sink = arg;
+	struct pax_work *w;
+
+	if((w = calloc(1, sizeof(struct pax_work))) == NULL || (w->path = strdup(path)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	w->pax_flags = pax_flags;
+	w->fd = -1;
+
+	// The registry is asked first, and that needs the file open
+	if(sink->registry && sink->policy)
+		w->need_policy = 1;
+	else if(sink->policy && !policy_classify(sink->policy, w))
+	{
+		sink->nunmatched++;
+		free(w->path);
+		free(w);
+		return;
+	}
+
+	if(sink->client)
+		client_submit(sink->client, w);
+	else
+		pool_submit(sink->pool, w);
+}
+
+
+/*
+ * Apply a manifest so that many different flag sets can be applied by
+ * one process.  Files are handed to the worker pool, each failure is
+ * reported with its own result code and a summary follows at the end.
+ * With --policy the manifest only lists paths and the policy decides,
+ * and so it does with --reconcile, which takes no flags.
+ */
+int
+run_batch(const struct paxctl_opts *opts)
+{
+	struct batch_sink sink;
+	struct pool_totals totals;
+	unsigned long nbad = 0;
+	int ret = EXIT_SUCCESS;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.policy = opts->policy;
+	sink.registry = opts->registry != NULL;
+	if(opts->connect == NULL || (sink.client = client_open(opts, 1)) == NULL)
+		sink.pool = pool_create(opts, 1);
+
+	ret |= read_manifest(opts->batch, opts->batch_delim, opts->policy != NULL || opts->reconcile, batch_one, &sink, &nbad);
+
+	if(sink.client)
+		ret |= client_finish(sink.client, &totals);
+	else
+		ret |= pool_finish(sink.pool, &totals);
+
+	if(nbad)
+		ret |= EXIT_FAILURE;
+
+	printf("%lu files, %lu ok, %lu failed, %lu bad records\n",
+		totals.nfiles, totals.nfiles - totals.nfailed, totals.nfailed, nbad);
+	if(opts->policy)
+		printf("%lu left alone by the policy\n", sink.nunmatched + totals.nunmatched);
+	print_totals(&totals);
+
+	return ret;
+}
@@ -0,0 +1,300 @@
+/*
+	client.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --connect: send the files to a paxctl-ng --server rather than doing
+ * the work here.  This has the same shape as the worker pool, so the
+ * single file and -B paths just pick one or the other.  Replies can
+ * come back in any order, so they are kept until the end and printed in
+ * the order the files were given.
+ */
+struct client_item
+{
+	char *path;
+	int changing;		/* set or copy, as for struct pax_work */
+	unsigned long id;	/* of the request, 0 if it could not be sent */
+	struct elfix_reply reply;
+};
+
+struct pax_client
+{
+	elfix_client_t *c;
+	const struct paxctl_opts *opts;
+	const char *op, *arg;
+	int report;
+
+	struct client_item *items;
+	unsigned long nitems, size, nsent;
+
+	char *cwd;
+	struct timespec start;
+};
+
+
+/*
+ * Spell out every bit, so that both halves of a pair as set by -z
+ * survive the trip, unlike with elfix_bin2string().
+ */
+static void
+flags2arg(uint16_t flags, char *buf)
+{
+	static const struct { uint16_t bit; char c; } letters[] = {
+		{ PF_PAGEEXEC, 'P' }, { PF_NOPAGEEXEC, 'p' },
+		{ PF_EMUTRAMP, 'E' }, { PF_NOEMUTRAMP, 'e' },
+		{ PF_MPROTECT, 'M' }, { PF_NOMPROTECT, 'm' },
+		{ PF_RANDMMAP, 'R' }, { PF_NORANDMMAP, 'r' },
+		{ PF_SEGMEXEC, 'S' }, { PF_NOSEGMEXEC, 's' }
+	};
+	size_t i;
+
+	for(i = 0; i < sizeof(letters) / sizeof(letters[0]); i++)
+		if(flags & letters[i].bit)
+			*buf++ = letters[i].c;
+	*buf = '\0';
+}
+
+
+static const char *
+set_op(int limit)
+{
+	if(limit == LIMIT_TO_PT_FLAGS)
+		return "set-pt";
+	if(limit == LIMIT_TO_XT_FLAGS)
+		return "set-xt";
+	return "set";
+}
+
+
+/*
+ * Connect to opts->connect.  If the socket only came from the
+ * environment and there is no server on it, return NULL and the caller
+ * does the work itself.  If report is set, as for the pool, each file
+ * which fails gets a line on stdout.
+ */
+struct pax_client *
+client_open(const struct paxctl_opts *opts, int report)
+{
+	struct pax_client *pc;
+
+	if((pc = calloc(1, sizeof(struct pax_client))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	if((pc->c = elfix_client_open(opts->connect)) == NULL)
+	{
+		if(!opts->connect_env)
+			err(EXIT_FAILURE, "%s", opts->connect);
+		free(pc);
+		return NULL;
+	}
+
+	// The server runs somewhere else, so relative paths need our cwd
+	if((pc->cwd = getcwd(NULL, 0)) == NULL)
+		err(EXIT_FAILURE, "getcwd()");
+
+	pc->opts = opts;
+	pc->report = report;
+	clock_gettime(CLOCK_MONOTONIC, &pc->start);
+
+	// Only the flags differ from file to file, and only with -B
+	pc->op = "get";
+	pc->arg = "";
+	switch(opts->cp_flags)
+	{
+#ifdef XTPAX
+		case CREATE_XT_FLAGS_SECURE:
+			pc->op = "create";
+			pc->arg = "secure";
+			break;
+		case CREATE_XT_FLAGS_DEFAULT:
+			pc->op = "create";
+			pc->arg = "default";
+			break;
+		case DELETE_XT_FLAGS:
+			pc->op = "delete";
+			break;
+#endif
+#if defined(PTPAX) && defined(XTPAX)
+		case COPY_PT_TO_XT_FLAGS:
+			pc->op = "copy";
+			pc->arg = "pt2xt";
+			break;
+		case COPY_XT_TO_PT_FLAGS:
+			pc->op = "copy";
+			pc->arg = "xt2pt";
+			break;
+#endif
+	}
+
+	return pc;
+}
+
+
+void
+client_submit(struct pax_client *pc, struct pax_work *w)
+{
+	struct client_item *item;
+	const char *op = pc->op, *arg = pc->arg;
+	char sflags[16], *path;
+	unsigned long id;
+
+	if(w->pax_flags != 0)
+	{
+		op = set_op(pc->opts->limit);
+		flags2arg(w->pax_flags, sflags);
+		arg = sflags;
+	}
+
+	if(w->path[0] == '/')
+		path = w->path;
+	else if(asprintf(&path, "%s/%s", pc->cwd, w->path) < 0)
+		err(EXIT_FAILURE, "asprintf()");
+
+	// A tab or newline in the path cannot go in a request, so that file fails
+	if((id = elfix_client_send(pc->c, op, arg, path, -1)) == 0 && errno != EINVAL)
+		err(EXIT_FAILURE, "%s", pc->opts->connect);
+
+	if(path != w->path)
+		free(path);
+
+	if(pc->nitems == pc->size)
+	{
+		pc->size = pc->size ? pc->size * 2 : 64;
+		if((pc->items = realloc(pc->items, pc->size * sizeof(struct client_item))) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	}
+
+	// Hold on to w->path for printing, the rest goes now
+	item = &pc->items[pc->nitems++];
+	item->path = w->path;
+	item->changing = w->pax_flags != 0 || !strcmp(op, "copy");
+	item->id = id;
+	memset(&item->reply, 0, sizeof(struct elfix_reply));
+	if(id == 0)
+		item->reply.error = EINVAL;
+	else
+		pc->nsent++;
+	free(w);
+}
+
+
+static void
+print_reply(const char *path, const struct elfix_reply *r, int verbose)
+{
+	if(!verbose)
+		return;
+
+	printf("%s:\n", path);
+	if(r->error)
+		printf("\t%s\n", strerror(r->error));
+	else
+	{
+#ifdef PTPAX
+		printf("\tPT_PAX    : %s\n", r->pt_flags[0] ? r->pt_flags : "not found");
+#endif
+#ifdef XTPAX
+		printf("\tXATTR_PAX : %s\n", r->xt_flags[0] ? r->xt_flags : "not found");
+#endif
+	}
+	printf("\n");
+}
+
+
+int
+client_finish(struct pax_client *pc, struct pool_totals *totals)
+{
+	struct elfix_reply r;
+	struct timespec now;
+	unsigned long i, *sent;
+	int n, ret = EXIT_SUCCESS;
+
+	if(elfix_client_done(pc->c) < 0)
+		err(EXIT_FAILURE, "%s", pc->opts->connect);
+
+	// Requests are numbered from 1 as sent, which skips the ones we could not send
+	if((sent = calloc(pc->nsent + 1, sizeof(unsigned long))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	for(i = 0; i < pc->nitems; i++)
+		if(pc->items[i].id)
+			sent[pc->items[i].id - 1] = i;
+
+	while((n = elfix_client_recv(pc->c, &r)) > 0)
+		if(r.id >= 1 && r.id <= pc->nsent)
+			pc->items[sent[r.id - 1]].reply = r;
+
+	if(n < 0)
+		err(EXIT_FAILURE, "%s", pc->opts->connect);
+	free(sent);
+
+	memset(totals, 0, sizeof(struct pool_totals));
+
+	for(i = 0; i < pc->nitems; i++)
+	{
+		struct client_item *item = &pc->items[i];
+
+		// No reply at all, the server must have gone away
+		if(item->id && item->reply.id == 0)
+			item->reply.error = EPIPE;
+
+		print_reply(item->path, &item->reply, pc->opts->verbose);
+
+		totals->nfiles++;
+		if(item->reply.error)
+		{
+			totals->nfailed++;
+			n = item->reply.error == ENOENT ? ENOENT : EXIT_FAILURE;
+			// Never sent, so say why
+			if(pc->report)
+				printf("FAILED\t%d\t%s\n", item->id ? n : EINVAL, item->path);
+			ret |= n;
+		}
+		else
+		{
+			totals->nelf++;
+			if(item->reply.written)
+				totals->nwritten++;
+			else if(item->changing)
+				totals->nunchanged++;
+		}
+
+		free(item->path);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	totals->secs = (now.tv_sec - pc->start.tv_sec) +
+		(now.tv_nsec - pc->start.tv_nsec) / 1e9;
+
+	elfix_client_close(pc->c);
+	free(pc->items);
+	free(pc->cwd);
+	free(pc);
+
+	return ret;
+}
@@ -0,0 +1,324 @@
+/*
+	live.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --live: compare the PaX flags each running process got from the kernel,
+ * the "PaX:" line of /proc/PID/status, with the marks on the binary it
+ * is running.  The binary is opened through /proc/PID/exe, so it is the
+ * inode which was executed even if the path has since been replaced, and
+ * it is read once however many processes run it: the marks are kept in a
+ * map keyed by (st_dev, st_ino), and every other pid costs a stat() and
+ * a read of its status.
+ *
+ * The kernel takes XATTR_PAX over PT_PAX, so that is what we compare with
+ * when both are there.  Flags left to the default on disk ('-') are not
+ * compared, nor is SEGMEXEC outside i386, where it does not exist and is
+ * always shown as 's'.  On i386 SEGMEXEC wins over PAGEEXEC if both are
+ * asked for, so PAGEEXEC is not compared then.
+ */
+#define LIVE_UNREAD		0
+#define LIVE_READ		1
+#define LIVE_FAILED		2
+
+struct live_bin
+{
+	dev_t dev;
+	ino_t ino;
+	int state;
+	uint16_t pt_flags, xt_flags;
+};
+
+struct live_map
+{
+	struct live_bin *slot;
+	size_t size, used;
+};
+
+struct live_counts
+{
+	unsigned long nprocs, nbins, ndiffer, nsame, nunmarked, nnopax, nunreadable;
+};
+
+
+// The slot for (dev, ino), a new LIVE_UNREAD one if it is not there yet
+static struct live_bin *
+live_lookup(struct live_map *m, dev_t dev, ino_t ino)
+{
+	struct live_bin *b;
+	size_t i, j, mask;
+
+	if(2 * (m->used + 1) > m->size)
+	{
+		struct live_map bigger;
+
+		bigger.size = m->size ? 2 * m->size : 1024;
+		bigger.used = m->used;
+		if((bigger.slot = calloc(bigger.size, sizeof(struct live_bin))) == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		for(i = 0; i < m->size; i++)
+			if(m->slot[i].ino)
+			{
+				for(j = inode_hash(m->slot[i].dev, m->slot[i].ino) & (bigger.size - 1);
+						bigger.slot[j].ino; j = (j + 1) & (bigger.size - 1))
+					;
+				bigger.slot[j] = m->slot[i];
+			}
+
+		free(m->slot);
+		*m = bigger;
+	}
+
+	mask = m->size - 1;
+	for(j = inode_hash(dev, ino) & mask; m->slot[j].ino; j = (j + 1) & mask)
+		if(m->slot[j].dev == dev && m->slot[j].ino == ino)
+			return &m->slot[j];
+
+	b = &m->slot[j];
+	b->dev = dev;
+	b->ino = ino;
+	b->state = LIVE_UNREAD;
+	m->used++;
+	return b;
+}
+
+
+// Copies the five flags of the "PaX:" line of PID/status into running
+static int
+read_pax_line(int procfd, const char *pid, char *running)
+{
+	char path[NAME_MAX + 16], buf[16384], *p;
+	ssize_t n;
+	size_t len = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/status", pid);
+	if((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+
+	// The status of a process with a big Cpus_allowed can pass a page
+	while(len < sizeof(buf) - 1 && (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += n;
+	close(fd);
+	buf[len] = '\0';
+
+	if(!strncmp(buf, "PaX:", 4))
+		p = buf;
+	else if((p = strstr(buf, "\nPaX:")) != NULL)
+		p++;
+	else
+		return -1;
+
+	for(p += 4; *p == ' ' || *p == '\t'; p++)
+		;
+	if(strspn(p, "PpEeMmRrSs") < ELFIX_FLAGS_SIZE - 1)
+		return -1;
+
+	memcpy(running, p, ELFIX_FLAGS_SIZE - 1);
+	running[ELFIX_FLAGS_SIZE - 1] = '\0';
+	return 0;
+}
+
+
+static void
+read_bin(struct live_bin *b, int procfd, const char *pid)
+{
+	char path[NAME_MAX + 16];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/exe", pid);
+	if((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		STAT_INC(STAT_OPEN_FAILED);
+		b->state = LIVE_FAILED;
+		return;
+	}
+	STAT_INC(STAT_OPEN_RDONLY);
+
+	b->pt_flags = b->xt_flags = UINT16_MAX;
+#ifdef PTPAX
+	b->pt_flags = get_pt_flags(fd, 0);
+#endif
+#ifdef XTPAX
+	b->xt_flags = get_xt_flags(fd);
+#endif
+	close(fd);
+
+	b->state = LIVE_READ;
+}
+
+
+static int
+flags_differ(const char *running, const char *disk)
+{
+	int i;
+
+	for(i = 0; i < ELFIX_FLAGS_SIZE - 1; i++)
+	{
+		if(disk[i] == '-')
+			continue;
+#ifdef __i386__
+		if(i == 0 && disk[4] == 'S')
+			continue;
+#else
+		if(i == 4)
+			continue;
+#endif
+		if(running[i] != disk[i])
+			return 1;
+	}
+
+	return 0;
+}
+
+
+static void
+report(int procfd, const char *what, const char *pid, const char *running, const char *disk, const char *field)
+{
+	char path[NAME_MAX + 16], exe[PATH_MAX];
+	ssize_t n;
+
+	snprintf(path, sizeof(path), "%s/exe", pid);
+	if((n = readlinkat(procfd, path, exe, sizeof(exe) - 1)) < 0)
+		n = 0;
+	exe[n] = '\0';
+
+	printf("%s\t%s\t%s\t%s\t%s\t%s\n", what, pid, running, disk, field, exe);
+}
+
+
+int
+run_live(const struct paxctl_opts *opts)
+{
+	const char *proc = opts->live_proc ? opts->live_proc : "/proc";
+	struct live_map map;
+	struct live_counts lc;
+	struct live_bin *b;
+	struct dirent *de;
+	struct stat st;
+	char path[NAME_MAX + 16], running[ELFIX_FLAGS_SIZE], disk[ELFIX_FLAGS_SIZE];
+	const char *field;
+	uint16_t flags;
+	DIR *dir;
+	int procfd;
+
+	if((dir = opendir(proc)) == NULL)
+		err(EXIT_FAILURE, "%s", proc);
+	procfd = dirfd(dir);
+
+	memset(&map, 0, sizeof(map));
+	memset(&lc, 0, sizeof(lc));
+
+	while((de = readdir(dir)) != NULL)
+	{
+		if(!isdigit((unsigned char)de->d_name[0]) || strspn(de->d_name, "0123456789") != strlen(de->d_name))
+			continue;
+
+		// Kernel threads have no exe, and the process may be gone already
+		snprintf(path, sizeof(path), "%s/exe", de->d_name);
+		if(fstatat(procfd, path, &st, 0) < 0)
+		{
+			if(errno == EACCES || errno == EPERM)
+			{
+				lc.nprocs++;
+				lc.nunreadable++;
+			}
+			continue;
+		}
+		lc.nprocs++;
+
+		if(read_pax_line(procfd, de->d_name, running) < 0)
+		{
+			lc.nnopax++;
+			continue;
+		}
+
+		b = live_lookup(&map, st.st_dev, st.st_ino);
+		if(b->state == LIVE_UNREAD)
+		{
+			read_bin(b, procfd, de->d_name);
+			lc.nbins++;
+		}
+		if(b->state == LIVE_FAILED)
+		{
+			lc.nunreadable++;
+			continue;
+		}
+
+		if(b->xt_flags != UINT16_MAX)
+		{
+			flags = b->xt_flags;
+			field = "XATTR_PAX";
+		}
+		else
+		{
+			flags = b->pt_flags;
+			field = "PT_PAX";
+		}
+
+		if(flags == UINT16_MAX)
+		{
+			lc.nunmarked++;
+			if(opts->verbose)
+				report(procfd, "unmarked", de->d_name, running, "-----", "none");
+			continue;
+		}
+
+		elfix_bin2string4print(flags, disk);
+		if(flags_differ(running, disk))
+		{
+			lc.ndiffer++;
+			report(procfd, "differs", de->d_name, running, disk, field);
+		}
+		else
+		{
+			lc.nsame++;
+			if(opts->verbose)
+				report(procfd, "same", de->d_name, running, disk, field);
+		}
+	}
+
+	closedir(dir);
+	free(map.slot);
+
+	if(lc.nnopax && lc.nnopax == lc.nprocs - lc.nunreadable)
+		warnx("no PaX: line in %s/PID/status, this kernel does not report PaX flags", proc);
+
+	printf("%lu processes, %lu binaries read: %lu differ, %lu match, %lu unmarked, %lu without PaX, %lu unreadable\n",
+		lc.nprocs, lc.nbins, lc.ndiffer, lc.nsame, lc.nunmarked, lc.nnopax, lc.nunreadable);
+
+	return lc.ndiffer ? EXIT_FAILURE : EXIT_SUCCESS;
+}
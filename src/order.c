@@ -0,0 +1,193 @@
+/*
+	order.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --order: we only read the head of each file, so on a disk which has
+ * to seek, or an array which has to fetch from cold storage, taking the
+ * files in the order the walk or the manifest gives them is a random
+ * read per file.  Instead the pool holds back the whole run, and before
+ * any file is read puts it in the order of where on the device the head
+ * of each file lies, so the reads become sweeps across the disk.
+ *
+ * With ORDER_EXTENT, the default, that is the physical offset of the
+ * first extent, from FS_IOC_FIEMAP, and where the filesystem cannot say,
+ * or the extent is not yet allocated or is inline, the inode number,
+ * which most filesystems lay out in disk order too.  ORDER_INODE only
+ * uses the inode number, and so costs a stat() a file rather than an
+ * open() and an ioctl().  Files are grouped by device first, then the
+ * ones placed by extent come before those placed by inode, and the ones
+ * we could not look at at all go last.
+ */
+#define KEY_EXTENT	0
+#define KEY_INODE	1
+#define KEY_NONE	2
+
+struct order_key
+{
+	dev_t dev;
+	int kind;
+	uint64_t where;
+	size_t index;		// in the walk, for ties
+	struct pax_work *w;
+};
+
+
+// The physical offset of the extent at offset 0, -1 if there is none we can use
+static int
+first_extent(int fd, uint64_t *physical)
+{
+	union {
+		struct fiemap fm;
+		char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+	} u;
+	struct fiemap_extent *fe = &u.fm.fm_extents[0];
+
+	memset(&u, 0, sizeof(u));
+	u.fm.fm_start = 0;
+	u.fm.fm_length = 1;
+	u.fm.fm_extent_count = 1;
+
+	if(ioctl(fd, FS_IOC_FIEMAP, &u.fm) < 0 || u.fm.fm_mapped_extents < 1)
+		return -1;
+	if(fe->fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE))
+		return -1;
+
+	*physical = fe->fe_physical;
+	return 0;
+}
+
+
+static void
+get_key(struct order_key *k, int how)
+{
+	struct stat st;
+	int fd;
+
+	k->kind = KEY_NONE;
+	k->dev = 0;
+	k->where = 0;
+
+	if(how == ORDER_INODE)
+	{
+		if(stat(k->w->path, &st) == 0)
+		{
+			k->kind = KEY_INODE;
+			k->dev = st.st_dev;
+			k->where = st.st_ino;
+		}
+		return;
+	}
+
+	if((fd = open(k->w->path, O_RDONLY | O_CLOEXEC)) < 0)
+		return;
+
+	if(fstat(fd, &st) == 0)
+	{
+		k->dev = st.st_dev;
+		if(first_extent(fd, &k->where) == 0)
+			k->kind = KEY_EXTENT;
+		else
+		{
+			k->kind = KEY_INODE;
+			k->where = st.st_ino;
+		}
+	}
+
+	close(fd);
+}
+
+
+static int
+key_cmp(const void *a, const void *b)
+{
+	const struct order_key *x = a, *y = b;
+
+	if((x->kind == KEY_NONE) != (y->kind == KEY_NONE))
+		return x->kind == KEY_NONE ? 1 : -1;
+	if(x->kind != KEY_NONE)
+	{
+		if(x->dev != y->dev)
+			return x->dev < y->dev ? -1 : 1;
+		if(x->kind != y->kind)
+			return x->kind - y->kind;
+		if(x->where != y->where)
+			return x->where < y->where ? -1 : 1;
+	}
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+
+/*
+ * Called by pool_finish() with everything submitted, before the workers
+ * see any of it.  Puts w[] in the order to read it in.
+ */
+void
+order_work(struct pax_work **w, size_t n, int how)
+{
+	struct order_key *keys;
+	struct timespec start, end;
+	unsigned long count[3] = { 0, 0, 0 };
+	size_t i;
+
+	if(n == 0)
+		return;
+
+	if((keys = calloc(n, sizeof(struct order_key))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < n; i++)
+	{
+		keys[i].w = w[i];
+		keys[i].index = i;
+		get_key(&keys[i], how);
+		count[keys[i].kind]++;
+	}
+
+	qsort(keys, n, sizeof(struct order_key), key_cmp);
+	for(i = 0; i < n; i++)
+		w[i] = keys[i].w;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	STAT_ADD(STAT_ORDER_EXTENT, count[KEY_EXTENT]);
+	STAT_ADD(STAT_ORDER_INODE, count[KEY_INODE]);
+
+	printf("order: %lu files by first extent, %lu by inode, %lu not looked at, %.3f seconds\n",
+		count[KEY_EXTENT], count[KEY_INODE], count[KEY_NONE],
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	free(keys);
+}
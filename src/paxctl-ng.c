@@ -22,55 +22,18 @@
 #include <string.h>
 #include <err.h>
 #include <libgen.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 
-#ifdef PTPAX
- #include <gelf.h>
-#endif
-
-#ifdef NEED_PAX_DECLS
- #define PT_PAX_FLAGS    0x65041580      /* Indicates PaX flag markings */
- #define PF_PAGEEXEC     (1 << 4)        /* Enable  PAGEEXEC */
- #define PF_NOPAGEEXEC   (1 << 5)        /* Disable PAGEEXEC */
- #define PF_SEGMEXEC     (1 << 6)        /* Enable  SEGMEXEC */
- #define PF_NOSEGMEXEC   (1 << 7)        /* Disable SEGMEXEC */
- #define PF_MPROTECT     (1 << 8)        /* Enable  MPROTECT */
- #define PF_NOMPROTECT   (1 << 9)        /* Disable MPROTECT */
- #define PF_RANDEXEC     (1 << 10)       /* DEPRECATED: Enable  RANDEXEC */
- #define PF_NORANDEXEC   (1 << 11)       /* DEPRECATED: Disable RANDEXEC */
- #define PF_EMUTRAMP     (1 << 12)       /* Enable  EMUTRAMP */
- #define PF_NOEMUTRAMP   (1 << 13)       /* Disable EMUTRAMP */
- #define PF_RANDMMAP     (1 << 14)       /* Enable  RANDMMAP */
- #define PF_NORANDMMAP   (1 << 15)       /* Disable RANDMMAP */
-#endif
-
-#ifdef XTPAX
- #include <sys/xattr.h>
- #ifndef ENOATTR
-  #define ENOATTR ENODATA
- #endif
- #define PAX_NAMESPACE	"user.pax.flags"
- #define CREATE_XT_FLAGS_SECURE         1
- #define CREATE_XT_FLAGS_DEFAULT        2
- #define DELETE_XT_FLAGS                3
-#endif
-
-#if defined(PTPAX) && defined(XTPAX)
- #define COPY_PT_TO_XT_FLAGS            4
- #define COPY_XT_TO_PT_FLAGS            5
-#endif
-
-#define LIMIT_TO_PT_FLAGS               6
-#define LIMIT_TO_XT_FLAGS               7
-
-#define FLAGS_SIZE                      6
-
 #include <config.h>
 
+#include "paxctl-ng.h"
+#include "probes.h"
+
 void
 print_help_exit(char *v)
 {
@@ -92,6 +55,25 @@ print_help_exit(char *v)
 		"             : %s -F|-f [-v] ELF\n"
 #endif
 		"             : %s -v ELF\n"
+		"             : %s -T [-j N] [OPTIONS] DIR ...\n"
+		"             : %s -B FILE [-0] [-j N] [-L|-l] [-v]\n"
+		"             : %s --server=SOCKET [-j N] [-v]\n"
+		"             : %s --policy=FILE [-T [-j N]] [-L|-l] [-v] ELF|DIR ...\n"
+		"             : %s --policy=FILE -B FILE [-0] [-j N] [-L|-l] [-v]\n"
+		"             : %s --registry=FILE [FLAGS|--policy=FILE] [-T|-B FILE] [-j N] [-L|-l] [-v] [ELF|DIR ...]\n"
+		"             : %s --plan=FILE -T|-B ...\n"
+		"             : %s --pseudo=FILE [--pseudo-format=FORMAT] -T [-j N] [OPTIONS] DIR ...\n"
+		"             : %s --apply=FILE [-j N] [-v]\n"
+		"             : %s --snapshot=FILE [-T [-j N]] ELF|DIR ...\n"
+		"             : %s --diff OLD NEW\n"
+		"             : %s --restore=FILE [-j N] [-L|-l] [-v]\n"
+#if defined(PTPAX) && defined(XTPAX)
+		"             : %s --reconcile[=pt|xt] [-T|-B FILE] [-j N] [-v] [ELF|DIR ...]\n"
+#endif
+		"             : %s --live[=PROC] [-v]\n"
+		"             : %s --restart=FILE [-0] [-v] [PROC]\n"
+		"             : %s --tar -PpEeMmRrSs|-Z|-z|--policy=FILE [-L|-l] [-v] < IN > OUT\n"
+		"             : %s --exec-agent[=FILE] [--policy=FILE] [-0] [-L|-l] [-v] [MOUNT ...]\n"
 		"             : %s -L|-l\n"
 		"             : %s [-h]\n\n"
 		"Options      : -P enable PAGEEXEC\t-p disable  PAGEEXEC\n"
@@ -123,6 +105,50 @@ print_help_exit(char *v)
 #else
 		"             : -l when given alone, EXIT_FAILURE (XATTR_PAX is not supported)\n"
 #endif
+		"             : -T recurse into the given directories, skipping non-ELF files\n"
+		"             : -B apply the FLAGS<TAB>PATH records in FILE ('-' for stdin)\n"
+		"             : -0 the -B records end in NUL rather than newline\n"
+		"             : -j run N worker threads with -T or -B (default: online CPUs)\n"
+#ifdef IOURING
+		"             : --io-uring[=N] with -T or -B, keep N files in flight with io_uring (default: 64)\n"
+#endif
+		"             : --stats[=FILE] report counters and timings on stderr, or as JSON to FILE\n"
+		"             : --order[=extent|inode] with -T or -B, read the files in the order they lie on the disk,\n"
+		"             :   by their first extent (default) or by inode\n"
+		"             : --throttle[=FILES[,BYTES]] with files, -T or -B, do at most FILES files and BYTES bytes a\n"
+		"             :   second (default: 100,1M), in the idle I/O class, and drop the pages read from the page cache\n"
+		"             : --server=SOCKET serve get/set/create/delete/copy requests on a UNIX socket\n"
+		"             : --connect=SOCKET hand the work to a server (default: $PAXCTL_NG_SOCKET)\n"
+#ifdef FANOTIFY
+		"             : --exec-agent[=FILE] mark files under MOUNT (default: /) on first exec as the -B manifest FILE\n"
+		"             :   or the --policy says\n"
+#endif
+		"             : --policy=FILE take each file's flags from the first rule in FILE which matches it;\n"
+		"             :   with -B, the records are just paths\n"
+		"             : --registry=FILE mark a build FILE knows by its NT_GNU_BUILD_ID as FILE says, without\n"
+		"             :   asking the policy, and record in FILE the flags each new build is set with\n"
+		"             : --plan=FILE with -T or -B, write what would change to FILE and change nothing\n"
+		"             : --apply=FILE carry out a --plan, only looking again at files changed since\n"
+		"             : --pseudo=FILE with -T, write XATTR_PAX to FILE as image builder definitions rather than\n"
+		"             :   to the tree, and only patch PT_PAX in place\n"
+		"             : --pseudo-format=FORMAT squashfs for mksquashfs -pf (default), or getfattr for setfattr --restore\n"
+		"             : --cache=FILE answer -v from FILE for files unchanged since (default: $PAXCTL_NG_CACHE)\n"
+		"             : --snapshot=FILE record the path, inode, ABI, size, header hash and flags of every ELF object in FILE\n"
+		"             : --diff OLD NEW report the flags added, lost or changed between two snapshots\n"
+		"             : --restore=FILE put back the flags of the snapshot FILE on each file still the same build\n"
+#if defined(PTPAX) && defined(XTPAX)
+		"             : --reconcile[=pt|xt] report the files whose PT_PAX and XATTR_PAX a kernel would refuse to\n"
+		"             :   exec, and copy the one named over the other where they disagree\n"
+#endif
+		"             : --tar mark the ELF members of the tar archive on stdin, writing it to stdout\n"
+		"             : --live[=PROC] report running processes whose PaX flags differ from the marks on their binary\n"
+		"             : --restart=FILE list the services and programs using the files the plan or -B manifest FILE\n"
+		"             :   changes, which need restarting to get the new flags\n"
+#ifdef PTPAX
+		"             : --replace-busy set PT_PAX of a running binary on a reflinked copy renamed over it\n"
+#endif
+		"             : --sync=MODE none (default) leaves the writes to the page cache, file flushes each file\n"
+		"             :   written before going on, fs calls syncfs() once per filesystem written at the end\n"
 		"             : -v view the flags, along with any accompanying operation\n"
 		"             : -h print out this help\n\n"
 		"Note         :  If both enabling and disabling flags are set, the default - is used\n\n",
@@ -133,7 +159,24 @@ print_help_exit(char *v)
 #endif
 #if defined(PTPAX) && defined(XTPAX)
 		basename(v),
+		basename(v),
 #endif
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
+		basename(v),
 		basename(v),
 		basename(v),
 		basename(v)
@@ -144,27 +187,58 @@ print_help_exit(char *v)
 
 
 void
-parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *cp_flags,
-	int *limit, int *begin, int *end)
+parse_cmd_args(int argc, char *argv[], struct paxctl_opts *opts, int *begin, int *end)
 {
-	int i, oc;
+	int oc;
 	int setflags, solflags, limitflags, solitaire;
+	struct option long_opts[] = {
+		{ "io-uring", optional_argument, NULL, OPT_IO_URING },
+		{ "stats", optional_argument, NULL, OPT_STATS },
+		{ "server", required_argument, NULL, OPT_SERVER },
+		{ "connect", required_argument, NULL, OPT_CONNECT },
+		{ "exec-agent", optional_argument, NULL, OPT_EXEC_AGENT },
+		{ "policy", required_argument, NULL, OPT_POLICY },
+		{ "plan", required_argument, NULL, OPT_PLAN },
+		{ "apply", required_argument, NULL, OPT_APPLY },
+		{ "cache", required_argument, NULL, OPT_CACHE },
+		{ "snapshot", required_argument, NULL, OPT_SNAPSHOT },
+		{ "diff", no_argument, NULL, OPT_DIFF },
+		{ "tar", no_argument, NULL, OPT_TAR },
+		{ "pseudo", required_argument, NULL, OPT_PSEUDO },
+		{ "pseudo-format", required_argument, NULL, OPT_PSEUDO_FORMAT },
+		{ "sync", required_argument, NULL, OPT_SYNC },
+		{ "live", optional_argument, NULL, OPT_LIVE },
+		{ "restart", required_argument, NULL, OPT_RESTART },
+		{ "replace-busy", no_argument, NULL, OPT_REPLACE_BUSY },
+		{ "registry", required_argument, NULL, OPT_REGISTRY },
+		{ "restore", required_argument, NULL, OPT_RESTORE },
+		{ "reconcile", optional_argument, NULL, OPT_RECONCILE },
+		{ "throttle", optional_argument, NULL, OPT_THROTTLE },
+		{ "order", optional_argument, NULL, OPT_ORDER },
+		{ NULL, 0, NULL, 0 }
+	};
+	uint16_t *pax_flags = &opts->pax_flags;
+	int *verbose = &opts->verbose;
+#ifdef XTPAX
+	int *cp_flags = &opts->cp_flags;
+#endif
+	int *limit = &opts->limit;
+	char *p;
 
 	setflags = 0;
 	solflags = 0;
 	limitflags = 0;
 	solitaire = 0;
 
-	*pax_flags = 0;
-	*verbose = 0;
-	*cp_flags = 0; 
+	memset(opts, 0, sizeof(struct paxctl_opts));
+	opts->batch_delim = '\n';
 
 #if defined(PTPAX) && defined(XTPAX)
-	while((oc = getopt(argc, argv,":PpEeMmRrSsZzCcdFfLlvh")) != -1)
+	while((oc = getopt_long(argc, argv,":PpEeMmRrSsZzCcdFfLlTj:B:0vh", long_opts, NULL)) != -1)
 #elif defined(XTPAX) && !defined(PTPAX)
-	while((oc = getopt(argc, argv,":PpEeMmRrSsZzCcdLlvh")) != -1)
+	while((oc = getopt_long(argc, argv,":PpEeMmRrSsZzCcdLlTj:B:0vh", long_opts, NULL)) != -1)
 #else
-	while((oc = getopt(argc, argv,":PpEeMmRrSsZzLlvh")) != -1)
+	while((oc = getopt_long(argc, argv,":PpEeMmRrSsZzLlTj:B:0vh", long_opts, NULL)) != -1)
 #endif
 	{
 		switch(oc)
@@ -252,21 +326,176 @@ parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *c
 				limitflags += 1;
 				*limit = LIMIT_TO_XT_FLAGS;
 				break;
+			case 'T':
+				opts->tree = 1;
+				break;
+			case 'j':
+				opts->nthreads = strtol(optarg, &p, 10);
+				if(*p != '\0' || opts->nthreads < 1)
+					errx(EXIT_FAILURE, "option -j needs a positive number of threads");
+				break;
+			case 'B':
+				opts->batch = optarg;
+				break;
+			case '0':
+				opts->batch_delim = '\0';
+				break;
 			case 'v':
 				*verbose = 1;
 				break;
+			case OPT_IO_URING:
+#ifdef IOURING
+				opts->uring_depth = 64;
+				if(optarg)
+				{
+					opts->uring_depth = strtol(optarg, &p, 10);
+					if(*p != '\0' || opts->uring_depth < 1 || opts->uring_depth > 4096)
+						errx(EXIT_FAILURE, "option --io-uring needs a depth between 1 and 4096");
+				}
+#else
+				warnx("option --io-uring is not supported by this build: ignored.");
+#endif
+				break;
+			case OPT_STATS:
+				opts->stats = 1;
+				opts->stats_file = optarg;
+				break;
+			case OPT_SERVER:
+				opts->server = optarg;
+				break;
+			case OPT_CONNECT:
+				opts->connect = optarg;
+				break;
+			case OPT_EXEC_AGENT:
+				opts->agent = 1;
+				opts->agent_file = optarg;
+				break;
+			case OPT_POLICY:
+				opts->policy_file = optarg;
+				break;
+			case OPT_PLAN:
+				opts->plan_file = optarg;
+				break;
+			case OPT_APPLY:
+				opts->apply = optarg;
+				break;
+			case OPT_CACHE:
+				opts->cache_file = optarg;
+				break;
+			case OPT_SNAPSHOT:
+				opts->snapshot_file = optarg;
+				break;
+			case OPT_DIFF:
+				opts->diff = 1;
+				break;
+			case OPT_TAR:
+				opts->tar = 1;
+				break;
+			case OPT_PSEUDO:
+				opts->pseudo_file = optarg;
+				break;
+			case OPT_PSEUDO_FORMAT:
+				opts->pseudo_format = optarg;
+				break;
+			case OPT_SYNC:
+				if(!strcmp(optarg, "none"))
+					opts->sync = SYNC_NONE;
+				else if(!strcmp(optarg, "file"))
+					opts->sync = SYNC_FILE;
+				else if(!strcmp(optarg, "fs"))
+					opts->sync = SYNC_FS;
+				else
+					errx(EXIT_FAILURE, "option --sync needs none, file or fs");
+				break;
+			case OPT_LIVE:
+				opts->live = 1;
+				opts->live_proc = optarg;
+				break;
+			case OPT_RESTART:
+				opts->restart_file = optarg;
+				break;
+			case OPT_REPLACE_BUSY:
+#ifdef PTPAX
+				opts->replace_busy = 1;
+#else
+				warnx("option --replace-busy is not supported by this build: ignored.");
+#endif
+				break;
+			case OPT_REGISTRY:
+				opts->registry_file = optarg;
+				break;
+			case OPT_RESTORE:
+				opts->restore_file = optarg;
+				break;
+			case OPT_RECONCILE:
+#if defined(PTPAX) && defined(XTPAX)
+				opts->reconcile = 1;
+				opts->reconcile_source = optarg;
+#else
+				errx(EXIT_FAILURE, "option --reconcile needs both PT_PAX and XATTR_PAX support");
+#endif
+				break;
+			case OPT_THROTTLE:
+				opts->throttle = 1;
+				opts->throttle_rate = optarg;
+				break;
+			case OPT_ORDER:
+				if(optarg == NULL || !strcmp(optarg, "extent"))
+					opts->order = ORDER_EXTENT;
+				else if(!strcmp(optarg, "inode"))
+					opts->order = ORDER_INODE;
+				else
+					errx(EXIT_FAILURE, "option --order takes extent or inode");
+				break;
 			case 'h':
 				print_help_exit(argv[0]);
 				break;
+			case ':':
+				errx(EXIT_FAILURE, "option -%c needs an argument", optopt ) ;
 			case '?':
 			default:
 				errx(EXIT_FAILURE, "option -%c is invalid: ignored.", optopt ) ;
 		}
 	}
 
+	// A server or an agent runs until it is stopped, so it has no end to sync at
+	if(opts->sync == SYNC_FS && (opts->server != NULL || opts->agent))
+		errx(EXIT_FAILURE, "option --sync=fs needs a run which ends, use --sync=file");
+
+	// The registry is read at the start of a run over files on disk and written at its end
+	if(opts->registry_file != NULL && (opts->server != NULL || opts->agent || opts->apply != NULL || opts->diff
+			|| opts->tar || opts->live || opts->restart_file != NULL || opts->restore_file != NULL || solitaire))
+		errx(EXIT_FAILURE, "option --registry needs flags, a --policy or -v, on files, -T or -B");
+
+	// It looks at the marks already there and takes no flags of its own
+	if(opts->reconcile && (setflags || solflags || limitflags || solitaire || opts->policy_file != NULL
+			|| opts->plan_file != NULL || opts->pseudo_file != NULL || opts->registry_file != NULL
+			|| opts->snapshot_file != NULL || opts->replace_busy || opts->server != NULL || opts->agent
+			|| opts->apply != NULL || opts->diff || opts->tar || opts->live || opts->restart_file != NULL
+			|| opts->restore_file != NULL))
+		errx(EXIT_FAILURE, "option --reconcile takes no flags, and works on files, -T or -B");
+
+	// Only the scans which open each file themselves are paced
+	if(opts->throttle && (opts->server != NULL || opts->agent || opts->apply != NULL || opts->diff || opts->tar
+			|| opts->live || opts->restart_file != NULL || opts->restore_file != NULL))
+		errx(EXIT_FAILURE, "option --throttle works on files, -T or -B");
+
+	// Only a walk or a manifest is known in full before the first file is read
+	if(opts->order && (!opts->tree && opts->batch == NULL))
+		errx(EXIT_FAILURE, "option --order needs -T or -B");
+
+	// The prefetch would read ahead of the pace
+	if(opts->throttle)
+		opts->uring_depth = 0;
+
+	// One worker keeps to the pace as well as any, and takes one core at most
+	if(opts->throttle && opts->nthreads == 0)
+		opts->nthreads = 1;
+
 	if(
 		  (setflags == 0 && solflags == 0 && limitflags == 1 && solitaire == 0)
-		&& *verbose == 0
+		&& *verbose == 0 && opts->batch == NULL && !opts->agent && opts->policy_file == NULL
+		&& opts->apply == NULL
 		&& argv[optind] == NULL								// -L|-l
 	)
 	{
@@ -285,216 +514,307 @@ parse_cmd_args(int argc, char *argv[], uint16_t *pax_flags, int *verbose, int *c
 	}
 
 	if(
-		(
-		    (setflags == 1 && solflags == 0 && limitflags <= 1 && solitaire == 0)		//-PpEeMmRrSs [-L|-l] [-v] ELF
-		 || (setflags == 0 && solflags == 1 && limitflags <= 1 && solitaire == 0)		//-Z|-z [-L|-l] [-v] ELF
-		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 1)		//-C|-c|-d|-F|-f [-v] ELF
-		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0 && *verbose == 1) // -v ELF
-		)
-		&& argv[optind] != NULL
+		   opts->diff
+		&& (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& !opts->agent && opts->policy_file == NULL && opts->plan_file == NULL
+		&& opts->apply == NULL && opts->snapshot_file == NULL
+		&& argc - optind == 2								// --diff OLD NEW
 	)
 	{
 		*begin = optind;
 		*end = argc;
+		return;
 	}
-	else
-		print_help_exit(argv[0]);
-}
 
+	if(
+		   opts->live
+		&& (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& !opts->agent && opts->policy_file == NULL && opts->plan_file == NULL
+		&& opts->apply == NULL && opts->snapshot_file == NULL && !opts->diff && !opts->tar
+		&& opts->pseudo_file == NULL && opts->sync == SYNC_NONE
+		&& argv[optind] == NULL								// --live[=PROC] [-v]
+	)
+	{
+		*begin = *end = optind;
+		return;
+	}
 
-#ifdef PTPAX
-uint16_t
-get_pt_flags(int fd, int verbose)
-{
-	Elf *elf;
-	GElf_Phdr phdr;
-	size_t i, phnum;
-
-	uint16_t pt_flags = UINT16_MAX;
-
-	if(elf_version(EV_CURRENT) == EV_NONE)
+	if(
+		   opts->restart_file != NULL
+		&& (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& !opts->agent && opts->policy_file == NULL && opts->plan_file == NULL
+		&& opts->apply == NULL && opts->snapshot_file == NULL && !opts->diff && !opts->tar
+		&& opts->pseudo_file == NULL && opts->sync == SYNC_NONE && !opts->live
+		&& argc - optind <= 1								// --restart=FILE [-0] [-v] [PROC]
+	)
 	{
-		if(verbose)
-			printf("\tELF ERROR: Library out of date.\n");
-		return pt_flags;
+		*begin = optind;
+		*end = argc;
+		return;
 	}
 
-	if((elf = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
+	if(
+		   opts->restore_file != NULL
+		&& (setflags == 0 && solflags == 0 && limitflags <= 1 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& !opts->agent && opts->policy_file == NULL && opts->plan_file == NULL
+		&& opts->apply == NULL && opts->snapshot_file == NULL && !opts->diff && !opts->tar
+		&& opts->pseudo_file == NULL && !opts->live && opts->restart_file == NULL
+		&& argv[optind] == NULL								// --restore=FILE [-j N] [-L|-l] [-v]
+	)
 	{
-		if(verbose)
-			printf("\tELF ERROR: elf_begin() fail: %s\n", elf_errmsg(elf_errno()));
-		return pt_flags;
+		*begin = *end = optind;
+		return;
 	}
 
-	if(elf_kind(elf) != ELF_K_ELF)
+	if(
+		   opts->server != NULL
+		&& (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->connect == NULL && opts->policy_file == NULL
+		&& opts->plan_file == NULL && opts->apply == NULL && opts->snapshot_file == NULL
+		&& argv[optind] == NULL								// --server=SOCKET [-j N] [-v]
+	)
 	{
-		elf_end(elf);
-		if(verbose)
-			printf("\tELF ERROR: elf_kind() fail: this is not an elf file.\n");
-		return pt_flags;
+		*begin = *end = optind;
+		return;
 	}
 
-	elf_getphdrnum(elf, &phnum);
+	if(
+		   opts->apply != NULL
+		&& (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& !opts->agent && opts->policy_file == NULL && opts->plan_file == NULL
+		&& opts->snapshot_file == NULL
+		&& argv[optind] == NULL								// --apply=FILE [-j N] [-v]
+	)
+	{
+		*begin = *end = optind;
+		return;
+	}
 
-	for(i=0; i<phnum; i++)
+	if(
+		   opts->agent && (opts->agent_file == NULL) != (opts->policy_file == NULL)
+		&& (setflags == 0 && solflags == 0 && limitflags <= 1 && solitaire == 0)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& opts->plan_file == NULL && opts->apply == NULL && opts->snapshot_file == NULL
+	)											// --exec-agent[=FILE] [--policy=FILE] [-0] [-L|-l] [-v] [MOUNT ...]
 	{
-		if(gelf_getphdr(elf, i, &phdr) != &phdr)
-		{
-			elf_end(elf);
-			if(verbose)
-				printf("\tELF ERROR: gelf_getphdr(): %s\n", elf_errmsg(elf_errno()));
-			return pt_flags;
-		}
+		*begin = optind;
+		*end = argc;
+		return;
+	}
 
-		if(phdr.p_type == PT_PAX_FLAGS)
-			pt_flags = phdr.p_flags;
+	if(
+		   opts->tar
+		&& (
+		    (setflags == 1 && solflags == 0 && limitflags <= 1 && solitaire == 0)
+		 || (setflags == 0 && solflags == 1 && limitflags <= 1 && solitaire == 0)
+		 || (setflags == 0 && solflags == 0 && limitflags <= 1 && solitaire == 0 && opts->policy_file)
+		)
+		&& !opts->tree && opts->batch == NULL && opts->server == NULL && opts->connect == NULL
+		&& !opts->agent && opts->plan_file == NULL && opts->apply == NULL
+		&& opts->snapshot_file == NULL && opts->cache_file == NULL && opts->pseudo_file == NULL
+		&& opts->sync == SYNC_NONE
+		&& argv[optind] == NULL								// --tar FLAGS|--policy=FILE [-L|-l] [-v]
+	)
+	{
+		*begin = *end = optind;
+		return;
 	}
 
-	elf_end(elf);
-	return pt_flags;
-}
-#endif
+	if(opts->server != NULL || opts->agent || opts->apply != NULL || opts->diff || opts->tar || opts->live
+			|| opts->restart_file != NULL || opts->restore_file != NULL)
+		print_help_exit(argv[0]);
 
+	// Only the flags can be planned, and only for many files at once
+	if(opts->plan_file != NULL && (solitaire || (!opts->tree && opts->batch == NULL)))
+		errx(EXIT_FAILURE, "option --plan needs -T or -B, and flags or a --policy");
 
-#ifdef XTPAX
-uint16_t
-string2bin(char *buf)
-{
-	int i;
-	uint16_t flags = 0;
+	// Paths in the image are relative to the tree
+	if(opts->pseudo_file != NULL && (solitaire || !opts->tree || opts->plan_file))
+		errx(EXIT_FAILURE, "option --pseudo needs -T, and flags or a --policy");
+
+	if(opts->pseudo_format != NULL && opts->pseudo_file == NULL)
+		errx(EXIT_FAILURE, "option --pseudo-format needs --pseudo");
 
-	for(i = 0; i < 5; i++)
+	// Scripts can be pointed at a server without being changed
+	if(opts->connect == NULL && (opts->connect = getenv("PAXCTL_NG_SOCKET")) != NULL)
 	{
-		if(buf[i] == 'P')
-			flags |= PF_PAGEEXEC;
-		else if(buf[i] == 'p')
-			flags |= PF_NOPAGEEXEC;
+		if(*opts->connect == '\0' || opts->tree || opts->policy_file || opts->plan_file || opts->snapshot_file
+				|| opts->pseudo_file || opts->sync || opts->replace_busy || opts->registry_file
+				|| opts->reconcile || opts->throttle || opts->order)
+			opts->connect = NULL;
+		else
+			opts->connect_env = 1;
+	}
 
-		if(buf[i] == 'E')
-			flags |= PF_EMUTRAMP;
-		else if(buf[i] == 'e')
-			flags |= PF_NOEMUTRAMP;
+	if(opts->connect != NULL && opts->tree)
+		errx(EXIT_FAILURE, "option --connect does not work with -T");
 
-		if(buf[i] == 'M')
-			flags |= PF_MPROTECT;
-		else if(buf[i] == 'm')
-			flags |= PF_NOMPROTECT;
+	if(opts->connect != NULL && opts->policy_file)
+		errx(EXIT_FAILURE, "option --connect does not work with --policy");
 
-		if(buf[i] == 'R')
-			flags |= PF_RANDMMAP;
-		else if(buf[i] == 'r')
-			flags |= PF_NORANDMMAP;
+	if(opts->connect != NULL && opts->plan_file)
+		errx(EXIT_FAILURE, "option --connect does not work with --plan");
 
-		if(buf[i] == 'S')
-			flags |= PF_SEGMEXEC;
-		else if(buf[i] == 's')
-			flags |= PF_NOSEGMEXEC;
-	}
+	if(opts->connect != NULL && opts->snapshot_file)
+		errx(EXIT_FAILURE, "option --connect does not work with --snapshot");
 
-	return flags;
-}
+	// The server writes with its own --sync
+	if(opts->connect != NULL && opts->sync)
+		errx(EXIT_FAILURE, "option --connect does not work with --sync");
 
+	if(opts->connect != NULL && opts->replace_busy)
+		errx(EXIT_FAILURE, "option --connect does not work with --replace-busy");
 
-uint16_t
-get_xt_flags(int fd)
-{
-	char buf[FLAGS_SIZE];
-	uint16_t xt_flags = UINT16_MAX;
+	if(opts->connect != NULL && opts->registry_file)
+		errx(EXIT_FAILURE, "option --connect does not work with --registry");
 
-	memset(buf, 0, FLAGS_SIZE);
+	if(opts->connect != NULL && opts->reconcile)
+		errx(EXIT_FAILURE, "option --connect does not work with --reconcile");
 
-	if(fgetxattr(fd, PAX_NAMESPACE, buf, FLAGS_SIZE) != -1)
-		xt_flags = string2bin(buf);
+	if(opts->connect != NULL && opts->throttle)
+		errx(EXIT_FAILURE, "option --connect does not work with --throttle");
 
-	return xt_flags;
+	if(opts->connect != NULL && opts->order)
+		errx(EXIT_FAILURE, "option --connect does not work with --order");
+
+	if(
+		   opts->batch != NULL
+		&& (setflags == 0 && solflags == 0 && limitflags <= 1 && solitaire == 0 && !opts->tree)
+		&& argv[optind] == NULL								// -B FILE [-0] [-j N] [-L|-l] [-v]
+	)
+	{
+		*begin = *end = optind;
+		return;
+	}
+
+	if(
+		(
+		    (setflags == 1 && solflags == 0 && limitflags <= 1 && solitaire == 0)		//-PpEeMmRrSs [-L|-l] [-v] ELF
+		 || (setflags == 0 && solflags == 1 && limitflags <= 1 && solitaire == 0)		//-Z|-z [-L|-l] [-v] ELF
+		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 1)		//-C|-c|-d|-F|-f [-v] ELF
+		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0 && *verbose == 1) // -v ELF
+		 || (setflags == 0 && solflags == 0 && limitflags <= 1 && solitaire == 0 && opts->policy_file)	//--policy=FILE [-L|-l] [-v] ELF
+		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0 && opts->snapshot_file)	//--snapshot=FILE ELF
+		 || (setflags == 0 && solflags == 0 && limitflags <= 1 && solitaire == 0 && opts->registry_file)	//--registry=FILE [-L|-l] [-v] ELF
+		 || (setflags == 0 && solflags == 0 && limitflags == 0 && solitaire == 0 && opts->reconcile)	//--reconcile[=pt|xt] [-v] ELF
+		)
+		&& argv[optind] != NULL
+	)
+	{
+		*begin = optind;
+		*end = argc;
+	}
+	else
+		print_help_exit(argv[0]);
 }
-#endif
 
 
-void
-bin2string4print(uint16_t flags, char *buf)
+/*
+ * Each thread gets its own libelfix handle the first time it needs one.
+ * Its counters are folded into --stats by stats_merge().
+ */
+__thread elfix_t *elfix_local;
+
+elfix_t *
+local_elfix(void)
 {
-	buf[0] = flags & PF_PAGEEXEC ? 'P' :
-		flags & PF_NOPAGEEXEC ? 'p' : '-' ;
+	if(elfix_local == NULL && (elfix_local = elfix_new()) == NULL)
+		err(EXIT_FAILURE, "elfix_new()");
+
+	return elfix_local;
+}
 
-	buf[1] = flags & PF_EMUTRAMP   ? 'E' :
-		flags & PF_NOEMUTRAMP ? 'e' : '-';
 
-	buf[2] = flags & PF_MPROTECT   ? 'M' :
-		flags & PF_NOMPROTECT ? 'm' : '-';
+void
+local_elfix_free(void)
+{
+	elfix_free(elfix_local);
+	elfix_local = NULL;
+}
 
-	buf[3] = flags & PF_RANDMMAP   ? 'R' :
-		flags & PF_NORANDMMAP ? 'r' : '-';
 
-	buf[4] = flags & PF_SEGMEXEC   ? 'S' :
-		flags & PF_NOSEGMEXEC ? 's' : '-';
+/*
+ * What is printed about the file in hand goes here.  A -v pool worker
+ * points it at a buffer of its own for each file and writes the buffer
+ * out in one go, so files neither interleave nor wait on each other for
+ * stdout.  Otherwise it is stdout.
+ */
+__thread FILE *out_local;
+
+FILE *
+local_out(void)
+{
+	return out_local ? out_local : stdout;
 }
 
 
-void
-bin2string(uint16_t flags, char *buf)
+#ifdef PTPAX
+uint16_t
+get_pt_flags(int fd, int verbose)
 {
-	int i;
+	elfix_t *h = local_elfix();
+	uint16_t pt_flags = UINT16_MAX;
+	int e;
 
-	for(i = 0; i < 5; i++)
-		buf[i] = 0;
+	PAX_PROBE1(get_pt_flags__entry, fd);
 
-	i = 0;
+	e = elfix_get_pt_flags(h, fd, &pt_flags);
+	if(e != ELFIX_OK && e != ELFIX_ENOFLAGS && verbose)
+		fprintf(local_out(), "\tELF ERROR: %s\n", elfix_strerror(h));
 
-	if(flags & PF_PAGEEXEC)
-		buf[i++] = 'P';
-	else if(flags & PF_NOPAGEEXEC)
-		buf[i++] = 'p';
+	PAX_PROBE3(get_pt_flags__return, fd, pt_flags, e);
+	return pt_flags;
+}
+#endif
 
-	if(flags & PF_EMUTRAMP)
-		buf[i++] = 'E';
-	else if(flags & PF_NOEMUTRAMP)
-		buf[i++] = 'e';
 
-	if(flags & PF_MPROTECT)
-		buf[i++] = 'M';
-	else if(flags & PF_NOMPROTECT)
-		buf[i++] = 'm';
+#ifdef XTPAX
+uint16_t
+get_xt_flags(int fd)
+{
+	elfix_t *h = local_elfix();
+	uint16_t xt_flags = UINT16_MAX;
+	int e;
+
+	PAX_PROBE1(get_xt_flags__entry, fd);
 
-	if(flags & PF_RANDMMAP)
-		buf[i++] = 'R';
-	if(flags & PF_NORANDMMAP)
-		buf[i++] = 'r';
+	e = elfix_get_xt_flags(h, fd, &xt_flags);
 
-	if(flags & PF_SEGMEXEC)
-		buf[i++] = 'S';
-	else if(flags & PF_NOSEGMEXEC)
-		buf[i++] = 's';
+	PAX_PROBE3(get_xt_flags__return, fd, xt_flags, e);
+	return xt_flags;
 }
+#endif
 
 
 void
-print_flags(int fd, int verbose)
+print_flags(uint16_t pt_flags, uint16_t xt_flags)
 {
-	uint16_t flags;
-	char buf[FLAGS_SIZE];
+	char buf[ELFIX_FLAGS_SIZE];
 
 #ifdef PTPAX
-	flags = get_pt_flags(fd, verbose);
-	if( flags == UINT16_MAX )
-		printf("\tPT_PAX    : not found\n");
+	if( pt_flags == UINT16_MAX )
+		fprintf(local_out(), "\tPT_PAX    : not found\n");
 	else
 	{
-		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
-		printf("\tPT_PAX    : %s\n", buf);
+		memset(buf, 0, ELFIX_FLAGS_SIZE);
+		elfix_bin2string4print(pt_flags, buf);
+		fprintf(local_out(), "\tPT_PAX    : %s\n", buf);
 	}
 #endif
 
 #ifdef XTPAX
-	flags = get_xt_flags(fd);
-	if( flags == UINT16_MAX )
-		printf("\tXATTR_PAX : not found\n");
+	if( xt_flags == UINT16_MAX )
+		fprintf(local_out(), "\tXATTR_PAX : not found\n");
 	else
 	{
-		memset(buf, 0, FLAGS_SIZE);
-		bin2string4print(flags, buf);
-		printf("\tXATTR_PAX : %s\n", buf);
+		memset(buf, 0, ELFIX_FLAGS_SIZE);
+		elfix_bin2string4print(xt_flags, buf);
+		fprintf(local_out(), "\tXATTR_PAX : %s\n", buf);
 	}
 #endif
 }
@@ -504,91 +824,11 @@ print_flags(int fd, int verbose)
 uint16_t
 update_flags(uint16_t flags, uint16_t pax_flags)
 {
-	//PAGEEXEC
-	if(pax_flags & PF_PAGEEXEC)
-	{
-		flags |= PF_PAGEEXEC;
-		flags &= ~PF_NOPAGEEXEC;
-	}
-	if(pax_flags & PF_NOPAGEEXEC)
-	{
-		flags &= ~PF_PAGEEXEC;
-		flags |= PF_NOPAGEEXEC;
-	}
-	if((pax_flags & PF_PAGEEXEC) && (pax_flags & PF_NOPAGEEXEC))
-	{
-		flags &= ~PF_PAGEEXEC;
-		flags &= ~PF_NOPAGEEXEC;
-	}
-
-	//EMUTRAMP
-	if(pax_flags & PF_EMUTRAMP)
-	{
-		flags |= PF_EMUTRAMP;
-		flags &= ~PF_NOEMUTRAMP;
-	}
-	if(pax_flags & PF_NOEMUTRAMP)
-	{
-		flags &= ~PF_EMUTRAMP;
-		flags |= PF_NOEMUTRAMP;
-	}
-	if((pax_flags & PF_EMUTRAMP) && (pax_flags & PF_NOEMUTRAMP))
-	{
-		flags &= ~PF_EMUTRAMP;
-		flags &= ~PF_NOEMUTRAMP;
-	}
-
-	//MPROTECT
-	if(pax_flags & PF_MPROTECT)
-	{
-		flags |= PF_MPROTECT;
-		flags &= ~PF_NOMPROTECT;
-	}
-	if(pax_flags & PF_NOMPROTECT)
-	{
-		flags &= ~PF_MPROTECT;
-		flags |= PF_NOMPROTECT;
-	}
-	if((pax_flags & PF_MPROTECT) && (pax_flags & PF_NOMPROTECT))
-	{
-		flags &= ~PF_MPROTECT;
-		flags &= ~PF_NOMPROTECT;
-	}
-
-	//RANDMMAP
-	if(pax_flags & PF_RANDMMAP)
-	{
-		flags |= PF_RANDMMAP;
-		flags &= ~PF_NORANDMMAP;
-	}
-	if(pax_flags & PF_NORANDMMAP)
-	{
-		flags &= ~PF_RANDMMAP;
-		flags |= PF_NORANDMMAP;
-	}
-	if((pax_flags & PF_RANDMMAP) && (pax_flags & PF_NORANDMMAP))
-	{
-		flags &= ~PF_RANDMMAP;
-		flags &= ~PF_NORANDMMAP;
-	}
+	PAX_PROBE2(update_flags__entry, flags, pax_flags);
 
-	//SEGMEXEC
-	if(pax_flags & PF_SEGMEXEC)
-	{
-		flags |= PF_SEGMEXEC;
-		flags &= ~PF_NOSEGMEXEC;
-	}
-	if(pax_flags & PF_NOSEGMEXEC)
-	{
-		flags &= ~PF_SEGMEXEC;
-		flags |= PF_NOSEGMEXEC;
-	}
-	if((pax_flags & PF_SEGMEXEC) && (pax_flags & PF_NOSEGMEXEC))
-	{
-		flags &= ~PF_SEGMEXEC;
-		flags &= ~PF_NOSEGMEXEC;
-	}
+	flags = elfix_update_flags(flags, pax_flags);
 
+	PAX_PROBE1(update_flags__return, flags);
 	return flags;
 }
 
@@ -597,120 +837,126 @@ update_flags(uint16_t flags, uint16_t pax_flags)
 int
 set_pt_flags(int fd, uint16_t pt_flags, int verbose)
 {
-	Elf *elf;
-	GElf_Phdr phdr;
-	size_t i, phnum;
+	elfix_t *h = local_elfix();
+	int e, ret = EXIT_SUCCESS;
 
-	if(elf_version(EV_CURRENT) == EV_NONE)
-	{
-		if(verbose)
-			printf("\tELF ERROR: Library out of date.\n");
-		return EXIT_FAILURE;
-	}
+	PAX_PROBE2(set_pt_flags__entry, fd, pt_flags);
 
-	if((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL)
+	e = elfix_set_pt_flags(h, fd, pt_flags);
+	if(e != ELFIX_OK && e != ELFIX_ENOFLAGS)
 	{
 		if(verbose)
-			printf("\tELF ERROR: elf_begin() fail: %s\n", elf_errmsg(elf_errno()));
-		return EXIT_FAILURE;
+			fprintf(local_out(), "\tELF ERROR: %s\n", elfix_strerror(h));
+		ret = EXIT_FAILURE;
 	}
 
-	if(elf_kind(elf) != ELF_K_ELF)
-	{
-		elf_end(elf);
-		if(verbose)
-			printf("\tELF ERROR: elf_kind() fail: this is not an elf file.\n");
-		return EXIT_FAILURE;
-	}
+	PAX_PROBE3(set_pt_flags__return, fd, pt_flags, e);
+	return ret;
+}
+#endif
 
-	elf_getphdrnum(elf, &phnum);
 
-	for(i=0; i<phnum; i++)
-	{
-		if(gelf_getphdr(elf, i, &phdr) != &phdr)
-		{
-			elf_end(elf);
-			if(verbose)
-				printf("\tELF ERROR: gelf_getphdr(): %s\n", elf_errmsg(elf_errno()));
-			return EXIT_FAILURE;
-		}
+#ifdef XTPAX
+int
+set_xt_flags(int fd, uint16_t xt_flags)
+{
+	elfix_t *h = local_elfix();
+	int e;
 
-		if(phdr.p_type == PT_PAX_FLAGS)
-		{
-			//RANDEXEC is deprecated, we'll force it off like paxctl
-			phdr.p_flags = pt_flags | PF_NORANDEXEC;
+	PAX_PROBE2(set_xt_flags__entry, fd, xt_flags);
 
-			if(!gelf_update_phdr(elf, i, &phdr))
-			{
-				elf_end(elf);
-				if(verbose)
-					printf("\tELF ERROR: gelf_update_phdr(): %s", elf_errmsg(elf_errno()));
-				return EXIT_FAILURE;
-			}
-		}
-	}
+	e = elfix_set_xt_flags(h, fd, xt_flags);
 
-	elf_end(elf);
-	return EXIT_SUCCESS;
+	PAX_PROBE3(set_xt_flags__return, fd, xt_flags, e);
+	return e == ELFIX_OK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 #endif
 
 
+/*
+ * Work out what setting pax_flags on fd would do, without writing: the
+ * flags there now and the flags they would become, for PT_PAX and for
+ * XATTR_PAX.  A missing field starts out as PF_NOEMUTRAMP.  Fields left
+ * out by -L, -l or a read-only fd are not wanted.
+ */
+void
+compute_flags(int fd, uint16_t pax_flags, int rdwr_pt_pax, int limit, int verbose, struct pax_change *c)
+{
+	memset(c, 0, sizeof(struct pax_change));
+	c->pt_old = c->pt_new = c->xt_old = c->xt_new = UINT16_MAX;
+
+#ifdef PTPAX
+	if(rdwr_pt_pax && limit != LIMIT_TO_XT_FLAGS)
+	{
+		c->pt_want = 1;
+		c->pt_old = get_pt_flags(fd, verbose);
+		c->pt_new = update_flags(c->pt_old == UINT16_MAX ? PF_NOEMUTRAMP : c->pt_old, pax_flags);
+		// set_pt_flags() always adds PF_NORANDEXEC
+		c->pt_write = c->pt_old != UINT16_MAX && c->pt_old != (c->pt_new | PF_NORANDEXEC);
+	}
+#endif
+
 #ifdef XTPAX
+	if(limit != LIMIT_TO_PT_FLAGS)
+	{
+		c->xt_want = 1;
+		c->xt_old = get_xt_flags(fd);
+		c->xt_new = update_flags(c->xt_old == UINT16_MAX ? PF_NOEMUTRAMP : c->xt_old, pax_flags);
+		c->xt_write = c->xt_old == UINT16_MAX || c->xt_old != c->xt_new;
+	}
+#endif
+}
+
+
+/*
+ * The set and copy paths below compare what is already on disk with what
+ * they are about to write and skip the write if nothing would change, so
+ * re-running the same marking does not dirty the inode or bump its ctime.
+ * *written gets WROTE_PT and WROTE_XT for the writes which did happen.
+ */
 int
-set_xt_flags(int fd, uint16_t xt_flags)
+set_flags(int fd, uint16_t *pax_flags, int rdwr_pt_pax, int limit, int verbose, int *written)
 {
-	char buf[FLAGS_SIZE];
+	struct pax_change c;
 
-	memset(buf, 0, FLAGS_SIZE);
-	bin2string(xt_flags, buf);
+	compute_flags(fd, *pax_flags, rdwr_pt_pax, limit, verbose, &c);
 
-	if( !fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), 0) )
-		return EXIT_SUCCESS;
-	else
-		return EXIT_FAILURE;
+	return apply_flags(fd, &c, verbose, written);
 }
-#endif
 
 
+// The writing half of set_flags(), for a change already worked out
 int
-set_flags(int fd, uint16_t *pax_flags, int rdwr_pt_pax, int limit, int verbose)
+apply_flags(int fd, const struct pax_change *c, int verbose, int *written)
 {
-	uint16_t flags;
 	int ret = EXIT_FAILURE;
 
 #ifdef PTPAX
-	if(rdwr_pt_pax)
+	if(c->pt_want)
 	{
-#ifdef XTPAX
-		if( !(limit == LIMIT_TO_XT_FLAGS))
+		// With no PT_PAX_FLAGS phdr this only finds out if fd is ELF
+		if(c->pt_old != UINT16_MAX && !c->pt_write)
+			ret = EXIT_SUCCESS;
+		else
 		{
-#endif
-			flags = get_pt_flags(fd, verbose);
-			if( flags == UINT16_MAX )
-				flags = PF_NOEMUTRAMP ;
-			flags = update_flags( flags, *pax_flags);
-			ret = set_pt_flags(fd, flags, verbose);
-#ifdef XTPAX
+			ret = set_pt_flags(fd, c->pt_new, verbose);
+			if(c->pt_write)
+				*written |= WROTE_PT;
 		}
-#endif
-
 	}
 #endif
 
 #ifdef XTPAX
-#ifdef PTPAX
-	if( !(limit == LIMIT_TO_PT_FLAGS) )
+	if(c->xt_want)
 	{
-#endif
-		flags = get_xt_flags(fd);
-		if( flags == UINT16_MAX )
-			flags = PF_NOEMUTRAMP ;
-		flags = update_flags( flags, *pax_flags);
-		ret = set_xt_flags(fd, flags);
-#ifdef PTPAX
+		if(!c->xt_write)
+			ret = EXIT_SUCCESS;
+		else
+		{
+			ret = set_xt_flags(fd, c->xt_new);
+			*written |= WROTE_XT;
+		}
 	}
-#endif
 #endif
 
 	return ret;
@@ -721,7 +967,6 @@ set_flags(int fd, uint16_t *pax_flags, int rdwr_pt_pax, int limit, int verbose)
 int
 create_xt_flags(int fd, int cp_flags)
 {
-	char buf[FLAGS_SIZE];
 	uint16_t xt_flags;
 
 	if(cp_flags == CREATE_XT_FLAGS_SECURE)
@@ -733,10 +978,7 @@ create_xt_flags(int fd, int cp_flags)
 		//Why are we here?
 		return EXIT_FAILURE;
 
-	memset(buf, 0, FLAGS_SIZE);
-	bin2string(xt_flags, buf);
-
-	if( !fsetxattr(fd, PAX_NAMESPACE, buf, strlen(buf), XATTR_CREATE) )
+	if(elfix_create_xt_flags(local_elfix(), fd, xt_flags) == ELFIX_OK)
 		return EXIT_SUCCESS;
 	else
 		return EXIT_FAILURE;
@@ -745,40 +987,60 @@ create_xt_flags(int fd, int cp_flags)
 int
 delete_xt_flags(int fd)
 {
-	if( !fremovexattr(fd, PAX_NAMESPACE) )
+	// A missing user.pax.flags counts as success, see bug #485908
+	if(elfix_delete_xt_flags(local_elfix(), fd) == ELFIX_OK)
 		return EXIT_SUCCESS;
 	else
-	{
-		// If this fails because there was no such named xattr
-		// in the first place, then in a sense, we succeeded.
-		// See: https://bugs.gentoo.org/show_bug.cgi?id=485908
-		if( errno == ENOATTR )
-			return EXIT_SUCCESS;
-		else
-			return EXIT_FAILURE;
-	}
+		return EXIT_FAILURE;
 }
 #endif
 
 
 #if defined(PTPAX) && defined(XTPAX)
 int
-copy_xt_flags(int fd, int cp_flags, int verbose)
+copy_xt_flags(struct pax_work *w, int *fd, int cp_flags, const struct paxctl_opts *opts, int *written)
 {
-	uint16_t flags;
+	int verbose = opts->verbose;
+	uint16_t flags, oflags;
+	char buf[ELFIX_FLAGS_SIZE];
 	int ret = EXIT_FAILURE;
 
 	if(cp_flags == COPY_PT_TO_XT_FLAGS)
 	{
-		flags = get_pt_flags(fd, verbose);
+		flags = get_pt_flags(*fd, verbose);
 		if( flags != UINT16_MAX )
-			ret = set_xt_flags(fd, flags);
+		{
+			// Compare what would actually be stored in the xattr
+			memset(buf, 0, ELFIX_FLAGS_SIZE);
+			elfix_bin2string(flags, buf);
+			oflags = get_xt_flags(*fd);
+			if( oflags != UINT16_MAX && oflags == elfix_string2bin(buf) )
+				ret = EXIT_SUCCESS;
+			else
+			{
+				ret = set_xt_flags(*fd, flags);
+				*written |= WROTE_XT;
+			}
+		}
 	}
 	else if(cp_flags == COPY_XT_TO_PT_FLAGS)
 	{
-		flags = get_xt_flags(fd);
+		flags = get_xt_flags(*fd);
 		if( flags != UINT16_MAX )
-			ret = set_pt_flags(fd, flags, verbose);
+		{
+			oflags = get_pt_flags(*fd, verbose);
+			if( oflags != UINT16_MAX && oflags == (flags | PF_NORANDEXEC) )
+				ret = EXIT_SUCCESS;
+			// With no PT_PAX_FLAGS phdr this only finds out if fd is ELF
+			else if( oflags != UINT16_MAX && !reopen_rdwr(w, fd, opts) )
+				ret = EXIT_FAILURE;
+			else
+			{
+				ret = set_pt_flags(*fd, flags, verbose);
+				if( oflags != UINT16_MAX )
+					*written |= WROTE_PT;
+			}
+		}
 	}
 
 	return ret;
@@ -786,68 +1048,494 @@ copy_xt_flags(int fd, int cp_flags, int verbose)
 #endif
 
 
+void
+announce(struct pax_work *w, int verbose)
+{
+	if(verbose && !w->announced)
+	{
+		fprintf(local_out(), "%s:\n", w->path);
+		w->announced = 1;
+	}
+}
+
+
+// A --throttle run leaves the access times alone where it may
+static int
+open_file(const char *path, int flags, const struct paxctl_opts *opts)
+{
+	return opts->throttle ? throttle_open(path, flags) : open(path, flags);
+}
+
+
+/*
+ * process_file() opens every file O_RDONLY, and only once it knows it
+ * has a PT_PAX_FLAGS phdr to patch opens it again O_RDWR: opening for
+ * writing copies the file up on overlayfs, wakes IN_CLOSE_WRITE watchers
+ * and fails on a running binary.  Returns 1 with *fd now open O_RDWR on
+ * the same file, else 0 with errno set.
+ */
 int
-main( int argc, char *argv[])
+reopen_rdwr(struct pax_work *w, int *fd, const struct paxctl_opts *opts)
+{
+	struct stat was, now;
+	int mode, newfd;
+
+	if((mode = fcntl(*fd, F_GETFL)) >= 0 && (mode & O_ACCMODE) == O_RDWR)
+		return 1;
+
+	if((newfd = open_file(w->path, O_RDWR, opts)) < 0)
+		goto fail;
+
+	// Someone may have renamed another file over it since
+	if(fstat(*fd, &was) < 0 || fstat(newfd, &now) < 0
+			|| was.st_dev != now.st_dev || was.st_ino != now.st_ino)
+	{
+		close(newfd);
+		errno = ESTALE;
+		goto fail;
+	}
+
+	STAT_INC(STAT_OPEN_RDWR);
+	close(*fd);
+	*fd = newfd;
+	return 1;
+
+fail:
+	// --replace-busy has a go at it instead
+	if(opts->verbose && !(errno == ETXTBSY && opts->replace_busy))
+		fprintf(local_out(), "\topen(O_RDWR) failed: cannot change PT_PAX flags\n");
+	return 0;
+}
+
+
+int
+is_elf(int fd)
+{
+	unsigned char ident[SELFMAG];
+
+	if(pread(fd, ident, SELFMAG, 0) != SELFMAG)
+		return 0;
+	STAT_ADD(STAT_BYTES_READ, SELFMAG);
+
+	return !memcmp(ident, ELFMAG, SELFMAG);
+}
+
+
+/*
+ * --cache: a file whose flags we are only asked to read can be answered
+ * without opening it, if it has not changed since they were cached.
+ * Returns 1 if it was.
+ */
+#if defined(PTPAX) && defined(XTPAX)
+ #define CACHE_WANT	(ELFIX_HAVE_PT | ELFIX_HAVE_XT)
+#elif defined(PTPAX)
+ #define CACHE_WANT	ELFIX_HAVE_PT
+#else
+ #define CACHE_WANT	ELFIX_HAVE_XT
+#endif
+
+static int
+cached_flags(struct pax_work *w, const struct paxctl_opts *opts)
+{
+	struct elfix_cache_entry e;
+	struct stat st;
+
+	if(stat(w->path, &st) < 0 || !S_ISREG(st.st_mode) || !elfix_cache_lookup(opts->cache, &st, &e))
+		goto miss;
+
+	if(e.what & ELFIX_CACHE_NOTELF)
+	{
+		// Only -T skips non-ELF files quietly, the rest is left to process_file()
+		if(!opts->tree)
+			goto miss;
+		STAT_INC(STAT_CACHE_HIT);
+		STAT_INC(STAT_NOT_ELF);
+		w->not_elf = 1;
+		return 1;
+	}
+
+	if((e.what & CACHE_WANT) != CACHE_WANT)
+		goto miss;
+
+	STAT_INC(STAT_CACHE_HIT);
+	if(w->query)
+	{
+		w->pt_flags = e.pt_flags;
+		w->xt_flags = e.xt_flags;
+	}
+	if(opts->verbose)
+	{
+		announce(w, opts->verbose);
+		print_flags(e.pt_flags, e.xt_flags);
+		fprintf(local_out(), "\n");
+	}
+	return 1;
+
+miss:
+	STAT_INC(STAT_CACHE_MISS);
+	return 0;
+}
+
+
+static void
+cache_flags(const struct paxctl_opts *opts, int fd, const struct stat *before, unsigned what,
+	uint16_t pt_flags, uint16_t xt_flags)
 {
-	int fd, fi;
-	uint16_t pax_flags;
-	int verbose, cp_flags, limit, begin, end;
-	int rdwr_pt_pax = 1;
+	struct elfix_cache_entry e;
+
+	e.what = what;
+	e.pt_flags = pt_flags;
+	e.xt_flags = xt_flags;
+	elfix_cache_store(opts->cache, fd, before, &e);
+}
+
+
+int
+process_file(struct pax_work *w, const struct paxctl_opts *opts)
+{
+	int fd;
+	int verbose = opts->verbose;
+	int cp_flags = opts->cp_flags;
+	int written = 0;
+	int created = 0;
+	int known = 0;
+	int rdwr;
+	struct pax_change c;
+	struct registry_key key;
+	struct throttle_pages pages;
+	int cacheable;
+	uint16_t pt_flags, xt_flags;
+	struct stat before;
+	double t;
 
 	int ret = EXIT_SUCCESS;
 
-	parse_cmd_args(argc, argv, &pax_flags, &verbose, &cp_flags, &limit, &begin, &end);
+	// Already found not to be ELF by the io_uring prefetch
+	if(w->not_elf)
+		return ret;
+
+	if(w->plan && !w->stale)
+		return apply_file(w, opts);
+
+	if(w->restore)
+		return restore_file(w, opts);
+
+	// Only reads are cached, anything else goes to the file
+	cacheable = opts->cache && w->fd < 0 && w->pax_flags == 0 && cp_flags == 0
+		&& !opts->plan && !opts->pseudo && !opts->snapshot && !opts->registry && !opts->reconcile
+		&& !w->need_policy && (verbose || w->query);
 
-	for(fi = begin; fi < end; fi++)
+	if(cacheable && cached_flags(w, opts))
+		return ret;
+
+	// In tree mode we only talk about ELF objects
+	if(!opts->tree)
+		announce(w, verbose);
+
+	// O_RDWR waits for reopen_rdwr(), when there is a PT_PAX write to make
+	t = stats_now();
+	if((fd = w->fd) < 0 && (fd = open_file(w->path, O_RDONLY, opts)) >= 0)
+		STAT_INC(STAT_OPEN_RDONLY);
+	else if(fd < 0)
 	{
+		w->errnum = errno;
+		STAT_INC(STAT_OPEN_FAILED);
+		stats_phase(PHASE_OPEN, t);
+		announce(w, verbose);
+		if(errno == ENOENT) {
+			if(verbose)
+				fprintf(local_out(), "\topen() failed: file does not exist\n\n");
+			return ENOENT;
+		}
 		if(verbose)
-			printf("%s:\n", argv[fi]);
+			fprintf(local_out(), "\topen(O_RDONLY) failed: cannot read/change PAX flags\n\n");
+		return ret;
+	}
+
+	if(opts->throttle_state)
+		throttle_mark(fd, &pages);
+
+	if(cacheable && fstat(fd, &before) < 0)
+		cacheable = 0;
 
-		if((fd = open(argv[fi], O_RDWR)) < 0)
+	if(opts->tree && !is_elf(fd))
+	{
+		if(cacheable)
+			cache_flags(opts, fd, &before, ELFIX_CACHE_NOTELF, UINT16_MAX, UINT16_MAX);
+		STAT_INC(STAT_NOT_ELF);
+		w->not_elf = 1;
+		if(opts->throttle_state)
+			throttle_drop(opts->throttle_state, fd, &pages);
+		close(fd);
+		stats_phase(PHASE_OPEN, t);
+		return ret;
+	}
+
+	// A build the registry knows needs no policy
+	if(opts->registry)
+		known = registry_lookup(opts->registry, w, fd, &key);
+
+	if(w->need_policy && (policy_match(opts->policy, w->path + w->image_at, fd, &w->pax_flags) != POLICY_MATCH
+			|| w->pax_flags == 0))
+	{
+		w->unmatched = 1;
+		if(opts->throttle_state)
+			throttle_drop(opts->throttle_state, fd, &pages);
+		close(fd);
+		stats_phase(PHASE_OPEN, t);
+		if(verbose && !opts->tree)
+			fprintf(local_out(), "	left alone by the policy\n\n");
+		return ret;
+	}
+	stats_phase(PHASE_OPEN, t);
+
+	announce(w, verbose);
+	if(known && verbose)
+		fprintf(local_out(), "\tregistry: a known build\n");
+
+#ifdef XTPAX
+	t = stats_now();
+	if(cp_flags == CREATE_XT_FLAGS_SECURE || cp_flags == CREATE_XT_FLAGS_DEFAULT)
+		ret |= create_xt_flags(fd, cp_flags);
+	if(cp_flags == DELETE_XT_FLAGS)
+		ret |= delete_xt_flags(fd);
+	// These do not say if they changed anything, so a --sync assumes so
+	if(cp_flags == CREATE_XT_FLAGS_SECURE || cp_flags == CREATE_XT_FLAGS_DEFAULT || cp_flags == DELETE_XT_FLAGS)
+		created = WROTE_XT;
+	stats_phase(PHASE_CREATE_DELETE, t);
+#endif
+
+#if defined(PTPAX) && defined(XTPAX)
+	if(cp_flags == COPY_PT_TO_XT_FLAGS || cp_flags == COPY_XT_TO_PT_FLAGS)
+	{
+		t = stats_now();
+		ret |= copy_xt_flags(w, &fd, cp_flags, opts, &written);
+		w->changing = 1;
+		stats_phase(PHASE_COPY, t);
+	}
+#endif
+
+	if(opts->plan)
+	{
+		t = stats_now();
+		// Whether --apply could open it O_RDWR, without opening it so here
+		ret |= plan_file(opts->plan, w, fd, faccessat(AT_FDCWD, w->path, W_OK, AT_EACCESS) == 0, verbose);
+		stats_phase(PHASE_SET, t);
+	}
+	else if(opts->pseudo)
+	{
+		t = stats_now();
+		ret |= pseudo_file(opts->pseudo, w, &fd, opts, &written);
+		w->changing = 1;
+		stats_phase(PHASE_SET, t);
+	}
+#if defined(PTPAX) && defined(XTPAX)
+	else if(opts->reconcile)
+	{
+		t = stats_now();
+		ret |= reconcile_file(opts->reconcile_state, w, &fd, opts, &written);
+		stats_phase(PHASE_SET, t);
+	}
+#endif
+	else if(w->pax_flags != 0)
+	{
+		t = stats_now();
+		compute_flags(fd, w->pax_flags, 1, opts->limit, verbose, &c);
+		rdwr = !c.pt_write || reopen_rdwr(w, &fd, opts);
+#ifdef PTPAX
+		if(!rdwr && errno == ETXTBSY && opts->replace_busy)
+			ret |= replace_busy(w, &fd, opts, &written);
+		else
+#endif
 		{
-			if(errno == ENOENT) {
-				if(verbose)
-					printf("\topen() failed: file does not exist\n\n");
-				ret |= ENOENT;
-				continue;
-			}
+			// Only XATTR_PAX then
+			if(!rdwr)
+				c.pt_want = c.pt_write = 0;
+			ret |= apply_flags(fd, &c, verbose, &written);
+		}
+		w->changing = 1;
+		stats_phase(PHASE_SET, t);
+	}
+
+	w->written = written > 0;
 
-			rdwr_pt_pax = 0;
+	// A plan changes nothing, so there is nothing to record yet
+	if(opts->registry && !known && !opts->plan && ret == EXIT_SUCCESS)
+		registry_record(opts->registry, &key, w);
+
+	if(w->query || verbose == 1 || opts->snapshot)
+	{
+		t = stats_now();
+		pt_flags = xt_flags = UINT16_MAX;
 #ifdef PTPAX
-			if(verbose)
-				printf("\topen(O_RDWR) failed: cannot change PT_PAX flags\n");
+		pt_flags = get_pt_flags(fd, verbose);
 #endif
-			if((fd = open(argv[fi], O_RDONLY)) < 0)
+#ifdef XTPAX
+		xt_flags = get_xt_flags(fd);
+#endif
+		if(w->query)
+		{
+			w->pt_flags = pt_flags;
+			w->xt_flags = xt_flags;
+		}
+		if(verbose == 1)
+			print_flags(pt_flags, xt_flags);
+		if(opts->snapshot)
+			snapshot_file(opts->snapshot, w->path, fd, pt_flags, xt_flags);
+		// Outside -T we have not looked, so only cache what is ELF
+		if(cacheable && (opts->tree || is_elf(fd)))
+			cache_flags(opts, fd, &before, CACHE_WANT, pt_flags, xt_flags);
+		stats_phase(PHASE_PRINT, t);
+	}
+
+	if(opts->sync)
+		ret |= sync_file(opts, w->path, fd, written | created);
+
+	if(opts->throttle_state)
+		throttle_drop(opts->throttle_state, fd, &pages);
+	close(fd);
+
+	if(verbose)
+		fprintf(local_out(), "\n");
+
+	return ret;
+}
+
+
+int
+main( int argc, char *argv[])
+{
+	int fi;
+	struct paxctl_opts opts;
+	struct pax_work w, *wp;
+	struct pax_client *client;
+	struct pool_totals totals;
+	int begin, end;
+
+	int ret = EXIT_SUCCESS;
+
+	parse_cmd_args(argc, argv, &opts, &begin, &end);
+
+	if(opts.policy_file)
+		opts.policy = policy_load_rules(opts.policy_file);
+
+	if(opts.diff)
+		exit(run_diff(argv[begin], argv[begin + 1]));
+
+	if(opts.plan_file)
+		opts.plan = plan_create(opts.plan_file, &opts);
+
+	if(opts.snapshot_file)
+		opts.snapshot = snapshot_create(opts.snapshot_file);
+
+	if(opts.pseudo_file)
+		opts.pseudo = pseudo_create(opts.pseudo_file, opts.pseudo_format, &opts);
+
+	if(opts.registry_file)
+		opts.registry = registry_open(opts.registry_file);
+
+#if defined(PTPAX) && defined(XTPAX)
+	if(opts.reconcile)
+		opts.reconcile_state = reconcile_create(opts.reconcile_source);
+#endif
+
+	if(opts.cache_file == NULL && (opts.cache_file = getenv("PAXCTL_NG_CACHE")) != NULL && *opts.cache_file == '\0')
+		opts.cache_file = NULL;
+
+	if(opts.cache_file && (opts.cache = elfix_cache_open(opts.cache_file)) == NULL)
+		warn("%s: carrying on without the cache", opts.cache_file);
+
+	if(opts.stats)
+		stats_begin();
+
+	// Before the workers start, so they are in its I/O class too
+	if(opts.throttle)
+		opts.throttle_state = throttle_create(opts.throttle_rate);
+
+	if(opts.connect && !opts.batch && (client = client_open(&opts, 0)) != NULL)
+	{
+		for(fi = begin; fi < end; fi++)
+		{
+			if((wp = calloc(1, sizeof(struct pax_work))) == NULL || (wp->path = strdup(argv[fi])) == NULL)
+				err(EXIT_FAILURE, "malloc()");
+			wp->pax_flags = opts.pax_flags;
+			client_submit(client, wp);
+		}
+		ret = client_finish(client, &totals);
+	}
+	else if(opts.server)
+		ret = run_server(&opts);
+	else if(opts.tar)
+		ret = run_tar(&opts);
+	else if(opts.live)
+		ret = run_live(&opts);
+	else if(opts.restart_file)
+		ret = run_restart(argv + begin, end - begin, &opts);
+	else if(opts.apply)
+		ret = run_apply(&opts);
+	else if(opts.restore_file)
+		ret = run_restore(&opts);
+	else if(opts.agent)
+		ret = run_agent(argv + begin, end - begin, &opts);
+	else if(opts.batch)
+		ret = run_batch(&opts);
+	else if(opts.tree)
+		ret = walk_trees(argv + begin, end - begin, &opts);
+	else
+		for(fi = begin; fi < end; fi++)
+		{
+			memset(&w, 0, sizeof(struct pax_work));
+			w.path = argv[fi];
+			w.fd = -1;
+			w.pax_flags = opts.pax_flags;
+			// The registry is asked first, with the file open
+			if(opts.registry && opts.policy)
+				w.need_policy = 1;
+			else if(opts.policy && !policy_classify(opts.policy, &w))
 			{
-				if(verbose)
-					printf("\topen(O_RDONLY) failed: cannot read/change PAX flags\n\n");
+				if(opts.verbose)
+					printf("%s:\n\tleft alone by the policy\n\n", w.path);
 				continue;
 			}
+			PAX_PROBE2(file__entry, w.path, w.pax_flags);
+			if(opts.throttle_state)
+				w.ret = throttle_process(opts.throttle_state, &w, &opts);
+			else
+				w.ret = process_file(&w, &opts);
+			PAX_PROBE3(file__return, w.path, w.pax_flags, w.ret);
+			ret |= w.ret;
 		}
 
-#ifdef XTPAX
-		if(cp_flags == CREATE_XT_FLAGS_SECURE || cp_flags == CREATE_XT_FLAGS_DEFAULT)
-			ret |= create_xt_flags(fd, cp_flags);
-		if(cp_flags == DELETE_XT_FLAGS)
-			ret |= delete_xt_flags(fd);
-#endif
+	if(opts.plan)
+		plan_close(opts.plan);
+
+	if(opts.snapshot)
+		snapshot_close(opts.snapshot);
+
+	if(opts.pseudo)
+		pseudo_close(opts.pseudo);
+
+	if(opts.registry)
+		ret |= registry_close(opts.registry);
 
 #if defined(PTPAX) && defined(XTPAX)
-		if(cp_flags == COPY_PT_TO_XT_FLAGS || (cp_flags == COPY_XT_TO_PT_FLAGS && rdwr_pt_pax))
-			ret |= copy_xt_flags(fd, cp_flags, verbose);
+	if(opts.reconcile)
+		ret |= reconcile_close(opts.reconcile_state);
 #endif
 
-		if(pax_flags != 0)
-			ret |= set_flags(fd, &pax_flags, rdwr_pt_pax, limit, verbose);
+	if(opts.throttle_state)
+		throttle_close(opts.throttle_state);
 
-		if(verbose == 1)
-			print_flags(fd, verbose);
+	if(opts.sync == SYNC_FS)
+		ret |= sync_finish();
 
-		close(fd);
+	elfix_cache_close(opts.cache);
 
-		if(verbose)
-			printf("\n");
-	}
+	if(opts.policy)
+		policy_free(opts.policy);
+
+	if(opts.stats)
+		stats_report(opts.stats_file);
 
 	exit(ret);
 }
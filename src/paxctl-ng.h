@@ -0,0 +1,417 @@
+/*
+	paxctl-ng.h: this file is part of the elfix package
+	Copyright (C) 2011  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PAXCTL_NG_H
+#define PAXCTL_NG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "elfix.h"
+
+#ifdef XTPAX
+ #include <sys/xattr.h>
+ #ifndef ENOATTR
+  #define ENOATTR ENODATA
+ #endif
+ #define CREATE_XT_FLAGS_SECURE         1
+ #define CREATE_XT_FLAGS_DEFAULT        2
+ #define DELETE_XT_FLAGS                3
+#endif
+
+#if defined(PTPAX) && defined(XTPAX)
+ #define COPY_PT_TO_XT_FLAGS            4
+ #define COPY_XT_TO_PT_FLAGS            5
+#endif
+
+#define LIMIT_TO_PT_FLAGS               6
+#define LIMIT_TO_XT_FLAGS               7
+
+/* Values for the options which only have a long form */
+#define OPT_IO_URING                    256
+#define OPT_STATS                       257
+#define OPT_SERVER                      258
+#define OPT_CONNECT                     259
+#define OPT_EXEC_AGENT                  260
+#define OPT_POLICY                      261
+#define OPT_PLAN                        262
+#define OPT_APPLY                       263
+#define OPT_CACHE                       264
+#define OPT_SNAPSHOT                    265
+#define OPT_DIFF                        266
+#define OPT_TAR                         267
+#define OPT_PSEUDO                      268
+#define OPT_PSEUDO_FORMAT               269
+#define OPT_SYNC                        270
+#define OPT_LIVE                        271
+#define OPT_RESTART                     272
+#define OPT_REPLACE_BUSY                273
+#define OPT_REGISTRY                    274
+#define OPT_RESTORE                     275
+#define OPT_RECONCILE                   276
+#define OPT_THROTTLE                    277
+#define OPT_ORDER                       278
+
+/* --sync: how far to go to make the marks survive a crash */
+#define SYNC_NONE                       0
+#define SYNC_FILE                       1
+#define SYNC_FS                         2
+
+/* --order: how to find where on the disk each file starts */
+#define ORDER_NONE                      0
+#define ORDER_EXTENT                    1
+#define ORDER_INODE                     2
+
+/* What set_flags() and friends wrote, see sync_file() */
+#define WROTE_PT                        1
+#define WROTE_XT                        2
+
+/* Options which apply to every file in a run */
+struct paxctl_opts
+{
+	uint16_t pax_flags;
+	int verbose;
+	int cp_flags;
+	int limit;
+	int tree;		/* -T: the arguments are directory trees */
+	int nthreads;		/* -j: worker threads for -T and -B */
+	char *batch;		/* -B: manifest of FLAGS<TAB>PATH records */
+	int batch_delim;	/* -0: records end in NUL rather than newline */
+	int uring_depth;	/* --io-uring: files kept in flight, 0 is off */
+	int stats;		/* --stats: report counters and timings */
+	char *stats_file;	/* --stats=FILE: as JSON to FILE, else a table on stderr */
+	char *server;		/* --server: listen for requests on this socket */
+	char *connect;		/* --connect: hand the work to a server on this socket */
+	int connect_env;	/* the socket came from $PAXCTL_NG_SOCKET, fall back if it is not there */
+	int agent;		/* --exec-agent: mark files on first exec */
+	char *agent_file;	/* as this manifest says, else as the --policy says */
+	char *policy_file;	/* --policy: take the flags from these rules */
+	struct pax_policy *policy;
+	char *plan_file;	/* --plan: write what -T or -B would do here, and do nothing */
+	struct pax_plan *plan;
+	char *apply;		/* --apply: carry out this plan */
+	char *cache_file;	/* --cache: answer reads of unchanged files from here */
+	elfix_cache_t *cache;
+	char *snapshot_file;	/* --snapshot: record the flags of every ELF object seen here */
+	struct pax_snapshot *snapshot;
+	int diff;		/* --diff: compare two snapshots */
+	int tar;		/* --tar: mark the ELF members of a tar stream from stdin to stdout */
+	char *pseudo_file;	/* --pseudo: write XATTR_PAX as image builder definitions here */
+	char *pseudo_format;	/* --pseudo-format: squashfs or getfattr */
+	struct pax_pseudo *pseudo;
+	int sync;		/* --sync: SYNC_NONE, SYNC_FILE or SYNC_FS */
+	int live;		/* --live: compare running processes with their binaries */
+	char *live_proc;	/* the proc filesystem to scan, else /proc */
+	char *restart_file;	/* --restart: find the processes using the files this plan or -B manifest changed */
+	int replace_busy;	/* --replace-busy: set PT_PAX of a running binary on a copy renamed over it */
+	char *registry_file;	/* --registry: mark known builds by their build-id, and record new ones */
+	struct pax_registry *registry;
+	char *restore_file;	/* --restore: put back the flags of this snapshot */
+	int reconcile;		/* --reconcile: find the objects whose PT_PAX and XATTR_PAX a kernel would refuse */
+	char *reconcile_source;	/* and copy this one, pt or xt, over the other */
+	struct pax_reconcile *reconcile_state;
+	int throttle;		/* --throttle: keep a scan out of the way of a loaded host */
+	char *throttle_rate;	/* FILES[,BYTES] a second */
+	struct pax_throttle *throttle_state;
+	int order;		/* --order: ORDER_NONE, ORDER_EXTENT or ORDER_INODE */
+};
+
+/* What setting the flags on one file would change, see compute_flags() */
+struct pax_change
+{
+	int pt_want, pt_write;
+	uint16_t pt_old, pt_new;	/* UINT16_MAX if there are none */
+	int xt_want, xt_write;
+	uint16_t xt_old, xt_new;
+};
+
+/* One file to be processed, either from argv or from a tree walk */
+struct pax_work
+{
+	char *path;
+	uint16_t pax_flags;
+	int fd;			/* already opened O_RDONLY by io_uring, else -1 */
+	int ret;
+	int not_elf;		/* only checked in tree mode */
+	int announced;		/* the "path:" header has been printed */
+	int changing;		/* we were asked to set or copy flags */
+	int written;		/* and at least one write was needed */
+	int errnum;		/* errno if the file could not be opened */
+	int query;		/* read the flags back into pt_flags and xt_flags */
+	int need_policy;	/* the policy must see the open file to decide */
+	int unmatched;		/* and it had nothing to say about it */
+	struct plan_entry *plan;	/* --apply: what the plan says to do */
+	int stale;		/* the file changed since the plan, so it was done afresh, or since the snapshot */
+	struct snap_restore *restore;	/* --restore: what the snapshot says it had */
+	size_t image_at;	/* --pseudo: the path in the image, which policies match, starts here */
+	uint16_t pt_flags;	/* UINT16_MAX if there are none */
+	uint16_t xt_flags;
+	const struct paxctl_opts *opts;		/* for this file only, else the pool's */
+	void (*done)(struct pax_work *);	/* the pool hands it back here rather than freeing it */
+	struct pax_work *next;
+};
+
+struct work_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct pax_work *head, *tail;
+	size_t queued;
+	int closed;
+};
+
+struct pool_totals
+{
+	unsigned long nfiles;
+	unsigned long nelf;
+	unsigned long nfailed;
+	unsigned long nwritten;
+	unsigned long nunchanged;
+	unsigned long nunmatched;
+	unsigned long nstale;
+	double secs;
+};
+
+/* Counters and phases for --stats, see stats.c */
+enum
+{
+	STAT_OPEN_RDWR,
+	STAT_OPEN_RDONLY,
+	STAT_OPEN_FAILED,
+	STAT_ELF_SESSIONS,
+	STAT_BYTES_READ,
+	STAT_XATTR_GET,
+	STAT_XATTR_SET,
+	STAT_XATTR_REMOVE,
+	STAT_ENOATTR,
+	STAT_NOT_ELF,
+	STAT_PT_WRITES,
+	STAT_CACHE_HIT,
+	STAT_CACHE_MISS,
+	STAT_FDATASYNC,
+	STAT_FSYNC,
+	STAT_SYNCFS,
+	STAT_REPLACED,
+	STAT_REPLACE_CLONE,
+	STAT_REPLACE_COPY,
+	STAT_REGISTRY_HIT,
+	STAT_REGISTRY_MISS,
+	STAT_PAGES_DROPPED,
+	STAT_ORDER_EXTENT,
+	STAT_ORDER_INODE,
+	STAT_URING_READ,
+	STAT_URING_GETXATTR,
+	STAT_COUNTERS
+};
+
+enum
+{
+	PHASE_OPEN,
+	PHASE_CREATE_DELETE,
+	PHASE_COPY,
+	PHASE_SET,
+	PHASE_PRINT,
+	PHASE_COUNT
+};
+
+struct pax_stats
+{
+	unsigned long count[STAT_COUNTERS];
+	double secs[PHASE_COUNT];
+};
+
+extern __thread struct pax_stats stats_local;
+
+#define STAT_INC(c)	(stats_local.count[(c)]++)
+#define STAT_ADD(c, n)	(stats_local.count[(c)] += (n))
+
+/* paxctl-ng.c */
+extern __thread elfix_t *elfix_local;
+elfix_t *local_elfix(void);
+void local_elfix_free(void);
+extern __thread FILE *out_local;
+FILE *local_out(void);
+int process_file(struct pax_work *, const struct paxctl_opts *);
+int reopen_rdwr(struct pax_work *, int *, const struct paxctl_opts *);
+#ifdef PTPAX
+uint16_t get_pt_flags(int, int);
+int set_pt_flags(int, uint16_t, int);
+#endif
+#ifdef XTPAX
+uint16_t get_xt_flags(int);
+int set_xt_flags(int, uint16_t);
+#endif
+#if defined(PTPAX) && defined(XTPAX)
+int copy_xt_flags(struct pax_work *, int *, int, const struct paxctl_opts *, int *);
+#endif
+uint16_t update_flags(uint16_t, uint16_t);
+void compute_flags(int, uint16_t, int, int, int, struct pax_change *);
+int set_flags(int, uint16_t *, int, int, int, int *);
+int apply_flags(int, const struct pax_change *, int, int *);
+
+/* pool.c */
+void queue_init(struct work_queue *);
+void queue_destroy(struct work_queue *);
+void queue_push(struct work_queue *, struct pax_work *);
+struct pax_work *queue_pop(struct work_queue *, int);
+void queue_close(struct work_queue *);
+
+struct pax_pool;
+struct pax_pool *pool_create(const struct paxctl_opts *, int);
+void pool_submit(struct pax_pool *, struct pax_work *);
+int pool_finish(struct pax_pool *, struct pool_totals *);
+void print_totals(const struct pool_totals *);
+
+/* tree.c */
+size_t inode_hash(dev_t, ino_t);
+int walk_trees(char **, int, const struct paxctl_opts *);
+
+/* batch.c */
+int read_manifest(const char *, int, int, void (*)(char *, uint16_t, void *), void *, unsigned long *);
+int run_batch(const struct paxctl_opts *);
+
+/* policy.c */
+#define POLICY_NONE                     0
+#define POLICY_MATCH                    1
+#define POLICY_NEED_FD                  2
+
+struct pax_policy;
+struct pax_policy *policy_load_manifest(const char *, int);
+struct pax_policy *policy_load_rules(const char *);
+int policy_match(const struct pax_policy *, const char *, int, uint16_t *);
+int policy_classify(const struct pax_policy *, struct pax_work *);
+void policy_free(struct pax_policy *);
+
+/* plan.c */
+#define PLAN_MAGIC                      "# paxctl-ng plan"
+
+struct pax_plan;
+struct plan_entry;
+struct pax_plan *plan_create(const char *, const struct paxctl_opts *);
+int plan_file(struct pax_plan *, struct pax_work *, int, int, int);
+void plan_close(struct pax_plan *);
+int apply_file(struct pax_work *, const struct paxctl_opts *);
+int run_apply(const struct paxctl_opts *);
+int plan_changed(FILE *, const char *, void (*)(dev_t, ino_t, const char *, void *), void *, unsigned long *);
+
+/* snapshot.c */
+struct pax_snapshot;
+struct pax_snapshot *snapshot_create(const char *);
+void snapshot_file(struct pax_snapshot *, const char *, int, uint16_t, uint16_t);
+void snapshot_close(struct pax_snapshot *);
+int run_diff(const char *, const char *);
+int restore_file(struct pax_work *, const struct paxctl_opts *);
+int run_restore(const struct paxctl_opts *);
+
+/* pseudo.c */
+struct pax_pseudo;
+struct pax_pseudo *pseudo_create(const char *, const char *, const struct paxctl_opts *);
+int pseudo_file(struct pax_pseudo *, struct pax_work *, int *, const struct paxctl_opts *, int *);
+void pseudo_close(struct pax_pseudo *);
+
+/* tar.c */
+int run_tar(const struct paxctl_opts *);
+
+/* sync.c */
+int sync_file(const struct paxctl_opts *, const char *, int, int);
+int sync_finish(void);
+
+/* live.c */
+int run_live(const struct paxctl_opts *);
+
+/* restart.c */
+int run_restart(char **, int, const struct paxctl_opts *);
+
+/* replace.c */
+#ifdef PTPAX
+int replace_busy(struct pax_work *, int *, const struct paxctl_opts *, int *);
+#endif
+
+/* registry.c */
+struct registry_key
+{
+	unsigned char id[ELFIX_BUILD_ID_MAX];
+	size_t len;		/* 0 if the file has no build-id */
+};
+
+struct pax_registry;
+struct pax_registry *registry_open(const char *);
+int registry_lookup(struct pax_registry *, struct pax_work *, int, struct registry_key *);
+void registry_record(struct pax_registry *, const struct registry_key *, const struct pax_work *);
+int registry_close(struct pax_registry *);
+
+/* reconcile.c */
+#if defined(PTPAX) && defined(XTPAX)
+struct pax_reconcile;
+struct pax_reconcile *reconcile_create(const char *);
+int reconcile_file(struct pax_reconcile *, struct pax_work *, int *, const struct paxctl_opts *, int *);
+int reconcile_close(struct pax_reconcile *);
+#endif
+
+/* throttle.c */
+#define THROTTLE_PAGES	16	/* of the head of a file, which is all we read of most */
+
+struct throttle_pages
+{
+	void *map;		/* NULL if we could not tell */
+	size_t len;
+	unsigned char resident[THROTTLE_PAGES];
+};
+
+struct pax_throttle;
+struct pax_throttle *throttle_create(const char *);
+int throttle_process(struct pax_throttle *, struct pax_work *, const struct paxctl_opts *);
+int throttle_open(const char *, int);
+void throttle_mark(int, struct throttle_pages *);
+void throttle_drop(struct pax_throttle *, int, struct throttle_pages *);
+void throttle_close(struct pax_throttle *);
+
+/* order.c */
+void order_work(struct pax_work **, size_t, int);
+
+/* agent.c */
+int run_agent(char **, int, const struct paxctl_opts *);
+
+/* server.c */
+int run_server(const struct paxctl_opts *);
+
+/* client.c */
+struct pax_client;
+struct pax_client *client_open(const struct paxctl_opts *, int);
+void client_submit(struct pax_client *, struct pax_work *);
+int client_finish(struct pax_client *, struct pool_totals *);
+
+/* stats.c */
+void stats_begin(void);
+double stats_now(void);
+void stats_phase(int, double);
+void stats_merge(void);
+void stats_report(const char *);
+
+/* uring.c */
+#ifdef IOURING
+struct uring_prefetch;
+struct uring_prefetch *uring_prefetch_create(const struct paxctl_opts *);
+void uring_prefetch_run(struct uring_prefetch *, struct work_queue *, struct work_queue *);
+void uring_prefetch_destroy(struct uring_prefetch *);
+#endif
+
+#endif
@@ -0,0 +1,561 @@
+/*
+	plan.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --plan and --apply.  A -T or -B run with --plan reads the flags of
+ * every file on the worker pool as usual, but rather than writing it
+ * records what it would do in the plan file, one line per file:
+ *
+ *	ACTION DEV INO CTIME FLAGS PT_OLD PT_NEW XT_OLD XT_NEW PATH
+ *
+ * separated by tabs.  ACTION is keep, pt, xt or pt+xt, for which fields
+ * need writing.  CTIME is seconds.nanoseconds.  FLAGS is what was asked
+ * for and the rest are the flags before and after, all as four hex
+ * digits, 'none' if the field is missing or '-' if it is not touched.
+ * PATH has any newline, tab or backslash in it as a \ooo octal escape,
+ * as a file name may hold them.  The first line gives the version and
+ * the -L/-l of the run.
+ *
+ * --apply then carries the plan out.  A file whose device, inode and
+ * ctime are still as planned is not read again: its new flags are just
+ * written, and a keep costs one stat().  Anything else has changed since
+ * and is done afresh with its FLAGS, as -B would.
+ */
+#define PLAN_VERSION	2
+
+#define ACT_PT		1
+#define ACT_XT		2
+
+struct plan_entry
+{
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+	uint16_t req;
+	int action;
+	uint16_t pt_new, xt_new;
+};
+
+struct pax_plan
+{
+	FILE *f;
+	char *file;
+	int limit;
+	pthread_mutex_t lock;
+	unsigned long nfiles, nwrite;
+};
+
+static const char *limit_names[] = { "both", "pt", "xt" };
+
+
+static int
+limit_index(int limit)
+{
+	if(limit == LIMIT_TO_PT_FLAGS)
+		return 1;
+	if(limit == LIMIT_TO_XT_FLAGS)
+		return 2;
+	return 0;
+}
+
+
+struct pax_plan *
+plan_create(const char *file, const struct paxctl_opts *opts)
+{
+	struct pax_plan *plan;
+
+	if((plan = calloc(1, sizeof(struct pax_plan))) == NULL || (plan->file = strdup(file)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	if((plan->f = fopen(file, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	plan->limit = opts->limit;
+	pthread_mutex_init(&plan->lock, NULL);
+
+	fprintf(plan->f, PLAN_MAGIC " %d limit=%s\n", PLAN_VERSION, limit_names[limit_index(opts->limit)]);
+	fprintf(plan->f, "# ACTION\tDEV\tINO\tCTIME\tFLAGS\tPT_OLD\tPT_NEW\tXT_OLD\tXT_NEW\tPATH\n");
+
+	return plan;
+}
+
+
+static void
+hex_field(char *buf, size_t len, int want, uint16_t flags)
+{
+	if(!want)
+		snprintf(buf, len, "-");
+	else if(flags == UINT16_MAX)
+		snprintf(buf, len, "none");
+	else
+		snprintf(buf, len, "%04x", flags);
+}
+
+
+static void
+print_change(const char *name, uint16_t old, uint16_t new)
+{
+	char obuf[ELFIX_FLAGS_SIZE], nbuf[ELFIX_FLAGS_SIZE];
+
+	memset(obuf, 0, ELFIX_FLAGS_SIZE);
+	memset(nbuf, 0, ELFIX_FLAGS_SIZE);
+	elfix_bin2string4print(new, nbuf);
+	if(old == UINT16_MAX)
+		fprintf(local_out(), "\tplan: %s not found -> %s\n", name, nbuf);
+	else
+	{
+		elfix_bin2string4print(old, obuf);
+		fprintf(local_out(), "\tplan: %s %s -> %s\n", name, obuf, nbuf);
+	}
+}
+
+
+// One plan record per line, so PATH cannot have a raw newline or tab
+static void
+put_path(FILE *f, const char *path)
+{
+	const char *p;
+
+	for(p = path; *p; p++)
+	{
+		if(*p == '\n' || *p == '\t' || *p == '\\')
+			fprintf(f, "\\%03o", (unsigned char)*p);
+		else
+			fputc(*p, f);
+	}
+}
+
+
+// Called from process_file() in place of setting the flags
+int
+plan_file(struct pax_plan *plan, struct pax_work *w, int fd, int rdwr_pt_pax, int verbose)
+{
+	struct pax_change c;
+	struct stat st;
+	char pt_old[8], pt_new[8], xt_old[8], xt_new[8];
+	const char *action;
+
+	if(w->pax_flags == 0)
+		return EXIT_SUCCESS;
+
+	if(fstat(fd, &st) < 0)
+	{
+		if(verbose)
+			fprintf(local_out(), "\tfstat() failed: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	compute_flags(fd, w->pax_flags, rdwr_pt_pax, plan->limit, verbose, &c);
+
+	hex_field(pt_old, sizeof(pt_old), c.pt_want, c.pt_old);
+	hex_field(pt_new, sizeof(pt_new), c.pt_want, c.pt_new);
+	hex_field(xt_old, sizeof(xt_old), c.xt_want, c.xt_old);
+	hex_field(xt_new, sizeof(xt_new), c.xt_want, c.xt_new);
+
+	if(c.pt_write && c.xt_write)
+		action = "pt+xt";
+	else if(c.pt_write)
+		action = "pt";
+	else if(c.xt_write)
+		action = "xt";
+	else
+		action = "keep";
+
+	if(verbose)
+	{
+		if(c.pt_write)
+			print_change("PT_PAX   ", c.pt_old, c.pt_new);
+		if(c.xt_write)
+			print_change("XATTR_PAX", c.xt_old, c.xt_new);
+		if(!c.pt_write && !c.xt_write)
+			fprintf(local_out(), "\tplan: up to date\n");
+	}
+
+	pthread_mutex_lock(&plan->lock);
+	fprintf(plan->f, "%s\t%ju\t%ju\t%jd.%09ld\t%04x\t%s\t%s\t%s\t%s\t",
+		action, (uintmax_t)st.st_dev, (uintmax_t)st.st_ino,
+		(intmax_t)st.st_ctim.tv_sec, st.st_ctim.tv_nsec, w->pax_flags,
+		pt_old, pt_new, xt_old, xt_new);
+	put_path(plan->f, w->path);
+	fputc('\n', plan->f);
+	plan->nfiles++;
+	if(c.pt_write || c.xt_write)
+		plan->nwrite++;
+	pthread_mutex_unlock(&plan->lock);
+
+	return EXIT_SUCCESS;
+}
+
+
+void
+plan_close(struct pax_plan *plan)
+{
+	fprintf(plan->f, "# %lu files, %lu to write\n", plan->nfiles, plan->nwrite);
+
+	if(fclose(plan->f) != 0)
+		err(EXIT_FAILURE, "%s", plan->file);
+
+	printf("plan: %lu files, %lu to write, %lu up to date, in %s\n",
+		plan->nfiles, plan->nwrite, plan->nfiles - plan->nwrite, plan->file);
+
+	pthread_mutex_destroy(&plan->lock);
+	free(plan->file);
+	free(plan);
+}
+
+
+static int
+same_file(const struct plan_entry *e, const struct stat *st)
+{
+	return e->dev == st->st_dev && e->ino == st->st_ino &&
+		e->ctime.tv_sec == st->st_ctim.tv_sec && e->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+
+/*
+ * Called from process_file() for each file of an --apply.  If the file
+ * has changed since the plan, fall back to setting its flags afresh.
+ */
+int
+apply_file(struct pax_work *w, const struct paxctl_opts *opts)
+{
+	struct plan_entry *e = w->plan;
+	struct stat st;
+	int fd, ret = EXIT_SUCCESS;
+
+	w->changing = 1;
+
+	if(e->action == 0)
+	{
+		if(stat(w->path, &st) < 0)
+		{
+			w->errnum = errno;
+			return errno == ENOENT ? ENOENT : EXIT_FAILURE;
+		}
+		if(same_file(e, &st))
+			return EXIT_SUCCESS;
+		goto stale;
+	}
+
+	if((fd = open(w->path, e->action & ACT_PT ? O_RDWR : O_RDONLY)) < 0)
+	{
+		w->errnum = errno;
+		STAT_INC(STAT_OPEN_FAILED);
+		if(errno == ENOENT)
+			return ENOENT;
+		// Perhaps it is busy now, see if a fresh look can do better
+		goto stale;
+	}
+	STAT_INC(e->action & ACT_PT ? STAT_OPEN_RDWR : STAT_OPEN_RDONLY);
+
+	if(fstat(fd, &st) < 0 || !same_file(e, &st))
+	{
+		close(fd);
+		goto stale;
+	}
+
+#ifdef PTPAX
+	if(e->action & ACT_PT)
+		ret |= set_pt_flags(fd, e->pt_new, opts->verbose);
+#endif
+#ifdef XTPAX
+	if(e->action & ACT_XT)
+		ret |= set_xt_flags(fd, e->xt_new);
+#endif
+	w->written = ret == EXIT_SUCCESS;
+
+	if(opts->sync && w->written)
+		ret |= sync_file(opts, w->path, fd, (e->action & ACT_PT ? WROTE_PT : 0) | (e->action & ACT_XT ? WROTE_XT : 0));
+
+	if(opts->verbose)
+		fprintf(local_out(), "%s:\n\t%s\n\n", w->path, ret == EXIT_SUCCESS ? "written as planned" : "write failed");
+
+	close(fd);
+	return ret;
+
+stale:
+	w->stale = 1;
+	w->errnum = 0;
+	w->pax_flags = e->req;
+	return process_file(w, opts);
+}
+
+
+static void
+apply_done(struct pax_work *w)
+{
+	free(w->plan);
+	free(w->path);
+	free(w);
+}
+
+
+static int
+parse_field(const char *s, int want, uint16_t *flags)
+{
+	unsigned long v;
+	char *end;
+
+	if(!strcmp(s, "-") || !strcmp(s, "none"))
+		return want ? -1 : 0;
+
+	v = strtoul(s, &end, 16);
+	if(*end != '\0' || end == s || v > UINT16_MAX)
+		return -1;
+	*flags = v;
+	return 0;
+}
+
+
+// Undo put_path() in place, -1 for a bad escape
+static int
+get_path(char *path)
+{
+	char *p, *q;
+	int i, c;
+
+	for(p = q = path; *p; p++)
+	{
+		if(*p != '\\')
+		{
+			*q++ = *p;
+			continue;
+		}
+		for(i = 1, c = 0; i <= 3; i++)
+		{
+			if(p[i] < '0' || p[i] > '7')
+				return -1;
+			c = c * 8 + p[i] - '0';
+		}
+		if(c == 0 || c > UCHAR_MAX)
+			return -1;
+		*q++ = c;
+		p += 3;
+	}
+	*q = '\0';
+
+	return 0;
+}
+
+
+// Split one plan line into e and *path, returns -1 if it is not right
+static int
+parse_entry(char *line, struct plan_entry *e, char **path)
+{
+	char *field[10], *p, *end;
+	unsigned long long v;
+	int i;
+
+	for(i = 0, p = line; i < 9; i++)
+	{
+		field[i] = p;
+		if((p = strchr(p, '\t')) == NULL)
+			return -1;
+		*p++ = '\0';
+	}
+	field[9] = p;
+	if(*p == '\0')
+		return -1;
+
+	memset(e, 0, sizeof(struct plan_entry));
+	if(!strcmp(field[0], "pt"))
+		e->action = ACT_PT;
+	else if(!strcmp(field[0], "xt"))
+		e->action = ACT_XT;
+	else if(!strcmp(field[0], "pt+xt"))
+		e->action = ACT_PT | ACT_XT;
+	else if(strcmp(field[0], "keep"))
+		return -1;
+
+	v = strtoull(field[1], &end, 10);
+	if(*end != '\0' || end == field[1])
+		return -1;
+	e->dev = v;
+
+	v = strtoull(field[2], &end, 10);
+	if(*end != '\0' || end == field[2])
+		return -1;
+	e->ino = v;
+
+	e->ctime.tv_sec = strtoll(field[3], &end, 10);
+	if(*end != '.')
+		return -1;
+	e->ctime.tv_nsec = strtol(end + 1, &end, 10);
+	if(*end != '\0')
+		return -1;
+
+	if(parse_field(field[4], 1, &e->req) < 0
+			|| parse_field(field[6], e->action & ACT_PT, &e->pt_new) < 0
+			|| parse_field(field[8], e->action & ACT_XT, &e->xt_new) < 0)
+		return -1;
+
+	if(get_path(field[9]) < 0)
+		return -1;
+
+	*path = field[9];
+	return 0;
+}
+
+
+/*
+ * For --restart: hand fn the device, inode and path of each file the
+ * plan in f, already read past its first line, writes to.
+ */
+int
+plan_changed(FILE *f, const char *file, void (*fn)(dev_t, ino_t, const char *, void *), void *arg, unsigned long *nbad)
+{
+	struct plan_entry e;
+	char *line = NULL, *path;
+	size_t len = 0;
+	ssize_t n;
+	unsigned long lineno = 1;
+	int ret = EXIT_SUCCESS;
+
+	while((n = getline(&line, &len, f)) != -1)
+	{
+		lineno++;
+
+		if(n > 0 && line[n-1] == '\n')
+			line[--n] = '\0';
+		if(n == 0 || line[0] == '#')
+			continue;
+
+		if(parse_entry(line, &e, &path) < 0)
+		{
+			warnx("%s:%lu: bad plan record", file, lineno);
+			(*nbad)++;
+			continue;
+		}
+
+		if(e.action)
+			fn(e.dev, e.ino, path, arg);
+	}
+
+	if(ferror(f))
+	{
+		warn("%s", file);
+		ret = EXIT_FAILURE;
+	}
+
+	free(line);
+	return ret;
+}
+
+
+int
+run_apply(const struct paxctl_opts *opts)
+{
+	struct paxctl_opts aopts;
+	struct pax_pool *pool;
+	struct pool_totals totals;
+	struct pax_work *w;
+	struct plan_entry e;
+	FILE *f;
+	char *line = NULL, *path, limit[8];
+	size_t len = 0;
+	ssize_t n;
+	unsigned long lineno = 0, nbad = 0;
+	int version, i, ret = EXIT_SUCCESS;
+
+	if(!strcmp(opts->apply, "-"))
+		f = stdin;
+	else if((f = fopen(opts->apply, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", opts->apply);
+
+	// The plan decides -L and -l, for the files done afresh
+	aopts = *opts;
+	aopts.uring_depth = 0;
+	if(getline(&line, &len, f) < 0
+			|| sscanf(line, PLAN_MAGIC " %d limit=%7s", &version, limit) != 2
+			|| version != PLAN_VERSION)
+		errx(EXIT_FAILURE, "%s: not a version %d plan", opts->apply, PLAN_VERSION);
+	lineno++;
+
+	for(i = 0; i < 3; i++)
+		if(!strcmp(limit, limit_names[i]))
+			break;
+	if(i == 3)
+		errx(EXIT_FAILURE, "%s: unknown limit '%s'", opts->apply, limit);
+	aopts.limit = i == 1 ? LIMIT_TO_PT_FLAGS : i == 2 ? LIMIT_TO_XT_FLAGS : 0;
+
+	pool = pool_create(&aopts, 1);
+
+	while((n = getline(&line, &len, f)) != -1)
+	{
+		lineno++;
+
+		if(n > 0 && line[n-1] == '\n')
+			line[--n] = '\0';
+		if(n == 0 || line[0] == '#')
+			continue;
+
+		if(parse_entry(line, &e, &path) < 0)
+		{
+			warnx("%s:%lu: bad plan record", opts->apply, lineno);
+			nbad++;
+			continue;
+		}
+
+		if((w = calloc(1, sizeof(struct pax_work))) == NULL || (w->path = strdup(path)) == NULL
+				|| (w->plan = malloc(sizeof(struct plan_entry))) == NULL)
+			err(EXIT_FAILURE, "malloc()");
+		*w->plan = e;
+		w->fd = -1;
+		w->done = apply_done;
+		pool_submit(pool, w);
+	}
+
+	if(ferror(f))
+	{
+		warn("%s", opts->apply);
+		ret |= EXIT_FAILURE;
+	}
+
+	free(line);
+	if(f != stdin)
+		fclose(f);
+
+	ret |= pool_finish(pool, &totals);
+	if(nbad)
+		ret |= EXIT_FAILURE;
+
+	printf("%lu files, %lu ok, %lu failed, %lu bad records\n",
+		totals.nfiles, totals.nfiles - totals.nfailed, totals.nfailed, nbad);
+	printf("%lu changed since the plan and done afresh\n", totals.nstale);
+	print_totals(&totals);
+
+	return ret;
+}
@@ -0,0 +1,690 @@
+/*
+	policy.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <regex.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * Which flags a given path should have.  A policy is an ordered list of
+ * rules and the first one which matches wins.  See paxctl-ng(1) for the
+ * file format; a -B manifest can also be loaded as a policy, each record
+ * becoming a path= rule.
+ *
+ * So that matching does not cost more as the rules pile up, they are
+ * compiled into two indexes.  path= rules go in a hash table keyed on
+ * the path.  Every other rule hangs off a byte trie at the node for the
+ * literal text its pattern has to start with, eg. /usr/lib/ for
+ * glob=/usr/lib/lib*.so or prefix=/usr/lib/.  A lookup walks the path down
+ * the trie once and only tries the rules it meets on the way.
+ */
+#define MATCH_PATH	0
+#define MATCH_PREFIX	1
+#define MATCH_GLOB	2
+#define MATCH_REGEX	3
+#define MATCH_ANY	4
+
+#define TYPE_EXEC	1
+#define TYPE_PIE	2
+#define TYPE_LIB	4
+#define TYPE_REL	8
+
+struct policy_rule
+{
+	int kind;
+	char *pattern;
+	regex_t re;
+	int types;		/* TYPE_ bits, 0 for any */
+	char *soname;		/* glob, or NULL for any */
+	uint16_t flags;
+};
+
+/* Indexes into the rule array, always in ascending order */
+struct rule_list
+{
+	unsigned *idx;
+	size_t n;
+};
+
+struct trie_node
+{
+	unsigned char *keys;	/* sorted, for a binary search */
+	struct trie_node **kids;
+	size_t nkids;
+	struct rule_list rules;
+};
+
+struct policy_entry
+{
+	char *path;
+	struct rule_list rules;
+};
+
+struct pax_policy
+{
+	struct policy_rule *rule;
+	size_t nrules, size;
+
+	struct policy_entry *slot;
+	size_t nslots, used;
+
+	struct trie_node root;
+};
+
+static size_t
+path_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for(; *path; path++)
+	{
+		h ^= (unsigned char)*path;
+		h *= 0x100000001b3ULL;
+	}
+	return (size_t)h;
+}
+
+
+static void
+list_add(struct rule_list *l, unsigned i)
+{
+	// Powers of two, so only grow when n is one
+	if((l->n & (l->n - 1)) == 0)
+		if((l->idx = realloc(l->idx, (l->n ? 2 * l->n : 1) * sizeof(unsigned))) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	l->idx[l->n++] = i;
+}
+
+
+static struct policy_entry *
+entry_slot(const struct pax_policy *pol, const char *path)
+{
+	size_t j, mask = pol->nslots - 1;
+
+	for(j = path_hash(path) & mask; pol->slot[j].path; j = (j + 1) & mask)
+		if(!strcmp(pol->slot[j].path, path))
+			break;
+
+	return &pol->slot[j];
+}
+
+
+static struct policy_entry *
+entry_add(struct pax_policy *pol, const char *path)
+{
+	struct policy_entry *e;
+	size_t i;
+
+	if(2 * (pol->used + 1) > pol->nslots)
+	{
+		struct pax_policy bigger;
+
+		bigger.nslots = pol->nslots ? 2 * pol->nslots : 1024;
+		if((bigger.slot = calloc(bigger.nslots, sizeof(*bigger.slot))) == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		for(i = 0; i < pol->nslots; i++)
+			if(pol->slot[i].path)
+				*entry_slot(&bigger, pol->slot[i].path) = pol->slot[i];
+
+		free(pol->slot);
+		pol->slot = bigger.slot;
+		pol->nslots = bigger.nslots;
+	}
+
+	e = entry_slot(pol, path);
+	if(!e->path)
+	{
+		if((e->path = strdup(path)) == NULL)
+			err(EXIT_FAILURE, "strdup()");
+		pol->used++;
+	}
+
+	return e;
+}
+
+
+static struct trie_node *
+trie_child(struct trie_node *node, unsigned char c, int create)
+{
+	struct trie_node *kid;
+	size_t lo = 0, hi = node->nkids, mid;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(node->keys[mid] == c)
+			return node->kids[mid];
+		if(node->keys[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if(!create)
+		return NULL;
+
+	if((kid = calloc(1, sizeof(struct trie_node))) == NULL
+			|| (node->keys = realloc(node->keys, node->nkids + 1)) == NULL
+			|| (node->kids = realloc(node->kids, (node->nkids + 1) * sizeof(*node->kids))) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	memmove(node->keys + lo + 1, node->keys + lo, node->nkids - lo);
+	memmove(node->kids + lo + 1, node->kids + lo, (node->nkids - lo) * sizeof(*node->kids));
+	node->keys[lo] = c;
+	node->kids[lo] = kid;
+	node->nkids++;
+
+	return kid;
+}
+
+
+static void
+trie_free(struct trie_node *node)
+{
+	size_t i;
+
+	for(i = 0; i < node->nkids; i++)
+	{
+		trie_free(node->kids[i]);
+		free(node->kids[i]);
+	}
+	free(node->keys);
+	free(node->kids);
+	free(node->rules.idx);
+}
+
+
+/*
+ * How many leading bytes of the pattern are plain text, which any path
+ * it matches must start with.
+ */
+static size_t
+literal_prefix(int kind, const char *pattern)
+{
+	size_t n = 0;
+
+	switch(kind)
+	{
+		case MATCH_PATH:
+		case MATCH_PREFIX:
+			return strlen(pattern);
+
+		case MATCH_GLOB:
+			while(pattern[n] && !strchr("*?[\\", pattern[n]))
+				n++;
+			return n;
+
+		case MATCH_REGEX:
+			// Only an anchored regex without alternatives has a prefix
+			if(pattern[0] != '^' || strchr(pattern, '|'))
+				return 0;
+			while(pattern[n + 1] && !strchr(".[]()*+?{}\\$^", pattern[n + 1]))
+				n++;
+			// The last letter may be optional, as in ^/usr/libx?
+			if(n > 0 && pattern[n + 1] && strchr("*?{", pattern[n + 1]))
+				n--;
+			return n;
+	}
+
+	return 0;
+}
+
+
+static unsigned
+rule_add(struct pax_policy *pol, int kind, const char *pattern, uint16_t flags)
+{
+	struct policy_rule *r;
+
+	if(pol->nrules == pol->size)
+	{
+		pol->size = pol->size ? 2 * pol->size : 64;
+		if((pol->rule = realloc(pol->rule, pol->size * sizeof(struct policy_rule))) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	}
+
+	r = &pol->rule[pol->nrules];
+	memset(r, 0, sizeof(struct policy_rule));
+	r->kind = kind;
+	r->flags = flags;
+	if(pattern && (r->pattern = strdup(pattern)) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+
+	return pol->nrules++;
+}
+
+
+// Put a rule which is complete in the index which suits it
+static void
+rule_index(struct pax_policy *pol, unsigned i)
+{
+	struct policy_rule *r = &pol->rule[i];
+	struct trie_node *node = &pol->root;
+	size_t j, n;
+
+	if(r->kind == MATCH_PATH)
+	{
+		list_add(&entry_add(pol, r->pattern)->rules, i);
+		return;
+	}
+
+	n = r->kind == MATCH_ANY ? 0 : literal_prefix(r->kind, r->pattern);
+	for(j = 0; j < n; j++)
+		node = trie_child(node, (r->kind == MATCH_REGEX ? r->pattern + 1 : r->pattern)[j], 1);
+
+	list_add(&node->rules, i);
+}
+
+
+static struct pax_policy *
+policy_new(void)
+{
+	struct pax_policy *pol;
+
+	if((pol = calloc(1, sizeof(struct pax_policy))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	return pol;
+}
+
+
+// A manifest record; a path given twice gets the flags of its last record, as with -B
+static void
+policy_record(char *path, uint16_t flags, void *arg)
+{
+	struct pax_policy *pol = arg;
+	struct policy_entry *e;
+
+	if(pol->used && (e = entry_slot(pol, path))->path)
+	{
+		pol->rule[e->rules.idx[0]].flags = flags;
+		return;
+	}
+
+	rule_index(pol, rule_add(pol, MATCH_PATH, path, flags));
+}
+
+
+struct pax_policy *
+policy_load_manifest(const char *file, int delim)
+{
+	struct pax_policy *pol = policy_new();
+	unsigned long nbad = 0;
+
+	if(read_manifest(file, delim, 0, policy_record, pol, &nbad) != EXIT_SUCCESS || nbad)
+		errx(EXIT_FAILURE, "%s: cannot use a policy with bad records", file);
+
+	return pol;
+}
+
+
+static int
+parse_types(const char *s, int *types)
+{
+	static const struct { const char *name; int bit; } names[] = {
+		{ "exec", TYPE_EXEC }, { "pie", TYPE_PIE },
+		{ "lib", TYPE_LIB }, { "rel", TYPE_REL }
+	};
+	size_t i, n;
+
+	*types = 0;
+	while(*s)
+	{
+		n = strcspn(s, ",");
+		for(i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+			if(strlen(names[i].name) == n && !strncmp(s, names[i].name, n))
+				break;
+		if(i == sizeof(names) / sizeof(names[0]))
+			return -1;
+		*types |= names[i].bit;
+		s += n;
+		if(*s == ',')
+			s++;
+	}
+
+	return *types ? 0 : -1;
+}
+
+
+/*
+ * Parse one rule: FLAGS followed by KEY=VALUE words.  Returns -1 after
+ * warning if the line is no good.
+ */
+static int
+parse_rule(struct pax_policy *pol, char *line, const char *file, unsigned long lineno)
+{
+	static const char *kinds[] = { "path", "prefix", "glob", "regex" };
+	char *word, *save, *val;
+	char *pattern = NULL, *soname = NULL;
+	int kind = MATCH_ANY, types = 0, e;
+	uint16_t flags;
+	struct policy_rule *r;
+	size_t k;
+	unsigned i;
+
+	word = strtok_r(line, " \t", &save);
+	if(elfix_parse_flags(word, &flags) < 0)
+	{
+		warnx("%s:%lu: invalid flags '%s'", file, lineno, word);
+		return -1;
+	}
+
+	while((word = strtok_r(NULL, " \t", &save)) != NULL)
+	{
+		if((val = strchr(word, '=')) == NULL || val[1] == '\0')
+		{
+			warnx("%s:%lu: expected KEY=VALUE, not '%s'", file, lineno, word);
+			return -1;
+		}
+		*val++ = '\0';
+
+		for(k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+			if(!strcmp(word, kinds[k]))
+				break;
+
+		if(k < sizeof(kinds) / sizeof(kinds[0]))
+		{
+			if(pattern)
+			{
+				warnx("%s:%lu: only one of path=, prefix=, glob= or regex= per rule", file, lineno);
+				return -1;
+			}
+			kind = k;
+			pattern = val;
+		}
+		else if(!strcmp(word, "type"))
+		{
+			if(parse_types(val, &types) < 0)
+			{
+				warnx("%s:%lu: type= takes exec, pie, lib or rel, not '%s'", file, lineno, val);
+				return -1;
+			}
+		}
+		else if(!strcmp(word, "soname"))
+			soname = val;
+		else
+		{
+			warnx("%s:%lu: unknown key '%s'", file, lineno, word);
+			return -1;
+		}
+	}
+
+	i = rule_add(pol, kind, pattern, flags);
+	r = &pol->rule[i];
+	r->types = types;
+	if(soname && (r->soname = strdup(soname)) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+
+	if(kind == MATCH_REGEX && (e = regcomp(&r->re, pattern, REG_EXTENDED | REG_NOSUB)) != 0)
+	{
+		char buf[256];
+
+		regerror(e, &r->re, buf, sizeof(buf));
+		warnx("%s:%lu: %s: %s", file, lineno, pattern, buf);
+		free(r->pattern);
+		free(r->soname);
+		pol->nrules--;
+		return -1;
+	}
+
+	rule_index(pol, i);
+	return 0;
+}
+
+
+struct pax_policy *
+policy_load_rules(const char *file)
+{
+	struct pax_policy *pol = policy_new();
+	FILE *f;
+	char *line = NULL, *p;
+	size_t len = 0;
+	ssize_t n;
+	unsigned long lineno = 0, nbad = 0;
+
+	if(!strcmp(file, "-"))
+		f = stdin;
+	else if((f = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	while((n = getline(&line, &len, f)) != -1)
+	{
+		lineno++;
+
+		if((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for(p = line; isspace((unsigned char)*p); p++)
+			;
+		if(*p == '\0')
+			continue;
+		n = strlen(p);
+		while(n > 0 && isspace((unsigned char)p[n-1]))
+			p[--n] = '\0';
+
+		if(parse_rule(pol, p, file, lineno) < 0)
+			nbad++;
+	}
+
+	if(ferror(f))
+		err(EXIT_FAILURE, "%s", file);
+
+	free(line);
+	if(f != stdin)
+		fclose(f);
+
+	if(nbad)
+		errx(EXIT_FAILURE, "%s: %lu bad rule(s)", file, nbad);
+
+	return pol;
+}
+
+
+static int
+type_of(const struct elfix_elf_info *info)
+{
+	switch(info->type)
+	{
+		case ET_EXEC:
+			return TYPE_EXEC;
+		case ET_DYN:
+			return info->has_interp ? TYPE_PIE : TYPE_LIB;
+		case ET_REL:
+			return TYPE_REL;
+	}
+	return 0;
+}
+
+
+/*
+ * Does rule r match?  The ELF conditions need fd, and the headers are
+ * only read the first time one of them is asked about.  Returns 1 or 0,
+ * or -1 if we would need to look at the file and fd is -1.
+ */
+static int
+rule_matches(const struct policy_rule *r, const char *path, int fd,
+	struct elfix_elf_info *info, int *have_info)
+{
+	switch(r->kind)
+	{
+		case MATCH_PATH:
+			if(strcmp(path, r->pattern))
+				return 0;
+			break;
+		case MATCH_PREFIX:
+			if(strncmp(path, r->pattern, strlen(r->pattern)))
+				return 0;
+			break;
+		case MATCH_GLOB:
+			if(fnmatch(r->pattern, path, FNM_PATHNAME) != 0)
+				return 0;
+			break;
+		case MATCH_REGEX:
+			if(regexec(&r->re, path, 0, NULL, 0) != 0)
+				return 0;
+			break;
+	}
+
+	if(r->types == 0 && r->soname == NULL)
+		return 1;
+
+	if(fd < 0)
+		return -1;
+
+	if(*have_info == 0)
+		*have_info = elfix_get_elf_info(local_elfix(), fd, info) == ELFIX_OK ? 1 : -1;
+
+	// Not an ELF object, so it has no type or soname to match
+	if(*have_info < 0)
+		return 0;
+
+	if(r->types && !(r->types & type_of(info)))
+		return 0;
+
+	if(r->soname && fnmatch(r->soname, info->soname, 0) != 0)
+		return 0;
+
+	return 1;
+}
+
+
+/*
+ * Try the rules in l which come before *best, in order.  The first to
+ * match becomes *best.  If one of them needs fd first, it goes in
+ * *need_fd instead, if it comes before any already there.
+ */
+static void
+try_rules(const struct pax_policy *pol, const struct rule_list *l, const char *path, int fd,
+	struct elfix_elf_info *info, int *have_info, unsigned *best, unsigned *need_fd)
+{
+	size_t i;
+	int m;
+
+	for(i = 0; i < l->n && l->idx[i] < *best; i++)
+	{
+		if((m = rule_matches(&pol->rule[l->idx[i]], path, fd, info, have_info)) < 0)
+		{
+			if(l->idx[i] < *need_fd)
+				*need_fd = l->idx[i];
+			break;
+		}
+		if(m)
+		{
+			*best = l->idx[i];
+			break;
+		}
+	}
+}
+
+
+/*
+ * What the policy says about path.  Pass fd as -1 to match on the path
+ * alone, in which case the answer may be POLICY_NEED_FD if a rule which
+ * could win asks about the ELF type or soname.  On POLICY_MATCH *flags
+ * is set, and may be 0 if the rule says to leave the file alone.
+ */
+int
+policy_match(const struct pax_policy *pol, const char *path, int fd, uint16_t *flags)
+{
+	const struct trie_node *node = &pol->root;
+	struct policy_entry *e;
+	struct elfix_elf_info info;
+	unsigned best = UINT_MAX, need_fd = UINT_MAX;
+	int have_info = 0;
+	const char *p;
+
+	if(pol->used && (e = entry_slot(pol, path))->path)
+		try_rules(pol, &e->rules, path, fd, &info, &have_info, &best, &need_fd);
+
+	for(p = path; node; node = trie_child((struct trie_node *)node, *p++, 0))
+	{
+		if(node->rules.n)
+			try_rules(pol, &node->rules, path, fd, &info, &have_info, &best, &need_fd);
+		if(*p == '\0')
+			break;
+	}
+
+	// A rule we could not try only matters if it would have come first
+	if(need_fd < best)
+		return POLICY_NEED_FD;
+
+	if(best == UINT_MAX)
+		return POLICY_NONE;
+
+	*flags = pol->rule[best].flags;
+	return POLICY_MATCH;
+}
+
+
+/*
+ * Decide what to do with w before it is queued.  Returns 0 if the
+ * policy has nothing to say about it, or if it says to leave it alone,
+ * otherwise sets w->pax_flags, or w->need_policy if process_file() must
+ * ask again with the file open.
+ */
+int
+policy_classify(const struct pax_policy *pol, struct pax_work *w)
+{
+	uint16_t flags;
+
+	switch(policy_match(pol, w->path + w->image_at, -1, &flags))
+	{
+		case POLICY_MATCH:
+			w->pax_flags = flags;
+			return flags != 0;
+		case POLICY_NEED_FD:
+			w->need_policy = 1;
+			return 1;
+	}
+
+	return 0;
+}
+
+
+void
+policy_free(struct pax_policy *pol)
+{
+	size_t i;
+
+	for(i = 0; i < pol->nrules; i++)
+	{
+		if(pol->rule[i].kind == MATCH_REGEX)
+			regfree(&pol->rule[i].re);
+		free(pol->rule[i].pattern);
+		free(pol->rule[i].soname);
+	}
+	free(pol->rule);
+
+	for(i = 0; i < pol->nslots; i++)
+	{
+		free(pol->slot[i].path);
+		free(pol->slot[i].rules.idx);
+	}
+	free(pol->slot);
+
+	trie_free(&pol->root);
+	free(pol);
+}
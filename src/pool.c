@@ -0,0 +1,353 @@
+/*
+	pool.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+#include "probes.h"
+
+// Keep the walker from running too far ahead of the workers
+#define QUEUE_MAX	4096
+
+void
+queue_init(struct work_queue *q)
+{
+	memset(q, 0, sizeof(struct work_queue));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+}
+
+
+void
+queue_destroy(struct work_queue *q)
+{
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+}
+
+
+void
+queue_push(struct work_queue *q, struct pax_work *w)
+{
+	w->next = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while(q->queued >= QUEUE_MAX)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	if(q->tail)
+		q->tail->next = w;
+	else
+		q->head = w;
+	q->tail = w;
+	q->queued++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+ * Take the next item.  If wait is set, block until there is one or the
+ * queue is closed.  Returns NULL when there is nothing to take.
+ */
+struct pax_work *
+queue_pop(struct work_queue *q, int wait)
+{
+	struct pax_work *w;
+
+	pthread_mutex_lock(&q->lock);
+	while(wait && q->head == NULL && !q->closed)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	if((w = q->head) != NULL)
+	{
+		if((q->head = w->next) == NULL)
+			q->tail = NULL;
+		if(q->queued-- == QUEUE_MAX)
+			pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return w;
+}
+
+
+void
+queue_close(struct work_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+
+struct pax_pool
+{
+	struct work_queue in;		// from the walker or manifest reader
+	struct work_queue *ready;	// to the workers, &in unless io_uring sits between
+
+	const struct paxctl_opts *opts;
+	pthread_t *threads;
+	int nthreads;
+	int report;
+
+#ifdef IOURING
+	struct work_queue prefetched;
+	pthread_t uring_thread;
+	struct uring_prefetch *uring;
+#endif
+
+	// --order: everything submitted, held back until pool_finish()
+	struct pax_work **held;
+	size_t nheld, maxheld;
+
+	// Totals, updated under lock as each worker exits
+	pthread_mutex_t lock;
+	struct timespec start;
+	struct pool_totals totals;
+	int ret;
+};
+
+static void *
+pool_worker(void *arg)
+{
+	struct pax_pool *pool = arg;
+	struct pax_work *w;
+	struct pool_totals totals;
+	char *buf = NULL;
+	size_t len = 0;
+	int ret = EXIT_SUCCESS;
+
+	memset(&totals, 0, sizeof(struct pool_totals));
+
+	while((w = queue_pop(pool->ready, 1)) != NULL)
+	{
+		// Gather what -v says about the file, so it goes out in one piece
+		if(pool->opts->verbose && (out_local = open_memstream(&buf, &len)) == NULL)
+			err(EXIT_FAILURE, "open_memstream()");
+		PAX_PROBE2(file__entry, w->path, w->pax_flags);
+		if(pool->opts->throttle_state)
+			w->ret = throttle_process(pool->opts->throttle_state, w, w->opts ? w->opts : pool->opts);
+		else
+			w->ret = process_file(w, w->opts ? w->opts : pool->opts);
+		PAX_PROBE3(file__return, w->path, w->pax_flags, w->ret);
+
+		flockfile(stdout);
+		if(out_local)
+		{
+			fclose(out_local);
+			out_local = NULL;
+			fwrite(buf, 1, len, stdout);
+			free(buf);
+			buf = NULL;
+		}
+		if(pool->report && w->ret != EXIT_SUCCESS)
+			printf("FAILED\t%d\t%s\n", w->ret, w->path);
+		funlockfile(stdout);
+
+		ret |= w->ret;
+		totals.nfiles++;
+		if(!w->not_elf)
+			totals.nelf++;
+		if(w->ret != EXIT_SUCCESS)
+			totals.nfailed++;
+		if(w->written)
+			totals.nwritten++;
+		else if(w->changing && !w->not_elf)
+			totals.nunchanged++;
+		if(w->unmatched)
+			totals.nunmatched++;
+		if(w->stale)
+			totals.nstale++;
+
+		if(w->done)
+			w->done(w);
+		else
+		{
+			free(w->path);
+			free(w);
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->totals.nfiles += totals.nfiles;
+	pool->totals.nelf += totals.nelf;
+	pool->totals.nfailed += totals.nfailed;
+	pool->totals.nwritten += totals.nwritten;
+	pool->totals.nunchanged += totals.nunchanged;
+	pool->totals.nunmatched += totals.nunmatched;
+	pool->totals.nstale += totals.nstale;
+	pool->ret |= ret;
+	pthread_mutex_unlock(&pool->lock);
+
+	stats_merge();
+	local_elfix_free();
+
+	return NULL;
+}
+
+
+#ifdef IOURING
+static void *
+pool_uring(void *arg)
+{
+	struct pax_pool *pool = arg;
+
+	uring_prefetch_run(pool->uring, &pool->in, &pool->prefetched);
+	queue_close(&pool->prefetched);
+	stats_merge();
+
+	return NULL;
+}
+#endif
+
+
+/*
+ * Start the worker threads.  If report is set, each file which fails
+ * gets a line on stdout with its own result code.
+ */
+struct pax_pool *
+pool_create(const struct paxctl_opts *opts, int report)
+{
+	struct pax_pool *pool;
+	int i;
+
+	if((pool = calloc(1, sizeof(struct pax_pool))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	pthread_mutex_init(&pool->lock, NULL);
+	queue_init(&pool->in);
+	pool->ready = &pool->in;
+	pool->opts = opts;
+	pool->report = report;
+	clock_gettime(CLOCK_MONOTONIC, &pool->start);
+
+#ifdef IOURING
+	// If the kernel is not up to it, the workers just read from pool->in
+	if(opts->uring_depth > 0 && (pool->uring = uring_prefetch_create(opts)) != NULL)
+	{
+		queue_init(&pool->prefetched);
+		pool->ready = &pool->prefetched;
+		if((errno = pthread_create(&pool->uring_thread, NULL, pool_uring, pool)))
+			err(EXIT_FAILURE, "pthread_create()");
+	}
+#endif
+
+	pool->nthreads = opts->nthreads;
+	if(pool->nthreads < 1)
+		pool->nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(pool->nthreads < 1)
+		pool->nthreads = 1;
+
+	if((pool->threads = calloc(pool->nthreads, sizeof(pthread_t))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	for(i = 0; i < pool->nthreads; i++)
+		if((errno = pthread_create(&pool->threads[i], NULL, pool_worker, pool)))
+			err(EXIT_FAILURE, "pthread_create()");
+
+	return pool;
+}
+
+
+// w->fd is either -1 or a descriptor for the pool to use and close
+void
+pool_submit(struct pax_pool *pool, struct pax_work *w)
+{
+	if(!pool->opts->order)
+	{
+		queue_push(&pool->in, w);
+		return;
+	}
+
+	if(pool->nheld == pool->maxheld)
+	{
+		pool->maxheld = pool->maxheld ? 2 * pool->maxheld : 4096;
+		if((pool->held = realloc(pool->held, pool->maxheld * sizeof(struct pax_work *))) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	}
+	pool->held[pool->nheld++] = w;
+}
+
+
+int
+pool_finish(struct pax_pool *pool, struct pool_totals *totals)
+{
+	struct timespec now;
+	size_t j;
+	int i, ret;
+
+	if(pool->opts->order)
+	{
+		order_work(pool->held, pool->nheld, pool->opts->order);
+		for(j = 0; j < pool->nheld; j++)
+			queue_push(&pool->in, pool->held[j]);
+		free(pool->held);
+	}
+
+	queue_close(&pool->in);
+
+#ifdef IOURING
+	if(pool->uring)
+	{
+		pthread_join(pool->uring_thread, NULL);
+		uring_prefetch_destroy(pool->uring);
+	}
+#endif
+
+	for(i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*totals = pool->totals;
+	totals->secs = (now.tv_sec - pool->start.tv_sec) +
+		(now.tv_nsec - pool->start.tv_nsec) / 1e9;
+	ret = pool->ret;
+
+#ifdef IOURING
+	if(pool->uring)
+		queue_destroy(&pool->prefetched);
+#endif
+	queue_destroy(&pool->in);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+
+	return ret;
+}
+
+
+void
+print_totals(const struct pool_totals *totals)
+{
+	printf("%lu written, %lu already up to date\n", totals->nwritten, totals->nunchanged);
+	printf("%.3f seconds, %.0f files/sec\n", totals->secs,
+		totals->secs > 0 ? totals->nfiles / totals->secs : 0.0);
+}
@@ -0,0 +1,46 @@
+/*
+	probes.h: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Static user-space probes under the "elfix" provider, built in with
+ * --enable-usdt.  Each one is a single nop plus an ELF note, so with no
+ * tracer attached only the argument registers are set up.  List them with
+ *
+ *	bpftrace -l 'usdt:/usr/sbin/paxctl-ng:elfix:*'
+ *
+ * Without USDT they compile away to nothing.  scripts/paxmodule.c
+ * includes this too, so the python module fires the same probes.
+ *
+ * The __return probes of the flag functions end with the ELFIX_* code
+ * libelfix gave, and file__return with EXIT_SUCCESS or EXIT_FAILURE.
+ */
+#ifdef USDT
+ #include <sys/sdt.h>
+ #define PAX_PROBE1(name, a)		DTRACE_PROBE1(elfix, name, a)
+ #define PAX_PROBE2(name, a, b)		DTRACE_PROBE2(elfix, name, a, b)
+ #define PAX_PROBE3(name, a, b, c)	DTRACE_PROBE3(elfix, name, a, b, c)
+#else
+ #define PAX_PROBE1(name, a)		((void)(a))
+ #define PAX_PROBE2(name, a, b)		((void)(a), (void)(b))
+ #define PAX_PROBE3(name, a, b, c)	((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif
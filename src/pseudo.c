@@ -0,0 +1,212 @@
+/*
+	pseudo.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --pseudo: mark a staging tree for a read-only image without setting
+ * any xattr on it.  A -T run works out the XATTR_PAX flags of each file
+ * as usual, but writes them as definitions for the image builder, with
+ * paths relative to the -T directory, ie. as they will be in the image:
+ *
+ *	squashfs	usr/bin/foo x user.pax.flags=PeMRS
+ *
+ * a mksquashfs -pf pseudo file, special characters escaped with '\'
+ * and paths with a newline, which it cannot take, left out, or
+ *
+ *	getfattr	# file: usr/bin/foo
+ *			user.pax.flags="PeMRS"
+ *
+ * the dump format of getfattr -d, which setfattr --restore reads, with
+ * special characters as octal escapes.
+ *
+ * PT_PAX lives in the file's data, which goes into the image as it is,
+ * so it is still written, but only where the header-only path can patch
+ * the p_flags words in place.  A layout which would need libelf to
+ * rewrite the object is counted and left alone.
+ */
+#define PSEUDO_SQUASHFS		0
+#define PSEUDO_GETFATTR		1
+
+struct pax_pseudo
+{
+	FILE *f;
+	char *file;
+	int format;
+	int limit;
+	pthread_mutex_t lock;
+	unsigned long nfiles, ndefs, npt, nptskipped;
+};
+
+
+struct pax_pseudo *
+pseudo_create(const char *file, const char *format, const struct paxctl_opts *opts)
+{
+	struct pax_pseudo *ps;
+
+	if((ps = calloc(1, sizeof(struct pax_pseudo))) == NULL || (ps->file = strdup(file)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	if(format == NULL || !strcmp(format, "squashfs"))
+		ps->format = PSEUDO_SQUASHFS;
+	else if(!strcmp(format, "getfattr"))
+		ps->format = PSEUDO_GETFATTR;
+	else
+		errx(EXIT_FAILURE, "option --pseudo-format needs squashfs or getfattr");
+
+	if((ps->f = fopen(file, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	ps->limit = opts->limit;
+	pthread_mutex_init(&ps->lock, NULL);
+
+	return ps;
+}
+
+
+// mksquashfs takes any character after a '\' as it is
+static void
+put_squashfs_path(FILE *f, const char *path)
+{
+	for(; *path; path++)
+	{
+		if(*path == ' ' || *path == '\t' || *path == '"' || *path == '\\')
+			fputc('\\', f);
+		fputc(*path, f);
+	}
+}
+
+
+// getfattr escapes as \ooo
+static void
+put_getfattr_path(FILE *f, const char *path)
+{
+	const unsigned char *p;
+
+	for(p = (const unsigned char *)path; *p; p++)
+	{
+		if(*p < 0x20 || *p >= 0x7f || *p == '\\')
+			fprintf(f, "\\%03o", *p);
+		else
+			fputc(*p, f);
+	}
+}
+
+
+/*
+ * Called from process_file() in place of set_flags() for each file of a
+ * --pseudo run.  The path in the image starts at w->path + w->image_at.
+ * Only PT_PAX patches go into *written.
+ */
+int
+pseudo_file(struct pax_pseudo *ps, struct pax_work *w, int *fd, const struct paxctl_opts *opts, int *written)
+{
+	int verbose = opts->verbose;
+	struct pax_change c;
+	const char *path;
+	char buf[ELFIX_FLAGS_SIZE];
+	int ret = EXIT_SUCCESS, pt_done = 0, pt_skipped = 0, defined = 0;
+
+	if(w->pax_flags == 0)
+		return ret;
+
+	compute_flags(*fd, w->pax_flags, 1, ps->limit, verbose, &c);
+
+#ifdef PTPAX
+	if(c.pt_write && !reopen_rdwr(w, fd, opts))
+		c.pt_write = 0;
+	if(c.pt_write)
+	{
+		switch(elfix_set_pt_flags_hdr(local_elfix(), *fd, c.pt_new))
+		{
+			case ELFIX_OK:
+				pt_done = 1;
+				*written |= WROTE_PT;
+				break;
+			case ELFIX_EINVAL:
+				pt_skipped = 1;
+				if(verbose)
+					fprintf(local_out(), "\tPT_PAX left alone: %s\n", elfix_strerror(local_elfix()));
+				break;
+			default:
+				if(verbose)
+					fprintf(local_out(), "\tELF ERROR: %s\n", elfix_strerror(local_elfix()));
+				ret = EXIT_FAILURE;
+		}
+	}
+#endif
+
+	// Relative to the root of the image
+	for(path = w->path + w->image_at; *path == '/'; path++)
+		;
+
+	pthread_mutex_lock(&ps->lock);
+	ps->nfiles++;
+	ps->npt += pt_done;
+	ps->nptskipped += pt_skipped;
+	if(c.xt_want && ps->format == PSEUDO_SQUASHFS && strchr(path, '\n'))
+		warnx("%s: a newline in the path, left out of %s", w->path, ps->file);
+	else if(c.xt_want)
+	{
+		memset(buf, 0, ELFIX_FLAGS_SIZE);
+		elfix_bin2string(c.xt_new, buf);
+		if(ps->format == PSEUDO_SQUASHFS)
+		{
+			put_squashfs_path(ps->f, path);
+			fprintf(ps->f, " x " ELFIX_PAX_NAMESPACE "=%s\n", buf);
+		}
+		else
+		{
+			fprintf(ps->f, "# file: ");
+			put_getfattr_path(ps->f, path);
+			fprintf(ps->f, "\n" ELFIX_PAX_NAMESPACE "=\"%s\"\n\n", buf);
+		}
+		ps->ndefs++;
+		defined = 1;
+	}
+	pthread_mutex_unlock(&ps->lock);
+
+	if(verbose && defined)
+		fprintf(local_out(), "\tpseudo: " ELFIX_PAX_NAMESPACE "=%s\n", buf);
+
+	return ret;
+}
+
+
+void
+pseudo_close(struct pax_pseudo *ps)
+{
+	if(fclose(ps->f) != 0)
+		err(EXIT_FAILURE, "%s", ps->file);
+
+	printf("pseudo: %lu files, %lu xattr definitions in %s, %lu PT_PAX patched, %lu PT_PAX left for libelf\n",
+		ps->nfiles, ps->ndefs, ps->file, ps->npt, ps->nptskipped);
+
+	pthread_mutex_destroy(&ps->lock);
+	free(ps->file);
+	free(ps);
+}
@@ -0,0 +1,220 @@
+/*
+	reconcile.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "paxctl-ng.h"
+
+#if defined(PTPAX) && defined(XTPAX)
+
+/*
+ * --reconcile: find the objects a PaX kernel would refuse to exec, by
+ * working out offline what pax_parse_pax_flags() in fs/binfmt_elf.c makes
+ * of their marks.  Each of PT_PAX and XATTR_PAX is turned into the set of
+ * features it enables: in hard mode a feature is on unless it is marked
+ * off, in soft mode only if it is marked on, and a field with both the
+ * on and off bit of any one feature counts as no field at all.  With both
+ * fields there the two sets must be the same, else the exec fails with
+ * EINVAL.  XATTR_PAX wins otherwise, and the set it gives must not have
+ * MPROTECT or EMUTRAMP without PAGEEXEC or SEGMEXEC, which pax_check_flags()
+ * also refuses.
+ *
+ * We take a kernel with every feature built in, SEGMEXEC only on i386,
+ * and its soft mode from /proc/sys/kernel/pax/softmode, hard if there is
+ * none.  With --reconcile=pt or =xt the field named is the source of truth
+ * and the other is copied from it, as -F or -f would, where they disagree.
+ */
+#define RECONCILE_SOFTMODE	"/proc/sys/kernel/pax/softmode"
+
+struct pax_reconcile
+{
+	int source;		// COPY_PT_TO_XT_FLAGS, COPY_XT_TO_PT_FLAGS, or 0 to only report
+	int softmode;
+	pthread_mutex_t lock;
+	unsigned long nmarked, nconflict, ninvalid, nfixed, nunfixed;
+};
+
+static const uint16_t features[][2] = {
+	{ PF_PAGEEXEC, PF_NOPAGEEXEC },
+	{ PF_SEGMEXEC, PF_NOSEGMEXEC },
+	{ PF_EMUTRAMP, PF_NOEMUTRAMP },
+	{ PF_MPROTECT, PF_NOMPROTECT },
+	{ PF_RANDMMAP, PF_NORANDMMAP }
+};
+
+
+struct pax_reconcile *
+reconcile_create(const char *source)
+{
+	struct pax_reconcile *rc;
+	FILE *f;
+
+	if((rc = calloc(1, sizeof(struct pax_reconcile))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	if(source == NULL)
+		rc->source = 0;
+	else if(!strcmp(source, "pt"))
+		rc->source = COPY_PT_TO_XT_FLAGS;
+	else if(!strcmp(source, "xt"))
+		rc->source = COPY_XT_TO_PT_FLAGS;
+	else
+		errx(EXIT_FAILURE, "option --reconcile takes pt or xt");
+
+	if((f = fopen(RECONCILE_SOFTMODE, "r")) != NULL)
+	{
+		if(fscanf(f, "%d", &rc->softmode) != 1)
+			rc->softmode = 0;
+		fclose(f);
+	}
+
+	pthread_mutex_init(&rc->lock, NULL);
+
+	return rc;
+}
+
+
+// The features flags turn on, UINT16_MAX if the kernel ignores the field
+static uint16_t
+effective(uint16_t flags, int softmode)
+{
+	uint16_t on = 0;
+	size_t i;
+
+	if(flags == UINT16_MAX)
+		return UINT16_MAX;
+
+	for(i = 0; i < sizeof(features) / sizeof(features[0]); i++)
+	{
+		if((flags & features[i][0]) && (flags & features[i][1]))
+			return UINT16_MAX;
+		if(softmode ? (flags & features[i][0]) : !(flags & features[i][1]))
+			on |= features[i][0];
+	}
+
+#ifndef __i386__
+	on &= ~PF_SEGMEXEC;
+#endif
+
+	return on;
+}
+
+
+// As pax_check_flags(), these need one of the non-executable page schemes
+static int
+invalid(uint16_t on)
+{
+	return (on & (PF_MPROTECT | PF_EMUTRAMP)) && !(on & (PF_PAGEEXEC | PF_SEGMEXEC));
+}
+
+
+static void
+print_field(char *buf, uint16_t flags)
+{
+	if(flags == UINT16_MAX)
+		strcpy(buf, "-");
+	else
+		elfix_bin2string4print(flags, buf);
+}
+
+
+/*
+ * Called from process_file() in place of setting the flags.  Prints a
+ * line for each object which would fail to exec, and fixes a conflict
+ * if there is a source of truth.
+ */
+int
+reconcile_file(struct pax_reconcile *rc, struct pax_work *w, int *fd, const struct paxctl_opts *opts, int *written)
+{
+	int verbose = opts->verbose;
+	uint16_t pt_flags, xt_flags, pt_on, xt_on;
+	char pt_buf[ELFIX_FLAGS_SIZE], xt_buf[ELFIX_FLAGS_SIZE];
+	int conflict, bad, fixed = 0, ret = EXIT_SUCCESS;
+
+	pt_flags = get_pt_flags(*fd, 0);
+	xt_flags = get_xt_flags(*fd);
+	if(pt_flags == UINT16_MAX && xt_flags == UINT16_MAX)
+		return ret;
+
+	pt_on = effective(pt_flags, rc->softmode);
+	xt_on = effective(xt_flags, rc->softmode);
+	conflict = pt_on != UINT16_MAX && xt_on != UINT16_MAX && pt_on != xt_on;
+
+	memset(pt_buf, 0, ELFIX_FLAGS_SIZE);
+	memset(xt_buf, 0, ELFIX_FLAGS_SIZE);
+	print_field(pt_buf, pt_flags);
+	print_field(xt_buf, xt_flags);
+
+	if(conflict && rc->source)
+	{
+		w->changing = 1;
+		fixed = copy_xt_flags(w, fd, rc->source, opts, written) == EXIT_SUCCESS;
+		if(!fixed)
+			ret = EXIT_FAILURE;
+		else if(rc->source == COPY_PT_TO_XT_FLAGS)
+			xt_on = pt_on;
+	}
+
+	// What the kernel would go by now
+	bad = invalid(xt_on != UINT16_MAX ? xt_on : pt_on != UINT16_MAX ? pt_on : 0);
+
+	if(conflict)
+		fprintf(local_out(), "%s\t%s\t%s\t%s\n", fixed ? "fixed" : "conflict", pt_buf, xt_buf, w->path);
+	if(bad)
+		fprintf(local_out(), "invalid\t%s\t%s\t%s\n", pt_buf, xt_buf, w->path);
+	if(verbose && !conflict && !bad)
+		fprintf(local_out(), "ok\t%s\t%s\t%s\n", pt_buf, xt_buf, w->path);
+
+	pthread_mutex_lock(&rc->lock);
+	rc->nmarked++;
+	rc->nconflict += conflict;
+	rc->ninvalid += bad;
+	rc->nfixed += fixed;
+	rc->nunfixed += (conflict && !fixed) || bad;
+	pthread_mutex_unlock(&rc->lock);
+
+	return ret;
+}
+
+
+// Returns EXIT_FAILURE if anything is left which would fail to exec
+int
+reconcile_close(struct pax_reconcile *rc)
+{
+	int ret = rc->nunfixed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	printf("reconcile: %lu marked, %lu PT_PAX and XATTR_PAX disagree, %lu invalid, %lu fixed from %s,"
+		" %lu would fail to exec (%s mode)\n",
+		rc->nmarked, rc->nconflict, rc->ninvalid, rc->nfixed,
+		rc->source == COPY_PT_TO_XT_FLAGS ? "PT_PAX" : rc->source == COPY_XT_TO_PT_FLAGS ? "XATTR_PAX" : "neither",
+		rc->nunfixed, rc->softmode ? "soft" : "hard");
+
+	pthread_mutex_destroy(&rc->lock);
+	free(rc);
+
+	return ret;
+}
+
+#endif
@@ -0,0 +1,389 @@
+/*
+	registry.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --registry: the flags of each build we have marked, keyed by its
+ * NT_GNU_BUILD_ID, one line per build:
+ *
+ *	BUILD_ID FLAGS PATH
+ *
+ * separated by tabs.  BUILD_ID is in hex, FLAGS is what was asked for
+ * as four hex digits, as in a plan, and PATH is just the last place the
+ * build was seen, for people reading the file.
+ *
+ * A file given no flags of its own is looked up by its build-id, which
+ * costs a read of the ELF headers and notes, and if it is known it gets
+ * the recorded flags without the policy being asked.  Otherwise it is
+ * done as usual, and whatever flags it ends up set with, from the command
+ * line, a -B manifest or a policy, are recorded for the next copy of the
+ * same build, wherever that is installed.  The file is rewritten at the
+ * end of the run if anything was recorded.
+ */
+#define REGISTRY_MAGIC		"# paxctl-ng registry"
+#define REGISTRY_VERSION	1
+
+struct registry_entry
+{
+	unsigned char id[ELFIX_BUILD_ID_MAX];
+	size_t len;
+	uint16_t flags;
+	char *path;
+};
+
+struct pax_registry
+{
+	char *file;
+	struct registry_entry *entry;	// in the order they go back to the file
+	size_t nentries, maxentries;
+	size_t *slot;			// index + 1 into entry, 0 is empty
+	size_t nslots;
+	pthread_mutex_t lock;
+	int dirty;
+	unsigned long nhits, nmisses, nrecorded, nnoid;
+};
+
+
+// FNV-1a, the ids are already hashes so any mixing will do
+static size_t
+id_hash(const unsigned char *id, size_t len)
+{
+	size_t h = 2166136261u;
+
+	while(len--)
+		h = (h ^ *id++) * 16777619u;
+
+	return h;
+}
+
+
+static size_t *
+find_slot(struct pax_registry *reg, const unsigned char *id, size_t len)
+{
+	struct registry_entry *e;
+	size_t i, mask = reg->nslots - 1;
+
+	for(i = id_hash(id, len) & mask; reg->slot[i]; i = (i + 1) & mask)
+	{
+		e = &reg->entry[reg->slot[i] - 1];
+		if(e->len == len && !memcmp(e->id, id, len))
+			break;
+	}
+
+	return &reg->slot[i];
+}
+
+
+// Adds or replaces the entry for id, returns 1 if that changed anything
+static int
+put_entry(struct pax_registry *reg, const unsigned char *id, size_t len, uint16_t flags, const char *path)
+{
+	struct registry_entry *e;
+	size_t *s, i;
+
+	if(2 * (reg->nentries + 1) > reg->nslots)
+	{
+		free(reg->slot);
+		reg->nslots = reg->nslots ? 2 * reg->nslots : 1024;
+		if((reg->slot = calloc(reg->nslots, sizeof(size_t))) == NULL)
+			err(EXIT_FAILURE, "calloc()");
+		for(i = 0; i < reg->nentries; i++)
+			*find_slot(reg, reg->entry[i].id, reg->entry[i].len) = i + 1;
+	}
+
+	s = find_slot(reg, id, len);
+	if(*s)
+	{
+		e = &reg->entry[*s - 1];
+		if(e->flags == flags && !strcmp(e->path, path))
+			return 0;
+		free(e->path);
+	}
+	else
+	{
+		if(reg->nentries == reg->maxentries)
+		{
+			reg->maxentries = reg->maxentries ? 2 * reg->maxentries : 1024;
+			if((reg->entry = realloc(reg->entry, reg->maxentries * sizeof(struct registry_entry))) == NULL)
+				err(EXIT_FAILURE, "realloc()");
+		}
+		e = &reg->entry[reg->nentries++];
+		memcpy(e->id, id, len);
+		e->len = len;
+		*s = reg->nentries;
+	}
+
+	e->flags = flags;
+	if((e->path = strdup(path)) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	return 1;
+}
+
+
+static int
+parse_hex_id(const char *s, unsigned char *id, size_t *len)
+{
+	unsigned int byte;
+	size_t n = strlen(s);
+
+	if(n == 0 || n % 2 || n / 2 > ELFIX_BUILD_ID_MAX || strspn(s, "0123456789abcdef") != n)
+		return -1;
+
+	for(*len = 0; *len < n / 2; (*len)++)
+	{
+		sscanf(s + 2 * *len, "%2x", &byte);
+		id[*len] = byte;
+	}
+
+	return 0;
+}
+
+
+struct pax_registry *
+registry_open(const char *file)
+{
+	struct pax_registry *reg;
+	unsigned char id[ELFIX_BUILD_ID_MAX];
+	char *line = NULL, *flags, *path, *p;
+	size_t cap = 0, len;
+	unsigned long lineno = 0, nbad = 0, f;
+	ssize_t n;
+	FILE *fp;
+
+	if((reg = calloc(1, sizeof(struct pax_registry))) == NULL || (reg->file = strdup(file)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	pthread_mutex_init(&reg->lock, NULL);
+
+	// A new registry starts out empty
+	if((fp = fopen(file, "r")) == NULL)
+	{
+		if(errno != ENOENT)
+			err(EXIT_FAILURE, "%s", file);
+		return reg;
+	}
+
+	while((n = getline(&line, &cap, fp)) > 0)
+	{
+		lineno++;
+		if(line[n - 1] == '\n')
+			line[--n] = '\0';
+
+		if(lineno == 1 && strncmp(line, REGISTRY_MAGIC " ", sizeof(REGISTRY_MAGIC)))
+			errx(EXIT_FAILURE, "%s: not a paxctl-ng registry", file);
+		if(lineno == 1 && atoi(line + sizeof(REGISTRY_MAGIC)) != REGISTRY_VERSION)
+			errx(EXIT_FAILURE, "%s: registry version %s, this paxctl-ng only knows %d",
+				file, line + sizeof(REGISTRY_MAGIC), REGISTRY_VERSION);
+		if(line[0] == '#' || line[0] == '\0')
+			continue;
+
+		if((flags = strchr(line, '\t')) == NULL || (path = strchr(flags + 1, '\t')) == NULL)
+			goto bad;
+		*flags++ = '\0';
+		*path++ = '\0';
+		f = strtoul(flags, &p, 16);
+		if(*p != '\0' || p - flags != 4 || f == 0 || parse_hex_id(line, id, &len) < 0)
+			goto bad;
+
+		put_entry(reg, id, len, f, path);
+		continue;
+
+	bad:
+		if(nbad++ < 10)
+			warnx("%s:%lu: bad registry entry, skipped", file, lineno);
+		reg->dirty = 1;
+	}
+
+	if(ferror(fp))
+		err(EXIT_FAILURE, "%s", file);
+	fclose(fp);
+	free(line);
+
+	return reg;
+}
+
+
+/*
+ * Called by process_file() once the file is open.  Reads its build-id
+ * into key, and if the file has no flags of its own yet and the registry
+ * knows the build, puts the recorded ones in w->pax_flags so no policy is
+ * needed.  Returns 1 if so.
+ */
+int
+registry_lookup(struct pax_registry *reg, struct pax_work *w, int fd, struct registry_key *key)
+{
+	elfix_t *h = local_elfix();
+	size_t *s;
+	int hit = 0;
+
+	if(elfix_get_build_id(h, fd, key->id, &key->len) != ELFIX_OK)
+	{
+		key->len = 0;
+		if(elfix_error(h) == ELFIX_ENOFLAGS)
+		{
+			pthread_mutex_lock(&reg->lock);
+			reg->nnoid++;
+			pthread_mutex_unlock(&reg->lock);
+		}
+		return 0;
+	}
+
+	// Flags asked for are recorded, not looked up
+	if(w->pax_flags != 0 && !w->need_policy)
+		return 0;
+
+	pthread_mutex_lock(&reg->lock);
+	if(reg->nslots && *(s = find_slot(reg, key->id, key->len)))
+	{
+		w->pax_flags = reg->entry[*s - 1].flags;
+		w->need_policy = 0;
+		reg->nhits++;
+		hit = 1;
+	}
+	else
+		reg->nmisses++;
+	pthread_mutex_unlock(&reg->lock);
+
+	STAT_INC(hit ? STAT_REGISTRY_HIT : STAT_REGISTRY_MISS);
+	return hit;
+}
+
+
+// Once w has been set with w->pax_flags, remember them for its build
+void
+registry_record(struct pax_registry *reg, const struct registry_key *key, const struct pax_work *w)
+{
+	const char *path;
+
+	if(key->len == 0 || w->pax_flags == 0)
+		return;
+
+	// The path is only a note, and a newline would end the line
+	path = strchr(w->path, '\n') ? "-" : w->path;
+
+	pthread_mutex_lock(&reg->lock);
+	if(put_entry(reg, key->id, key->len, w->pax_flags, path))
+	{
+		reg->nrecorded++;
+		reg->dirty = 1;
+	}
+	pthread_mutex_unlock(&reg->lock);
+}
+
+
+// Writes the registry back, through a new file renamed over the old
+static int
+registry_write(struct pax_registry *reg)
+{
+	struct registry_entry *e;
+	struct stat st;
+	char *tmp;
+	size_t i, j;
+	FILE *fp;
+	int fd;
+
+	if(asprintf(&tmp, "%s.XXXXXX", reg->file) < 0)
+		err(EXIT_FAILURE, "asprintf()");
+
+	if((fd = mkstemp(tmp)) < 0 || (fp = fdopen(fd, "w")) == NULL)
+	{
+		warn("%s: cannot write the registry", reg->file);
+		if(fd >= 0)
+		{
+			close(fd);
+			unlink(tmp);
+		}
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	// mkstemp() makes it 0600, keep the mode of the one it replaces
+	if(fchmod(fd, stat(reg->file, &st) == 0 ? st.st_mode & 07777 : 0644) < 0)
+	{
+		warn("%s: cannot write the registry", reg->file);
+		fclose(fp);
+		unlink(tmp);
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(fp, REGISTRY_MAGIC " %d\n", REGISTRY_VERSION);
+	fprintf(fp, "# BUILD_ID\tFLAGS\tPATH\n");
+	for(i = 0; i < reg->nentries; i++)
+	{
+		e = &reg->entry[i];
+		for(j = 0; j < e->len; j++)
+			fprintf(fp, "%02x", e->id[j]);
+		fprintf(fp, "\t%04x\t%s\n", e->flags, e->path);
+	}
+
+	if(fflush(fp) != 0 || fsync(fd) < 0 || fclose(fp) != 0)
+	{
+		warn("%s: cannot write the registry", reg->file);
+		unlink(tmp);
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	if(rename(tmp, reg->file) < 0)
+	{
+		warn("%s: cannot replace the registry", reg->file);
+		unlink(tmp);
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	free(tmp);
+	return EXIT_SUCCESS;
+}
+
+
+int
+registry_close(struct pax_registry *reg)
+{
+	size_t i;
+	int ret = EXIT_SUCCESS;
+
+	if(reg->dirty)
+		ret = registry_write(reg);
+
+	printf("registry: %lu builds in %s, %lu known, %lu not known, %lu recorded, %lu without a build-id\n",
+		(unsigned long)reg->nentries, reg->file, reg->nhits, reg->nmisses, reg->nrecorded, reg->nnoid);
+
+	for(i = 0; i < reg->nentries; i++)
+		free(reg->entry[i].path);
+	free(reg->entry);
+	free(reg->slot);
+	pthread_mutex_destroy(&reg->lock);
+	free(reg->file);
+	free(reg);
+
+	return ret;
+}
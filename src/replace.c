@@ -0,0 +1,223 @@
+/*
+	replace.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+#ifdef PTPAX
+
+/*
+ * --replace-busy: a binary which is running cannot be opened for writing,
+ * open() fails with ETXTBSY, so normally only XATTR_PAX can be set on it.
+ * Instead we make a copy next to it, reflinked with FICLONE where the
+ * filesystem can share the blocks and copied where it cannot, give it
+ * the owner, mode and xattrs of the original, patch PT_PAX in the copy
+ * and rename() it over the original.  The processes running the old
+ * inode carry on with it, and the next exec gets the new one.  A symlink
+ * is resolved first, so it is the file it names which is replaced.
+ *
+ * A file with other hard links is left alone, since they would go on
+ * naming the old inode, and so is one whose owner or xattrs cannot all
+ * be carried over, since the copy would then lose them.
+ */
+#define XATTR_LIST_MAX_LEN	65536
+
+static int
+copy_data(int from, int to)
+{
+	ssize_t n, m;
+	char buf[65536];
+
+	if(ioctl(to, FICLONE, from) == 0)
+	{
+		STAT_INC(STAT_REPLACE_CLONE);
+		return 0;
+	}
+
+	STAT_INC(STAT_REPLACE_COPY);
+	while((n = copy_file_range(from, NULL, to, NULL, 1 << 30, 0)) > 0)
+		;
+	if(n == 0)
+		return 0;
+	if(errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+		return -1;
+
+	// Older kernels and some filesystem pairs cannot, so do it ourselves
+	if(lseek(from, 0, SEEK_SET) < 0 || ftruncate(to, 0) < 0 || lseek(to, 0, SEEK_SET) < 0)
+		return -1;
+	while((n = read(from, buf, sizeof(buf))) > 0)
+		for(m = 0; m < n; )
+		{
+			ssize_t k = write(to, buf + m, n - m);
+			if(k < 0)
+				return -1;
+			m += k;
+		}
+
+	return n < 0 ? -1 : 0;
+}
+
+
+static int
+copy_xattrs(int from, int to, const char *path)
+{
+	char *names, *name, *value = NULL;
+	ssize_t len, vlen;
+	int ret = 0;
+
+	if((names = malloc(XATTR_LIST_MAX_LEN)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	if((len = flistxattr(from, names, XATTR_LIST_MAX_LEN)) < 0)
+	{
+		free(names);
+		return errno == ENOTSUP ? 0 : -1;
+	}
+
+	for(name = names; name < names + len && ret == 0; name += strlen(name) + 1)
+	{
+		if((vlen = fgetxattr(from, name, NULL, 0)) < 0
+				|| (value = realloc(value, vlen + 1)) == NULL
+				|| (vlen = fgetxattr(from, name, value, vlen)) < 0
+				|| fsetxattr(to, name, value, vlen, 0) < 0)
+		{
+			warn("%s: cannot copy xattr %s", path, name);
+			ret = -1;
+		}
+	}
+
+	free(value);
+	free(names);
+	return ret;
+}
+
+
+/*
+ * Called by process_file() in place of set_flags() for a file which
+ * could only be opened read-only because it is running.  If PT_PAX has
+ * nothing to change, or the file cannot be replaced, only XATTR_PAX is
+ * set as before.  On success *fd is the new file.
+ */
+int
+replace_busy(struct pax_work *w, int *fd, const struct paxctl_opts *opts, int *written)
+{
+	struct pax_change c;
+	struct stat st, now;
+	char *dir, *tmp, *copy, *real;
+	int newfd, wrote = 0;
+
+	compute_flags(*fd, w->pax_flags, 1, opts->limit, opts->verbose, &c);
+	if(!c.pt_write)
+		return set_flags(*fd, &w->pax_flags, 0, opts->limit, opts->verbose, written);
+
+	if(fstat(*fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_nlink > 1)
+	{
+		if(opts->verbose)
+			fprintf(local_out(), "\tbusy, and has other hard links: cannot change PT_PAX flags\n");
+		return set_flags(*fd, &w->pax_flags, 0, opts->limit, opts->verbose, written);
+	}
+
+	// The copy goes next to the file itself, not next to a symlink to it
+	if((real = realpath(w->path, NULL)) == NULL)
+	{
+		warn("%s: cannot make a copy to replace it", w->path);
+		return set_flags(*fd, &w->pax_flags, 0, opts->limit, opts->verbose, written) | EXIT_FAILURE;
+	}
+
+	if((copy = strdup(real)) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	dir = dirname(copy);
+	if(asprintf(&tmp, "%s/.paxctl-ng.XXXXXX", dir) < 0)
+		err(EXIT_FAILURE, "asprintf()");
+	free(copy);
+
+	if((newfd = mkostemp(tmp, O_CLOEXEC)) < 0)
+	{
+		warn("%s: cannot make a copy to replace it", w->path);
+		free(tmp);
+		free(real);
+		return set_flags(*fd, &w->pax_flags, 0, opts->limit, opts->verbose, written) | EXIT_FAILURE;
+	}
+
+	// The chown() first, as it clears the setuid and setgid bits
+	if(copy_data(*fd, newfd) < 0 || fchown(newfd, st.st_uid, st.st_gid) < 0
+			|| fchmod(newfd, st.st_mode & 07777) < 0 || copy_xattrs(*fd, newfd, w->path) < 0)
+	{
+		warn("%s: cannot make a copy to replace it", w->path);
+		goto fail;
+	}
+
+	if(set_flags(newfd, &w->pax_flags, 1, opts->limit, opts->verbose, &wrote) != EXIT_SUCCESS)
+		goto fail;
+
+	// So a crash cannot leave the name on a copy whose data never made it
+	if(opts->sync && fsync(newfd) < 0)
+	{
+		warn("%s: sync failed", tmp);
+		goto fail;
+	}
+
+	// Only rename over the very file we copied
+	if(lstat(real, &now) < 0 || !S_ISREG(now.st_mode) || now.st_dev != st.st_dev || now.st_ino != st.st_ino)
+	{
+		warnx("%s: changed since it was opened, not replaced", w->path);
+		goto fail;
+	}
+
+	if(rename(tmp, real) < 0)
+	{
+		warn("%s: cannot replace it", w->path);
+		goto fail;
+	}
+
+	STAT_INC(STAT_REPLACED);
+	*written |= wrote;
+	if(opts->verbose)
+		fprintf(local_out(), "\tbusy: replaced with a copy\n");
+
+	close(*fd);
+	*fd = newfd;
+	free(tmp);
+	free(real);
+	return EXIT_SUCCESS;
+
+fail:
+	unlink(tmp);
+	close(newfd);
+	free(tmp);
+	free(real);
+	return set_flags(*fd, &w->pax_flags, 0, opts->limit, opts->verbose, written) | EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,649 @@
+/*
+	restart.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --restart: the kernel only reads the flags at exec, so after a bulk
+ * re-mark anything already running keeps the old ones until it is
+ * restarted.  Given the plan or -B manifest of the run, find each process
+ * which maps one of the files it changed, as its executable or as a
+ * shared object, and list what to restart, one line for each:
+ *
+ *	service	sshd.service	exe	812,813
+ *	program	/usr/bin/foo	lib	1207
+ *
+ * A process in a systemd unit or an OpenRC service cgroup is listed under
+ * the service, anything else under its executable.  exe means one of the
+ * processes runs a changed executable, whose flags it will get when it
+ * is restarted; lib means they only map a changed shared object.
+ *
+ * The changed files go into a set keyed by (st_dev, st_ino).  A plan
+ * already has those; a manifest is stat()ed.  Then /proc/PID/maps of each
+ * process is read once, and the inode of each file mapping looked up in
+ * the set.  maps gives the device of the filesystem's superblock, which
+ * on btrfs subvolumes and overlayfs is not st_dev, so each file is also
+ * put in the set under the device maps gives for its st_dev, which we
+ * find by mapping one of its files ourselves.
+ *
+ * A file renamed over since it was mapped, as by --replace-busy or a
+ * package upgrade, is in maps as "PATH (deleted)" with an inode we never
+ * saw, so those are looked up by path instead: whatever runs an older
+ * copy of a changed file needs restarting as much as one running it.
+ */
+struct restart_file
+{
+	dev_t dev;
+	ino_t ino;
+	char *path;
+};
+
+struct restart_set
+{
+	struct restart_file *slot;
+	size_t size, used;
+};
+
+struct restart_group
+{
+	char *name;
+	int service;
+	int exe;
+	char *pids;
+	size_t len, cap;
+};
+
+struct restart_state
+{
+	struct restart_set set;
+	struct restart_file *bypath;	/* the set again by realpath(), sorted */
+	size_t npaths;
+	struct restart_group *groups;
+	size_t ngroups, cap;
+	unsigned long nfiles, nprocs, nmatched, nunreadable, nbad;
+};
+
+
+static struct restart_file *
+set_find(struct restart_set *set, dev_t dev, ino_t ino)
+{
+	size_t j, mask;
+
+	if(set->size == 0)
+		return NULL;
+
+	mask = set->size - 1;
+	for(j = inode_hash(dev, ino) & mask; set->slot[j].ino; j = (j + 1) & mask)
+		if(set->slot[j].dev == dev && set->slot[j].ino == ino)
+			return &set->slot[j];
+
+	return NULL;
+}
+
+
+static void
+set_add(struct restart_set *set, dev_t dev, ino_t ino, const char *path)
+{
+	size_t i, j, mask;
+
+	if(ino == 0 || set_find(set, dev, ino))
+		return;
+
+	if(2 * (set->used + 1) > set->size)
+	{
+		struct restart_set bigger;
+
+		bigger.size = set->size ? 2 * set->size : 1024;
+		bigger.used = set->used;
+		if((bigger.slot = calloc(bigger.size, sizeof(struct restart_file))) == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		for(i = 0; i < set->size; i++)
+			if(set->slot[i].ino)
+			{
+				for(j = inode_hash(set->slot[i].dev, set->slot[i].ino) & (bigger.size - 1);
+						bigger.slot[j].ino; j = (j + 1) & (bigger.size - 1))
+					;
+				bigger.slot[j] = set->slot[i];
+			}
+
+		free(set->slot);
+		*set = bigger;
+	}
+
+	mask = set->size - 1;
+	for(j = inode_hash(dev, ino) & mask; set->slot[j].ino; j = (j + 1) & mask)
+		;
+
+	set->slot[j].dev = dev;
+	set->slot[j].ino = ino;
+	if((set->slot[j].path = strdup(path)) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	set->used++;
+}
+
+
+static void
+note_planned(dev_t dev, ino_t ino, const char *path, void *arg)
+{
+	struct restart_state *rs = arg;
+
+	set_add(&rs->set, dev, ino, path);
+}
+
+
+// A manifest record is FLAGS<TAB>PATH, or just PATH for --policy
+static void
+note_record(char *line, struct restart_state *rs)
+{
+	struct stat st;
+	char *path;
+
+	path = (path = strchr(line, '\t')) ? path + 1 : line;
+	if(stat(path, &st) < 0)
+	{
+		warn("%s", path);
+		rs->nbad++;
+		return;
+	}
+
+	set_add(&rs->set, st.st_dev, st.st_ino, path);
+}
+
+
+static int
+read_changed(const char *file, int delim, struct restart_state *rs)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int ret = EXIT_SUCCESS;
+
+	if(!strcmp(file, "-"))
+		f = stdin;
+	else if((f = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	if((n = getdelim(&line, &len, delim, f)) != -1 && !strncmp(line, PLAN_MAGIC, strlen(PLAN_MAGIC)))
+		ret = plan_changed(f, file, note_planned, rs, &rs->nbad);
+	else
+		for(; n != -1; n = getdelim(&line, &len, delim, f))
+		{
+			if(n > 0 && line[n-1] == delim)
+				line[--n] = '\0';
+			if(n == 0 || (delim == '\n' && line[0] == '#'))
+				continue;
+			note_record(line, rs);
+		}
+
+	if(ferror(f))
+	{
+		warn("%s", file);
+		ret = EXIT_FAILURE;
+	}
+
+	free(line);
+	if(f != stdin)
+		fclose(f);
+
+	return ret;
+}
+
+
+/*
+ * A line of maps is
+ *	START-END PERMS OFFSET MAJOR:MINOR INODE PATH
+ * with the device in hex.  Returns PATH, without its newline, or NULL if
+ * the line does not parse.
+ */
+static char *
+maps_line(char *line, dev_t *dev, unsigned long long *ino)
+{
+	unsigned long maj, min;
+	char *p, *end;
+	int i;
+
+	// Past the address, permissions and offset
+	for(p = line, i = 0; i < 3 && p; i++)
+		if((p = strchr(p, ' ')) != NULL)
+			p++;
+	if(p == NULL)
+		return NULL;
+
+	maj = strtoul(p, &end, 16);
+	if(*end != ':')
+		return NULL;
+	min = strtoul(end + 1, &end, 16);
+	*ino = strtoull(end, &end, 10);
+	*dev = makedev(maj, min);
+
+	end += strspn(end, " ");
+	end[strcspn(end, "\n")] = '\0';
+	return end;
+}
+
+
+// The device maps gives for path, which we map to see
+static int
+maps_dev(const char *path, dev_t *dev)
+{
+	struct stat st;
+	char *line = NULL;
+	size_t len = 0;
+	unsigned long long ino;
+	void *addr;
+	FILE *f;
+	int fd, ret = -1;
+
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if(fstat(fd, &st) < 0 || st.st_size == 0
+			|| (addr = mmap(NULL, 1, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	if((f = fopen("/proc/self/maps", "r")) != NULL)
+	{
+		while(ret < 0 && getline(&line, &len, f) != -1)
+			if(strtoull(line, NULL, 16) == (uintptr_t)addr && maps_line(line, dev, &ino) && ino == st.st_ino)
+				ret = 0;
+		free(line);
+		fclose(f);
+	}
+
+	munmap(addr, 1);
+	return ret;
+}
+
+
+// Also key each file by the device maps gives its filesystem
+static void
+add_maps_devs(struct restart_state *rs)
+{
+	struct { dev_t st_dev, dev; int ok; } *devs = NULL;
+	struct restart_file *files;
+	size_t i, j, n = 0, nfiles = 0;
+
+	// set_add() may move the slots, so work from a copy
+	if((files = calloc(rs->set.used + 1, sizeof(struct restart_file))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	for(i = 0; i < rs->set.size; i++)
+		if(rs->set.slot[i].ino)
+			files[nfiles++] = rs->set.slot[i];
+
+	for(i = 0; i < nfiles; i++)
+	{
+		for(j = 0; j < n && devs[j].st_dev != files[i].dev; j++)
+			;
+		if(j == n)
+		{
+			if((devs = realloc(devs, (n + 1) * sizeof(*devs))) == NULL)
+				err(EXIT_FAILURE, "realloc()");
+			devs[n].st_dev = files[i].dev;
+			devs[n].ok = 0;
+		}
+		// Any file on the same st_dev will do, so try until one can be mapped
+		if(!devs[j].ok)
+			devs[j].ok = maps_dev(files[i].path, &devs[j].dev) == 0;
+		if(j == n)
+			n++;
+	}
+
+	for(i = 0; i < nfiles; i++)
+	{
+		for(j = 0; devs[j].st_dev != files[i].dev; j++)
+			;
+		if(devs[j].ok && devs[j].dev != files[i].dev)
+			set_add(&rs->set, devs[j].dev, files[i].ino, files[i].path);
+	}
+
+	free(devs);
+	free(files);
+}
+
+
+static int
+path_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct restart_file *)a)->path, ((const struct restart_file *)b)->path);
+}
+
+
+// Index the set by the real path of each file, for the ones since replaced
+static void
+index_paths(struct restart_state *rs)
+{
+	size_t i;
+	char *real;
+
+	if((rs->bypath = calloc(rs->set.used + 1, sizeof(struct restart_file))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	for(i = 0; i < rs->set.size; i++)
+		if(rs->set.slot[i].ino)
+		{
+			if((real = realpath(rs->set.slot[i].path, NULL)) == NULL
+					&& (real = strdup(rs->set.slot[i].path)) == NULL)
+				err(EXIT_FAILURE, "strdup()");
+			rs->bypath[rs->npaths] = rs->set.slot[i];
+			rs->bypath[rs->npaths++].path = real;
+		}
+
+	qsort(rs->bypath, rs->npaths, sizeof(struct restart_file), path_cmp);
+}
+
+
+// A changed file which has since been renamed over, by the path maps gives
+static struct restart_file *
+find_deleted(struct restart_state *rs, const char *mapped)
+{
+	static const char deleted[] = " (deleted)";
+	struct restart_file key;
+	size_t len = strlen(mapped);
+	char *path;
+
+	if(len <= sizeof(deleted) - 1 || strcmp(mapped + len - (sizeof(deleted) - 1), deleted))
+		return NULL;
+
+	if((path = strndup(mapped, len - (sizeof(deleted) - 1))) == NULL)
+		err(EXIT_FAILURE, "strndup()");
+	key.path = path;
+	key.ino = 0;
+	mapped = bsearch(&key, rs->bypath, rs->npaths, sizeof(struct restart_file), path_cmp);
+	free(path);
+
+	return (struct restart_file *)mapped;
+}
+
+
+/*
+ * Looks up each file mapping of PID/maps.  Returns the first changed file
+ * mapped, or NULL, with *unreadable set if the maps could not be read.
+ */
+static struct restart_file *
+scan_maps(struct restart_state *rs, int procfd, const char *pid, int *unreadable)
+{
+	struct restart_file *found = NULL;
+	char path[NAME_MAX + 16], *line = NULL, *mapped;
+	unsigned long long ino, last = 0;
+	dev_t dev;
+	size_t len = 0;
+	FILE *f;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/maps", pid);
+	if((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		*unreadable = errno != ENOENT && errno != ESRCH;
+		return NULL;
+	}
+	if((f = fdopen(fd, "r")) == NULL)
+		err(EXIT_FAILURE, "fdopen()");
+
+	while(found == NULL && getline(&line, &len, f) != -1)
+	{
+		if((mapped = maps_line(line, &dev, &ino)) == NULL)
+			continue;
+
+		// A file is usually mapped several times in a row
+		if(ino == 0 || ino == last)
+			continue;
+		last = ino;
+
+		if((found = set_find(&rs->set, dev, ino)) == NULL)
+			found = find_deleted(rs, mapped);
+	}
+
+	free(line);
+	fclose(f);
+	*unreadable = 0;
+	return found;
+}
+
+
+/*
+ * The systemd unit or OpenRC service of PID from its cgroup, eg.
+ * 0::/system.slice/sshd.service or 0::/openrc.sshd, else NULL.  The
+ * deepest unit is taken, since a user's units are inside user@.service.
+ */
+static char *
+service_of(int procfd, const char *pid)
+{
+	char path[NAME_MAX + 16], buf[4096], *line, *next, *c, *save, *unit, *name = NULL;
+	ssize_t n;
+	size_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/cgroup", pid);
+	if((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(n <= 0)
+		return NULL;
+	buf[n] = '\0';
+
+	// Each line is ID:CONTROLLERS:PATH, the unified hierarchy's is 0::PATH
+	for(line = buf; line; line = next)
+	{
+		if((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		if((c = strchr(line, ':')) == NULL || (c = strchr(c + 1, ':')) == NULL)
+			continue;
+
+		unit = NULL;
+		for(c = strtok_r(c + 1, "/", &save); c; c = strtok_r(NULL, "/", &save))
+		{
+			len = strlen(c);
+			if(len > 8 && !strcmp(c + len - 8, ".service"))
+				unit = c;
+			else if(!strncmp(c, "openrc.", 7) && c[7] != '\0')
+				unit = c + 7;
+		}
+
+		if(unit && (name == NULL || !strncmp(line, "0::", 3)))
+			name = unit;
+	}
+
+	return name ? strdup(name) : NULL;
+}
+
+
+static void
+add_to_group(struct restart_state *rs, char *name, int service, int exe, const char *pid)
+{
+	struct restart_group *g;
+	size_t i, need;
+
+	for(i = 0; i < rs->ngroups; i++)
+		if(rs->groups[i].service == service && !strcmp(rs->groups[i].name, name))
+			break;
+
+	if(i == rs->ngroups)
+	{
+		if(rs->ngroups == rs->cap)
+		{
+			rs->cap = rs->cap ? 2 * rs->cap : 64;
+			if((rs->groups = realloc(rs->groups, rs->cap * sizeof(struct restart_group))) == NULL)
+				err(EXIT_FAILURE, "realloc()");
+		}
+		g = &rs->groups[rs->ngroups++];
+		memset(g, 0, sizeof(struct restart_group));
+		g->name = name;
+		g->service = service;
+	}
+	else
+	{
+		g = &rs->groups[i];
+		free(name);
+	}
+
+	g->exe |= exe;
+
+	need = g->len + strlen(pid) + 2;
+	if(need > g->cap)
+	{
+		g->cap = need > 2 * g->cap ? need : 2 * g->cap;
+		if((g->pids = realloc(g->pids, g->cap)) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	}
+	g->len += sprintf(g->pids + g->len, "%s%s", g->len ? "," : "", pid);
+}
+
+
+static int
+group_cmp(const void *a, const void *b)
+{
+	const struct restart_group *ga = a, *gb = b;
+
+	if(ga->service != gb->service)
+		return gb->service - ga->service;
+	return strcmp(ga->name, gb->name);
+}
+
+
+static void
+scan_proc(struct restart_state *rs, const char *proc, int verbose)
+{
+	struct restart_file *found, *exe_file;
+	struct dirent *de;
+	struct stat st;
+	char path[NAME_MAX + 16], self[32], exe[PATH_MAX], *name;
+	ssize_t n;
+	int procfd, unreadable, service;
+	DIR *dir;
+
+	if((dir = opendir(proc)) == NULL)
+		err(EXIT_FAILURE, "%s", proc);
+	procfd = dirfd(dir);
+	snprintf(self, sizeof(self), "%ld", (long)getpid());
+
+	while((de = readdir(dir)) != NULL)
+	{
+		if(!isdigit((unsigned char)de->d_name[0]) || strspn(de->d_name, "0123456789") != strlen(de->d_name)
+				|| !strcmp(de->d_name, self))
+			continue;
+
+		found = scan_maps(rs, procfd, de->d_name, &unreadable);
+		rs->nprocs++;
+		rs->nunreadable += unreadable;
+		if(found == NULL)
+			continue;
+		rs->nmatched++;
+
+		// Only the executable's marks decide the flags at exec
+		snprintf(path, sizeof(path), "%s/exe", de->d_name);
+		exe_file = NULL;
+		if(fstatat(procfd, path, &st, 0) == 0)
+			exe_file = set_find(&rs->set, st.st_dev, st.st_ino);
+		if(exe_file == NULL && (n = readlinkat(procfd, path, exe, sizeof(exe) - 1)) > 0)
+		{
+			exe[n] = '\0';
+			exe_file = find_deleted(rs, exe);
+		}
+
+		if(verbose)
+			printf("pid\t%s\t%s\t%s\n", de->d_name, exe_file ? "exe" : "lib", (exe_file ? exe_file : found)->path);
+
+		service = 1;
+		if((name = service_of(procfd, de->d_name)) == NULL)
+		{
+			service = 0;
+			if((n = readlinkat(procfd, path, exe, sizeof(exe) - 1)) < 0)
+				snprintf(exe, sizeof(exe), "pid %s", de->d_name);
+			else
+				exe[n] = '\0';
+			if((name = strdup(exe)) == NULL)
+				err(EXIT_FAILURE, "strdup()");
+		}
+
+		add_to_group(rs, name, service, exe_file != NULL, de->d_name);
+	}
+
+	closedir(dir);
+}
+
+
+int
+run_restart(char **argv, int argc, const struct paxctl_opts *opts)
+{
+	struct restart_state rs;
+	unsigned long nservices = 0;
+	size_t i;
+	int ret;
+
+	memset(&rs, 0, sizeof(rs));
+
+	ret = read_changed(opts->restart_file, opts->batch_delim, &rs);
+	rs.nfiles = rs.set.used;
+
+	if(rs.nfiles)
+	{
+		index_paths(&rs);
+		add_maps_devs(&rs);
+		scan_proc(&rs, argc ? argv[0] : "/proc", opts->verbose);
+	}
+
+	qsort(rs.groups, rs.ngroups, sizeof(struct restart_group), group_cmp);
+	for(i = 0; i < rs.ngroups; i++)
+	{
+		printf("%s\t%s\t%s\t%s\n", rs.groups[i].service ? "service" : "program", rs.groups[i].name,
+			rs.groups[i].exe ? "exe" : "lib", rs.groups[i].pids);
+		nservices += rs.groups[i].service;
+		free(rs.groups[i].name);
+		free(rs.groups[i].pids);
+	}
+	free(rs.groups);
+
+	for(i = 0; i < rs.set.size; i++)
+		free(rs.set.slot[i].path);
+	free(rs.set.slot);
+	for(i = 0; i < rs.npaths; i++)
+		free(rs.bypath[i].path);
+	free(rs.bypath);
+
+	printf("%lu files changed, %lu processes, %lu using them: %lu services and %lu other programs to restart, %lu unreadable\n",
+		rs.nfiles, rs.nprocs, rs.nmatched, nservices, rs.ngroups - nservices, rs.nunreadable);
+
+	if(rs.nbad)
+		ret |= EXIT_FAILURE;
+
+	return ret;
+}
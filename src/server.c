@@ -0,0 +1,584 @@
+/*
+	server.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --server: a long running paxctl-ng which takes requests over a UNIX
+ * socket, so that callers marking a few files at a time do not pay for
+ * a process start each time.  The protocol is described in lib/client.c.
+ *
+ * Each connection has a thread which reads its requests and hands them
+ * to the one worker pool; the workers write the replies back as they
+ * finish.  A connection is closed once the client has shut down its
+ * side and every request has been answered.
+ */
+
+// Longest request line we take, OP and ARG are short
+#define LINE_MAX_LEN	(PATH_MAX + 64)
+
+// Descriptors taken from one recvmsg()
+#define PASS_MAX	64
+
+struct srv_conn
+{
+	int fd;
+	int trusted;		/* the peer is root or us, so it may name paths */
+	uid_t uid;		/* else who it is, for the files it passes us */
+	unsigned long nreq;
+
+	pthread_mutex_t lock;	/* for writing replies and for pending */
+	pthread_cond_t idle;
+	unsigned long pending;
+
+	int *fds;		/* descriptors passed but not used yet */
+	size_t nfds, fds_size, fds_head;
+
+	struct srv_conn *next;
+};
+
+struct srv_req
+{
+	struct pax_work w;	/* first, the pool gives us back &w */
+	struct paxctl_opts opts;
+	struct srv_conn *conn;
+	unsigned long id;
+};
+
+static const struct paxctl_opts *server_opts;
+static struct pax_pool *server_pool;
+
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conns_gone = PTHREAD_COND_INITIALIZER;
+static struct srv_conn *conns;
+
+static volatile sig_atomic_t server_stop;
+
+
+static void
+stop_handler(int sig)
+{
+	server_stop = 1;
+}
+
+
+static void
+flags4reply(uint16_t flags, char *buf)
+{
+	if(flags == UINT16_MAX)
+		strcpy(buf, "none");
+	else
+		elfix_bin2string4print(flags, buf);
+}
+
+
+// Call with c->lock held
+static void
+conn_reply(struct srv_conn *c, unsigned long id, int error, int written, uint16_t pt_flags, uint16_t xt_flags)
+{
+	char line[64], pt[ELFIX_FLAGS_SIZE], xt[ELFIX_FLAGS_SIZE];
+	ssize_t n;
+	int len, off = 0;
+
+	flags4reply(pt_flags, pt);
+	flags4reply(xt_flags, xt);
+	len = snprintf(line, sizeof(line), "%lu\t%d\t%d\t%s\t%s\n", id, error, written, pt, xt);
+
+	// If the client has gone away there is nobody left to tell
+	while(off < len)
+	{
+		if((n = send(c->fd, line + off, len - off, MSG_NOSIGNAL)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		off += n;
+	}
+}
+
+
+static void
+request_done(struct pax_work *w)
+{
+	struct srv_req *r = (struct srv_req *)w;
+	struct srv_conn *c = r->conn;
+	int error = w->errnum;
+
+	if(error == 0 && w->ret != EXIT_SUCCESS)
+		error = EIO;
+
+	pthread_mutex_lock(&c->lock);
+	conn_reply(c, r->id, error, w->written, w->pt_flags, w->xt_flags);
+	if(--c->pending == 0)
+		pthread_cond_signal(&c->idle);
+	pthread_mutex_unlock(&c->lock);
+
+	free(w->path);
+	free(r);
+}
+
+
+/*
+ * Turn OP and ARG into the options process_file() would have had on the
+ * command line.  Returns 0 or an errno value for the reply.
+ */
+static int
+request_opts(const char *op, const char *arg, struct paxctl_opts *opts, uint16_t *pax_flags)
+{
+	*opts = *server_opts;
+	opts->verbose = 0;
+	opts->tree = 0;
+	opts->cp_flags = 0;
+	opts->limit = 0;
+	*pax_flags = 0;
+
+	if(!strcmp(op, "get"))
+		return 0;
+
+	if(!strcmp(op, "set") || !strcmp(op, "set-pt") || !strcmp(op, "set-xt"))
+	{
+		if(elfix_parse_flags(arg, pax_flags) < 0)
+			return EINVAL;
+		if(!strcmp(op, "set-pt"))
+			opts->limit = LIMIT_TO_PT_FLAGS;
+		else if(!strcmp(op, "set-xt"))
+			opts->limit = LIMIT_TO_XT_FLAGS;
+		return 0;
+	}
+
+#ifdef XTPAX
+	if(!strcmp(op, "create"))
+	{
+		if(!strcmp(arg, "secure"))
+			opts->cp_flags = CREATE_XT_FLAGS_SECURE;
+		else if(!strcmp(arg, "default"))
+			opts->cp_flags = CREATE_XT_FLAGS_DEFAULT;
+		else
+			return EINVAL;
+		return 0;
+	}
+
+	if(!strcmp(op, "delete"))
+	{
+		opts->cp_flags = DELETE_XT_FLAGS;
+		return 0;
+	}
+#endif
+
+#if defined(PTPAX) && defined(XTPAX)
+	if(!strcmp(op, "copy"))
+	{
+		if(!strcmp(arg, "pt2xt"))
+			opts->cp_flags = COPY_PT_TO_XT_FLAGS;
+		else if(!strcmp(arg, "xt2pt"))
+			opts->cp_flags = COPY_XT_TO_PT_FLAGS;
+		else
+			return EINVAL;
+		return 0;
+	}
+#endif
+
+	if(!strcmp(op, "create") || !strcmp(op, "delete") || !strcmp(op, "copy"))
+		return ENOTSUP;
+
+	return EINVAL;
+}
+
+
+/*
+ * fsetxattr() asks nothing of how the descriptor was opened, so a peer
+ * could pass one it only opened for reading, eg. of a setuid binary, and
+ * have us mark it.  Returns 0 if fd was opened for writing and uid owns
+ * the file, else EPERM.
+ */
+static int
+fd_writable_by(int fd, uid_t uid)
+{
+	struct stat st;
+	int mode;
+
+	if((mode = fcntl(fd, F_GETFL)) < 0 || fstat(fd, &st) < 0)
+		return EPERM;
+	if((mode & O_ACCMODE) != O_RDWR && (mode & O_ACCMODE) != O_WRONLY)
+		return EPERM;
+	if(st.st_uid != uid)
+		return EPERM;
+
+	return 0;
+}
+
+
+static void
+conn_request(struct srv_conn *c, char *line)
+{
+	struct srv_req *r;
+	char *op, *arg, *path;
+	uint16_t pax_flags;
+	int error, fd = -1;
+
+	if((r = calloc(1, sizeof(struct srv_req))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	r->id = ++c->nreq;
+	r->conn = c;
+
+	op = strsep(&line, "\t");
+	arg = strsep(&line, "\t");
+	path = line;
+
+	if(arg == NULL || path == NULL)
+		error = EINVAL;
+	else
+		error = request_opts(op, arg, &r->opts, &pax_flags);
+
+	// Every request with no path uses up a descriptor, even a bad one
+	if(path != NULL && *path == '\0')
+	{
+		if(c->fds_head < c->nfds)
+			fd = c->fds[c->fds_head++];
+		else if(error == 0)
+			error = EBADF;
+	}
+	else if(path != NULL && !c->trusted && error == 0)
+		error = EPERM;
+
+	// We may be root, so only change what the peer could have changed itself
+	if(fd >= 0 && !c->trusted && error == 0 && (pax_flags != 0 || r->opts.cp_flags != 0))
+		error = fd_writable_by(fd, c->uid);
+
+	if(error == 0 && (r->w.path = strdup(*path ? path : "(fd)")) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+
+	pthread_mutex_lock(&c->lock);
+	if(error)
+	{
+		conn_reply(c, r->id, error, 0, UINT16_MAX, UINT16_MAX);
+		pthread_mutex_unlock(&c->lock);
+		if(fd >= 0)
+			close(fd);
+		free(r);
+		return;
+	}
+	c->pending++;
+	pthread_mutex_unlock(&c->lock);
+
+	r->w.fd = fd;
+	r->w.pax_flags = pax_flags;
+	r->w.query = 1;
+	r->w.pt_flags = UINT16_MAX;
+	r->w.xt_flags = UINT16_MAX;
+	r->w.opts = &r->opts;
+	r->w.done = request_done;
+
+	pool_submit(server_pool, &r->w);
+}
+
+
+// Keep the descriptors which came with the data, in order
+static void
+conn_take_fds(struct srv_conn *c, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	int *fds, i, n;
+
+	for(cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		fds = (int *)CMSG_DATA(cmsg);
+
+		// Drop the ones already used before making room
+		if(c->fds_head > 0)
+		{
+			memmove(c->fds, c->fds + c->fds_head, (c->nfds - c->fds_head) * sizeof(int));
+			c->nfds -= c->fds_head;
+			c->fds_head = 0;
+		}
+		if(c->nfds + n > c->fds_size)
+		{
+			c->fds_size = c->nfds + n + PASS_MAX;
+			if((c->fds = realloc(c->fds, c->fds_size * sizeof(int))) == NULL)
+				err(EXIT_FAILURE, "realloc()");
+		}
+		for(i = 0; i < n; i++)
+			c->fds[c->nfds++] = fds[i];
+	}
+
+	if(msg->msg_flags & MSG_CTRUNC)
+		warnx("server: passed descriptors were dropped");
+}
+
+
+static void
+conn_free(struct srv_conn *c)
+{
+	struct srv_conn **pp;
+
+	pthread_mutex_lock(&c->lock);
+	while(c->pending > 0)
+		pthread_cond_wait(&c->idle, &c->lock);
+	pthread_mutex_unlock(&c->lock);
+
+	pthread_mutex_lock(&conns_lock);
+	for(pp = &conns; *pp; pp = &(*pp)->next)
+		if(*pp == c)
+		{
+			*pp = c->next;
+			break;
+		}
+	pthread_cond_broadcast(&conns_gone);
+	pthread_mutex_unlock(&conns_lock);
+
+	if(server_opts->verbose)
+		printf("server: %d: %lu requests\n", c->fd, c->nreq);
+
+	for(; c->fds_head < c->nfds; c->fds_head++)
+		close(c->fds[c->fds_head]);
+	close(c->fd);
+
+	pthread_cond_destroy(&c->idle);
+	pthread_mutex_destroy(&c->lock);
+	free(c->fds);
+	free(c);
+}
+
+
+static void *
+conn_reader(void *arg)
+{
+	struct srv_conn *c = arg;
+	struct msghdr msg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(PASS_MAX * sizeof(int))];
+	char *buf, *line, *nl;
+	size_t len = 0;
+	ssize_t n;
+
+	if((buf = malloc(LINE_MAX_LEN)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	for(;;)
+	{
+		if(len == LINE_MAX_LEN)
+		{
+			warnx("server: %d: request too long", c->fd);
+			break;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf + len;
+		iov.iov_len = LINE_MAX_LEN - len;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		if((n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		conn_take_fds(c, &msg);
+		if(n == 0)
+			break;
+		len += n;
+
+		line = buf;
+		while((nl = memchr(line, '\n', len - (line - buf))) != NULL)
+		{
+			*nl = '\0';
+			conn_request(c, line);
+			line = nl + 1;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+	}
+
+	free(buf);
+	conn_free(c);
+
+	return NULL;
+}
+
+
+static void
+conn_start(int fd)
+{
+	struct srv_conn *c;
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	memset(&cred, 0, sizeof(cred));
+	if((c = calloc(1, sizeof(struct srv_conn))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	c->fd = fd;
+	c->uid = (uid_t)-1;
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->idle, NULL);
+
+	// Anybody who can reach the socket may mark the files it passes us, if they are its own
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) == 0)
+	{
+		c->trusted = cred.uid == 0 || cred.uid == geteuid();
+		c->uid = cred.uid;
+	}
+
+	if(server_opts->verbose)
+		printf("server: %d: connected, pid %d uid %d\n", fd, (int)cred.pid, (int)cred.uid);
+
+	pthread_mutex_lock(&conns_lock);
+	c->next = conns;
+	conns = c;
+	pthread_mutex_unlock(&conns_lock);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if((errno = pthread_create(&tid, &attr, conn_reader, c)))
+		err(EXIT_FAILURE, "pthread_create()");
+	pthread_attr_destroy(&attr);
+}
+
+
+int
+run_server(const struct paxctl_opts *opts)
+{
+	struct paxctl_opts popts;
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	struct sigaction sa;
+	struct pool_totals totals;
+	struct stat st;
+	struct srv_conn *c;
+	sigset_t stop, orig;
+	mode_t mask;
+	int lfd, fd;
+
+	if(strlen(opts->server) >= sizeof(addr.sun_path))
+		errx(EXIT_FAILURE, "%s: socket path too long", opts->server);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, opts->server);
+
+	if((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		err(EXIT_FAILURE, "socket()");
+
+	// Replace a socket left behind by a server which did not clean up
+	if(lstat(opts->server, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(opts->server);
+
+	// Only we may connect, unless the socket's mode is changed later
+	mask = umask(077);
+	if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		err(EXIT_FAILURE, "%s", opts->server);
+	umask(mask);
+
+	if(listen(lfd, SOMAXCONN) < 0)
+		err(EXIT_FAILURE, "listen()");
+
+	/*
+	 * SIGINT and SIGTERM stay blocked, so every thread started from here
+	 * on inherits that, and are only let through while we wait in ppoll().
+	 */
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGINT);
+	sigaddset(&stop, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop, &orig);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// The prefetch stage would open paths itself, so it is left out
+	popts = *opts;
+	popts.uring_depth = 0;
+	server_opts = &popts;
+	server_pool = pool_create(&popts, 0);
+
+	if(opts->verbose)
+		printf("server: listening on %s\n", opts->server);
+
+	while(!server_stop)
+	{
+		pfd.fd = lfd;
+		pfd.events = POLLIN;
+		if(ppoll(&pfd, 1, NULL, &orig) < 0)
+		{
+			if(errno != EINTR)
+				warn("ppoll()");
+			continue;
+		}
+
+		if((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+		{
+			if(errno != EINTR && errno != ECONNABORTED)
+				warn("accept()");
+			continue;
+		}
+
+		conn_start(fd);
+	}
+
+	close(lfd);
+	unlink(opts->server);
+
+	// Stop reading, let the requests already taken be answered
+	pthread_mutex_lock(&conns_lock);
+	for(c = conns; c; c = c->next)
+		shutdown(c->fd, SHUT_RD);
+	while(conns)
+		pthread_cond_wait(&conns_gone, &conns_lock);
+	pthread_mutex_unlock(&conns_lock);
+
+	// Requests which failed have been reported to their own clients
+	pool_finish(server_pool, &totals);
+
+	if(opts->verbose)
+	{
+		printf("server: %lu files, %lu failed\n", totals.nfiles, totals.nfailed);
+		print_totals(&totals);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,637 @@
+/*
+	snapshot.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --snapshot, --diff and --restore.  A snapshot records, for every ELF
+ * object a run looked at, its path, device and inode, ABI, size and
+ * header hash, and PT_PAX and XATTR_PAX flags.  The records are sorted by
+ * path, bytewise as strcmp() does, so two snapshots can be compared by
+ * walking them side by side once.
+ *
+ * The file is binary and little endian:
+ *
+ *	"PAXSNAP\0"	magic
+ *	u32		version
+ *	u32		reserved, 0
+ *	u64		number of records
+ *
+ * and then each record is
+ *
+ *	varint		bytes in common with the previous path
+ *	varint		length of the rest of the path
+ *	bytes		the rest of the path
+ *	varint		st_dev
+ *	varint		st_ino
+ *	u8 u8 u8	EI_CLASS, EI_DATA, EI_OSABI
+ *	varint		e_machine
+ *	u16 u16		PT_PAX and XATTR_PAX flags, 0xffff if there are none
+ *	varint		st_size
+ *	u64		elfix_get_header_hash()
+ *
+ * where a varint is 7 bits per byte, low bits first, with the top bit
+ * set on every byte but the last.  Sorted paths share most of their
+ * bytes with the one before, so a record is usually 25 to 35 bytes.
+ * Version 1 snapshots, which end each record at the flags, can still be
+ * diffed but not restored.
+ */
+#define SNAP_MAGIC	"PAXSNAP"
+#define SNAP_VERSION	2
+
+struct snap_record
+{
+	char *path;
+	uint64_t dev, ino;
+	unsigned char elf_class, data, osabi;
+	uint16_t machine;
+	uint16_t pt_flags, xt_flags;
+	uint64_t size, hash;
+};
+
+struct pax_snapshot
+{
+	FILE *f;
+	char *file;
+	pthread_mutex_t lock;
+	struct snap_record *rec;
+	size_t n, size;
+};
+
+
+struct pax_snapshot *
+snapshot_create(const char *file)
+{
+	struct pax_snapshot *snap;
+
+	if((snap = calloc(1, sizeof(struct pax_snapshot))) == NULL || (snap->file = strdup(file)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	// Fail now rather than after the scan
+	if((snap->f = fopen(file, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	pthread_mutex_init(&snap->lock, NULL);
+
+	return snap;
+}
+
+
+// Called from process_file() once the flags of an open file are read
+void
+snapshot_file(struct pax_snapshot *snap, const char *path, int fd, uint16_t pt_flags, uint16_t xt_flags)
+{
+	struct elfix_elf_info info;
+	struct snap_record r;
+	struct stat st;
+
+	// Only ELF objects are recorded
+	if(fstat(fd, &st) < 0 || elfix_get_elf_info(local_elfix(), fd, &info) != ELFIX_OK
+			|| elfix_get_header_hash(local_elfix(), fd, &r.hash, &r.size) != ELFIX_OK)
+		return;
+
+	if((r.path = strdup(path)) == NULL)
+		err(EXIT_FAILURE, "strdup()");
+	r.dev = st.st_dev;
+	r.ino = st.st_ino;
+	r.elf_class = info.elf_class;
+	r.data = info.data;
+	r.osabi = info.osabi;
+	r.machine = info.machine;
+	r.pt_flags = pt_flags;
+	r.xt_flags = xt_flags;
+
+	pthread_mutex_lock(&snap->lock);
+	if(snap->n == snap->size)
+	{
+		snap->size = snap->size ? 2 * snap->size : 1024;
+		if((snap->rec = realloc(snap->rec, snap->size * sizeof(struct snap_record))) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	}
+	snap->rec[snap->n++] = r;
+	pthread_mutex_unlock(&snap->lock);
+}
+
+
+static void
+put_varint(FILE *f, uint64_t v)
+{
+	while(v >= 0x80)
+	{
+		putc((v & 0x7f) | 0x80, f);
+		v >>= 7;
+	}
+	putc(v, f);
+}
+
+
+static void
+put_le(FILE *f, uint64_t v, int n)
+{
+	for(; n > 0; n--, v >>= 8)
+		putc(v & 0xff, f);
+}
+
+
+static int
+record_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct snap_record *)a)->path, ((const struct snap_record *)b)->path);
+}
+
+
+void
+snapshot_close(struct pax_snapshot *snap)
+{
+	const char *prev = "";
+	size_t i, j, shared, len;
+	long bytes;
+
+	qsort(snap->rec, snap->n, sizeof(struct snap_record), record_cmp);
+
+	// The same file reached twice, eg. by overlapping -T arguments
+	for(i = j = 0; i < snap->n; i++)
+		if(j > 0 && !strcmp(snap->rec[j-1].path, snap->rec[i].path))
+			free(snap->rec[i].path);
+		else
+			snap->rec[j++] = snap->rec[i];
+	snap->n = j;
+
+	fwrite(SNAP_MAGIC, 1, sizeof(SNAP_MAGIC), snap->f);
+	put_le(snap->f, SNAP_VERSION, 4);
+	put_le(snap->f, 0, 4);
+	put_le(snap->f, snap->n, 8);
+
+	for(i = 0; i < snap->n; i++)
+	{
+		struct snap_record *r = &snap->rec[i];
+
+		for(shared = 0; prev[shared] && prev[shared] == r->path[shared]; shared++)
+			;
+		len = strlen(r->path + shared);
+
+		put_varint(snap->f, shared);
+		put_varint(snap->f, len);
+		fwrite(r->path + shared, 1, len, snap->f);
+		put_varint(snap->f, r->dev);
+		put_varint(snap->f, r->ino);
+		putc(r->elf_class, snap->f);
+		putc(r->data, snap->f);
+		putc(r->osabi, snap->f);
+		put_varint(snap->f, r->machine);
+		put_le(snap->f, r->pt_flags, 2);
+		put_le(snap->f, r->xt_flags, 2);
+		put_varint(snap->f, r->size);
+		put_le(snap->f, r->hash, 8);
+
+		if(i > 0)
+			free((char *)prev);
+		prev = r->path;
+	}
+	if(snap->n > 0)
+		free((char *)prev);
+
+	bytes = ftell(snap->f);
+	if(fclose(snap->f) != 0)
+		err(EXIT_FAILURE, "%s", snap->file);
+
+	printf("snapshot: %zu files, %ld bytes, in %s\n", snap->n, bytes, snap->file);
+
+	pthread_mutex_destroy(&snap->lock);
+	free(snap->rec);
+	free(snap->file);
+	free(snap);
+}
+
+
+/*
+ * Reading a snapshot back, one record at a time, so that a diff needs
+ * no more memory than the two records it is looking at.
+ */
+struct snap_reader
+{
+	FILE *f;
+	const char *file;
+	int version;
+	uint64_t left;
+	struct snap_record r;
+	size_t size;
+};
+
+
+static void
+truncated(const struct snap_reader *s)
+{
+	if(ferror(s->f))
+		err(EXIT_FAILURE, "%s", s->file);
+	errx(EXIT_FAILURE, "%s: truncated or corrupt snapshot", s->file);
+}
+
+
+static uint64_t
+get_varint(struct snap_reader *s)
+{
+	uint64_t v = 0;
+	int c, shift;
+
+	for(shift = 0; shift < 64; shift += 7)
+	{
+		if((c = getc(s->f)) == EOF)
+			truncated(s);
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if(!(c & 0x80))
+			return v;
+	}
+
+	truncated(s);
+	return 0;
+}
+
+
+static uint64_t
+get_le(struct snap_reader *s, int n)
+{
+	uint64_t v = 0;
+	int c, i;
+
+	for(i = 0; i < n; i++)
+	{
+		if((c = getc(s->f)) == EOF)
+			truncated(s);
+		v |= (uint64_t)c << (8 * i);
+	}
+
+	return v;
+}
+
+
+static void
+reader_open(struct snap_reader *s, const char *file)
+{
+	char magic[sizeof(SNAP_MAGIC)];
+
+	memset(s, 0, sizeof(struct snap_reader));
+	s->file = file;
+
+	if((s->f = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+
+	if(fread(magic, 1, sizeof(magic), s->f) != sizeof(magic) || memcmp(magic, SNAP_MAGIC, sizeof(magic)))
+		errx(EXIT_FAILURE, "%s: not a paxctl-ng snapshot", file);
+	s->version = get_le(s, 4);
+	if(s->version < 1 || s->version > SNAP_VERSION)
+		errx(EXIT_FAILURE, "%s: unknown snapshot version", file);
+	get_le(s, 4);
+	s->left = get_le(s, 8);
+
+	s->size = 256;
+	if((s->r.path = malloc(s->size)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	s->r.path[0] = '\0';
+}
+
+
+// Returns 0 at the end of the snapshot
+static int
+reader_next(struct snap_reader *s)
+{
+	uint64_t shared, len;
+
+	if(s->left == 0)
+		return 0;
+	s->left--;
+
+	shared = get_varint(s);
+	len = get_varint(s);
+	if(shared > strlen(s->r.path) || len > SIZE_MAX / 2)
+		truncated(s);
+
+	if(shared + len + 1 > s->size)
+	{
+		while(shared + len + 1 > s->size)
+			s->size *= 2;
+		if((s->r.path = realloc(s->r.path, s->size)) == NULL)
+			err(EXIT_FAILURE, "realloc()");
+	}
+	if(fread(s->r.path + shared, 1, len, s->f) != len)
+		truncated(s);
+	s->r.path[shared + len] = '\0';
+
+	s->r.dev = get_varint(s);
+	s->r.ino = get_varint(s);
+	s->r.elf_class = get_le(s, 1);
+	s->r.data = get_le(s, 1);
+	s->r.osabi = get_le(s, 1);
+	s->r.machine = get_varint(s);
+	s->r.pt_flags = get_le(s, 2);
+	s->r.xt_flags = get_le(s, 2);
+	if(s->version >= 2)
+	{
+		s->r.size = get_varint(s);
+		s->r.hash = get_le(s, 8);
+	}
+
+	return 1;
+}
+
+
+static void
+reader_close(struct snap_reader *s)
+{
+	fclose(s->f);
+	free(s->r.path);
+}
+
+
+struct diff_counts
+{
+	unsigned long added, lost, changed;
+};
+
+
+/*
+ * One line per field which differs: KIND FIELD OLD NEW PATH, separated
+ * by tabs, where KIND is added, lost or changed and a missing side is '-'.
+ */
+static void
+diff_field(struct diff_counts *dc, const char *field, uint16_t old, uint16_t new, const char *path)
+{
+	char obuf[ELFIX_FLAGS_SIZE], nbuf[ELFIX_FLAGS_SIZE];
+
+	if(old == new)
+		return;
+
+	strcpy(obuf, "-");
+	strcpy(nbuf, "-");
+	if(old != UINT16_MAX)
+		elfix_bin2string4print(old, obuf);
+	if(new != UINT16_MAX)
+		elfix_bin2string4print(new, nbuf);
+
+	if(old == UINT16_MAX)
+	{
+		printf("added\t%s\t%s\t%s\t%s\n", field, obuf, nbuf, path);
+		dc->added++;
+	}
+	else if(new == UINT16_MAX)
+	{
+		printf("lost\t%s\t%s\t%s\t%s\n", field, obuf, nbuf, path);
+		dc->lost++;
+	}
+	else
+	{
+		printf("changed\t%s\t%s\t%s\t%s\n", field, obuf, nbuf, path);
+		dc->changed++;
+	}
+}
+
+
+static void
+diff_record(struct diff_counts *dc, const struct snap_record *old, const struct snap_record *new)
+{
+	const char *path = old ? old->path : new->path;
+
+	diff_field(dc, "PT_PAX", old ? old->pt_flags : UINT16_MAX, new ? new->pt_flags : UINT16_MAX, path);
+	diff_field(dc, "XATTR_PAX", old ? old->xt_flags : UINT16_MAX, new ? new->xt_flags : UINT16_MAX, path);
+}
+
+
+int
+run_diff(const char *old_file, const char *new_file)
+{
+	struct snap_reader a, b;
+	struct diff_counts dc;
+	unsigned long nold = 0, nnew = 0;
+	int more_a, more_b, c;
+
+	memset(&dc, 0, sizeof(dc));
+	reader_open(&a, old_file);
+	reader_open(&b, new_file);
+
+	more_a = reader_next(&a);
+	more_b = reader_next(&b);
+	while(more_a || more_b)
+	{
+		if(!more_a)
+			c = 1;
+		else if(!more_b)
+			c = -1;
+		else
+			c = strcmp(a.r.path, b.r.path);
+
+		if(c < 0)
+		{
+			diff_record(&dc, &a.r, NULL);
+			nold++;
+			more_a = reader_next(&a);
+		}
+		else if(c > 0)
+		{
+			diff_record(&dc, NULL, &b.r);
+			nnew++;
+			more_b = reader_next(&b);
+		}
+		else
+		{
+			diff_record(&dc, &a.r, &b.r);
+			nold++;
+			nnew++;
+			more_a = reader_next(&a);
+			more_b = reader_next(&b);
+		}
+	}
+
+	reader_close(&a);
+	reader_close(&b);
+
+	printf("%lu files before, %lu after: %lu flags added, %lu lost, %lu changed\n",
+		nold, nnew, dc.added, dc.lost, dc.changed);
+
+	return EXIT_SUCCESS;
+}
+
+
+/*
+ * --restore: put back the flags a snapshot recorded, eg. after a backup
+ * or rsync which did not keep user.pax.flags.  The snapshot is streamed
+ * to the worker pool, and each file is first checked to still be the
+ * same build, by its size and header hash, since only the path ties it
+ * to the record.  One which is not is left alone.  Then only the fields
+ * which differ from the snapshot are written, and a field the snapshot
+ * has as missing is left as it is.
+ */
+struct snap_restore
+{
+	uint64_t size, hash;
+	uint16_t pt_flags, xt_flags;
+};
+
+
+// Called from process_file() for each file of a --restore
+int
+restore_file(struct pax_work *w, const struct paxctl_opts *opts)
+{
+	struct snap_restore *e = w->restore;
+	uint64_t hash, size;
+#ifdef PTPAX
+	uint16_t flags;
+#endif
+	int fd, rdwr = 0, written = 0, ret = EXIT_SUCCESS;
+
+#ifdef PTPAX
+	// Most restores are only XATTR_PAX, which needs no write access to the data
+	if(e->pt_flags != UINT16_MAX && opts->limit != LIMIT_TO_XT_FLAGS)
+		rdwr = 1;
+#endif
+
+	if((fd = open(w->path, rdwr ? O_RDWR : O_RDONLY)) < 0 && rdwr && errno != ENOENT)
+	{
+		rdwr = 0;
+		fd = open(w->path, O_RDONLY);
+	}
+	if(fd < 0)
+	{
+		w->errnum = errno;
+		STAT_INC(STAT_OPEN_FAILED);
+		if(opts->verbose)
+			fprintf(local_out(), "%s:\n\topen() failed: %s\n\n", w->path, strerror(errno));
+		return errno == ENOENT ? ENOENT : EXIT_FAILURE;
+	}
+	STAT_INC(rdwr ? STAT_OPEN_RDWR : STAT_OPEN_RDONLY);
+
+	if(elfix_get_header_hash(local_elfix(), fd, &hash, &size) != ELFIX_OK)
+	{
+		if(opts->verbose)
+			fprintf(local_out(), "%s:\n\t%s\n\n", w->path, elfix_strerror(local_elfix()));
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if(size != e->size || hash != e->hash)
+	{
+		w->stale = 1;
+		if(opts->verbose)
+			fprintf(local_out(), "%s:\n\tnot the file in the snapshot, left alone\n\n", w->path);
+		close(fd);
+		return EXIT_SUCCESS;
+	}
+	w->changing = 1;
+
+#ifdef PTPAX
+	if(rdwr && (flags = get_pt_flags(fd, 0)) != UINT16_MAX && flags != e->pt_flags)
+	{
+		ret |= set_pt_flags(fd, e->pt_flags, opts->verbose);
+		written |= WROTE_PT;
+	}
+#endif
+#ifdef XTPAX
+	if(e->xt_flags != UINT16_MAX && opts->limit != LIMIT_TO_PT_FLAGS && get_xt_flags(fd) != e->xt_flags)
+	{
+		ret |= set_xt_flags(fd, e->xt_flags);
+		written |= WROTE_XT;
+	}
+#endif
+	w->written = written && ret == EXIT_SUCCESS;
+
+	if(opts->sync && w->written)
+		ret |= sync_file(opts, w->path, fd, written);
+
+	if(opts->verbose)
+		fprintf(local_out(), "%s:\n\t%s\n\n", w->path, ret != EXIT_SUCCESS ? "write failed" : written ? "restored" : "up to date");
+
+	close(fd);
+	return ret;
+}
+
+
+static void
+restore_done(struct pax_work *w)
+{
+	free(w->restore);
+	free(w->path);
+	free(w);
+}
+
+
+int
+run_restore(const struct paxctl_opts *opts)
+{
+	struct paxctl_opts ropts;
+	struct snap_reader s;
+	struct pax_pool *pool;
+	struct pool_totals totals;
+	struct pax_work *w;
+	unsigned long nrecords = 0, nbare = 0;
+	int ret;
+
+	reader_open(&s, opts->restore_file);
+	if(s.version < 2)
+		errx(EXIT_FAILURE, "%s: a version %d snapshot has no sizes and hashes to check files against",
+			opts->restore_file, s.version);
+
+	ropts = *opts;
+	ropts.uring_depth = 0;
+	pool = pool_create(&ropts, 1);
+
+	while(reader_next(&s))
+	{
+		nrecords++;
+
+		// Nothing to put back
+		if(s.r.pt_flags == UINT16_MAX && s.r.xt_flags == UINT16_MAX)
+		{
+			nbare++;
+			continue;
+		}
+
+		if((w = calloc(1, sizeof(struct pax_work))) == NULL || (w->path = strdup(s.r.path)) == NULL
+				|| (w->restore = malloc(sizeof(struct snap_restore))) == NULL)
+			err(EXIT_FAILURE, "malloc()");
+		w->restore->size = s.r.size;
+		w->restore->hash = s.r.hash;
+		w->restore->pt_flags = s.r.pt_flags;
+		w->restore->xt_flags = s.r.xt_flags;
+		w->fd = -1;
+		w->done = restore_done;
+		pool_submit(pool, w);
+	}
+
+	reader_close(&s);
+	ret = pool_finish(pool, &totals);
+
+	printf("%lu records, %lu without flags: %lu files, %lu ok, %lu failed\n",
+		nrecords, nbare, totals.nfiles, totals.nfiles - totals.nfailed, totals.nfailed);
+	printf("%lu not the file in the snapshot and left alone\n", totals.nstale);
+	print_totals(&totals);
+
+	return ret;
+}
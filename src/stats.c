@@ -0,0 +1,210 @@
+/*
+	stats.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --stats counters.  Each thread bumps its own copy in stats_local with
+ * no locking and adds it into stats_all with stats_merge() just before
+ * it exits.  The counters are always kept since they are only an add;
+ * the phase timings need a clock_gettime() each and so are only taken
+ * when --stats was given.
+ */
+__thread struct pax_stats stats_local;
+int stats_timing;
+
+static struct pax_stats stats_all;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec stats_start;
+
+static const char *stat_names[STAT_COUNTERS] = {
+	"open_rdwr",
+	"open_rdonly",
+	"open_failed",
+	"libelf_sessions",
+	"bytes_read",
+	"xattr_get",
+	"xattr_set",
+	"xattr_remove",
+	"enoattr",
+	"not_elf",
+	"pt_writes",
+	"cache_hits",
+	"cache_misses",
+	"fdatasync",
+	"fsync",
+	"syncfs",
+	"replaced",
+	"replace_clone",
+	"replace_copy",
+	"registry_hits",
+	"registry_misses",
+	"pages_dropped",
+	"ordered_by_extent",
+	"ordered_by_inode",
+	"uring_read",
+	"uring_getxattr"
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+	"open",
+	"create_delete",
+	"copy",
+	"set",
+	"print"
+};
+
+
+void
+stats_begin(void)
+{
+	stats_timing = 1;
+	clock_gettime(CLOCK_MONOTONIC, &stats_start);
+}
+
+
+double
+stats_now(void)
+{
+	struct timespec now;
+
+	if(!stats_timing)
+		return 0.0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+void
+stats_phase(int phase, double since)
+{
+	if(stats_timing)
+		stats_local.secs[phase] += stats_now() - since;
+}
+
+
+void
+stats_merge(void)
+{
+	struct elfix_stats es;
+	int i;
+
+	// What libelfix counted for this thread
+	if(elfix_local)
+	{
+		elfix_get_stats(elfix_local, &es);
+		elfix_reset_stats(elfix_local);
+		stats_local.count[STAT_ELF_SESSIONS] += es.elf_sessions;
+		stats_local.count[STAT_BYTES_READ] += es.bytes_read;
+		stats_local.count[STAT_XATTR_GET] += es.xattr_get;
+		stats_local.count[STAT_XATTR_SET] += es.xattr_set;
+		stats_local.count[STAT_XATTR_REMOVE] += es.xattr_remove;
+		stats_local.count[STAT_ENOATTR] += es.enoattr;
+		stats_local.count[STAT_PT_WRITES] += es.pt_writes;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	for(i = 0; i < STAT_COUNTERS; i++)
+		stats_all.count[i] += stats_local.count[i];
+	for(i = 0; i < PHASE_COUNT; i++)
+		stats_all.secs[i] += stats_local.secs[i];
+	pthread_mutex_unlock(&stats_lock);
+
+	memset(&stats_local, 0, sizeof(struct pax_stats));
+}
+
+
+static double
+tv2secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+
+/*
+ * Print everything collected so far.  With no file the report is a
+ * table on stderr, out of the way of -v and the summary lines; otherwise
+ * it is written as JSON to the file, or to stdout for "-".
+ */
+void
+stats_report(const char *file)
+{
+	struct timespec now;
+	struct rusage ru;
+	double wall, user, sys;
+	FILE *f;
+	int i;
+
+	stats_merge();
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wall = (now.tv_sec - stats_start.tv_sec) + (now.tv_nsec - stats_start.tv_nsec) / 1e9;
+	getrusage(RUSAGE_SELF, &ru);
+	user = tv2secs(&ru.ru_utime);
+	sys = tv2secs(&ru.ru_stime);
+
+	if(file == NULL)
+	{
+		fflush(stdout);
+		for(i = 0; i < STAT_COUNTERS; i++)
+			fprintf(stderr, "stats: %-16s %lu\n", stat_names[i], stats_all.count[i]);
+		for(i = 0; i < PHASE_COUNT; i++)
+			fprintf(stderr, "stats: %-16s %.6f s\n", phase_names[i], stats_all.secs[i]);
+		fprintf(stderr, "stats: %-16s %.6f s\n", "wall", wall);
+		fprintf(stderr, "stats: %-16s %.6f s (user %.6f, sys %.6f)\n", "cpu", user + sys, user, sys);
+		return;
+	}
+
+	if(!strcmp(file, "-"))
+		f = stdout;
+	else if((f = fopen(file, "w")) == NULL)
+	{
+		warn("%s", file);
+		return;
+	}
+
+	fprintf(f, "{\n\t\"counters\": {\n");
+	for(i = 0; i < STAT_COUNTERS; i++)
+		fprintf(f, "\t\t\"%s\": %lu%s\n", stat_names[i], stats_all.count[i],
+			i < STAT_COUNTERS - 1 ? "," : "");
+	fprintf(f, "\t},\n\t\"phase_secs\": {\n");
+	for(i = 0; i < PHASE_COUNT; i++)
+		fprintf(f, "\t\t\"%s\": %.6f%s\n", phase_names[i], stats_all.secs[i],
+			i < PHASE_COUNT - 1 ? "," : "");
+	fprintf(f, "\t},\n");
+	fprintf(f, "\t\"wall_secs\": %.6f,\n", wall);
+	fprintf(f, "\t\"user_secs\": %.6f,\n", user);
+	fprintf(f, "\t\"sys_secs\": %.6f\n", sys);
+	fprintf(f, "}\n");
+
+	if(f != stdout)
+		fclose(f);
+}
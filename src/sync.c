@@ -0,0 +1,158 @@
+/*
+	sync.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --sync: by default the marks are left in the page cache like any other
+ * write, which is all an image build needs since it syncs at the end
+ * anyway.  With --sync=file each file is flushed before it is closed:
+ * fdatasync() is enough when only PT_PAX changed, since that is data,
+ * but an xattr is inode metadata which fdatasync() need not write, so
+ * XATTR_PAX takes an fsync().  With --sync=fs we only note the
+ * filesystem of each file written, and sync_finish() calls syncfs()
+ * once on each at the end of the run.
+ *
+ * syncfs() needs an fd on the filesystem.  Keeping a dup() of the one we
+ * wrote through would keep the binary open for writing, and so make
+ * exec() of it fail with ETXTBSY until we exit, so we open it again
+ * read-only instead.  That is once per filesystem, not per file.
+ */
+struct sync_fs
+{
+	dev_t dev;
+	int fd;
+	struct sync_fs *next;
+};
+
+static struct sync_fs *sync_list;
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int
+note_fs(const char *path, int fd)
+{
+	struct sync_fs *s;
+	struct stat st;
+	int ret = EXIT_SUCCESS;
+
+	if(fstat(fd, &st) < 0)
+	{
+		warn("%s: cannot sync", path);
+		return EXIT_FAILURE;
+	}
+
+	pthread_mutex_lock(&sync_lock);
+	for(s = sync_list; s; s = s->next)
+		if(s->dev == st.st_dev)
+			break;
+
+	if(s == NULL)
+	{
+		if((s = malloc(sizeof(struct sync_fs))) == NULL)
+			err(EXIT_FAILURE, "malloc()");
+		s->dev = st.st_dev;
+		if((s->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		{
+			warn("%s: cannot sync its filesystem", path);
+			ret = EXIT_FAILURE;
+			free(s);
+		}
+		else
+		{
+			s->next = sync_list;
+			sync_list = s;
+		}
+	}
+	pthread_mutex_unlock(&sync_lock);
+
+	return ret;
+}
+
+
+/*
+ * Called with the fd still open once WROTE_PT and WROTE_XT in what say
+ * something was written to path.
+ */
+int
+sync_file(const struct paxctl_opts *opts, const char *path, int fd, int what)
+{
+	if(what == 0)
+		return EXIT_SUCCESS;
+
+	switch(opts->sync)
+	{
+		case SYNC_FILE:
+			if(what & WROTE_XT)
+			{
+				STAT_INC(STAT_FSYNC);
+				if(fsync(fd) == 0)
+					return EXIT_SUCCESS;
+			}
+			else
+			{
+				STAT_INC(STAT_FDATASYNC);
+				if(fdatasync(fd) == 0)
+					return EXIT_SUCCESS;
+			}
+			warn("%s: sync failed", path);
+			return EXIT_FAILURE;
+
+		case SYNC_FS:
+			return note_fs(path, fd);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+// One syncfs() for each filesystem noted during the run
+int
+sync_finish(void)
+{
+	struct sync_fs *s;
+	int ret = EXIT_SUCCESS;
+
+	while((s = sync_list) != NULL)
+	{
+		STAT_INC(STAT_SYNCFS);
+		if(syncfs(s->fd) < 0)
+		{
+			warn("syncfs()");
+			ret = EXIT_FAILURE;
+		}
+		close(s->fd);
+		sync_list = s->next;
+		free(s);
+	}
+
+	return ret;
+}
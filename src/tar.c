@@ -0,0 +1,858 @@
+/*
+	tar.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --tar: mark the ELF members of a tar archive as it streams from stdin
+ * to stdout, so a rootfs or image layer can be marked without unpacking
+ * it.  The flags come from the command line or from --policy, matched
+ * against each member's name as if the archive were unpacked at /.
+ *
+ * PT_PAX is patched in the member's data.  Only its first TAR_HEAD bytes
+ * are read in, which holds the Ehdr and phdr table of nearly every object;
+ * the rest is passed through with splice() or copy_file_range(), or
+ * read() and write() if neither works on stdin and stdout.  A member
+ * whose phdrs lie further in, or which the policy must look into, is
+ * spooled whole to a memfd first.
+ *
+ * XATTR_PAX goes in a SCHILY.xattr.user.pax.flags record of the pax
+ * extended header in front of the member, the record GNU tar and
+ * bsdtar restore as an xattr with --xattrs.  An extended header already
+ * there is rewritten with the record added or replaced.
+ */
+#define TAR_BLOCK	512
+#define TAR_HEAD	4096
+
+#define PAX_XATTR	"SCHILY.xattr." ELFIX_PAX_NAMESPACE
+
+struct tar_header
+{
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+union tar_block
+{
+	struct tar_header h;
+	unsigned char b[TAR_BLOCK];
+};
+
+// How to move data from one fd to another, the first which works is kept
+#define COPY_SPLICE	0
+#define COPY_RANGE	1
+#define COPY_RW		2
+
+struct tar_filter
+{
+	const struct paxctl_opts *opts;
+	int in, out;
+	int how_out, how_spool, how_unspool;
+	uint64_t at;			/* bytes of the input read so far */
+
+	/* What goes out in front of the next member */
+	char *pend;			/* GNU 'L' and 'K' headers with their data */
+	size_t npend, szpend;
+	char *longname;			/* the name from an 'L' header */
+	int have_x;			/* a pax 'x' header */
+	union tar_block xhdr;
+	char *x;			/* and its records */
+	size_t nx;
+
+	unsigned long nmembers, nelf, nmarked, nunmatched, nfailed;
+};
+
+static char copy_buf[1 << 17];
+
+
+static size_t
+read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while(done < len)
+	{
+		if((n = read(fd, (char *)buf + done, len - done)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "read() of the archive");
+		}
+		if(n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
+
+static void
+writev_full(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while(iovcnt > 0)
+	{
+		if((n = writev(fd, iov, iovcnt)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "write() of the archive");
+		}
+		for(; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--)
+			n -= iov->iov_len;
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+
+static void
+write_full(int fd, const void *buf, size_t len)
+{
+	struct iovec iov = { (void *)buf, len };
+
+	writev_full(fd, &iov, 1);
+}
+
+
+/*
+ * Move len bytes from in to out, without them passing through here if
+ * the kernel can do it: splice() if either is a pipe, copy_file_range()
+ * if both are files.  Returns the bytes moved, short only at EOF.
+ */
+static uint64_t
+copy_data(int in, int out, uint64_t len, int *how)
+{
+	uint64_t done = 0;
+	size_t chunk;
+	ssize_t n;
+
+	while(done < len)
+	{
+		chunk = len - done > (1 << 30) ? (1 << 30) : len - done;
+
+		if(*how == COPY_SPLICE)
+			n = splice(in, NULL, out, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+		else if(*how == COPY_RANGE)
+			n = copy_file_range(in, NULL, out, NULL, chunk, 0);
+		else
+		{
+			if((n = read(in, copy_buf, chunk > sizeof(copy_buf) ? sizeof(copy_buf) : chunk)) > 0)
+				write_full(out, copy_buf, n);
+		}
+
+		if(n < 0 && errno == EINTR)
+			continue;
+
+		// Not for these two fds, try the next way
+		if(n < 0 && *how != COPY_RW && done == 0 && (errno == EINVAL || errno == ENOSYS
+				|| errno == EXDEV || errno == EBADF || errno == EOPNOTSUPP))
+		{
+			(*how)++;
+			continue;
+		}
+
+		if(n < 0)
+			err(EXIT_FAILURE, "copying the archive");
+		if(n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
+
+static void
+pass_through(struct tar_filter *t, uint64_t len)
+{
+	if(copy_data(t->in, t->out, len, &t->how_out) != len)
+		errx(EXIT_FAILURE, "the archive ends in the middle of a member");
+	t->at += len;
+}
+
+
+static uint64_t
+padded(uint64_t len)
+{
+	return (len + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+}
+
+
+// Octal, or base-256 as GNU tar writes sizes which do not fit
+static int
+tar_number(const char *field, size_t len, uint64_t *v)
+{
+	const unsigned char *p = (const unsigned char *)field;
+	size_t i;
+
+	*v = 0;
+
+	if(*p & 0x80)
+	{
+		if(*p != 0x80 || len > 9 + 8)
+			return -1;
+		for(i = 1; i < len; i++)
+		{
+			if(*v >> 56)
+				return -1;
+			*v = (*v << 8) | p[i];
+		}
+		return 0;
+	}
+
+	for(i = 0; i < len && p[i] == ' '; i++)
+		;
+	for(; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+		*v = (*v << 3) | (p[i] - '0');
+
+	return i < len && p[i] != ' ' && p[i] != '\0' ? -1 : 0;
+}
+
+
+// The checksum counts the chksum field itself as spaces
+static unsigned
+tar_checksum(const union tar_block *blk)
+{
+	unsigned sum = 0;
+	size_t i;
+
+	for(i = 0; i < TAR_BLOCK; i++)
+		if(i < offsetof(struct tar_header, chksum) || i >= offsetof(struct tar_header, typeflag))
+			sum += blk->b[i];
+
+	return sum + 8 * ' ';
+}
+
+
+static int
+header_ok(const union tar_block *blk)
+{
+	uint64_t sum;
+
+	return tar_number(blk->h.chksum, sizeof(blk->h.chksum), &sum) == 0 && sum == tar_checksum(blk);
+}
+
+
+static void
+set_checksum(union tar_block *blk)
+{
+	snprintf(blk->h.chksum, sizeof(blk->h.chksum), "%06o", tar_checksum(blk));
+	blk->h.chksum[7] = ' ';
+}
+
+
+static void
+grow(char **buf, size_t *size, size_t want)
+{
+	if(want <= *size)
+		return;
+
+	*size = want < 2 * *size ? 2 * *size : want;
+	if((*buf = realloc(*buf, *size)) == NULL)
+		err(EXIT_FAILURE, "realloc()");
+}
+
+
+// Read a member's data and its padding, NUL terminated for convenience
+static char *
+read_data(struct tar_filter *t, uint64_t len)
+{
+	char *data;
+
+	if(len > (1 << 24))
+		errx(EXIT_FAILURE, "an extended header of %llu bytes is too long", (unsigned long long)len);
+
+	if((data = malloc(padded(len) + 1)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	if(read_full(t->in, data, padded(len)) != padded(len))
+		errx(EXIT_FAILURE, "the archive ends in the middle of a member");
+	t->at += padded(len);
+	data[len] = '\0';
+
+	return data;
+}
+
+
+/*
+ * Pax records are "LEN KEY=VALUE\n" where LEN counts the whole record,
+ * its own digits included.  Calls fn, if any, on each until it returns
+ * nonzero.  Returns -1 if the records do not parse.
+ */
+static int
+pax_records(const char *x, size_t nx, int (*fn)(const char *, size_t, const char *, size_t, const char *, size_t, void *), void *arg)
+{
+	const char *p = x, *end = x + nx, *key, *eq;
+	size_t len;
+
+	while(p < end)
+	{
+		for(len = 0, key = p; key < end && *key >= '0' && *key <= '9' && len < nx; key++)
+			len = len * 10 + (*key - '0');
+		// At least the space and the newline after the digits
+		if(key == p || key >= end || *key != ' ' || len > (size_t)(end - p)
+				|| len <= (size_t)(key - p) + 1 || p[len - 1] != '\n')
+			return -1;
+		key++;
+		if((eq = memchr(key, '=', p + len - 1 - key)) == NULL)
+			return -1;
+		if(fn && fn(key, eq - key, eq + 1, p + len - 1 - (eq + 1), p, len, arg))
+			break;
+		p += len;
+	}
+
+	return 0;
+}
+
+
+struct pax_lookup
+{
+	const char *key;
+	const char *val;
+	size_t len;
+};
+
+static int
+pax_find_one(const char *key, size_t klen, const char *val, size_t vlen, const char *rec, size_t rlen, void *arg)
+{
+	struct pax_lookup *l = arg;
+
+	if(strlen(l->key) != klen || memcmp(l->key, key, klen))
+		return 0;
+
+	// The last record for a key wins, keep going
+	l->val = val;
+	l->len = vlen;
+	return 0;
+}
+
+static int
+pax_find(const struct tar_filter *t, const char *key, const char **val, size_t *len)
+{
+	struct pax_lookup l = { key, NULL, 0 };
+
+	if(!t->have_x || pax_records(t->x, t->nx, pax_find_one, &l) < 0 || l.val == NULL)
+		return 0;
+
+	*val = l.val;
+	*len = l.len;
+	return 1;
+}
+
+
+#ifdef XTPAX
+struct pax_rebuild
+{
+	const char *key;
+	char *out;
+	size_t nout;
+};
+
+static int
+pax_keep_one(const char *key, size_t klen, const char *val, size_t vlen, const char *rec, size_t rlen, void *arg)
+{
+	struct pax_rebuild *r = arg;
+
+	if(strlen(r->key) != klen || memcmp(r->key, key, klen))
+	{
+		memcpy(r->out + r->nout, rec, rlen);
+		r->nout += rlen;
+	}
+	return 0;
+}
+
+static size_t
+ndigits(size_t n)
+{
+	size_t d = 1;
+
+	while(n >= 10)
+	{
+		n /= 10;
+		d++;
+	}
+
+	return d;
+}
+
+// Set key to val in the pending extended header, starting one if need be
+static void
+pax_set(struct tar_filter *t, const char *key, const char *val)
+{
+	struct pax_rebuild r;
+	size_t kv, len;
+	char *old;
+
+	// " KEY=VALUE\n" and then the length, which counts its own digits
+	kv = strlen(key) + strlen(val) + 3;
+	len = kv + ndigits(kv);
+	len = kv + ndigits(len);
+
+	old = t->x;
+	r.key = key;
+	if((r.out = malloc((t->have_x ? t->nx : 0) + len + 1)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	r.nout = 0;
+
+	if(t->have_x)
+		pax_records(old, t->nx, pax_keep_one, &r);
+
+	r.nout += sprintf(r.out + r.nout, "%zu %s=%s\n", len, key, val);
+
+	free(old);
+	t->x = r.out;
+	t->nx = r.nout;
+	t->have_x = 1;
+}
+#endif
+
+
+// The member's name as the files would be unpacked at /
+static char *
+member_path(struct tar_filter *t, const union tar_block *blk)
+{
+	const char *val, *name;
+	char *path;
+	size_t len;
+
+	if(pax_find(t, "path", &val, &len))
+		;
+	else if(t->longname)
+	{
+		val = t->longname;
+		len = strlen(val);
+	}
+	else
+	{
+		val = NULL;
+		len = 0;
+	}
+
+	if((path = malloc(len + sizeof(blk->h.prefix) + sizeof(blk->h.name) + 3)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+
+	if(val)
+	{
+		path[0] = '/';
+		memcpy(path + 1, val, len);
+		path[len + 1] = '\0';
+	}
+	// Only POSIX ustar has a prefix, GNU keeps other things there
+	else if(!memcmp(blk->h.magic, "ustar", 6) && blk->h.prefix[0])
+		sprintf(path, "/%.155s/%.100s", blk->h.prefix, blk->h.name);
+	else
+		sprintf(path, "/%.100s", blk->h.name);
+
+	// ./usr/bin/foo and usr/bin/foo are both /usr/bin/foo
+	for(name = path + 1; name[0] == '/' || (name[0] == '.' && name[1] == '/'); name++)
+		;
+	memmove(path + 1, name, strlen(name) + 1);
+
+	return path;
+}
+
+
+// Send out whatever was waiting for the member whose header is blk, then blk and head
+static void
+flush_pending(struct tar_filter *t, const union tar_block *blk, const char *head, size_t nhead)
+{
+	static const char zeros[TAR_BLOCK];
+	struct iovec iov[6];
+	int n = 0;
+
+	if(t->npend)
+	{
+		iov[n].iov_base = t->pend;
+		iov[n++].iov_len = t->npend;
+	}
+
+	if(t->have_x)
+	{
+		snprintf(t->xhdr.h.size, sizeof(t->xhdr.h.size), "%011llo", (unsigned long long)t->nx);
+		set_checksum(&t->xhdr);
+		iov[n].iov_base = t->xhdr.b;
+		iov[n++].iov_len = TAR_BLOCK;
+		iov[n].iov_base = t->x;
+		iov[n++].iov_len = t->nx;
+		if(padded(t->nx) != t->nx)
+		{
+			iov[n].iov_base = (void *)zeros;
+			iov[n++].iov_len = padded(t->nx) - t->nx;
+		}
+	}
+
+	iov[n].iov_base = (void *)blk->b;
+	iov[n++].iov_len = TAR_BLOCK;
+
+	if(nhead)
+	{
+		iov[n].iov_base = (void *)head;
+		iov[n++].iov_len = nhead;
+	}
+
+	writev_full(t->out, iov, n);
+
+	t->npend = 0;
+	free(t->longname);
+	t->longname = NULL;
+	t->have_x = 0;
+}
+
+
+#ifdef XTPAX
+// A new extended header for the member whose header is blk
+static void
+start_x(struct tar_filter *t, const union tar_block *blk)
+{
+	const char *base;
+	char name[sizeof(blk->h.name) + 1];
+
+	memcpy(name, blk->h.name, sizeof(blk->h.name));
+	name[sizeof(blk->h.name)] = '\0';
+	base = strrchr(name, '/') && strrchr(name, '/')[1] ? strrchr(name, '/') + 1 : name;
+
+	memset(&t->xhdr, 0, sizeof(t->xhdr));
+	snprintf(t->xhdr.h.name, sizeof(t->xhdr.h.name), "PaxHeaders/%.88s", base);
+	strcpy(t->xhdr.h.mode, "0000644");
+	strcpy(t->xhdr.h.uid, "0000000");
+	strcpy(t->xhdr.h.gid, "0000000");
+	memcpy(t->xhdr.h.mtime, blk->h.mtime, sizeof(blk->h.mtime));
+	t->xhdr.h.typeflag = 'x';
+	memcpy(t->xhdr.h.magic, "ustar", 6);
+	memcpy(t->xhdr.h.version, "00", 2);
+
+	free(t->x);
+	t->x = NULL;
+	t->nx = 0;
+	t->have_x = 1;
+}
+#endif
+
+
+// Copy the rest of a member into a memfd, with the head already read
+static int
+spool(struct tar_filter *t, const char *head, size_t nhead, uint64_t size)
+{
+	int fd;
+
+	if((fd = memfd_create("paxctl-ng-tar", MFD_CLOEXEC)) < 0)
+		err(EXIT_FAILURE, "memfd_create()");
+
+	write_full(fd, head, nhead);
+	if(copy_data(t->in, fd, size - nhead, &t->how_spool) != size - nhead)
+		errx(EXIT_FAILURE, "the archive ends in the middle of a member");
+	t->at += size - nhead;
+
+	return fd;
+}
+
+
+static void
+print_member(const char *path, uint16_t pt_flags, uint16_t xt_flags)
+{
+	char buf[ELFIX_FLAGS_SIZE];
+
+	fprintf(stderr, "%s:\n", path);
+#ifdef PTPAX
+	memset(buf, 0, ELFIX_FLAGS_SIZE);
+	elfix_bin2string4print(pt_flags, buf);
+	fprintf(stderr, "\tPT_PAX    : %s\n", pt_flags == UINT16_MAX ? "not found" : buf);
+#endif
+#ifdef XTPAX
+	memset(buf, 0, ELFIX_FLAGS_SIZE);
+	elfix_bin2string4print(xt_flags, buf);
+	fprintf(stderr, "\tXATTR_PAX : %s\n", xt_flags == UINT16_MAX ? "not found" : buf);
+#endif
+	fprintf(stderr, "\n");
+}
+
+
+/*
+ * A regular file: work out its flags, patch its head and give it an
+ * extended header as need be, then send it all on.
+ */
+static void
+mark_member(struct tar_filter *t, union tar_block *blk, uint64_t size)
+{
+	const struct paxctl_opts *opts = t->opts;
+	char head[TAR_HEAD];
+	char *path;
+	size_t nhead;
+	uint64_t rest;
+	uint16_t pax_flags = opts->pax_flags;
+	uint16_t pt_flags = UINT16_MAX, xt_flags = UINT16_MAX;
+	uint16_t old;
+	int fd = -1, m, marked = 0;
+#ifdef PTPAX
+	int e;
+#endif
+#ifdef XTPAX
+	const char *val;
+	size_t len;
+	char buf[ELFIX_FLAGS_SIZE];
+#endif
+
+	nhead = size < TAR_HEAD ? size : TAR_HEAD;
+	if(read_full(t->in, head, nhead) != nhead)
+		errx(EXIT_FAILURE, "the archive ends in the middle of a member");
+	t->at += nhead;
+	STAT_ADD(STAT_BYTES_READ, nhead);
+
+	path = member_path(t, blk);
+
+	if(nhead < SELFMAG || memcmp(head, ELFMAG, SELFMAG))
+	{
+		STAT_INC(STAT_NOT_ELF);
+		goto out;
+	}
+	t->nelf++;
+
+	if(opts->policy)
+	{
+		m = policy_match(opts->policy, path, -1, &pax_flags);
+		if(m == POLICY_NEED_FD)
+		{
+			fd = spool(t, head, nhead, size);
+			m = policy_match(opts->policy, path, fd, &pax_flags);
+		}
+		if(m != POLICY_MATCH || pax_flags == 0)
+		{
+			t->nunmatched++;
+			goto out;
+		}
+	}
+
+#ifdef PTPAX
+	if(opts->limit != LIMIT_TO_XT_FLAGS)
+	{
+		old = UINT16_MAX;
+		e = elfix_get_pt_flags_mem(local_elfix(), head, nhead, &old);
+
+		// The phdrs are not in the head, so it is all in a file or nothing
+		if(e == ELFIX_EINVAL && nhead < size)
+		{
+			if(fd < 0)
+				fd = spool(t, head, nhead, size);
+			old = get_pt_flags(fd, 0);
+		}
+		else if(e != ELFIX_OK && e != ELFIX_ENOFLAGS)
+		{
+			warnx("%s: %s", path, elfix_strerror(local_elfix()));
+			t->nfailed++;
+		}
+
+		pt_flags = old;
+		if(old != UINT16_MAX && old != (update_flags(old, pax_flags) | PF_NORANDEXEC))
+		{
+			pt_flags = update_flags(old, pax_flags) | PF_NORANDEXEC;
+			if(e == ELFIX_EINVAL && fd >= 0)
+			{
+				if(set_pt_flags(fd, pt_flags, 0) != EXIT_SUCCESS
+						|| pread(fd, head, nhead, 0) != (ssize_t)nhead)
+					errx(EXIT_FAILURE, "%s: could not set PT_PAX", path);
+			}
+			else
+				elfix_set_pt_flags_mem(local_elfix(), head, nhead, pt_flags);
+			marked = 1;
+		}
+	}
+#endif
+
+#ifdef XTPAX
+	if(opts->limit != LIMIT_TO_PT_FLAGS)
+	{
+		if(pax_find(t, PAX_XATTR, &val, &len) && len < ELFIX_FLAGS_SIZE)
+		{
+			memcpy(buf, val, len);
+			buf[len] = '\0';
+			xt_flags = elfix_string2bin(buf);
+		}
+
+		old = xt_flags;
+		xt_flags = update_flags(old == UINT16_MAX ? PF_NOEMUTRAMP : old, pax_flags);
+		if(old == UINT16_MAX || old != xt_flags)
+		{
+			if(!t->have_x)
+				start_x(t, blk);
+			memset(buf, 0, ELFIX_FLAGS_SIZE);
+			elfix_bin2string(xt_flags, buf);
+			pax_set(t, PAX_XATTR, buf);
+			marked = 1;
+		}
+	}
+#endif
+
+	t->nmarked += marked;
+
+	if(opts->verbose)
+		print_member(path, pt_flags, xt_flags);
+
+out:
+	flush_pending(t, blk, head, nhead);
+
+	rest = padded(size) - nhead;
+	if(fd >= 0)
+	{
+		if(lseek(fd, nhead, SEEK_SET) < 0
+				|| copy_data(fd, t->out, size - nhead, &t->how_unspool) != size - nhead)
+			err(EXIT_FAILURE, "copying %s back from the memfd", path);
+		close(fd);
+		rest = padded(size) - size;
+	}
+	pass_through(t, rest);
+
+	free(path);
+}
+
+
+int
+run_tar(const struct paxctl_opts *opts)
+{
+	struct tar_filter t;
+	union tar_block blk;
+	const char *val;
+	size_t n, len;
+	uint64_t size;
+	char *data, *num;
+
+	if(isatty(STDOUT_FILENO))
+		errx(EXIT_FAILURE, "option --tar will not write an archive to a terminal");
+
+	memset(&t, 0, sizeof(t));
+	t.opts = opts;
+	t.in = STDIN_FILENO;
+	t.out = STDOUT_FILENO;
+
+	for(;;)
+	{
+		if((n = read_full(t.in, blk.b, TAR_BLOCK)) == 0)
+			break;
+		if(n < TAR_BLOCK)
+			errx(EXIT_FAILURE, "the archive ends in the middle of a header");
+
+		// The end of the archive, the rest is zeros and goes out as it is
+		if(blk.b[0] == 0 && !memcmp(blk.b, blk.b + 1, TAR_BLOCK - 1))
+		{
+			flush_pending(&t, &blk, NULL, 0);
+			copy_data(t.in, t.out, UINT64_MAX, &t.how_out);
+			break;
+		}
+
+		if(!header_ok(&blk) || tar_number(blk.h.size, sizeof(blk.h.size), &size) < 0)
+			errx(EXIT_FAILURE, "this is not a tar archive, or it is damaged at byte %llu",
+				(unsigned long long)t.at);
+		t.at += TAR_BLOCK;
+
+		// An extended header can say how big the member really is
+		if(blk.h.typeflag != 'x' && pax_find(&t, "size", &val, &len))
+		{
+			if((num = strndup(val, len)) == NULL)
+				err(EXIT_FAILURE, "strndup()");
+			size = strtoull(num, NULL, 10);
+			free(num);
+		}
+
+		switch(blk.h.typeflag)
+		{
+			case 'x':
+				free(t.x);
+				t.x = read_data(&t, size);
+				t.nx = size;
+				if(pax_records(t.x, t.nx, NULL, NULL) < 0)
+					errx(EXIT_FAILURE, "a bad extended header at byte %llu", (unsigned long long)t.at);
+				t.xhdr = blk;
+				t.have_x = 1;
+				continue;
+			case 'L':
+			case 'K':
+				data = read_data(&t, size);
+				grow(&t.pend, &t.szpend, t.npend + TAR_BLOCK + padded(size));
+				memcpy(t.pend + t.npend, blk.b, TAR_BLOCK);
+				memcpy(t.pend + t.npend + TAR_BLOCK, data, padded(size));
+				t.npend += TAR_BLOCK + padded(size);
+				if(blk.h.typeflag == 'L')
+				{
+					free(t.longname);
+					t.longname = data;
+				}
+				else
+					free(data);
+				continue;
+		}
+
+		t.nmembers++;
+		if(blk.h.typeflag == '0' || blk.h.typeflag == '\0' || blk.h.typeflag == '7')
+			mark_member(&t, &blk, size);
+		else
+		{
+			flush_pending(&t, &blk, NULL, 0);
+			pass_through(&t, padded(size));
+		}
+	}
+
+	free(t.pend);
+	free(t.longname);
+	free(t.x);
+
+	if(opts->verbose)
+	{
+		fprintf(stderr, "%lu members, %lu ELF, %lu marked, %lu failed\n",
+			t.nmembers, t.nelf, t.nmarked, t.nfailed);
+		if(opts->policy)
+			fprintf(stderr, "%lu left alone by the policy\n", t.nunmatched);
+	}
+
+	return t.nfailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
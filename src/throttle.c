@@ -0,0 +1,318 @@
+/*
+	throttle.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * --throttle: run a scan on a loaded host without getting in its way.
+ * Files are started no faster than FILES a second and the bytes read
+ * from them are paid for at BYTES a second, on one schedule shared by
+ * all the workers, so -j only helps until the cap is reached.  The run
+ * goes in the idle I/O class, which the BFQ scheduler serves only when
+ * no one else wants the disk, files are opened with O_NOATIME where we
+ * may, and once done with a file the pages of its head we brought into
+ * the page cache are dropped again with POSIX_FADV_DONTNEED.  Pages which
+ * were there before are left alone, as someone else wants them.
+ *
+ * At the end we report what we cost: our cpu time, how long we slept to
+ * keep to the caps and the longest any one file took.
+ */
+#define THROTTLE_FILES		100		// a second, if not given
+#define THROTTLE_BYTES		(1 << 20)	// a second, if not given
+
+// From linux/ioprio.h, which older headers do not have
+#define THROTTLE_IOPRIO_WHO_PROCESS	1
+#define THROTTLE_IOPRIO_CLASS_IDLE	3
+#define THROTTLE_IOPRIO_CLASS_SHIFT	13
+
+struct pax_throttle
+{
+	unsigned long files, bytes;	// caps a second, 0 is none
+	int idle;			// got the idle I/O class
+	pthread_mutex_t lock;
+	double next;			// when the next file may start
+	unsigned long nfiles, nbytes, ndropped;
+	double waited, busiest, busy;
+};
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static unsigned long
+parse_rate(const char *s, const char *end, int suffix)
+{
+	unsigned long n;
+	char *p;
+
+	errno = 0;
+	n = strtoul(s, &p, 10);
+	if(p == s || errno)
+		errx(EXIT_FAILURE, "option --throttle needs FILES[,BYTES]");
+
+	if(suffix && p < end)
+		switch(*p++)
+		{
+			case 'K': case 'k': n <<= 10; break;
+			case 'M': case 'm': n <<= 20; break;
+			case 'G': case 'g': n <<= 30; break;
+			default: p--;
+		}
+
+	if(p != end)
+		errx(EXIT_FAILURE, "option --throttle needs FILES[,BYTES]");
+
+	return n;
+}
+
+
+/*
+ * rate is FILES[,BYTES], BYTES with an optional K, M or G, and either
+ * may be 0 for no cap.  NULL gives the defaults.  Call before any worker
+ * thread is started, so they get the I/O class too.
+ */
+struct pax_throttle *
+throttle_create(const char *rate)
+{
+	struct pax_throttle *th;
+	const char *comma;
+
+	if((th = calloc(1, sizeof(struct pax_throttle))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	th->files = THROTTLE_FILES;
+	th->bytes = THROTTLE_BYTES;
+	if(rate != NULL)
+	{
+		if((comma = strchr(rate, ',')) == NULL)
+			comma = rate + strlen(rate);
+		th->files = parse_rate(rate, comma, 0);
+		if(*comma)
+			th->bytes = parse_rate(comma + 1, comma + strlen(comma), 1);
+	}
+
+	if(syscall(SYS_ioprio_set, THROTTLE_IOPRIO_WHO_PROCESS, 0,
+			THROTTLE_IOPRIO_CLASS_IDLE << THROTTLE_IOPRIO_CLASS_SHIFT) < 0)
+		warn("cannot go in the idle I/O class");
+	else
+		th->idle = 1;
+
+	pthread_mutex_init(&th->lock, NULL);
+	th->next = now();
+
+	return th;
+}
+
+
+// Wait for our turn to start a file
+static void
+pace(struct pax_throttle *th)
+{
+	struct timespec ts;
+	double t = now(), slot;
+
+	pthread_mutex_lock(&th->lock);
+	if(th->next < t)
+		th->next = t;
+	slot = th->next;
+	if(th->files)
+		th->next += 1.0 / th->files;
+	if(slot > t)
+		th->waited += slot - t;
+	pthread_mutex_unlock(&th->lock);
+
+	if(slot <= t)
+		return;
+
+	ts.tv_sec = slot;
+	ts.tv_nsec = (slot - ts.tv_sec) * 1e9;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+
+// Bytes read so far by this thread, by libelfix and by us
+static unsigned long
+bytes_read(void)
+{
+	struct elfix_stats es;
+
+	elfix_get_stats(local_elfix(), &es);
+	return es.bytes_read + stats_local.count[STAT_BYTES_READ];
+}
+
+
+/*
+ * In place of process_file() for each file: waits for its turn, does it
+ * and charges the bytes it read against the next file.
+ */
+int
+throttle_process(struct pax_throttle *th, struct pax_work *w, const struct paxctl_opts *opts)
+{
+	unsigned long bytes;
+	double t, busy;
+	int ret;
+
+	pace(th);
+
+	bytes = bytes_read();
+	t = now();
+	ret = process_file(w, opts);
+	busy = now() - t;
+	bytes = bytes_read() - bytes;
+
+	pthread_mutex_lock(&th->lock);
+	if(th->bytes)
+	{
+		t = now();
+		if(th->next < t)
+			th->next = t;
+		th->next += (double)bytes / th->bytes;
+	}
+	th->nfiles++;
+	th->nbytes += bytes;
+	th->busy += busy;
+	if(busy > th->busiest)
+		th->busiest = busy;
+	pthread_mutex_unlock(&th->lock);
+
+	return ret;
+}
+
+
+// O_NOATIME is only for the owner or CAP_FOWNER, anyone else gets EPERM
+int
+throttle_open(const char *path, int flags)
+{
+	int fd;
+
+	if((fd = open(path, flags | O_NOATIME)) >= 0 || errno != EPERM)
+		return fd;
+
+	return open(path, flags);
+}
+
+
+// Note which pages of the head of fd are already in the page cache
+void
+throttle_mark(int fd, struct throttle_pages *p)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	p->len = THROTTLE_PAGES * pagesize;
+	if((p->map = mmap(NULL, p->len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED
+			|| mincore(p->map, p->len, p->resident) < 0)
+	{
+		if(p->map != MAP_FAILED)
+			munmap(p->map, p->len);
+		p->map = NULL;
+	}
+}
+
+
+// And drop again the ones which are there now but were not then
+void
+throttle_drop(struct pax_throttle *th, int fd, struct throttle_pages *p)
+{
+	unsigned char vec[THROTTLE_PAGES];
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned long ndropped = 0;
+	size_t i, j;
+
+	if(p->map == NULL)
+		return;
+
+	if(mincore(p->map, p->len, vec) == 0)
+		for(i = 0; i < THROTTLE_PAGES; i = j)
+		{
+			for(j = i; j < THROTTLE_PAGES && (vec[j] & 1) && !(p->resident[j] & 1); j++)
+				;
+			if(j > i && posix_fadvise(fd, i * pagesize, (j - i) * pagesize, POSIX_FADV_DONTNEED) == 0)
+				ndropped += j - i;
+			if(j == i)
+				j++;
+		}
+
+	munmap(p->map, p->len);
+	p->map = NULL;
+
+	STAT_ADD(STAT_PAGES_DROPPED, ndropped);
+	pthread_mutex_lock(&th->lock);
+	th->ndropped += ndropped;
+	pthread_mutex_unlock(&th->lock);
+}
+
+
+static double
+tv2secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+
+void
+throttle_close(struct pax_throttle *th)
+{
+	struct rusage ru;
+	char files[32], bytes[32];
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	if(th->files)
+		snprintf(files, sizeof(files), "%lu", th->files);
+	else
+		strcpy(files, "no cap on");
+	if(th->bytes)
+		snprintf(bytes, sizeof(bytes), "%lu", th->bytes);
+	else
+		strcpy(bytes, "no cap on");
+
+	printf("throttle: %s files/sec, %s bytes/sec, %s I/O class\n", files, bytes, th->idle ? "idle" : "usual");
+	printf("throttle: %lu files, %lu bytes read, %lu pages dropped from the page cache\n",
+		th->nfiles, th->nbytes, th->ndropped);
+	printf("throttle: %.3f s cpu, %.3f s waiting, %.3f ms a file, %.3f ms at most\n",
+		tv2secs(&ru.ru_utime) + tv2secs(&ru.ru_stime), th->waited,
+		th->nfiles ? 1e3 * th->busy / th->nfiles : 0.0, 1e3 * th->busiest);
+
+	pthread_mutex_destroy(&th->lock);
+	free(th);
+}
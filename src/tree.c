@@ -0,0 +1,184 @@
+/*
+	tree.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * Set of (st_dev, st_ino) pairs already queued, so that a file with
+ * several hard links is only processed once.  Only files with
+ * st_nlink > 1 ever go in here.  Open addressing, linear probing.
+ */
+struct inode_set
+{
+	struct { dev_t dev; ino_t ino; } *slot;
+	size_t size, used;
+};
+
+size_t
+inode_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t)dev << 32) ^ (uint64_t)ino;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+// Returns 1 if newly added, 0 if it was already there
+static int
+inode_set_add(struct inode_set *set, dev_t dev, ino_t ino)
+{
+	size_t i, j, mask;
+
+	if(2 * (set->used + 1) > set->size)
+	{
+		struct inode_set bigger;
+
+		bigger.size = set->size ? 2 * set->size : 1024;
+		bigger.used = 0;
+		if((bigger.slot = calloc(bigger.size, sizeof(*bigger.slot))) == NULL)
+			err(EXIT_FAILURE, "calloc()");
+
+		for(i = 0; i < set->size; i++)
+			if(set->slot[i].ino)
+				inode_set_add(&bigger, set->slot[i].dev, set->slot[i].ino);
+
+		free(set->slot);
+		*set = bigger;
+	}
+
+	mask = set->size - 1;
+	for(j = inode_hash(dev, ino) & mask; set->slot[j].ino; j = (j + 1) & mask)
+		if(set->slot[j].dev == dev && set->slot[j].ino == ino)
+			return 0;
+
+	set->slot[j].dev = dev;
+	set->slot[j].ino = ino;
+	set->used++;
+	return 1;
+}
+
+
+/*
+ * nftw() gives us no closure, so the walker's state lives here.
+ * Only the main thread walks; the workers never touch these.
+ */
+static struct pax_pool *walk_pool;
+static struct inode_set walk_seen;
+static uint16_t walk_pax_flags;
+static const struct pax_policy *walk_policy;
+static unsigned long walk_links, walk_unmatched;
+static int walk_verbose;
+static int walk_registry;
+static size_t walk_image_at;
+
+static int
+walk_one(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	struct pax_work *w;
+
+	if(typeflag == FTW_DNR)
+	{
+		if(walk_verbose)
+			warnx("%s: cannot read directory", fpath);
+		return 0;
+	}
+
+	if(typeflag != FTW_F || !S_ISREG(sb->st_mode))
+		return 0;
+
+	if(sb->st_nlink > 1 && !inode_set_add(&walk_seen, sb->st_dev, sb->st_ino))
+	{
+		walk_links++;
+		return 0;
+	}
+
+	if((w = calloc(1, sizeof(struct pax_work))) == NULL || (w->path = strdup(fpath)) == NULL)
+		err(EXIT_FAILURE, "malloc()");
+	w->pax_flags = walk_pax_flags;
+	w->fd = -1;
+	w->image_at = walk_image_at;
+
+	// The registry is asked first, and that needs the file open
+	if(walk_registry && walk_policy)
+		w->need_policy = 1;
+	// Most of a tree is usually left alone, so never even open those files
+	else if(walk_policy && !policy_classify(walk_policy, w))
+	{
+		walk_unmatched++;
+		free(w->path);
+		free(w);
+		return 0;
+	}
+
+	pool_submit(walk_pool, w);
+	return 0;
+}
+
+
+int
+walk_trees(char **dirs, int ndirs, const struct paxctl_opts *opts)
+{
+	struct pool_totals totals;
+	int i, ret = EXIT_SUCCESS;
+
+	walk_pool = pool_create(opts, 0);
+	walk_pax_flags = opts->pax_flags;
+	walk_policy = opts->policy;
+	walk_verbose = opts->verbose;
+	walk_registry = opts->registry != NULL;
+
+	for(i = 0; i < ndirs; i++)
+	{
+		// With --pseudo each directory is the root of an image, and nftw() drops trailing '/'s
+		if(opts->pseudo)
+			for(walk_image_at = strlen(dirs[i]); walk_image_at > 0 && dirs[i][walk_image_at - 1] == '/'; walk_image_at--)
+				;
+
+		if(nftw(dirs[i], walk_one, 64, FTW_PHYS) < 0)
+		{
+			warn("%s", dirs[i]);
+			ret |= EXIT_FAILURE;
+		}
+	}
+
+	ret |= pool_finish(walk_pool, &totals);
+	free(walk_seen.slot);
+
+	printf("%lu files, %lu ELF, %lu non-ELF skipped, %lu hard links skipped\n",
+		totals.nfiles, totals.nelf, totals.nfiles - totals.nelf, walk_links);
+	if(opts->policy)
+		printf("%lu left alone by the policy\n", walk_unmatched + totals.nunmatched);
+	print_totals(&totals);
+
+	return ret;
+}
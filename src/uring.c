@@ -0,0 +1,409 @@
+/*
+	uring.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+
+#ifdef IOURING
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "paxctl-ng.h"
+
+/*
+ * An io_uring stage which sits between the feeder (tree walk or -B
+ * manifest) and the worker pool.  It keeps up to --io-uring=N files in
+ * flight, issuing an O_RDONLY OPENAT, a READ of the Ehdr and, where the
+ * kernel has it, GETXATTR of user.pax.flags for each.  By the time a
+ * worker gets a file it is open and its header page and xattr are in
+ * cache, so the worker's own pread()/fgetxattr() do not block on cold
+ * storage.  Non-ELF files found in tree mode are closed with CLOSE and
+ * never cost a worker more than a counter bump.  The writes stay
+ * synchronous in the workers, which open a file again O_RDWR if it has
+ * a PT_PAX write to make: after the skip-if-unchanged checks they are
+ * rare, and PT_PAX and XATTR_PAX must be decided together.
+ *
+ * We talk to the kernel directly rather than through liburing, so this
+ * only needs the kernel headers.
+ */
+
+#define HDR_SIZE	sizeof(Elf64_Ehdr)
+
+// user_data is the slot index with the operation in the top bits
+#define OP_SHIFT	56
+#define OP_OPEN		1ULL
+#define OP_READ		2ULL
+#define OP_XATTR	3ULL
+#define OP_CLOSE	4ULL
+
+// OPENAT, GETXATTR, READ and, for a non-ELF file in tree mode, CLOSE
+#define OPS_PER_FILE	4
+
+struct slot
+{
+	struct pax_work *w;
+	int pending;			// operations still in flight
+	unsigned char hdr[HDR_SIZE];
+	char xattr[ELFIX_FLAGS_SIZE];
+};
+
+struct uring_prefetch
+{
+	int fd;
+	unsigned entries;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+
+	unsigned tail;			// our copy of *sq_tail, ahead of it until we enter
+	int have_xattr;
+	int tree;
+
+	struct slot *slots;
+	int *free_slots;
+	int nfree;
+};
+
+
+static int
+probe_ops(struct uring_prefetch *u)
+{
+	struct io_uring_probe *probe;
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	int ok = 0;
+
+	if((probe = calloc(1, size)) == NULL)
+		return 0;
+
+	if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+	{
+#define HAVE_OP(op) (probe->last_op >= (op) && (probe->ops[(op)].flags & IO_URING_OP_SUPPORTED))
+		ok = HAVE_OP(IORING_OP_OPENAT) && HAVE_OP(IORING_OP_READ) && HAVE_OP(IORING_OP_CLOSE);
+#if HAVE_DECL_IORING_OP_GETXATTR
+		u->have_xattr = HAVE_OP(IORING_OP_GETXATTR);
+#endif
+#undef HAVE_OP
+	}
+
+	free(probe);
+	return ok;
+}
+
+
+/*
+ * Returns NULL if io_uring is not available or lacks the operations we
+ * need, in which case the caller carries on with the synchronous path.
+ */
+struct uring_prefetch *
+uring_prefetch_create(const struct paxctl_opts *opts)
+{
+	struct uring_prefetch *u;
+	struct io_uring_params p;
+	unsigned i;
+
+	if((u = calloc(1, sizeof(struct uring_prefetch))) == NULL)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	if((u->fd = syscall(__NR_io_uring_setup, OPS_PER_FILE * opts->uring_depth, &p)) < 0)
+	{
+		if(opts->verbose)
+			warn("io_uring_setup(): using synchronous I/O");
+		free(u);
+		return NULL;
+	}
+
+	if(!probe_ops(u))
+	{
+		if(opts->verbose)
+			warnx("io_uring: kernel lacks OPENAT/READ/CLOSE, using synchronous I/O");
+		close(u->fd);
+		free(u);
+		return NULL;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(u->sq_ring == MAP_FAILED)
+		goto fail;
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else
+	{
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if(u->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED)
+		goto fail;
+
+	u->sq_head = (unsigned *)((char *)u->sq_ring + p.sq_off.head);
+	u->sq_tail = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+	u->cq_head = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+
+	/*
+	 * Each file queues at most OPS_PER_FILE operations over its life, so
+	 * this many files can never overrun the submission ring.
+	 */
+	u->entries = p.sq_entries / OPS_PER_FILE;
+	if(u->entries < 1)
+		u->entries = 1;
+	u->tree = opts->tree;
+
+	if((u->slots = calloc(u->entries, sizeof(struct slot))) == NULL ||
+			(u->free_slots = calloc(u->entries, sizeof(int))) == NULL)
+		goto fail;
+	for(i = 0; i < u->entries; i++)
+		u->free_slots[i] = i;
+	u->nfree = u->entries;
+
+	return u;
+
+fail:
+	uring_prefetch_destroy(u);
+	return NULL;
+}
+
+
+void
+uring_prefetch_destroy(struct uring_prefetch *u)
+{
+	if(u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_size);
+	if(u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if(u->sq_ring && u->sq_ring != MAP_FAILED)
+		munmap(u->sq_ring, u->sq_ring_size);
+	close(u->fd);
+	free(u->slots);
+	free(u->free_slots);
+	free(u);
+}
+
+
+static struct io_uring_sqe *
+get_sqe(struct uring_prefetch *u, int slot, unsigned long long op)
+{
+	unsigned idx = u->tail++ & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = (op << OP_SHIFT) | (unsigned)slot;
+	u->sq_array[idx] = idx;
+	u->slots[slot].pending++;
+
+	return sqe;
+}
+
+
+static void
+submit_open(struct uring_prefetch *u, int slot)
+{
+	struct slot *s = &u->slots[slot];
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe(u, slot, OP_OPEN);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)s->w->path;
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+#if defined(XTPAX) && HAVE_DECL_IORING_OP_GETXATTR
+	// By path, so it can go in parallel with the open
+	if(u->have_xattr)
+	{
+		sqe = get_sqe(u, slot, OP_XATTR);
+		sqe->opcode = IORING_OP_GETXATTR;
+		sqe->addr = (uintptr_t)ELFIX_PAX_NAMESPACE;
+		sqe->addr2 = (uintptr_t)s->xattr;
+		sqe->addr3 = (uintptr_t)s->w->path;
+		sqe->len = ELFIX_FLAGS_SIZE;
+	}
+#endif
+}
+
+
+static void
+submit_read(struct uring_prefetch *u, int slot)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe(u, slot, OP_READ);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = u->slots[slot].w->fd;
+	sqe->addr = (uintptr_t)u->slots[slot].hdr;
+	sqe->len = HDR_SIZE;
+	sqe->off = 0;
+}
+
+
+static void
+submit_close(struct uring_prefetch *u, int slot)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe(u, slot, OP_CLOSE);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = u->slots[slot].w->fd;
+	u->slots[slot].w->fd = -1;
+}
+
+
+static void
+complete(struct uring_prefetch *u, struct io_uring_cqe *cqe, struct work_queue *out)
+{
+	int slot = cqe->user_data & ((1ULL << OP_SHIFT) - 1);
+	unsigned long long op = cqe->user_data >> OP_SHIFT;
+	struct slot *s = &u->slots[slot];
+
+	s->pending--;
+
+	switch(op)
+	{
+		case OP_OPEN:
+			// On failure the worker redoes the open and reports why
+			if(cqe->res >= 0)
+			{
+				STAT_INC(STAT_OPEN_RDONLY);
+				s->w->fd = cqe->res;
+				submit_read(u, slot);
+			}
+			break;
+		/*
+		 * The worker reads these again through libelfix, where they
+		 * are counted as bytes_read and xattr_get, so count ours apart.
+		 */
+		case OP_READ:
+			if(cqe->res > 0)
+				STAT_ADD(STAT_URING_READ, cqe->res);
+			if(u->tree && (cqe->res < SELFMAG || memcmp(s->hdr, ELFMAG, SELFMAG)))
+			{
+				s->w->not_elf = 1;
+				STAT_INC(STAT_NOT_ELF);
+				submit_close(u, slot);
+			}
+			break;
+#ifdef XTPAX
+		case OP_XATTR:
+			STAT_INC(STAT_URING_GETXATTR);
+			break;
+#endif
+		default:
+			break;
+	}
+
+	if(s->pending == 0)
+	{
+		queue_push(out, s->w);
+		s->w = NULL;
+		u->free_slots[u->nfree++] = slot;
+	}
+}
+
+
+void
+uring_prefetch_run(struct uring_prefetch *u, struct work_queue *in, struct work_queue *out)
+{
+	struct pax_work *w;
+	unsigned head, tail, to_submit;
+	int slot, inflight = 0, closed = 0;
+
+	u->tail = *u->sq_tail;
+
+	while(!closed || inflight > 0)
+	{
+		// Top up, only blocking for new work if nothing is in flight
+		while(!closed && u->nfree > 0)
+		{
+			if((w = queue_pop(in, inflight == 0)) == NULL)
+			{
+				if(inflight == 0)
+					closed = 1;
+				break;
+			}
+
+			slot = u->free_slots[--u->nfree];
+			u->slots[slot].w = w;
+			u->slots[slot].pending = 0;
+			submit_open(u, slot);
+			inflight++;
+		}
+
+		if(inflight == 0)
+			continue;
+
+		__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+		to_submit = u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+		if(syscall(__NR_io_uring_enter, u->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+		{
+			if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			err(EXIT_FAILURE, "io_uring_enter()");
+		}
+
+		head = *u->cq_head;
+		tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++)
+		{
+			struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+
+			slot = cqe->user_data & ((1ULL << OP_SHIFT) - 1);
+			complete(u, cqe, out);
+			if(u->slots[slot].w == NULL)
+				inflight--;
+		}
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+#endif
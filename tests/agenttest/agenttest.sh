@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+#    agenttest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "EXEC AGENT" "$@"
+
+# fanotify needs CAP_SYS_ADMIN, and we can only look at XATTR_PAX here
+if [[ -z "${FANOTIFY}" || -z "${XTPAX}" || $(id -u) != 0 ]]; then
+  skip "needs root, fanotify and XATTR_PAX"
+fi
+
+rm -rf ${TREE}
+mkdir -p ${TREE}
+cp ${DUMMY} ${TREE}/listed
+cp ${DUMMY} ${TREE}/unlisted
+printf "PeMrS\t${TREE}/listed\n" > ${TREE}/policy
+
+${PAXCTLNG} --exec-agent=${TREE}/policy -v ${TREE} > ${TREE}/log &
+agent=$!
+for i in $(seq 50); do
+  grep -q "watching" ${TREE}/log 2>/dev/null && break
+  sleep 0.1
+done
+
+# Only the first exec of each should need the policy
+for i in 1 2 3; do
+  ${TREE}/listed
+  ${TREE}/unlisted
+done
+
+kill ${agent}
+wait ${agent}
+
+if [[ "${verbose}" != 0 ]] ;then
+  cat ${TREE}/log
+fi
+
+for f in listed unlisted; do
+  [[ ${f} = listed ]] && expected="PeMrS" || expected="not"
+  check "${f}" "$(${PAXCTLNG} -v ${TREE}/${f} | grep XATTR_PAX | awk '{ print $3 }')" "${expected}"
+done
+
+# The whole mount is watched, so other execs are counted as well
+check "summary" "$(tail -n 1 ${TREE}/log | grep -o ', [0-9]* marked, [0-9]* failed$')" ", 1 marked, 0 failed"
+
+finish
@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+#    batchtest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "BATCH" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}
+
+# Give every file its own flag set, in both manifest formats
+i=0
+manifest=""
+nulmanifest=()
+for pf in "p" "P" "-"; do
+  for ef in "e" "E" "-"; do
+    for mf in "m" "M" "-"; do
+      cp ${DUMMY} ${TREE}/nl${i}
+      cp ${DUMMY} ${TREE}/nul${i}
+      manifest+="${pf}${ef}${mf}Rs	${TREE}/nl${i}"$'\n'
+      nulmanifest+=("${pf}${ef}${mf}rS	${TREE}/nul${i}")
+      (( i = i + 1 ))
+    done
+  done
+done
+manifest+="PEMRS	${TREE}/missing"$'\n'
+manifest+="bogus"$'\n'
+
+check "summary" "$(echo -n "${manifest}" | ${PAXCTLNG} -B - 2>/dev/null | grep "files,")" \
+  "28 files, 27 ok, 1 failed, 1 bad records"
+
+printf "%s\0" "${nulmanifest[@]}" | ${PAXCTLNG} -0 -B - >/dev/null
+
+if [[ -n "${XTPAX}" ]]; then
+  i=0
+  for pf in "p" "P" "-"; do
+    for ef in "e" "E" "-"; do
+      for mf in "m" "M" "-"; do
+        for t in nl nul; do
+          [[ ${t} = nl ]] && expected="${pf}${ef}${mf}Rs" || expected="${pf}${ef}${mf}rS"
+          # An unmarked file starts out with EMUTRAMP disabled
+          [[ ${ef} = "-" ]] && expected="${pf}e${expected:2}"
+          check "${t}${i}" "$(${PAXCTLNG} -v ${TREE}/${t}${i} | grep XATTR_PAX | awk '{ print $3 }')" "${expected}"
+        done
+        (( i = i + 1 ))
+      done
+    done
+  done
+
+  # Running the same manifest again must not write any xattr
+  printf "%s\0" "${nulmanifest[@]}" | ${PAXCTLNG} -l -0 -B - --stats=${TREE}/stats.json >/dev/null
+  check "rerun xattr sets" "$(grep '"xattr_set"' ${TREE}/stats.json | tr -dc '0-9')" 0
+fi
+
+finish
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+#    cachetest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "CACHE" "$@"
+
+CACHE="$(pwd)/tree/cache"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/d
+
+for i in 0 1 2 3 4 5; do
+  cp ${DUMMY} ${TREE}/d/f${i}
+done
+echo "not an ELF" > ${TREE}/d/text
+
+counter() {
+  grep "\"${1}\"" ${TREE}/stats.json | tr -dc '0-9'
+}
+
+audit() {
+  ${PAXCTLNG} --cache=${CACHE} --stats=${TREE}/stats.json -T -v ${TREE}/d > ${TREE}/audit
+}
+
+# Anything changed in the last couple of seconds is not cached yet
+sleep 3
+
+audit
+check "first run misses" "$(counter cache_misses)" 7
+grep -v seconds ${TREE}/audit | sort > ${TREE}/audit.read
+audit
+check "second run hits" "$(counter cache_hits)" 7
+check "second run opens" "$(( $(counter open_rdwr) + $(counter open_rdonly) ))" 0
+check "cached output" "$(md5sum < ${TREE}/audit.read)" "$(grep -v seconds ${TREE}/audit | sort | md5sum)"
+
+if [[ -n "${XTPAX}" ]]; then
+  # A change to the flags must be seen at once, however recent
+  ${PAXCTLNG} -l -PeMRs ${TREE}/d/f1 >/dev/null
+  audit
+  check "after a change hits" "$(counter cache_hits)" 6
+  sflags=$(grep -A2 "/f1:" ${TREE}/audit | grep XATTR_PAX | awk '{ print $3 }')
+  check "after a change f1" "${sflags}" PeMRs
+
+  # As must a new file in the place of an old one
+  rm ${TREE}/d/f2
+  cp ${DUMMY} ${TREE}/d/f2
+  ${PAXCTLNG} -l -pemrs ${TREE}/d/f2 >/dev/null
+  audit
+  sflags=$(grep -A2 "/f2:" ${TREE}/audit | grep XATTR_PAX | awk '{ print $3 }')
+  check "replaced f2" "${sflags}" pemrs
+fi
+
+finish
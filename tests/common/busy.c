@@ -0,0 +1,2 @@
+#include <unistd.h>
+int main() { pause() ; return 0 ; }
@@ -0,0 +1,94 @@
+#!/bin/bash
+#
+#    common.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# What the paxctl-ng tests share.  Each one starts with
+#
+#	. ../common/common.sh "NAME" "$@"
+#
+# which prints its banner, takes the verbosity and the -D/-U flags of
+# $CFLAGS from the command line, and ends with finish, or skip if it
+# cannot run here.  Run from the test's own directory.
+
+echo "================================================================================"
+echo
+echo " RUNNIG ${1} TEST"
+echo
+
+verbose=${2-0}
+shift
+shift
+
+PAXCTLNG="$(pwd)/../../src/paxctl-ng"
+DUMMY="$(pwd)/../common/dummy"
+LIBDUMMY="$(pwd)/../common/libdummy.so"
+BUSY="$(pwd)/../common/busy"
+TREE="$(pwd)/tree"
+
+#NOTE: the last -D or -U wins as it does for gcc $CFLAGS
+for f in $@; do
+  [[ $f = "-UPTPAX" ]] && unset PTPAX
+  [[ $f = "-DPTPAX" ]] && PTPAX=1
+  [[ $f = "-UXTPAX" ]] && unset XTPAX
+  [[ $f = "-DXTPAX" ]] && XTPAX=1
+  [[ $f = "-UFANOTIFY" ]] && unset FANOTIFY
+  [[ $f = "-DFANOTIFY" ]] && FANOTIFY=1
+done
+
+count=0
+
+check() {
+  if [[ "${verbose}" != 0 ]] ;then
+    echo "${1} : ${2}"
+  fi
+  if [[ "${2}" != "${3}" ]]; then
+    (( count = count + 1 ))
+    echo " Mismatch: ${1} ${2}"
+  fi
+}
+
+# Turn the PT_GNU_STACK phdr of a 64 bit little endian ELF into PT_PAX_FLAGS
+ptpax() {
+  local phoff phentsize phnum i off
+  [[ "$(od -An -tx1 -j4 -N2 ${1} | tr -d ' ')" = "0201" ]] || return 1
+  phoff=$(od -An -tu8 -j32 -N8 ${1} | tr -d ' ')
+  phentsize=$(od -An -tu2 -j54 -N2 ${1} | tr -d ' ')
+  phnum=$(od -An -tu2 -j56 -N2 ${1} | tr -d ' ')
+  for (( i = 0; i < phnum; i++ )); do
+    off=$(( phoff + i * phentsize ))
+    if [[ "$(od -An -tx4 -j${off} -N4 ${1} | tr -d ' ')" = "6474e551" ]]; then
+      printf '\x80\x15\x04\x65' | dd of=${1} bs=1 seek=${off} conv=notrunc 2>/dev/null
+      return 0
+    fi
+  done
+  return 1
+}
+
+finish() {
+  rm -rf ${TREE}
+  echo
+  echo " Mismatches = ${count}"
+  echo
+  echo "================================================================================"
+  exit ${count}
+}
+
+skip() {
+  echo " Skipped: ${1}"
+  finish
+}
@@ -0,0 +1,412 @@
+/*
+	elfixtest.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <byteswap.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <elfix.h>
+
+#define ROUNDS 200
+
+static const char *marks[] = { "PeMrS", "pEmRs", "-----", "pemrs", "PEMRS" };
+#define NMARKS (sizeof(marks) / sizeof(marks[0]))
+
+static int verbose;
+
+/*
+ * Each thread marks its file over and over with its own handle and
+ * checks that what it reads back is what it just wrote.
+ */
+static void *
+hammer(void *arg)
+{
+	const char *path = arg;
+	elfix_t *h;
+	uint16_t want, got;
+	char buf[ELFIX_FLAGS_SIZE];
+	int fd, i, ret;
+	long bad = 0;
+
+	if((h = elfix_new()) == NULL)
+		return (void *)1;
+
+	if((fd = open(path, O_RDWR)) < 0)
+	{
+		elfix_free(h);
+		return (void *)1;
+	}
+
+	for(i = 0; i < ROUNDS; i++)
+	{
+		want = elfix_string2bin(marks[i % NMARKS]);
+		elfix_bin2string4print(want, buf);
+
+		if(elfix_features() & ELFIX_HAVE_XT)
+		{
+			if(elfix_set_xt_flags(h, fd, want) != ELFIX_OK ||
+			   elfix_get_xt_flags(h, fd, &got) != ELFIX_OK || got != want)
+			{
+				if(verbose)
+					printf("%s: XT %s: %s\n", path, buf, elfix_strerror(h));
+				bad++;
+			}
+		}
+
+		// Our own binary need not have a PT_PAX_FLAGS phdr
+		if(elfix_features() & ELFIX_HAVE_PT)
+		{
+			ret = elfix_set_pt_flags(h, fd, want);
+			if(ret == ELFIX_OK)
+				ret = elfix_get_pt_flags(h, fd, &got);
+			if((ret == ELFIX_OK && got != want) ||
+			   (ret != ELFIX_OK && ret != ELFIX_ENOFLAGS))
+			{
+				if(verbose)
+					printf("%s: PT %s: %s\n", path, buf, elfix_strerror(h));
+				bad++;
+			}
+		}
+	}
+
+	close(fd);
+	elfix_free(h);
+
+	return (void *)bad;
+}
+
+
+/*
+ * The header-only PT_PAX path, on objects we build: each class and byte
+ * order, with none, one or several PT_PAX_FLAGS phdrs among others.  In
+ * memory and on disk the last one is read and all of them are written,
+ * and the rest are left alone.  What the raw path does not handle, more
+ * PT_PAX_FLAGS phdrs than it tracks or PN_XNUM, is refused in memory and
+ * left to libelf on disk, which we see in the elf_sessions counter.
+ */
+#define OBJ_SIZE	1024
+#define OBJ_PHOFF	64		// past either Ehdr
+#define OBJ_SHOFF	768		// past 8 Elf64_Phdr, for PN_XNUM's section 0
+#define OBJ_MAXPH	8
+
+struct layout
+{
+	const char *name;
+	int xnum;			// e_phnum is PN_XNUM, the count in sh_info
+	int raw;			// the raw path can handle it
+	uint32_t types[OBJ_MAXPH];	// 0 ends the table
+};
+
+static const struct layout layouts[] = {
+	{ "none", 0, 1, { PT_LOAD, PT_GNU_STACK } },
+	{ "one", 0, 1, { PT_LOAD, PT_PAX_FLAGS, PT_GNU_STACK } },
+	{ "three", 0, 1, { PT_PAX_FLAGS, PT_LOAD, PT_PAX_FLAGS, PT_NOTE, PT_PAX_FLAGS } },
+	{ "five", 0, 0, { PT_PAX_FLAGS, PT_PAX_FLAGS, PT_LOAD, PT_PAX_FLAGS, PT_PAX_FLAGS, PT_PAX_FLAGS } },
+	{ "xnum", 1, 0, { PT_LOAD, PT_PAX_FLAGS, PT_NOTE, PT_PAX_FLAGS } }
+};
+#define NLAYOUTS (sizeof(layouts) / sizeof(layouts[0]))
+
+#define OTHER_FLAGS	(PF_R | PF_X)
+
+static int swap;
+
+static uint16_t o16(uint16_t v) { return swap ? bswap_16(v) : v; }
+static uint32_t o32(uint32_t v) { return swap ? bswap_32(v) : v; }
+static uint64_t o64(uint64_t v) { return swap ? bswap_64(v) : v; }
+
+
+// The p_flags the i-th PT_PAX_FLAGS phdr starts with
+static uint32_t
+initial(int i)
+{
+	return elfix_string2bin(marks[i % NMARKS]);
+}
+
+
+static int
+build(unsigned char *buf, int is64, int msb, const struct layout *l)
+{
+	int i, n;
+
+	for(n = 0; n < OBJ_MAXPH && l->types[n]; n++)
+		;
+
+	swap = msb != (__BYTE_ORDER == __BIG_ENDIAN);
+	memset(buf, 0, OBJ_SIZE);
+
+	if(is64)
+	{
+		Elf64_Ehdr e;
+		Elf64_Phdr ph;
+		Elf64_Shdr sh;
+
+		memset(&e, 0, sizeof(e));
+		memcpy(e.e_ident, ELFMAG, SELFMAG);
+		e.e_ident[EI_CLASS] = ELFCLASS64;
+		e.e_ident[EI_DATA] = msb ? ELFDATA2MSB : ELFDATA2LSB;
+		e.e_ident[EI_VERSION] = EV_CURRENT;
+		e.e_type = o16(ET_EXEC);
+		e.e_version = o32(EV_CURRENT);
+		e.e_phoff = o64(OBJ_PHOFF);
+		e.e_ehsize = o16(sizeof(Elf64_Ehdr));
+		e.e_phentsize = o16(sizeof(Elf64_Phdr));
+		e.e_phnum = o16(l->xnum ? PN_XNUM : n);
+		if(l->xnum)
+		{
+			e.e_shoff = o64(OBJ_SHOFF);
+			e.e_shentsize = o16(sizeof(Elf64_Shdr));
+			e.e_shnum = o16(1);
+			memset(&sh, 0, sizeof(sh));
+			sh.sh_info = o32(n);
+			memcpy(buf + OBJ_SHOFF, &sh, sizeof(sh));
+		}
+		memcpy(buf, &e, sizeof(e));
+
+		for(i = 0; i < n; i++)
+		{
+			memset(&ph, 0, sizeof(ph));
+			ph.p_type = o32(l->types[i]);
+			ph.p_flags = o32(l->types[i] == PT_PAX_FLAGS ? initial(i) : OTHER_FLAGS);
+			memcpy(buf + OBJ_PHOFF + i * sizeof(ph), &ph, sizeof(ph));
+		}
+	}
+	else
+	{
+		Elf32_Ehdr e;
+		Elf32_Phdr ph;
+		Elf32_Shdr sh;
+
+		memset(&e, 0, sizeof(e));
+		memcpy(e.e_ident, ELFMAG, SELFMAG);
+		e.e_ident[EI_CLASS] = ELFCLASS32;
+		e.e_ident[EI_DATA] = msb ? ELFDATA2MSB : ELFDATA2LSB;
+		e.e_ident[EI_VERSION] = EV_CURRENT;
+		e.e_type = o16(ET_EXEC);
+		e.e_version = o32(EV_CURRENT);
+		e.e_phoff = o32(OBJ_PHOFF);
+		e.e_ehsize = o16(sizeof(Elf32_Ehdr));
+		e.e_phentsize = o16(sizeof(Elf32_Phdr));
+		e.e_phnum = o16(l->xnum ? PN_XNUM : n);
+		if(l->xnum)
+		{
+			e.e_shoff = o32(OBJ_SHOFF);
+			e.e_shentsize = o16(sizeof(Elf32_Shdr));
+			e.e_shnum = o16(1);
+			memset(&sh, 0, sizeof(sh));
+			sh.sh_info = o32(n);
+			memcpy(buf + OBJ_SHOFF, &sh, sizeof(sh));
+		}
+		memcpy(buf, &e, sizeof(e));
+
+		for(i = 0; i < n; i++)
+		{
+			memset(&ph, 0, sizeof(ph));
+			ph.p_type = o32(l->types[i]);
+			ph.p_flags = o32(l->types[i] == PT_PAX_FLAGS ? initial(i) : OTHER_FLAGS);
+			memcpy(buf + OBJ_PHOFF + i * sizeof(ph), &ph, sizeof(ph));
+		}
+	}
+
+	return n;
+}
+
+
+// How many phdrs do not hold what they should after marking with want
+static int
+check_phdrs(const unsigned char *buf, int is64, int n, const struct layout *l, uint32_t want)
+{
+	size_t size = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	size_t at = is64 ? offsetof(Elf64_Phdr, p_flags) : offsetof(Elf32_Phdr, p_flags);
+	uint32_t p_flags;
+	int i, bad = 0;
+
+	for(i = 0; i < n; i++)
+	{
+		memcpy(&p_flags, buf + OBJ_PHOFF + i * size + at, sizeof(p_flags));
+		if(o32(p_flags) != (l->types[i] == PT_PAX_FLAGS ? want : OTHER_FLAGS))
+			bad++;
+	}
+
+	return bad;
+}
+
+
+static int
+check_layout(elfix_t *h, int is64, int msb, const struct layout *l)
+{
+	unsigned char buf[OBJ_SIZE], obj[OBJ_SIZE];
+	struct elfix_stats es;
+	uint16_t want = elfix_string2bin("pEmRs"), got;
+	uint32_t wrote = want | PF_NORANDEXEC, last = 0;
+	int i, n, npax = 0, ret, fd, bad = 0;
+	FILE *f;
+
+	n = build(obj, is64, msb, l);
+	for(i = 0; i < n; i++)
+		if(l->types[i] == PT_PAX_FLAGS)
+		{
+			npax++;
+			last = initial(i);
+		}
+
+	// In memory, where there is no libelf to fall back on
+	memcpy(buf, obj, OBJ_SIZE);
+	got = 0;
+	ret = elfix_get_pt_flags_mem(h, buf, OBJ_SIZE, &got);
+	if(!l->raw)
+		bad += ret != ELFIX_EINVAL;
+	else if(npax == 0)
+		bad += ret != ELFIX_ENOFLAGS;
+	else
+		bad += ret != ELFIX_OK || got != last;
+
+	elfix_reset_stats(h);
+	ret = elfix_set_pt_flags_mem(h, buf, OBJ_SIZE, want);
+	elfix_get_stats(h, &es);
+	if(!l->raw)
+		bad += ret != ELFIX_EINVAL || memcmp(buf, obj, OBJ_SIZE);
+	else if(npax == 0)
+		bad += ret != ELFIX_ENOFLAGS || memcmp(buf, obj, OBJ_SIZE);
+	else
+		bad += ret != ELFIX_OK || es.pt_writes != (unsigned long)npax || check_phdrs(buf, is64, n, l, wrote);
+
+	// On disk, where libelf takes what the raw path cannot
+	if((f = tmpfile()) == NULL)
+		return 1;
+	fd = fileno(f);
+	if(pwrite(fd, obj, OBJ_SIZE, 0) != OBJ_SIZE)
+	{
+		fclose(f);
+		return 1;
+	}
+
+	// Long enough for the PN_XNUM phdrs, else a short read would hide them
+	if(l->xnum && ftruncate(fd, OBJ_PHOFF + PN_XNUM * sizeof(Elf64_Phdr)) < 0)
+	{
+		fclose(f);
+		return 1;
+	}
+
+	elfix_reset_stats(h);
+	got = 0;
+	ret = elfix_get_pt_flags(h, fd, &got);
+	elfix_get_stats(h, &es);
+	bad += es.elf_sessions != (unsigned long)!l->raw;
+	if(npax == 0)
+		bad += ret != ELFIX_ENOFLAGS;
+	else
+		bad += ret != ELFIX_OK || got != last;
+
+	// Only the raw path is allowed here, and so must not touch the file
+	ret = elfix_set_pt_flags_hdr(h, fd, want);
+	bad += (l->raw ? ret != (npax ? ELFIX_OK : ELFIX_ENOFLAGS) : ret != ELFIX_EINVAL);
+	if(!l->raw)
+		bad += pread(fd, buf, OBJ_SIZE, 0) != OBJ_SIZE || memcmp(buf, obj, OBJ_SIZE);
+
+	elfix_reset_stats(h);
+	ret = elfix_set_pt_flags(h, fd, want);
+	elfix_get_stats(h, &es);
+	bad += es.elf_sessions != (unsigned long)!l->raw;
+	bad += ret != (npax ? ELFIX_OK : ELFIX_ENOFLAGS);
+
+	/*
+	 * libelf changes a converted copy of phdrs not in our byte order,
+	 * and with no elf_update() that never reaches the file, so only the
+	 * raw path is held to writing those.
+	 */
+	if(l->raw || !swap)
+	{
+		bad += pread(fd, buf, OBJ_SIZE, 0) != OBJ_SIZE || check_phdrs(buf, is64, n, l, npax ? wrote : 0);
+
+		got = 0;
+		ret = elfix_get_pt_flags(h, fd, &got);
+		if(npax)
+			bad += ret != ELFIX_OK || got != wrote;
+	}
+
+	fclose(f);
+
+	if(bad && verbose)
+		printf("ELF%d%s %s: %d wrong\n", is64 ? 64 : 32, msb ? "MSB" : "LSB", l->name, bad);
+
+	return bad;
+}
+
+
+static int
+check_layouts(void)
+{
+	elfix_t *h;
+	size_t i;
+	int is64, msb, bad = 0;
+
+	if((h = elfix_new()) == NULL)
+		return 1;
+
+	for(is64 = 0; is64 < 2; is64++)
+		for(msb = 0; msb < 2; msb++)
+			for(i = 0; i < NLAYOUTS; i++)
+				bad += check_layout(h, is64, msb, &layouts[i]);
+
+	elfix_free(h);
+	return bad;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	pthread_t *tids;
+	void *bad;
+	int i, count = 0;
+
+	if(argc < 3)
+	{
+		fprintf(stderr, "usage: %s verbose file ...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	verbose = atoi(argv[1]);
+	argc -= 2;
+	argv += 2;
+
+	if(elfix_features() & ELFIX_HAVE_PT)
+		count += check_layouts();
+
+	if((tids = calloc(argc, sizeof(pthread_t))) == NULL)
+		exit(EXIT_FAILURE);
+
+	for(i = 0; i < argc; i++)
+		if(pthread_create(&tids[i], NULL, hammer, argv[i]))
+			exit(EXIT_FAILURE);
+
+	for(i = 0; i < argc; i++)
+	{
+		pthread_join(tids[i], &bad);
+		count += (long)bad;
+	}
+
+	free(tids);
+
+	return count > 255 ? 255 : count;
+}
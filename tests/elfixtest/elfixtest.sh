@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+#    elfixtest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "LIBELFIX" "$@"
+
+ELFIXTEST="$(pwd)/elfixtest"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}
+
+# First elfixtest checks the header-only PT_PAX path on objects it builds
+# itself, then eight threads, each with its own handle, mark and read back
+# a file of their own at the same time.  It exits with the mismatches.
+files=""
+for i in 1 2 3 4 5 6 7 8; do
+  cp ${ELFIXTEST} ${TREE}/f${i}
+  files="${files} ${TREE}/f${i}"
+done
+
+${ELFIXTEST} ${verbose} ${files}
+count=$?
+
+finish
@@ -0,0 +1,78 @@
+#!/bin/bash
+#
+#    livetest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "LIVE" "$@"
+
+PROC="$(pwd)/tree/proc"
+
+# A made up /proc: PID/exe and the PaX: line of PID/status are all we read
+proc() {
+  mkdir -p ${PROC}/${1}
+  ln -s ${2} ${PROC}/${1}/exe
+  printf "Name:\tdummy\nState:\tS (sleeping)\nPaX:\t%s\nCpus_allowed:\tff\n" ${3} > ${PROC}/${1}/status
+}
+
+counter() {
+  grep "\"${1}\"" ${TREE}/stats.json | tr -dc '0-9'
+}
+
+rm -rf ${TREE}
+mkdir -p ${PROC}/self ${PROC}/2
+cp ${DUMMY} ${TREE}/one
+cp ${DUMMY} ${TREE}/two
+cp ${DUMMY} ${TREE}/three
+
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -PEMR ${TREE}/one >/dev/null
+  ${PAXCTLNG} -l -pemr ${TREE}/two >/dev/null
+
+  for pid in 100 101 102 103; do
+    proc ${pid} ${TREE}/one PEMRs
+  done
+  proc 104 ${TREE}/one PeMRs
+  proc 200 ${TREE}/two pemrs
+  proc 201 ${TREE}/two pEmrs
+  proc 300 ${TREE}/three PeMRs
+  # Gone before we got to it
+  proc 400 ${TREE}/gone PEMRs
+
+  ${PAXCTLNG} --live=${PROC} --stats=${TREE}/stats.json > ${TREE}/out
+  check "exit" "$?" 1
+  check "differs" "$(grep ^differs ${TREE}/out | cut -f2-5 | sort | xargs)" "104 PeMRs PEMR- XATTR_PAX 201 pEmrs pemr- XATTR_PAX"
+  check "exe" "$(grep ^differs ${TREE}/out | cut -f6 | sort -u | xargs)" "${TREE}/one ${TREE}/two"
+  check "summary" "$(tail -n 1 ${TREE}/out)" "8 processes, 3 binaries read: 2 differ, 5 match, 1 unmarked, 0 without PaX, 0 unreadable"
+  # Each binary is only opened once, however many run it
+  check "opens" "$(counter open_rdonly)" 3
+
+  ${PAXCTLNG} --live=${PROC} -v > ${TREE}/out
+  check "verbose" "$(cut -f1 ${TREE}/out | grep -v processes | sort | uniq -c | xargs)" "2 differs 5 same 1 unmarked"
+
+  rm -rf ${PROC}/104 ${PROC}/201
+  ${PAXCTLNG} --live=${PROC} > ${TREE}/out
+  check "all match" "$?" 0
+fi
+
+# A kernel without PaX has no line to compare
+rm -rf ${PROC}
+mkdir -p ${PROC}
+proc 100 ${TREE}/one ""
+sed -i '/^PaX/d' ${PROC}/100/status
+${PAXCTLNG} --live=${PROC} > ${TREE}/out 2>/dev/null
+check "no PaX" "$(tail -n 1 ${TREE}/out)" "1 processes, 0 binaries read: 0 differ, 0 match, 0 unmarked, 1 without PaX, 0 unreadable"
+
+finish
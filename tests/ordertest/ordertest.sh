@@ -0,0 +1,65 @@
+#!/bin/bash
+#
+#    ordertest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "ORDER" "$@"
+
+# The paths in the order one worker announced them
+announced() {
+  grep "^${TREE}/tree/.*:$" | sed 's/:$//' | tr '\n' ' '
+}
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/tree/a ${TREE}/tree/b
+
+for i in $(seq 1 10); do
+  cp ${DUMMY} ${TREE}/tree/b/dummy${i}
+  cp ${DUMMY} ${TREE}/tree/a/dummy${i}
+done
+
+# By inode, whatever order the walk found them in
+${PAXCTLNG} --order=inode -j 1 -T -v ${TREE}/tree > ${TREE}/out
+check "inode exit" "$?" 0
+check "inode order" "$(announced < ${TREE}/out)" \
+  "$(find ${TREE}/tree -type f -printf '%i %p\n' | sort -n | awk '{ printf "%s ", $2 }')"
+check "inode summary" "$(grep '^order:' ${TREE}/out | sed 's/, [0-9.]* seconds//')" \
+  "order: 0 files by first extent, 20 by inode, 0 not looked at"
+
+# By extent where the filesystem can say, else by inode, but every file once
+${PAXCTLNG} --order --stats=${TREE}/stats.json -j 1 -T -v ${TREE}/tree > ${TREE}/out
+check "extent exit" "$?" 0
+check "extent all" "$(announced < ${TREE}/out | tr ' ' '\n' | grep -c . )" 20
+check "extent once" "$(announced < ${TREE}/out | tr ' ' '\n' | sort -u | grep -c .)" 20
+check "extent summary" "$(grep '^order:' ${TREE}/out | awk '{ print $2 + $7, $10 }')" "20 0"
+check "counted" "$(grep -c '"ordered_by_' ${TREE}/stats.json)" 2
+
+# A manifest too, with a file gone last
+find ${TREE}/tree -type f > ${TREE}/manifest
+echo ${TREE}/tree/gone >> ${TREE}/manifest
+sed -i 's/^/-E-R-\t/' ${TREE}/manifest
+${PAXCTLNG} --order=inode -j 1 -B ${TREE}/manifest -v > ${TREE}/out
+check "batch summary" "$(grep '^order:' ${TREE}/out | sed 's/, [0-9.]* seconds//')" \
+  "order: 0 files by first extent, 20 by inode, 1 not looked at"
+check "batch gone last" "$(announced < ${TREE}/out | awk '{ print $NF }')" "${TREE}/tree/gone"
+check "batch marked" "$(${PAXCTLNG} -v ${TREE}/tree/a/dummy3 | grep -c '\-E\-R\-' | awk '{ print ($1 > 0) }')" 1
+
+${PAXCTLNG} --order -v ${TREE}/tree/a/dummy1 2>/dev/null
+check "needs -T" "$?" 1
+${PAXCTLNG} --order=disk -T -v ${TREE}/tree 2>/dev/null
+check "bad order" "$?" 1
+
+finish
@@ -34,6 +34,7 @@ pythonversion=$(python --version 2>&1)
 pythonversion=$(echo ${pythonversion} | awk '{ print $2 }')
 pythonversion=${pythonversion%\.*}
 export PYTHONPATH="$(pwd)/../../scripts/build/lib.linux-${unamem}-${pythonversion}"
+export LD_LIBRARY_PATH="$(pwd)/../../lib/.libs${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
 
 #NOTE: the last -D or -U wins as it does for gcc $CFLAGS
 for f in $@; do
@@ -41,9 +42,12 @@ for f in $@; do
   [[ $f = "-DXTPAX" ]] && XTPAX=1
   [[ $f = "-UPTPAX" ]] && unset PTPAX
   [[ $f = "-DPTPAX" ]] && PTPAX=1
+  [[ $f = "-UUSDT" ]] && unset USDT
+  [[ $f = "-DUSDT" ]] && USDT=1
 done
 export XTPAX
 export PTPAX
+export USDT
 
 if [[ -d ${PYTHONPATH} ]]; then
   rm -rf ${PYTHONPATH}
@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+#    plantest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "PLAN" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/d
+
+for i in 0 1 2 3 4 5 6 7; do
+  cp ${DUMMY} ${TREE}/d/f${i}
+done
+echo "not an ELF" > ${TREE}/d/text
+
+xt_flags() {
+  ${PAXCTLNG} -v "${1}" | grep XATTR_PAX | awk '{ print $3 }'
+}
+
+# One file is already as it should be
+${PAXCTLNG} -pEmRs ${TREE}/d/f0 >/dev/null
+
+if [[ -n "${XTPAX}" ]]; then
+  expected="plan: 8 files, 7 to write, 1 up to date, in ${TREE}/plan"
+else
+  expected="plan: 8 files, 0 to write, 8 up to date, in ${TREE}/plan"
+fi
+check "plan" "$(${PAXCTLNG} --plan=${TREE}/plan -T -pEmRs ${TREE}/d | grep "^plan:")" "${expected}"
+
+if [[ -n "${XTPAX}" ]]; then
+  # Planning changes nothing
+  check "planned f1" "$(xt_flags ${TREE}/d/f1)" "not"
+
+  # Things change under the plan: f2 is marked by someone else and f3 replaced
+  ${PAXCTLNG} -PEMRS ${TREE}/d/f2 >/dev/null
+  rm ${TREE}/d/f3
+  cp ${DUMMY} ${TREE}/d/f3
+
+  check "apply" "$(${PAXCTLNG} --apply=${TREE}/plan | grep -E "files,|afresh" | tr '\n' ' ')" \
+    "8 files, 8 ok, 0 failed, 0 bad records 2 changed since the plan and done afresh "
+
+  for i in 0 1 2 3 4 5 6 7; do
+    check "f${i}" "$(xt_flags ${TREE}/d/f${i})" "pEmRs"
+  done
+
+  # A second apply finds every file written by the first changed
+  check "second apply" "$(${PAXCTLNG} --apply=${TREE}/plan | grep "afresh")" \
+    "7 changed since the plan and done afresh"
+
+  # A newline, tab or backslash in a name must not split its record
+  mkdir -p ${TREE}/n
+  cp ${DUMMY} ${TREE}/n/foo
+  cp ${DUMMY} "${TREE}/n/foo
+bar"
+  cp ${DUMMY} "${TREE}/n/a	b\\c"
+  ${PAXCTLNG} --plan=${TREE}/nplan -T -pEmRs ${TREE}/n >/dev/null
+  check "escaped apply" "$(${PAXCTLNG} --apply=${TREE}/nplan | grep "files,")" \
+    "3 files, 3 ok, 0 failed, 0 bad records"
+  check "foo" "$(xt_flags ${TREE}/n/foo)" "pEmRs"
+  check "foo newline bar" "$(xt_flags "${TREE}/n/foo
+bar")" "pEmRs"
+  check "tab backslash" "$(xt_flags "${TREE}/n/a	b\\c")" "pEmRs"
+fi
+
+finish
@@ -0,0 +1,71 @@
+#!/bin/bash
+#
+#    policytest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "POLICY" "$@"
+
+rm -rf ${TREE}
+
+make_tree() {
+  mkdir -p ${1}/bin ${1}/lib ${1}/opt/app ${1}/share ${1}/misc
+  cp ${DUMMY} ${1}/bin/a
+  cp ${DUMMY} ${1}/bin/b
+  cp ${LIBDUMMY} ${1}/lib/libdummy.so.1
+  cp ${DUMMY} ${1}/lib/other
+  cp ${DUMMY} ${1}/opt/app/c
+  cp ${DUMMY} ${1}/misc/d
+  echo "not an ELF" > ${1}/share/x
+}
+
+make_tree ${TREE}/t
+make_tree ${TREE}/b
+
+# First match wins, so the exceptions go at the top
+cat > ${TREE}/rules <<RULES
+# leave b alone, but mark everything else in bin
+-----	path=${TREE}/t/bin/b
+-----	path=${TREE}/b/bin/b
+pEMRs	glob=${TREE}/*/bin/*
+PemRS	prefix=${TREE}/t/opt/  # a comment
+PemRS	regex=^${TREE}/b/opt/.*
+pemrs	type=lib soname=libdummy.so*
+PEMRS	glob=${TREE}/*/lib/*	type=exec,pie
+RULES
+
+check "-T" "$(${PAXCTLNG} --policy=${TREE}/rules -T ${TREE}/t | grep "left alone")" \
+  "2 left alone by the policy"
+
+check "-B" "$(find ${TREE}/b -type f | ${PAXCTLNG} --policy=${TREE}/rules -B - | grep "files,")" \
+  "6 files, 6 ok, 0 failed, 0 bad records"
+
+# A bad rule stops us before anything is touched
+echo "PEMRS	glob=/x	colour=red" > ${TREE}/bad
+${PAXCTLNG} --policy=${TREE}/bad ${TREE}/t/misc/d 2>/dev/null
+check "bad rule exit" "$?" 1
+
+if [[ -n "${XTPAX}" ]]; then
+  for t in t b; do
+    for f in bin/a:pEMRs bin/b:not opt/app/c:PemRS lib/libdummy.so.1:pemrs lib/other:PEMRS misc/d:not; do
+      file=${f%%:*}
+      expected=${f##*:}
+      check "${t}/${file}" "$(${PAXCTLNG} -v ${TREE}/${t}/${file} | grep XATTR_PAX | awk '{ print $3 }')" "${expected}"
+    done
+  done
+fi
+
+finish
@@ -0,0 +1,59 @@
+#!/bin/bash
+#
+#    pseudotest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "PSEUDO" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/stage/usr/bin ${TREE}/stage/usr/lib
+
+cp ${DUMMY} ${TREE}/stage/usr/bin/one
+cp ${DUMMY} "${TREE}/stage/usr/bin/t w o"
+cp ${DUMMY} ${TREE}/stage/usr/lib/three
+echo "not an ELF" > ${TREE}/stage/usr/bin/text
+
+# The policy sees the paths as they will be in the image
+echo "PEMRS prefix=/usr/bin/" > ${TREE}/policy
+echo "pemrs prefix=/usr/lib/" >> ${TREE}/policy
+
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -Pe ${TREE}/stage/usr/lib/three >/dev/null
+fi
+
+summary=$(${PAXCTLNG} --pseudo=${TREE}/pseudo --policy=${TREE}/policy -T -j 2 ${TREE}/stage/ | grep "^pseudo:" | cut -d, -f1)
+check "files" "${summary}" "pseudo: 3 files"
+
+if [[ -n "${XTPAX}" ]]; then
+  check "one" "$(grep "^usr/bin/one " ${TREE}/pseudo)" "usr/bin/one x user.pax.flags=PEMRS"
+  check "two" "$(grep "^usr/bin/t" ${TREE}/pseudo)" 'usr/bin/t\ w\ o x user.pax.flags=PEMRS'
+  check "three" "$(grep "^usr/lib/three " ${TREE}/pseudo)" "usr/lib/three x user.pax.flags=pemrs"
+  check "no text" "$(grep -c text ${TREE}/pseudo)" "0"
+
+  # And the tree itself keeps the xattrs it had
+  check "one untouched" "$(${PAXCTLNG} -v ${TREE}/stage/usr/bin/one | grep XATTR_PAX | awk '{ print $3 }')" "not"
+  check "three untouched" "$(${PAXCTLNG} -v ${TREE}/stage/usr/lib/three | grep XATTR_PAX | awk '{ print $3 }')" "Pe---"
+
+  # The other format, as getfattr -d writes it
+  ${PAXCTLNG} --pseudo=${TREE}/dump --pseudo-format=getfattr -T -l -pm ${TREE}/stage >/dev/null
+  check "dump" "$(grep -A1 "^# file: usr/lib/three$" ${TREE}/dump | tail -n 1)" 'user.pax.flags="pem"'
+fi
+
+# --pseudo only makes sense for a tree
+${PAXCTLNG} --pseudo=${TREE}/pseudo -PEMRS ${TREE}/stage/usr/bin/one >/dev/null 2>&1
+check "needs -T" "$?" 1
+
+finish
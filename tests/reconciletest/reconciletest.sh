@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+#    reconciletest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "RECONCILE" "$@"
+
+flags() {
+  ${PAXCTLNG} -v ${1} | grep "${2} *:" | awk '{ print $3 }'
+}
+
+# A copy of dummy marked PT_FLAGS in PT_PAX and XT_FLAGS in XATTR_PAX
+mark() {
+  cp ${DUMMY} ${TREE}/${1}
+  ptpax ${TREE}/${1} || return 1
+  ${PAXCTLNG} -L -${2} ${TREE}/${1} >/dev/null
+  ${PAXCTLNG} -l -${3} ${TREE}/${1} >/dev/null
+}
+
+rm -rf ${TREE}
+mkdir -p ${TREE}
+
+if [[ -z "${PTPAX}" || -z "${XTPAX}" ]] || ! mark ok PEMRs PEMRs; then
+  skip "needs PT_PAX, XATTR_PAX and a 64 bit little endian ELF"
+fi
+
+# Each way round, so the source of truth is seen to matter
+mark conflict pemrs PEMRs
+mark conflict2 PEMRs pemrs
+mark invalid pEMrs pEMrs
+cp ${DUMMY} ${TREE}/unmarked
+
+${PAXCTLNG} --reconcile -T ${TREE} > ${TREE}/out
+check "report exit" "$?" 1
+check "conflict" "$(grep -c "^conflict	pemrs	PEMRs	${TREE}/conflict$" ${TREE}/out)" 1
+check "conflict2" "$(grep -c "^conflict	PEMRs	pemrs	${TREE}/conflict2$" ${TREE}/out)" 1
+check "invalid" "$(grep -c "^invalid	pEMrs	pEMrs	${TREE}/invalid$" ${TREE}/out)" 1
+check "ok quiet" "$(grep -c "/ok$" ${TREE}/out)" 0
+check "summary" "$(grep '^reconcile:' ${TREE}/out | sed 's/ (.*//')" \
+  "reconcile: 4 marked, 2 PT_PAX and XATTR_PAX disagree, 1 invalid, 0 fixed from neither, 3 would fail to exec"
+check "untouched" "$(flags ${TREE}/conflict XATTR_PAX)" "PEMRs"
+
+# Without flags in hard mode a feature is on, so only the kernel's mode tells these apart
+if grep -q '(hard mode)' ${TREE}/out; then
+  mark same z PEMRS
+  ${PAXCTLNG} --reconcile -v ${TREE}/same > ${TREE}/out
+  check "hard same" "$?" 0
+  rm -f ${TREE}/same
+fi
+
+${PAXCTLNG} --reconcile=pt -j 2 -T ${TREE} > ${TREE}/out
+check "pt exit" "$?" 1
+check "pt fixed" "$(grep -c '^fixed' ${TREE}/out)" 2
+check "pt conflict" "$(flags ${TREE}/conflict XATTR_PAX)" "pemrs"
+check "pt conflict2" "$(flags ${TREE}/conflict2 XATTR_PAX)" "PEMRs"
+check "pt kept" "$(flags ${TREE}/conflict PT_PAX)" "pemrs"
+
+${PAXCTLNG} -l -PEMRS ${TREE}/conflict >/dev/null
+printf '%s\n' ${TREE}/conflict ${TREE}/ok > ${TREE}/manifest
+${PAXCTLNG} --reconcile=xt -B ${TREE}/manifest > ${TREE}/out
+check "xt exit" "$?" 0
+check "xt fixed" "$(flags ${TREE}/conflict PT_PAX)" "PEMRS"
+check "xt summary" "$(grep '^reconcile:' ${TREE}/out | sed 's/ (.*//')" \
+  "reconcile: 2 marked, 1 PT_PAX and XATTR_PAX disagree, 0 invalid, 1 fixed from XATTR_PAX, 0 would fail to exec"
+
+# Fixing the invalid one is left to the user
+${PAXCTLNG} --reconcile ${TREE}/invalid >/dev/null
+check "still invalid" "$?" 1
+${PAXCTLNG} -PEMrs ${TREE}/invalid >/dev/null
+${PAXCTLNG} --reconcile -v ${TREE}/invalid > ${TREE}/out
+check "valid" "$?" 0
+check "verbose ok" "$(grep -c "^ok	PEMrs	PEMrs	${TREE}/invalid$" ${TREE}/out)" 1
+
+${PAXCTLNG} --reconcile=both ${TREE}/ok 2>/dev/null
+check "bad source" "$?" 1
+${PAXCTLNG} --reconcile -PEMRS ${TREE}/ok 2>/dev/null
+check "no flags" "$?" 1
+
+finish
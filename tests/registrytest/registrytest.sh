@@ -0,0 +1,102 @@
+#!/bin/bash
+#
+#    registrytest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "REGISTRY" "$@"
+
+REG="${TREE}/registry"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/old ${TREE}/new
+
+xtflags() {
+  ${PAXCTLNG} -v ${1} | grep XATTR_PAX | awk '{ print $3 }'
+}
+
+summary() {
+  grep "^registry:" | sed "s|${REG}|REG|"
+}
+
+cp ${DUMMY} ${TREE}/old/a
+cp ${LIBDUMMY} ${TREE}/old/libdummy.so.1
+
+if [[ -n "${XTPAX}" ]]; then
+  # The flags set on a build are recorded, a new registry is made
+  got=$(${PAXCTLNG} --registry=${REG} -l -PeMRs ${TREE}/old/a | summary)
+  if [[ "${got}" == *"1 without a build-id"* ]]; then
+    echo " No build-id in the test programs: skipped"
+    got=""
+  else
+    check "record" "${got}" "registry: 1 builds in REG, 0 known, 0 not known, 1 recorded, 0 without a build-id"
+    check "header" "$(head -n 1 ${REG})" "# paxctl-ng registry 1"
+    check "new mode" "$(stat -c %a ${REG})" "644"
+
+    # A copy of the same build anywhere else is marked as recorded, with
+    # no flags given, and a build it does not know is left alone
+    cp ${DUMMY} ${TREE}/new/b
+    cp ${LIBDUMMY} ${TREE}/new/libdummy.so.1
+    got=$(${PAXCTLNG} --registry=${REG} -T -l ${TREE}/new | summary)
+    check "lookup" "${got}" "registry: 1 builds in REG, 1 known, 1 not known, 0 recorded, 0 without a build-id"
+    check "known" "$(xtflags ${TREE}/new/b)" "PeMRs"
+    check "not known" "$(xtflags ${TREE}/new/libdummy.so.1)" "not"
+
+    # A known build is not put to the policy, the rest are and get recorded
+    cat > ${TREE}/rules <<RULES
+pemrs	prefix=${TREE}/
+RULES
+    rm -f ${TREE}/new/b ${TREE}/new/libdummy.so.1
+    cp ${DUMMY} ${TREE}/new/b
+    cp ${LIBDUMMY} ${TREE}/new/libdummy.so.1
+    chmod 664 ${REG}
+    got=$(${PAXCTLNG} --registry=${REG} --policy=${TREE}/rules -T -l ${TREE}/new | summary)
+    check "policy" "${got}" "registry: 2 builds in REG, 1 known, 1 not known, 1 recorded, 0 without a build-id"
+    check "policy known" "$(xtflags ${TREE}/new/b)" "PeMRs"
+    check "policy not known" "$(xtflags ${TREE}/new/libdummy.so.1)" "pemrs"
+    check "kept mode" "$(stat -c %a ${REG})" "664"
+
+    # Flags given on the command line win, and replace what was recorded
+    cp ${DUMMY} ${TREE}/new/c
+    ${PAXCTLNG} --registry=${REG} -l -pEmrS ${TREE}/new/c > /dev/null
+    check "replaced" "$(xtflags ${TREE}/new/c)" "pEmrS"
+    cp ${DUMMY} ${TREE}/new/d
+    ${PAXCTLNG} --registry=${REG} -l ${TREE}/new/d > /dev/null
+    check "replaced known" "$(xtflags ${TREE}/new/d)" "pEmrS"
+
+    # A -B record with no flags is left to the registry
+    cp ${DUMMY} ${TREE}/new/e
+    printf -- "-\t${TREE}/new/e\n" | ${PAXCTLNG} --registry=${REG} -B - > /dev/null
+    check "batch" "$(xtflags ${TREE}/new/e)" "pEmrS"
+
+    # A plan records nothing
+    cp ${LIBDUMMY} ${TREE}/new/libother.so
+    got=$(${PAXCTLNG} --registry=${REG} --plan=${TREE}/plan -T -l -PEMRS ${TREE}/new | summary)
+    check "plan" "${got}" "registry: 2 builds in REG, 0 known, 0 not known, 0 recorded, 0 without a build-id"
+  fi
+
+  # Not an ELF object, or no build-id, is done as without a registry
+  echo "not an ELF" > ${TREE}/new/text
+  ${PAXCTLNG} --registry=${REG} -l -PEMRS ${TREE}/new/text > /dev/null 2>&1
+fi
+
+echo "# something else" > ${TREE}/bad
+${PAXCTLNG} --registry=${TREE}/bad -PEMRS ${TREE}/old/a > /dev/null 2>&1
+check "bad registry" "$?" 1
+
+${PAXCTLNG} --registry=${REG} --tar -PEMRS < /dev/null > /dev/null 2>&1
+check "tar" "$?" 1
+
+finish
@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+#    replacetest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "REPLACE" "$@"
+
+ptflags() {
+  ${PAXCTLNG} -v ${1} | grep 'PT_PAX *:' | awk '{ print $3 }'
+}
+
+rm -rf ${TREE}
+mkdir -p ${TREE}
+
+if [[ -z "${PTPAX}" ]] || ! cp ${BUSY} ${TREE}/busy || ! ptpax ${TREE}/busy; then
+  skip "needs PT_PAX and a 64 bit little endian ELF"
+fi
+
+chmod 0751 ${TREE}/busy
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -pemrs ${TREE}/busy >/dev/null
+fi
+
+${TREE}/busy &
+pid=$!
+sleep 0.5
+ino=$(stat -c %i ${TREE}/busy)
+
+# Running, so without --replace-busy PT_PAX cannot be written
+${PAXCTLNG} -L -PEMRS ${TREE}/busy >/dev/null
+check "busy" "$(ptflags ${TREE}/busy)" "-----"
+
+${PAXCTLNG} --stats=${TREE}/stats.json --replace-busy -L -PEMRS ${TREE}/busy >/dev/null
+check "exit" "$?" 0
+check "replaced" "$(ptflags ${TREE}/busy)" "PEMRS"
+check "new inode" "$([[ $(stat -c %i ${TREE}/busy) != ${ino} ]] && echo yes)" "yes"
+check "mode" "$(stat -c %a ${TREE}/busy)" "751"
+check "counted" "$(grep '"replaced"' ${TREE}/stats.json | tr -dc '0-9')" 1
+check "no leftovers" "$(ls -A ${TREE} | grep -c paxctl-ng)" 0
+if [[ -n "${XTPAX}" ]]; then
+  check "xattrs kept" "$(${PAXCTLNG} -v ${TREE}/busy | grep XATTR_PAX | awk '{ print $3 }')" "pemrs"
+fi
+
+# The old inode carries on running
+check "still running" "$(kill -0 ${pid} && echo yes)" "yes"
+check "old inode" "$(stat -L -c %i /proc/${pid}/exe)" "${ino}"
+
+# Nothing to change, nothing replaced
+ino=$(stat -c %i ${TREE}/busy)
+${TREE}/busy &
+pid2=$!
+sleep 0.5
+${PAXCTLNG} --replace-busy -L -PEMRS ${TREE}/busy >/dev/null
+check "unchanged" "$(stat -c %i ${TREE}/busy)" "${ino}"
+
+# Nor is a file with other hard links
+ln ${TREE}/busy ${TREE}/link
+${PAXCTLNG} --replace-busy -L -pemrs ${TREE}/busy >/dev/null
+check "hard link" "$(ptflags ${TREE}/busy)" "PEMRS"
+
+# A symlink stays a symlink, and the file it names is replaced in its own directory
+mkdir ${TREE}/sub
+cp ${TREE}/busy ${TREE}/sub/real
+ln -s sub/real ${TREE}/alias
+${TREE}/sub/real &
+pid3=$!
+sleep 0.5
+ino=$(stat -c %i ${TREE}/sub/real)
+${PAXCTLNG} --replace-busy -L -pemrs ${TREE}/alias >/dev/null
+check "symlink exit" "$?" 0
+check "symlink kept" "$([[ -L ${TREE}/alias ]] && readlink ${TREE}/alias)" "sub/real"
+check "symlink target" "$(ptflags ${TREE}/sub/real)" "pemrs"
+check "symlink new inode" "$([[ $(stat -c %i ${TREE}/sub/real) != ${ino} ]] && echo yes)" "yes"
+check "symlink no leftovers" "$(ls -A ${TREE} ${TREE}/sub | grep -c paxctl-ng)" 0
+
+kill ${pid} ${pid2} ${pid3}
+wait 2>/dev/null
+
+finish
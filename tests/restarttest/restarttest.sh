@@ -0,0 +1,96 @@
+#!/bin/bash
+#
+#    restarttest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "RESTART" "$@"
+
+PROC="$(pwd)/tree/proc"
+
+# The maps line of a file, with its device as the kernel prints it
+maps() {
+  local d=$(( 0x$(stat -c %D ${1}) ))
+  printf "7f0000000000-7f0000001000 r-xp 00000000 %02x:%02x %d %s\n" \
+    $(( (d >> 8) & 0xfff )) $(( (d & 0xff) | ((d >> 12) & 0xfff00) )) $(stat -c %i ${1}) ${1}
+}
+
+# A made up /proc: PID/exe, PID/maps and PID/cgroup are all we read
+proc() {
+  local pid=${1} cgroup=${2} exe=${3}
+  shift 3
+  mkdir -p ${PROC}/${pid}
+  ln -s ${exe} ${PROC}/${pid}/exe
+  echo "0::${cgroup}" > ${PROC}/${pid}/cgroup
+  for f in ${exe} "$@"; do
+    maps ${f}
+    maps ${f}
+  done > ${PROC}/${pid}/maps
+}
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/bin ${TREE}/lib ${PROC}/self
+for f in bin/sshd bin/cron bin/sh bin/vi lib/libfoo.so lib/libbar.so; do
+  cp ${DUMMY} ${TREE}/${f}
+done
+
+proc 100 /system.slice/sshd.service ${TREE}/bin/sshd ${TREE}/lib/libbar.so
+proc 101 /system.slice/sshd.service ${TREE}/bin/sshd
+proc 102 /user.slice/user-1000.slice/session-1.scope ${TREE}/bin/sshd
+proc 200 /openrc.cronie ${TREE}/bin/cron ${TREE}/lib/libfoo.so
+proc 201 /openrc.cronie ${TREE}/bin/sh
+proc 300 /user.slice/user-1000.slice/session-1.scope ${TREE}/bin/vi ${TREE}/lib/libfoo.so
+proc 301 /user.slice/user-1000.slice/session-1.scope ${TREE}/bin/sh ${TREE}/lib/libbar.so
+# A kernel thread maps nothing
+mkdir -p ${PROC}/2
+touch ${PROC}/2/maps
+
+# sshd and libfoo were re-marked
+printf "PeMRs\t${TREE}/bin/sshd\nPeMRs\t${TREE}/lib/libfoo.so\n" > ${TREE}/manifest
+${PAXCTLNG} --restart=${TREE}/manifest ${PROC} > ${TREE}/out
+check "exit" "$?" 0
+check "list" "$(grep -v processes ${TREE}/out | tr '\t' ' ' | xargs -d '\n' | sed s,${TREE},,g)" \
+  "service cronie lib 200 service sshd.service exe 100,101 program /bin/sshd exe 102 program /bin/vi lib 300"
+check "summary" "$(tail -n 1 ${TREE}/out)" \
+  "2 files changed, 8 processes, 5 using them: 2 services and 2 other programs to restart, 0 unreadable"
+
+${PAXCTLNG} --restart=${TREE}/manifest -v ${PROC} > ${TREE}/out
+check "verbose" "$(grep ^pid ${TREE}/out | cut -f2,3 | sort | xargs)" "100 exe 101 exe 102 exe 200 lib 300 lib"
+
+# The same from the plan of a run, which only lists what it changes
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -PEMRS ${TREE}/bin/cron > /dev/null
+  ${PAXCTLNG} --plan=${TREE}/plan -T -l -PEMRS ${TREE}/bin > /dev/null
+  ${PAXCTLNG} --restart=${TREE}/plan ${PROC} > ${TREE}/out
+  check "plan" "$(grep -v processes ${TREE}/out | cut -f1,2 | tr '\t' ' ' | xargs -d '\n' | sed s,${TREE},,g)" \
+    "service cronie service sshd.service program /bin/sh program /bin/sshd program /bin/vi"
+fi
+
+# vi replaced since 400 started, so maps has the old inode, marked deleted
+ino=$(stat -c %i ${TREE}/bin/vi)
+cp ${TREE}/bin/vi ${TREE}/bin/vi.new
+mv ${TREE}/bin/vi.new ${TREE}/bin/vi
+rm -rf ${PROC}
+mkdir -p ${PROC}/400 ${PROC}/401
+ln -s "${TREE}/bin/vi (deleted)" ${PROC}/400/exe
+ln -s ${TREE}/bin/cron ${PROC}/401/exe
+echo "0::/user.slice" | tee ${PROC}/400/cgroup > ${PROC}/401/cgroup
+maps ${TREE}/bin/cron | sed "s, [0-9]* ${TREE}/bin/cron, ${ino} ${TREE}/bin/vi (deleted)," > ${PROC}/400/maps
+maps ${TREE}/bin/cron > ${PROC}/401/maps
+printf "PeMRs\t${TREE}/bin/vi\n" > ${TREE}/manifest
+${PAXCTLNG} --restart=${TREE}/manifest -v ${PROC} > ${TREE}/out
+check "deleted" "$(grep ^pid ${TREE}/out | cut -f2,3,4 | tr '\t' ' ' | sed s,${TREE},,g)" "400 exe /bin/vi"
+
+finish
@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+#    restoretest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "RESTORE" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/d/lib
+
+xtflags() {
+  ${PAXCTLNG} -v ${1} | grep XATTR_PAX | awk '{ print $3 }'
+}
+
+for i in 0 1 2 3; do
+  cp ${DUMMY} ${TREE}/d/f${i}
+done
+cp ${LIBDUMMY} ${TREE}/d/lib/libdummy.so.1
+cp ${DUMMY} ${TREE}/d/unmarked
+echo "not an ELF" > ${TREE}/d/text
+
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -PeMRs ${TREE}/d/f0 ${TREE}/d/f1 > /dev/null
+  ${PAXCTLNG} -l -pEmrS ${TREE}/d/f2 ${TREE}/d/f3 ${TREE}/d/lib/libdummy.so.1 > /dev/null
+  ${PAXCTLNG} --snapshot=${TREE}/snap -T ${TREE}/d > /dev/null
+
+  # A copy which does not keep xattrs, as some backups do
+  mv ${TREE}/d ${TREE}/old
+  cp -r ${TREE}/old ${TREE}/d
+  check "lost" "$(xtflags ${TREE}/d/f0)" "not"
+
+  # f3 is not the same program any more, and f2 is gone
+  cp ${LIBDUMMY} ${TREE}/d/f3
+  rm -f ${TREE}/d/f2
+
+  got=$(${PAXCTLNG} --restore=${TREE}/snap -j 2 2>/dev/null | grep -v FAILED | head -n 3 | tr '\n' ' ')
+  check "summary" "${got}" "6 records, 1 without flags: 5 files, 4 ok, 1 failed 1 not the file in the snapshot and left alone 3 written, 0 already up to date "
+  check "f0" "$(xtflags ${TREE}/d/f0)" "PeMRs"
+  check "f1" "$(xtflags ${TREE}/d/f1)" "PeMRs"
+  check "lib" "$(xtflags ${TREE}/d/lib/libdummy.so.1)" "pEmrS"
+  check "changed" "$(xtflags ${TREE}/d/f3)" "not"
+  check "unmarked" "$(xtflags ${TREE}/d/unmarked)" "not"
+
+  # Again, there is nothing left to do
+  cp ${DUMMY} ${TREE}/d/f2
+  got=$(${PAXCTLNG} --restore=${TREE}/snap | sed -n 3p)
+  check "again" "${got}" "1 written, 3 already up to date"
+  check "f2" "$(xtflags ${TREE}/d/f2)" "pEmrS"
+
+  # Only the fields asked for
+  ${PAXCTLNG} -d ${TREE}/d/f0 > /dev/null
+  ${PAXCTLNG} --restore=${TREE}/snap -L > /dev/null
+  check "limit" "$(xtflags ${TREE}/d/f0)" "not"
+
+  # A snapshot still diffs against itself
+  got=$(${PAXCTLNG} --diff ${TREE}/snap ${TREE}/snap | tail -n 1)
+  check "diff" "${got}" "6 files before, 6 after: 0 flags added, 0 lost, 0 changed"
+fi
+
+${PAXCTLNG} --restore=${TREE}/d/text > /dev/null 2>&1
+check "not a snapshot" "$?" 1
+
+finish
@@ -66,6 +66,7 @@ pythonversion=$(python --version 2>&1)
 pythonversion=$(echo ${pythonversion} | awk '{ print $2 }')
 pythonversion=${pythonversion%\.*}
 export PYTHONPATH="$(pwd)/../../scripts/build/lib.linux-${unamem}-${pythonversion}"
+export LD_LIBRARY_PATH="$(pwd)/../../lib/.libs${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
 
 #NOTE: the last -D or -U wins as it does for gcc $CFLAGS
 for f in $@; do
@@ -0,0 +1,87 @@
+/*
+	fdclient.c: this file is part of the elfix package
+	Copyright (C) 2026  Anthony G. Basile
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include <elfix.h>
+
+/*
+ * Usage: fdclient [-r] SOCKET OP ARG FILE ...
+ *
+ * Opens each FILE, read-only with -r, and sends OP ARG for it to the
+ * server as a passed descriptor, then prints "FILE ERRNO XT" for each
+ * reply in order.
+ */
+int
+main(int argc, char *argv[])
+{
+	elfix_client_t *c;
+	struct elfix_reply r;
+	struct elfix_reply *replies;
+	int i, fd, n, nfiles, mode = O_RDWR;
+
+	if(argc > 1 && !strcmp(argv[1], "-r"))
+	{
+		mode = O_RDONLY;
+		argv++;
+		argc--;
+	}
+
+	if(argc < 5)
+		errx(EXIT_FAILURE, "usage: %s [-r] SOCKET OP ARG FILE ...", argv[0]);
+
+	nfiles = argc - 4;
+	if((replies = calloc(nfiles, sizeof(struct elfix_reply))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+
+	if((c = elfix_client_open(argv[1])) == NULL)
+		err(EXIT_FAILURE, "%s", argv[1]);
+
+	for(i = 0; i < nfiles; i++)
+	{
+		if((fd = open(argv[i + 4], mode)) < 0)
+			err(EXIT_FAILURE, "%s", argv[i + 4]);
+		if(elfix_client_send(c, argv[2], argv[3], NULL, fd) == 0)
+			err(EXIT_FAILURE, "elfix_client_send()");
+		// The server has its own copy now
+		close(fd);
+	}
+
+	if(elfix_client_done(c) < 0)
+		err(EXIT_FAILURE, "elfix_client_done()");
+
+	while((n = elfix_client_recv(c, &r)) > 0)
+		if(r.id >= 1 && r.id <= (unsigned long)nfiles)
+			replies[r.id - 1] = r;
+	if(n < 0)
+		err(EXIT_FAILURE, "elfix_client_recv()");
+
+	for(i = 0; i < nfiles; i++)
+		printf("%s %d %s\n", argv[i + 4], replies[i].error,
+			replies[i].xt_flags[0] ? replies[i].xt_flags : "none");
+
+	elfix_client_close(c);
+	free(replies);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#!/bin/bash
+#
+#    servertest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "SERVER" "$@"
+
+FDCLIENT="$(pwd)/fdclient"
+SOCK="$(pwd)/paxctl-ng.sock"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}
+for i in 1 2 3 4 5 6; do
+  cp ${FDCLIENT} ${TREE}/f${i}
+  cp ${FDCLIENT} ${TREE}/l${i}
+done
+
+${PAXCTLNG} --server=${SOCK} -j 2 &
+server=$!
+for i in $(seq 50); do
+  [[ -S ${SOCK} ]] && break
+  sleep 0.1
+done
+
+# The same manifest through the server and locally
+manifest=""
+localmanifest=""
+for i in 1 2 3 4 5; do
+  manifest+="PeMrS	${TREE}/f${i}"$'\n'
+  localmanifest+="PeMrS	${TREE}/l${i}"$'\n'
+done
+manifest+="PEMRS	${TREE}/missing"$'\n'
+
+check "summary" "$(echo -n "${manifest}" | ${PAXCTLNG} --connect=${SOCK} -B - | grep "files,")" \
+  "6 files, 5 ok, 1 failed, 0 bad records"
+echo -n "${localmanifest}" | ${PAXCTLNG} -B - >/dev/null
+
+# A tab or newline cannot go in a request, so those files fail and the rest go on
+cp ${FDCLIENT} "${TREE}/tab	name"
+check "tab and newline" "$(printf 'PeMrS\t%s\0PeMrS\t%s\0PeMrS\t%s\0' "${TREE}/f1" "${TREE}/tab	name" "${TREE}/new
+line" | ${PAXCTLNG} --connect=${SOCK} -0 -B - | grep -c "^FAILED	22	")" 2
+check "tab summary" "$(printf 'PeMrS\t%s\0PeMrS\t%s\0' "${TREE}/f1" "${TREE}/tab	name" | ${PAXCTLNG} --connect=${SOCK} -0 -B - | grep "files,")" \
+  "2 files, 1 ok, 1 failed, 0 bad records"
+rm -f "${TREE}/tab	name"
+
+# Relative paths are resolved in the client's directory
+( cd ${TREE} && ${PAXCTLNG} --connect=${SOCK} -m f6 && ${PAXCTLNG} -m l6 )
+
+for i in 1 2 3 4 5 6; do
+  check "f${i}" "$(PAXCTL_NG_SOCKET=${SOCK} ${PAXCTLNG} -v ${TREE}/f${i} | tail -n +2)" \
+    "$(${PAXCTLNG} -v ${TREE}/l${i} | tail -n +2)"
+done
+
+# Files passed by descriptor rather than by path
+if [[ -n "${XTPAX}" ]]; then
+  check "fd" "$(${FDCLIENT} ${SOCK} set-xt pEmRs ${TREE}/f1 ${TREE}/f2 | awk '{ print $2 $3 }' | sort -u)" "0pEmRs"
+fi
+
+# Anyone else may only mark their own files, through a descriptor opened for writing
+if [[ -n "${XTPAX}" && $(id -u) = 0 ]] && type -p setpriv >/dev/null \
+    && setpriv --reuid=65534 --regid=65534 --clear-groups true 2>/dev/null \
+    && setpriv --reuid=65534 --regid=65534 --clear-groups test -x ${FDCLIENT} 2>/dev/null; then
+  chmod 0666 ${SOCK}
+  cp ${FDCLIENT} ${TREE}/nobody
+  chown 65534:65534 ${TREE}/nobody
+  chmod 0644 ${TREE}/f3
+  asnobody="setpriv --reuid=65534 --regid=65534 --clear-groups ${FDCLIENT}"
+
+  check "read-only fd" "$(${asnobody} -r ${SOCK} set-xt PEMRS ${TREE}/f3 | awk '{ print $2 }')" 1
+  check "not marked" "$(${PAXCTLNG} -v ${TREE}/f3 | grep XATTR_PAX | awk '{ print $3 }' | grep -c PEMRS)" 0
+  check "own fd" "$(${asnobody} ${SOCK} set-xt PEMRS ${TREE}/nobody | awk '{ print $2 $3 }')" "0PEMRS"
+
+  # Reading is fine
+  check "read-only get" "$(${asnobody} -r ${SOCK} get - ${TREE}/f3 | awk '{ print $2 }')" 0
+fi
+
+kill ${server}
+wait ${server}
+check "socket left" "$(ls ${SOCK} 2>/dev/null)" ""
+
+# With no server on $PAXCTL_NG_SOCKET the work is done here
+PAXCTL_NG_SOCKET=${SOCK} ${PAXCTLNG} -m ${TREE}/f1
+check "no server" "$?" 0
+
+finish
@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+#    snapshottest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "SNAPSHOT" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/d/sub
+
+for i in 0 1 2 3; do
+  cp ${DUMMY} ${TREE}/d/f${i}
+  cp ${DUMMY} ${TREE}/d/sub/g${i}
+done
+echo "not an ELF" > ${TREE}/d/text
+
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -PEMRS ${TREE}/d/f0 >/dev/null
+  ${PAXCTLNG} -l -pemrs ${TREE}/d/sub/g3 >/dev/null
+fi
+
+summary=$(${PAXCTLNG} --snapshot=${TREE}/before -T -j 2 ${TREE}/d | grep "^snapshot:" | cut -d, -f1)
+check "before" "${summary}" "snapshot: 8 files"
+
+# Between the two: f0 changes, f1 is marked, g3 is replaced unmarked and f9 is new
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} -l -pEmrs ${TREE}/d/f0 >/dev/null
+  ${PAXCTLNG} -l -PeMRS ${TREE}/d/f1 >/dev/null
+  rm ${TREE}/d/sub/g3
+  cp ${DUMMY} ${TREE}/d/sub/g3
+  cp ${DUMMY} ${TREE}/d/f9
+  ${PAXCTLNG} -l -Z ${TREE}/d/f9 >/dev/null
+fi
+
+${PAXCTLNG} --snapshot=${TREE}/after -T ${TREE}/d >/dev/null
+${PAXCTLNG} --diff ${TREE}/before ${TREE}/after > ${TREE}/diff
+
+if [[ -n "${XTPAX}" ]]; then
+  check "f0" "$(grep /f0$ ${TREE}/diff)" "$(printf 'changed\tXATTR_PAX\tPEMRS\tpEmrs\t%s' ${TREE}/d/f0)"
+  check "f1" "$(grep /f1$ ${TREE}/diff)" "$(printf 'added\tXATTR_PAX\t-\tPeMRS\t%s' ${TREE}/d/f1)"
+  check "g3" "$(grep /g3$ ${TREE}/diff)" "$(printf 'lost\tXATTR_PAX\tpemrs\t-\t%s' ${TREE}/d/sub/g3)"
+  check "f9" "$(grep /f9$ ${TREE}/diff | cut -f1,2)" "$(printf 'added\tXATTR_PAX')"
+  check "summary" "$(tail -n 1 ${TREE}/diff)" "8 files before, 9 after: 2 flags added, 1 lost, 1 changed"
+else
+  check "summary" "$(tail -n 1 ${TREE}/diff)" "8 files before, 8 after: 0 flags added, 0 lost, 0 changed"
+fi
+
+# A snapshot does not differ from itself
+summary=$(${PAXCTLNG} --diff ${TREE}/after ${TREE}/after | tail -n 1 | cut -d: -f2)
+check "same" "${summary}" " 0 flags added, 0 lost, 0 changed"
+
+# And anything else is refused
+${PAXCTLNG} --diff ${TREE}/d/text ${TREE}/after >/dev/null 2>&1
+check "not a snapshot" "$?" 1
+
+finish
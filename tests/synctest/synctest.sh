@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+#    synctest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "SYNC" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/d
+
+for i in 0 1 2 3 4; do
+  cp ${DUMMY} ${TREE}/d/f${i}
+done
+echo "not an ELF" > ${TREE}/d/text
+
+counter() {
+  grep "\"${1}\"" ${TREE}/stats.json | tr -dc '0-9'
+}
+
+mark() {
+  ${PAXCTLNG} --stats=${TREE}/stats.json -T -j 2 "$@" ${TREE}/d > /dev/null
+}
+
+syncs() {
+  echo "$(counter fdatasync) $(counter fsync) $(counter syncfs)"
+}
+
+if [[ -n "${XTPAX}" ]]; then
+  # The default leaves it all to the page cache
+  mark -l -PEMRS
+  check "none" "$(syncs)" "0 0 0"
+
+  # An xattr is metadata, so it needs fsync() rather than fdatasync()
+  mark -l -pemrs --sync=file
+  check "file" "$(syncs)" "0 5 0"
+
+  # Nothing written, nothing to sync
+  mark -l -pemrs --sync=file
+  check "file unchanged" "$(syncs)" "0 0 0"
+
+  # One syncfs() for the one filesystem, however many files
+  mark -l -PEMRS --sync=fs
+  check "fs" "$(syncs)" "0 0 1"
+  mark -l -PEMRS --sync=fs
+  check "fs unchanged" "$(syncs)" "0 0 0"
+
+  # And an --apply syncs what it writes in the same way
+  ${PAXCTLNG} --plan=${TREE}/plan -T -l -pemrs ${TREE}/d > /dev/null
+  ${PAXCTLNG} --stats=${TREE}/stats.json --apply=${TREE}/plan --sync=file > /dev/null
+  check "apply" "$(syncs)" "0 5 0"
+  check "applied" "$(${PAXCTLNG} -v ${TREE}/d/f3 | grep XATTR_PAX | awk '{ print $3 }')" "pemrs"
+fi
+
+${PAXCTLNG} --sync=always -T -PEMRS ${TREE}/d >/dev/null 2>&1
+check "bad mode" "$?" 1
+
+${PAXCTLNG} --sync=fs --server=${TREE}/sock >/dev/null 2>&1
+check "fs server" "$?" 1
+
+finish
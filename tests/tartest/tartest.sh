@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+#    tartest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "TAR" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/root/usr/bin ${TREE}/root/usr/lib ${TREE}/out
+LONG=${TREE}/root/usr/lib/$(printf 'd%.0s' {1..120})
+mkdir -p ${LONG}
+
+cp ${DUMMY} ${TREE}/root/usr/bin/one
+cp ${DUMMY} ${TREE}/root/usr/bin/two
+cp ${DUMMY} ${LONG}/three
+echo "not an ELF" > ${TREE}/root/usr/bin/text
+ln -s one ${TREE}/root/usr/bin/link
+
+xtflags() {
+  ${PAXCTLNG} -v ${1} | grep XATTR_PAX | awk '{ print $3 }'
+}
+
+echo "PEMRS prefix=/usr/bin/" > ${TREE}/policy
+echo "pemrs prefix=/usr/lib/" >> ${TREE}/policy
+
+for format in gnu posix; do
+  tar --format=${format} -C ${TREE}/root -cf ${TREE}/in.tar .
+
+  # Through a pipe, so splice() does the copying
+  cat ${TREE}/in.tar | ${PAXCTLNG} --tar -l -pEMrs | cat > ${TREE}/out.tar
+  check "${format} members" "$(tar -tf ${TREE}/out.tar | sort | xargs)" "$(tar -tf ${TREE}/in.tar | sort | xargs)"
+
+  rm -rf ${TREE}/out/*
+  tar --xattrs --xattrs-include='user.*' -C ${TREE}/out -xf ${TREE}/out.tar
+  check "${format} one data" "$(cmp ${TREE}/out/usr/bin/one ${DUMMY} && echo same)" "same"
+  check "${format} text data" "$(cat ${TREE}/out/usr/bin/text)" "not an ELF"
+  if [[ -n "${XTPAX}" ]]; then
+    check "${format} one" "$(xtflags ${TREE}/out/usr/bin/one)" "pEMrs"
+    check "${format} three" "$(xtflags ${TREE}/out/usr/lib/d*/three)" "pEMrs"
+  fi
+
+  # From and to files, so copy_file_range() does, and with the policy
+  ${PAXCTLNG} --tar --policy=${TREE}/policy -l < ${TREE}/out.tar > ${TREE}/again.tar
+  rm -rf ${TREE}/out/*
+  tar --xattrs --xattrs-include='user.*' -C ${TREE}/out -xf ${TREE}/again.tar
+  check "${format} two data" "$(cmp ${TREE}/out/usr/bin/two ${DUMMY} && echo same)" "same"
+  if [[ -n "${XTPAX}" ]]; then
+    check "${format} policy two" "$(xtflags ${TREE}/out/usr/bin/two)" "PEMRS"
+    check "${format} policy three" "$(xtflags ${TREE}/out/usr/lib/d*/three)" "pemrs"
+  fi
+done
+
+# Nothing left to change leaves the archive as it was
+if [[ -n "${XTPAX}" ]]; then
+  ${PAXCTLNG} --tar -l -PEMRS < ${TREE}/again.tar > ${TREE}/same.tar 2>/dev/null
+  ${PAXCTLNG} --tar -l -PEMRS < ${TREE}/same.tar > ${TREE}/same2.tar 2>/dev/null
+  check "unchanged" "$(cmp ${TREE}/same.tar ${TREE}/same2.tar && echo same)" "same"
+fi
+
+# And anything else is refused
+${PAXCTLNG} --tar -PEMRS < ${TREE}/root/usr/bin/one >/dev/null 2>&1
+check "not a tar" "$?" 1
+
+# As is an extended header whose record lengths are too short, even after
+# a good record: tar writes RECORD as its own, and we overwrite it with BAD
+badx() {
+  local off
+  tar --format=posix --pax-option="${2}" -C ${TREE}/root -cf ${TREE}/bad.tar usr/bin/one
+  off=$(grep -obUa "${3}" ${TREE}/bad.tar | head -n 1 | cut -d: -f1)
+  printf "${4}" | dd of=${TREE}/bad.tar bs=1 seek=${off} conv=notrunc 2>/dev/null
+  timeout 10 ${PAXCTLNG} --tar -PEMRS < ${TREE}/bad.tar >/dev/null 2>&1
+  check "${1}" "$?" 1
+}
+badx "length 0" "ab:=cdefg" "12 ab=cdefg" "0 "
+badx "length 2" "a:=b" "6 a=b" "2 a=b"
+
+finish
@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+#    throttletest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+. ../common/common.sh "THROTTLE" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/tree
+
+for i in $(seq 1 20); do
+  cp ${DUMMY} ${TREE}/tree/dummy${i}
+done
+echo "not elf" > ${TREE}/tree/text
+
+# 21 files at 10 a second, the first at once, is at least 2 seconds however many workers
+start=$(date +%s%N)
+${PAXCTLNG} --throttle=10 -j 4 -T -v ${TREE}/tree > ${TREE}/out
+check "exit" "$?" 0
+check "paced" "$(( ($(date +%s%N) - start) / 1000000 >= 1900 ))" 1
+check "caps" "$(grep '^throttle:' ${TREE}/out | head -1 | sed 's/, [a-z]* I\/O class//')" \
+  "throttle: 10 files/sec, 1048576 bytes/sec"
+check "files" "$(grep '^throttle:' ${TREE}/out | sed -n 2p | awk '{ print $2 }')" 21
+check "read" "$(grep -c 'XATTR_PAX\|PT_PAX' ${TREE}/out | awk '{ print ($1 > 0) }')" 1
+
+# No caps, but the rest still holds
+start=$(date +%s%N)
+${PAXCTLNG} --throttle=0,0 --stats=${TREE}/stats.json -T -v ${TREE}/tree > ${TREE}/out
+check "uncapped" "$(( ($(date +%s%N) - start) / 1000000 < 1900 ))" 1
+check "no caps" "$(grep '^throttle:' ${TREE}/out | head -1 | sed 's/, [a-z]* I\/O class//')" \
+  "throttle: no cap on files/sec, no cap on bytes/sec"
+check "counted" "$(grep -c '"pages_dropped"' ${TREE}/stats.json)" 1
+
+# A byte cap alone paces by what was read
+${PAXCTLNG} --throttle=0,1K -T -v ${TREE}/tree > ${TREE}/out
+check "bytes" "$(grep '^throttle:' ${TREE}/out | sed -n 3p | awk '{ print ($4 > 0) }')" 1
+
+# Marking is paced too
+${PAXCTLNG} --throttle=100,64K -T -PEMRS ${TREE}/tree > /dev/null
+check "marked" "$(${PAXCTLNG} -v ${TREE}/tree/dummy7 | grep -c PEMRS | awk '{ print ($1 > 0) }')" 1
+
+${PAXCTLNG} --throttle=fast -v ${TREE}/tree/dummy1 2>/dev/null
+check "bad rate" "$?" 1
+${PAXCTLNG} --throttle=10,1X -v ${TREE}/tree/dummy1 2>/dev/null
+check "bad suffix" "$?" 1
+${PAXCTLNG} --throttle --live 2>/dev/null
+check "not live" "$?" 1
+
+finish
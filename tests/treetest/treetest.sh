@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+#    treetest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "TREE" "$@"
+
+rm -rf ${TREE}
+mkdir -p ${TREE}/a/b
+cp ${DUMMY} ${TREE}/a/one
+cp ${DUMMY} ${TREE}/a/b/two
+ln ${TREE}/a/one ${TREE}/a/b/three
+ln -s ${TREE}/a/one ${TREE}/a/four
+echo "not an elf" > ${TREE}/a/five
+
+# one, two and five are walked, three is a hard link to one and four is
+# a symlink.  Unmarked files start out with EMUTRAMP disabled.
+check "summary" "$(${PAXCTLNG} -T -j 2 -m ${TREE} | head -n 1)" \
+  "3 files, 2 ELF, 1 non-ELF skipped, 1 hard links skipped"
+
+if [[ -n "${XTPAX}" ]]; then
+  for f in a/one a/b/two a/b/three; do
+    check "${f}" "$(${PAXCTLNG} -v ${TREE}/${f} | grep XATTR_PAX | awk '{ print $3 }')" "-em--"
+  done
+fi
+
+finish
@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+#    uringtest.sh: this file is part of the elfix package
+#    Copyright (C) 2026  Anthony G. Basile
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+. ../common/common.sh "IO_URING" "$@"
+
+# The flags of every file under a tree, with the tree left out of the path
+flags() {
+  local f
+  for f in $(cd ${1} && find . -type f | sort); do
+    echo "${f}" $(${PAXCTLNG} -v ${1}/${f} | tail -n +2)
+  done
+}
+
+# The same tree twice, one for a run through the io_uring and one without
+rm -rf ${TREE}
+for t in uring sync; do
+  mkdir -p ${TREE}/${t}/a/b
+  for i in $(seq 1 12); do
+    cp ${DUMMY} ${TREE}/${t}/a/elf${i}
+    cp ${DUMMY} ${TREE}/${t}/a/b/elf${i}
+    echo "not an elf ${i}" > ${TREE}/${t}/a/b/text${i}
+  done
+  for i in $(seq 1 6); do
+    ptpax ${TREE}/${t}/a/elf${i}
+  done
+done
+
+# Deep enough that the ring is full, and shallow enough that it turns over
+uring=$(${PAXCTLNG} -T -j 2 --io-uring=4 -m ${TREE}/uring | head -n 2)
+sync=$(${PAXCTLNG} -T -j 2 -m ${TREE}/sync | head -n 2)
+check "-T summary" "${uring}" "${sync}"
+check "-T flags" "$(flags ${TREE}/uring)" "$(flags ${TREE}/sync)"
+
+# Again, so that this time everything is already up to date
+uring=$(${PAXCTLNG} -T -j 2 --io-uring=4 -m ${TREE}/uring | head -n 2)
+sync=$(${PAXCTLNG} -T -j 2 -m ${TREE}/sync | head -n 2)
+check "-T again" "${uring}" "${sync}"
+
+# Reads only, the flags reported for each file in either order
+uring=$(${PAXCTLNG} -T -j 2 --io-uring=4 -v ${TREE}/uring | sed "s|${TREE}/uring||" | grep -v seconds | sort)
+sync=$(${PAXCTLNG} -T -j 2 -v ${TREE}/sync | sed "s|${TREE}/sync||" | grep -v seconds | sort)
+check "-T -v" "${uring}" "${sync}"
+
+# A manifest with its own flags for each file, and one which is missing
+for t in uring sync; do
+  for i in $(seq 1 12); do
+    echo -e "PEr\t${TREE}/${t}/a/elf${i}"
+    echo -e "pm\t${TREE}/${t}/a/b/elf${i}"
+  done > ${TREE}/${t}.manifest
+  echo -e "PEMRS\t${TREE}/${t}/missing" >> ${TREE}/${t}.manifest
+done
+uring=$(${PAXCTLNG} -j 2 --io-uring=4 -B ${TREE}/uring.manifest | grep "files,")
+sync=$(${PAXCTLNG} -j 2 -B ${TREE}/sync.manifest | grep "files,")
+check "-B summary" "${uring}" "${sync}"
+check "-B flags" "$(flags ${TREE}/uring)" "$(flags ${TREE}/sync)"
+
+finish